@@ -0,0 +1,20 @@
+# Finds the bitshuffle include path and library Sets the following if bitshuffle is found:
+# BITSHUFFLE_FOUND, BITSHUFFLE_INCLUDE_DIR, BITSHUFFLE_LIBRARY
+#
+# The library is either a standalone build of bitshuffle, or the HDF5 filter plugin (h5bshuf),
+# which includes the compression functions.
+
+include(FindPackageHandleStandardArgs)
+
+set(BITSHUFFLE_SEARCH_PATHS /usr/include /usr/local/include)
+
+find_path(
+    BITSHUFFLE_INCLUDE_DIR
+    NAMES bitshuffle.h
+    PATHS ${BITSHUFFLE_SEARCH_PATHS})
+
+find_library(BITSHUFFLE_LIBRARY NAMES bitshuffle h5bshuf)
+
+find_package_handle_standard_args(BITSHUFFLE DEFAULT_MSG BITSHUFFLE_LIBRARY BITSHUFFLE_INCLUDE_DIR)
+
+mark_as_advanced(BITSHUFFLE_INCLUDE_DIR BITSHUFFLE_LIBRARY)
@@ -0,0 +1,17 @@
+# Finds liburing include path and libraries Sets the following if liburing is found:
+# LIBURING_FOUND, LIBURING_INCLUDE_DIR, LIBURING_LIBRARY
+
+include(FindPackageHandleStandardArgs)
+
+set(LIBURING_SEARCH_PATHS /usr/include /usr/local/include)
+
+find_path(
+    LIBURING_INCLUDE_DIR
+    NAMES liburing.h
+    PATHS ${LIBURING_SEARCH_PATHS})
+
+find_library(LIBURING_LIBRARY NAMES uring)
+
+find_package_handle_standard_args(LIBURING DEFAULT_MSG LIBURING_LIBRARY LIBURING_INCLUDE_DIR)
+
+mark_as_advanced(LIBURING_INCLUDE_DIR LIBURING_LIBRARY)
@@ -0,0 +1,289 @@
+/**
+ * @file
+ * @brief C++ wrappers for the producer/consumer registrations on a @c Buffer
+ *  - BufferConsumer
+ *  - BufferProducer
+ *  - BatchedBufferConsumer
+ *  - BufferWaitSet
+ */
+
+#ifndef BUFFER_HANDLE_HPP
+#define BUFFER_HANDLE_HPP
+
+#include "buffer.h" // for Buffer, register_consumer, register_producer, mark_frame_empty_by_slot
+
+#include <stdexcept> // for runtime_error
+#include <stdint.h>  // for uint8_t
+#include <string>    // for string
+#include <time.h>    // for timespec
+#include <vector>    // for vector
+
+namespace kotekan {
+
+/**
+ * @class BufferConsumer
+ * @brief A consumer registration on a buffer.
+ *
+ * Registers the stage as a consumer when constructed and keeps the consumer slot
+ * the buffer assigned to it, so the frame calls don't need to look up the stage
+ * by name on every frame.
+ *
+ * The registration lasts as long as the buffer, like a call to @c register_consumer,
+ * so copies of the handle share the same slot and nothing is unregistered on destruction.
+ */
+class BufferConsumer {
+public:
+    /// Create an unregistered handle, it must be assigned before use.
+    BufferConsumer() : buf(nullptr), slot(-1) {}
+
+    /**
+     * @brief Register @c name as a consumer of @c buf.
+     *
+     * @param buf   The buffer to consume from.
+     * @param name  The name of the consumer (normally the stage unique_name).
+     **/
+    BufferConsumer(struct Buffer* buf, const std::string& name) :
+        buf(buf), slot(register_consumer(buf, name.c_str())) {
+        if (slot < 0)
+            throw std::runtime_error("Could not register consumer " + name + " on buffer "
+                                     + buf->buffer_name);
+    }
+
+    /// See @c wait_for_full_frame
+    uint8_t* wait_for_full_frame(const int frame_id) {
+        return wait_for_full_frame_by_slot(buf, slot, frame_id);
+    }
+
+    /// See @c wait_for_full_frame_timeout
+    int wait_for_full_frame_timeout(const int frame_id, const struct timespec timeout) {
+        return wait_for_full_frame_timeout_by_slot(buf, slot, frame_id, timeout);
+    }
+
+    /// See @c mark_frame_empty
+    void mark_frame_empty(const int frame_id) {
+        mark_frame_empty_by_slot(buf, slot, frame_id);
+    }
+
+    /// See @c wait_for_full_frames
+    int wait_for_full_frames(const int first_id, const int n) {
+        return wait_for_full_frames_by_slot(buf, slot, first_id, n);
+    }
+
+    /// See @c mark_frames_empty
+    void mark_frames_empty(const int first_id, const int n) {
+        mark_frames_empty_by_slot(buf, slot, first_id, n);
+    }
+
+    /// The buffer this handle is registered on.
+    struct Buffer* buffer() const {
+        return buf;
+    }
+
+    /// The consumer slot in the buffer.
+    int get_slot() const {
+        return slot;
+    }
+
+private:
+    struct Buffer* buf;
+    int slot;
+};
+
+/**
+ * @class BufferProducer
+ * @brief A producer registration on a buffer.
+ *
+ * The producer side counterpart of @c BufferConsumer.
+ */
+class BufferProducer {
+public:
+    /// Create an unregistered handle, it must be assigned before use.
+    BufferProducer() : buf(nullptr), slot(-1) {}
+
+    /**
+     * @brief Register @c name as a producer of @c buf.
+     *
+     * @param buf   The buffer to produce into.
+     * @param name  The name of the producer (normally the stage unique_name).
+     **/
+    BufferProducer(struct Buffer* buf, const std::string& name) :
+        buf(buf), slot(register_producer(buf, name.c_str())) {
+        if (slot < 0)
+            throw std::runtime_error("Could not register producer " + name + " on buffer "
+                                     + buf->buffer_name);
+    }
+
+    /// See @c wait_for_empty_frame
+    uint8_t* wait_for_empty_frame(const int frame_id) {
+        return wait_for_empty_frame_by_slot(buf, slot, frame_id);
+    }
+
+    /// See @c mark_frame_full
+    void mark_frame_full(const int frame_id) {
+        mark_frame_full_by_slot(buf, slot, frame_id);
+    }
+
+    /// The buffer this handle is registered on.
+    struct Buffer* buffer() const {
+        return buf;
+    }
+
+    /// The producer slot in the buffer.
+    int get_slot() const {
+        return slot;
+    }
+
+private:
+    struct Buffer* buf;
+    int slot;
+};
+
+/**
+ * @class BatchedBufferConsumer
+ * @brief Reads the frames of a buffer in order, acquiring and releasing them in batches.
+ *
+ * Replaces the usual @c wait_for_full_frame / @c mark_frame_empty loop of a
+ * consumer which walks through every frame in turn. Whenever it runs out of
+ * frames it takes all the frames that are already full (up to @c batch_size)
+ * with one call to @c wait_for_full_frames, and the frames are handed back to
+ * the producer together with one call to @c mark_frames_empty once the whole
+ * batch has been marked empty.
+ *
+ * @c batch_size should be kept well below the number of frames in the buffer,
+ * as the producer can't refill any frame of a batch until all of it is released.
+ */
+class BatchedBufferConsumer {
+public:
+    /// Create an unregistered consumer, it must be assigned before use.
+    BatchedBufferConsumer() : batch_size(1), frame_id(0), num_acquired(0), num_done(0) {}
+
+    /**
+     * @brief Read @c consumer's buffer from frame zero in batches.
+     *
+     * @param consumer    The registration to read with.
+     * @param batch_size  The maximum number of frames to hold at once.
+     **/
+    BatchedBufferConsumer(const BufferConsumer& consumer, const int batch_size) :
+        consumer(consumer),
+        batch_size(batch_size), frame_id(0), num_acquired(0), num_done(0) {
+        if (batch_size < 1 || batch_size > consumer.buffer()->num_frames)
+            throw std::runtime_error("Invalid batch size for buffer "
+                                     + std::string(consumer.buffer()->buffer_name));
+    }
+
+    /**
+     * @brief Wait for the current frame to be full.
+     *
+     * @returns A pointer to the frame, or nullptr if the buffer is shutting down.
+     **/
+    uint8_t* wait_for_full_frame() {
+        if (num_acquired == num_done) {
+            num_acquired = consumer.wait_for_full_frames(get_frame_id(), batch_size);
+            num_done = 0;
+            if (num_acquired == 0)
+                return nullptr;
+        }
+        return consumer.buffer()->frames[get_frame_id()];
+    }
+
+    /// Finish with the current frame and move on to the next one.
+    void mark_frame_empty() {
+        num_done++;
+        if (num_done == num_acquired) {
+            consumer.mark_frames_empty(frame_id, num_done);
+            frame_id = (frame_id + num_done) % consumer.buffer()->num_frames;
+            num_acquired = num_done = 0;
+        }
+    }
+
+    /// The ID of the current frame.
+    int get_frame_id() const {
+        return (frame_id + num_done) % consumer.buffer()->num_frames;
+    }
+
+private:
+    BufferConsumer consumer;
+    int batch_size;
+
+    // The first frame of the batch, the number of frames in it and how many of them are done
+    int frame_id;
+    int num_acquired;
+    int num_done;
+};
+
+/**
+ * @class BufferWaitSet
+ * @brief Waits for a full frame on whichever of several buffers gets one first.
+ *
+ * For stages which read several input buffers and don't care about the order
+ * the frames arrive in.  Instead of polling each input with a timeout in turn,
+ * the stage sleeps until a frame arrives on any of them (see @c wait_for_any_full_frame).
+ *
+ * The consumers are attached to the set when added and detached when it is destroyed,
+ * so it must be destroyed before the buffers.
+ */
+class BufferWaitSet {
+public:
+    BufferWaitSet() {
+        init_buffer_wait_set(&set);
+    }
+
+    ~BufferWaitSet() {
+        for (size_t i = 0; i < bufs.size(); ++i)
+            attach_buffer_wait_set(bufs[i], slots[i], nullptr);
+        destroy_buffer_wait_set(&set);
+    }
+
+    BufferWaitSet(const BufferWaitSet&) = delete;
+    BufferWaitSet& operator=(const BufferWaitSet&) = delete;
+
+    /**
+     * @brief Add an input to the set.
+     *
+     * @param consumer  The registered consumer of the input buffer.
+     * @returns The index of the input, as returned by @c wait_for_any_full_frame.
+     **/
+    int add(const BufferConsumer& consumer) {
+        attach_buffer_wait_set(consumer.buffer(), consumer.get_slot(), &set);
+        consumers.push_back(consumer);
+        bufs.push_back(consumer.buffer());
+        slots.push_back(consumer.get_slot());
+        return consumers.size() - 1;
+    }
+
+    /**
+     * @brief Wait for a full frame on any of the inputs.
+     *
+     * @param frame_ids  The frame to wait for on each input, in the order they were added.
+     * @param ready      Set to the index of the input with a full frame.
+     * @param timeout    Give up after this absolute time, nullptr to wait forever.
+     * @returns 0 if an input has a frame, 1 on timeout and -1 if an input is shutting down.
+     **/
+    int wait_for_any_full_frame(const std::vector<int>& frame_ids, int& ready,
+                                const struct timespec* timeout = nullptr) {
+        if (frame_ids.size() != bufs.size())
+            throw std::runtime_error("BufferWaitSet: need one frame ID for every input");
+        return ::wait_for_any_full_frame(&set, bufs.data(), slots.data(), frame_ids.data(),
+                                         bufs.size(), timeout, &ready);
+    }
+
+    /// The consumer of input @c i.
+    BufferConsumer& consumer(const int i) {
+        return consumers.at(i);
+    }
+
+    /// The number of inputs.
+    size_t size() const {
+        return consumers.size();
+    }
+
+private:
+    struct bufferWaitSet set;
+    std::vector<BufferConsumer> consumers;
+    std::vector<struct Buffer*> bufs;
+    std::vector<int> slots;
+};
+
+} // namespace kotekan
+
+#endif // BUFFER_HANDLE_HPP
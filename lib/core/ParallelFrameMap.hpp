@@ -0,0 +1,163 @@
+/**
+ * @file
+ * @brief Ordered parallel processing of the frames of a buffer
+ *  - ParallelFrameMap
+ */
+
+#ifndef PARALLEL_FRAME_MAP_HPP
+#define PARALLEL_FRAME_MAP_HPP
+
+#include "BufferHandle.hpp"      // for BufferConsumer, BufferProducer
+#include "WorkPool.hpp"          // for OrderedTasks, WorkPool
+#include "buffer.h"              // for Buffer
+#include "prometheusMetrics.hpp" // for Metrics, MetricFamily, Counter, Gauge
+
+#include <algorithm>  // for min
+#include <atomic>     // for atomic, atomic_bool
+#include <chrono>     // for steady_clock, duration
+#include <functional> // for function
+#include <memory>     // for make_shared, shared_ptr
+#include <optional>   // for optional
+#include <stdexcept>  // for invalid_argument
+#include <stdint.h>   // for uint32_t
+#include <string>     // for string, to_string
+#include <utility>    // for move
+
+namespace kotekan {
+
+/**
+ * @class ParallelFrameMap
+ * @brief Maps each frame of an input buffer to a frame of an output buffer, in parallel.
+ *
+ * Replaces the hand rolled worker threads of stages which turn every input frame
+ * into one output frame.  The stage's main thread calls @c run(), which walks
+ * through the input frames in order and for each one:
+ *  - calls @c prepare on the main thread.  This is where anything which depends on
+ *    the order of the frames happens (e.g. dataset ID changes), and it returns the
+ *    per frame state for @c process, or @c std::nullopt to drop the frame.
+ *  - waits for the next empty output frame and runs @c process on the @c WorkPool.
+ *  - once the frame and all the ones before it are processed, marks the output
+ *    frame full and the input frame empty, so the output is always in input order.
+ *
+ * At most @c window frames are processed at once, which bounds how far ahead of
+ * the oldest unfinished frame the others can get.  The window is capped at the
+ * number of frames in the input and output buffers, as each frame in flight holds
+ * one of each.  Dropped frames also hold their place in the window until the
+ * frames before them are done, so the input frames are released in order.
+ *
+ * @tparam T  The per frame state passed from @c prepare to @c process.
+ *
+ * @par Metrics
+ * @metric kotekan_parallelframemap_frames_total
+ *         The number of frames processed by each work pool worker.
+ * @metric kotekan_parallelframemap_process_time_seconds
+ *         The time the last frame processed by each worker took.
+ * @metric kotekan_parallelframemap_frames_in_flight
+ *         The number of frames being processed, or waiting for an earlier frame.
+ */
+template<typename T>
+class ParallelFrameMap {
+public:
+    /// Sets up the state for one input frame, on the stage thread. Return nullopt to drop it.
+    using prepare_fn = std::function<std::optional<T>(int in_frame_id)>;
+
+    /// Fills the output frame from the input frame, on a work pool thread.
+    using process_fn = std::function<void(T& state, int in_frame_id, int out_frame_id)>;
+
+    /**
+     * @brief Create the frame map
+     *
+     * @param in           The registered consumer of the input buffer.
+     * @param out          The registered producer of the output buffer.
+     * @param unique_name  The stage name, for the metrics.
+     * @param window       The maximum number of frames processed at once, capped at the
+     *                     number of frames in @c in and @c out.
+     * @param numa_node    Run the work on work pool workers on this node, -1 for any.
+     */
+    ParallelFrameMap(BufferConsumer in, BufferProducer out, const std::string& unique_name,
+                     uint32_t window, int numa_node = -1) :
+        in(in),
+        out(out),
+        window(std::min({window, (uint32_t)in.buffer()->num_frames,
+                         (uint32_t)out.buffer()->num_frames})),
+        numa_node(numa_node),
+        frame_counter(prometheus::Metrics::instance().add_counter(
+            "kotekan_parallelframemap_frames_total", unique_name, {"worker"})),
+        process_time_metric(prometheus::Metrics::instance().add_gauge(
+            "kotekan_parallelframemap_process_time_seconds", unique_name, {"worker"})),
+        in_flight_metric(prometheus::Metrics::instance().add_gauge(
+            "kotekan_parallelframemap_frames_in_flight", unique_name)) {
+        if (window == 0)
+            throw std::invalid_argument("ParallelFrameMap: window has to be at least 1.");
+    }
+
+    /**
+     * @brief Process frames until @c stop_thread is set or the buffers shut down.
+     *
+     * Returns once all the frames in flight are finished.
+     */
+    void run(const std::atomic_bool& stop_thread, prepare_fn prepare, process_fn process) {
+        std::atomic<int> in_flight(0);
+        OrderedTasks tasks(numa_node);
+        int in_frame_id = 0;
+        int out_frame_id = 0;
+
+        while (!stop_thread) {
+            tasks.wait(window - 1);
+
+            if (in.wait_for_full_frame(in_frame_id) == nullptr)
+                break;
+
+            std::optional<T> prepared = prepare(in_frame_id);
+            if (!prepared) {
+                // Release the frame after the ones before it, so it keeps its place in the window
+                tasks.submit([]() {}, [this, in_frame_id]() { in.mark_frame_empty(in_frame_id); });
+                in_frame_id = (in_frame_id + 1) % in.buffer()->num_frames;
+                continue;
+            }
+
+            if (out.wait_for_empty_frame(out_frame_id) == nullptr)
+                break;
+
+            // std::function needs a copyable callable
+            auto state = std::make_shared<T>(std::move(*prepared));
+            in_flight_metric.set(++in_flight);
+
+            tasks.submit(
+                [this, state, process, in_frame_id, out_frame_id]() {
+                    auto start = std::chrono::steady_clock::now();
+                    process(*state, in_frame_id, out_frame_id);
+                    std::chrono::duration<double> elapsed =
+                        std::chrono::steady_clock::now() - start;
+
+                    std::string worker = std::to_string(WorkPool::get_worker_id());
+                    process_time_metric.labels({worker}).set(elapsed.count());
+                    frame_counter.labels({worker}).inc();
+                },
+                [this, &in_flight, in_frame_id, out_frame_id]() {
+                    out.mark_frame_full(out_frame_id);
+                    in.mark_frame_empty(in_frame_id);
+                    in_flight_metric.set(--in_flight);
+                });
+
+            in_frame_id = (in_frame_id + 1) % in.buffer()->num_frames;
+            out_frame_id = (out_frame_id + 1) % out.buffer()->num_frames;
+        }
+
+        tasks.wait();
+    }
+
+private:
+    BufferConsumer in;
+    BufferProducer out;
+    uint32_t window;
+    int numa_node;
+
+    prometheus::MetricFamily<prometheus::Counter>& frame_counter;
+    prometheus::MetricFamily<prometheus::Gauge>& process_time_metric;
+    prometheus::Gauge& in_flight_metric;
+};
+
+} // namespace kotekan
+
+#endif /* PARALLEL_FRAME_MAP_HPP */
@@ -0,0 +1,305 @@
+#include "WorkPool.hpp"
+
+#include "Config.hpp"         // for Config
+#include "buffer.h"           // for get_cpu_numa_node
+#include "kotekanLogging.hpp" // for INFO_NON_OO, ERROR_NON_OO
+
+#include "fmt.hpp" // for format
+
+#include <algorithm>  // for min
+#include <functional> // for ref
+#include <pthread.h>  // for pthread_setaffinity_np, pthread_setname_np
+#include <sched.h>    // for cpu_set_t, CPU_SET, CPU_ZERO
+#include <utility>    // for move
+
+namespace kotekan {
+
+// The index of the worker the current thread is running, -1 outside the pool
+static thread_local int current_worker_id = -1;
+
+thread_local WorkPool::worker_set* WorkPool::current_set = nullptr;
+
+WorkPool& WorkPool::instance() {
+    static WorkPool _instance;
+    return _instance;
+}
+
+WorkPool& WorkPool::instance(const Config& config) {
+    WorkPool& pool = instance();
+    pool.stop();
+    pool.start(config.get_default<uint32_t>("/work_pool", "num_threads", 0),
+               config.get_default<std::vector<int>>("/work_pool", "cpu_affinity", {}));
+    return pool;
+}
+
+WorkPool::~WorkPool() {
+    stop();
+}
+
+void WorkPool::start(uint32_t num_threads, const std::vector<int>& cpu_affinity) {
+    std::lock_guard<std::mutex> lock(pool_lock);
+    start_locked(num_threads, cpu_affinity);
+}
+
+void WorkPool::start_locked(uint32_t num_threads, const std::vector<int>& cpu_affinity) {
+    if (running)
+        return;
+
+    if (num_threads == 0)
+        num_threads = cpu_affinity.empty() ? std::thread::hardware_concurrency()
+                                           : cpu_affinity.size();
+    if (num_threads == 0)
+        num_threads = 1;
+
+    INFO_NON_OO("Starting the work pool with {:d} threads", num_threads);
+
+    auto set = std::make_shared<worker_set>();
+    for (uint32_t i = 0; i < num_threads; ++i) {
+        set->workers.push_back(std::make_unique<worker>());
+        int cpu = cpu_affinity.empty() ? -1 : cpu_affinity[i % cpu_affinity.size()];
+        set->workers[i]->numa_node = (cpu < 0) ? -1 : get_cpu_numa_node(cpu);
+        set->node_workers[set->workers[i]->numa_node].push_back(i);
+    }
+
+    // Start the threads once all the queues exist, since they steal from each other
+    for (uint32_t i = 0; i < num_threads; ++i) {
+        std::thread& thread = set->workers[i]->thread;
+        thread = std::thread(&WorkPool::worker_thread, std::ref(*set), i);
+
+#ifndef MAC_OSX
+        if (!cpu_affinity.empty()) {
+            cpu_set_t cpuset;
+            CPU_ZERO(&cpuset);
+            CPU_SET(cpu_affinity[i % cpu_affinity.size()], &cpuset);
+            int err = pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t), &cpuset);
+            if (err)
+                ERROR_NON_OO("Failed to set the work pool thread affinity, error code {:d}", err);
+        }
+        std::string name = fmt::format(fmt("work_pool_{:d}"), i);
+        pthread_setname_np(thread.native_handle(), name.c_str());
+#endif
+    }
+
+    running = std::move(set);
+}
+
+void WorkPool::stop() {
+    // Take the workers out of the pool, so tasks submitted from outside it from here on
+    // start a new one. The workers can still submit tasks to their own set while they
+    // finish the queue, so they must be joined without holding the pool lock.
+    std::shared_ptr<worker_set> set;
+    {
+        std::lock_guard<std::mutex> lock(pool_lock);
+        if (!running)
+            return;
+        set = std::move(running);
+
+        std::lock_guard<std::mutex> sleep_guard(set->sleep_lock);
+        set->stop_workers = true;
+    }
+    set->sleep_cond.notify_all();
+
+    for (auto& w : set->workers)
+        w->thread.join();
+}
+
+int WorkPool::get_worker_id() {
+    return current_worker_id;
+}
+
+uint32_t WorkPool::get_num_threads() {
+    std::lock_guard<std::mutex> lock(pool_lock);
+    return running ? running->workers.size() : 0;
+}
+
+void WorkPool::submit(std::function<void()> task, int numa_node) {
+    // Tasks submitted by a worker go to its own set, which runs them before it stops
+    if (current_set) {
+        push(*current_set, std::move(task), numa_node);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(pool_lock);
+    start_locked(0, {});
+    push(*running, std::move(task), numa_node);
+}
+
+void WorkPool::push(worker_set& set, std::function<void()> task, int numa_node) {
+    // Round robin over the workers on the requested node, or all of them
+    size_t worker_id;
+    uint32_t n = set.next_worker++;
+    auto node = set.node_workers.find(numa_node);
+    if (numa_node >= 0 && node != set.node_workers.end()) {
+        worker_id = node->second[n % node->second.size()];
+    } else {
+        worker_id = n % set.workers.size();
+    }
+
+    {
+        std::lock_guard<std::mutex> queue_guard(set.workers[worker_id]->queue_lock);
+        set.workers[worker_id]->queue.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> sleep_guard(set.sleep_lock);
+        set.num_queued++;
+    }
+    set.sleep_cond.notify_one();
+}
+
+void WorkPool::parallel_for(size_t n, const std::function<void(size_t)>& f, uint32_t max_helpers,
+                            int numa_node) {
+    struct loop {
+        const std::function<void(size_t)>* f;
+        size_t n;
+        std::atomic<size_t> next{0};
+        std::mutex lock;
+        std::condition_variable done_cond;
+        size_t done = 0;
+    };
+
+    // Helpers keep the loop alive, as they may only start after we have returned
+    auto l = std::make_shared<loop>();
+    l->f = &f;
+    l->n = n;
+
+    auto run = [](loop& l) {
+        size_t count = 0;
+        for (size_t i = l.next++; i < l.n; i = l.next++) {
+            (*l.f)(i);
+            count++;
+        }
+        if (count > 0) {
+            std::lock_guard<std::mutex> guard(l.lock);
+            l.done += count;
+            l.done_cond.notify_all();
+        }
+    };
+
+    size_t num_helpers = std::min<size_t>(max_helpers, (n > 0) ? n - 1 : 0);
+    for (size_t i = 0; i < num_helpers; i++)
+        submit([l, run]() { run(*l); }, numa_node);
+
+    run(*l);
+
+    std::unique_lock<std::mutex> guard(l->lock);
+    l->done_cond.wait(guard, [&] { return l->done == n; });
+}
+
+bool WorkPool::get_task(worker_set& set, size_t worker_id, std::function<void()>& task) {
+    auto take = [&](size_t id, bool own) {
+        worker& w = *set.workers[id];
+        std::lock_guard<std::mutex> queue_guard(w.queue_lock);
+        if (w.queue.empty())
+            return false;
+        // Run our own tasks in submission order, steal the most recent ones
+        if (own) {
+            task = std::move(w.queue.front());
+            w.queue.pop_front();
+        } else {
+            task = std::move(w.queue.back());
+            w.queue.pop_back();
+        }
+        return true;
+    };
+
+    bool found = take(worker_id, true);
+
+    // Steal from our own NUMA node first, then from anyone
+    const int numa_node = set.workers[worker_id]->numa_node;
+    const std::vector<size_t>& local = set.node_workers.at(numa_node);
+    for (size_t i = 0; i < local.size() && !found; ++i) {
+        if (local[i] != worker_id)
+            found = take(local[i], false);
+    }
+    for (size_t i = 0; i < set.workers.size() && !found; ++i) {
+        if (i != worker_id && set.workers[i]->numa_node != numa_node)
+            found = take(i, false);
+    }
+
+    if (found) {
+        std::lock_guard<std::mutex> sleep_guard(set.sleep_lock);
+        set.num_queued--;
+        set.num_running++;
+    }
+    return found;
+}
+
+void WorkPool::worker_thread(worker_set& set, size_t worker_id) {
+    current_worker_id = worker_id;
+    current_set = &set;
+    std::function<void()> task;
+    for (;;) {
+        if (get_task(set, worker_id, task)) {
+            task();
+            task = nullptr;
+
+            std::lock_guard<std::mutex> sleep_guard(set.sleep_lock);
+            if (--set.num_running == 0 && set.stop_workers)
+                set.sleep_cond.notify_all();
+            continue;
+        }
+
+        // Once stopped, exit only when no running task can submit any more work
+        std::unique_lock<std::mutex> sleep_guard(set.sleep_lock);
+        if (set.stop_workers && set.num_queued == 0 && set.num_running == 0)
+            return;
+        set.sleep_cond.wait(sleep_guard, [&] {
+            return set.num_queued > 0 || (set.stop_workers && set.num_running == 0);
+        });
+    }
+}
+
+OrderedTasks::OrderedTasks(int numa_node) : numa_node(numa_node) {}
+
+OrderedTasks::~OrderedTasks() {
+    wait();
+}
+
+void OrderedTasks::submit(std::function<void()> work, std::function<void()> finish) {
+    uint64_t seq;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        seq = next_submit++;
+        pending[seq] = std::move(finish);
+    }
+
+    WorkPool::instance().submit(
+        [this, seq, work = std::move(work)]() {
+            work();
+            work_done(seq);
+        },
+        numa_node);
+}
+
+void OrderedTasks::work_done(uint64_t seq) {
+    std::unique_lock<std::mutex> guard(lock);
+    done[seq] = std::move(pending[seq]);
+    pending.erase(seq);
+
+    // Whoever is already finishing tasks will pick this one up when its turn comes
+    if (finishing)
+        return;
+    finishing = true;
+
+    for (auto next = done.find(next_finish); next != done.end(); next = done.find(next_finish)) {
+        std::function<void()> finish = std::move(next->second);
+        done.erase(next);
+
+        guard.unlock();
+        if (finish)
+            finish();
+        guard.lock();
+
+        next_finish++;
+        finished_cond.notify_all();
+    }
+
+    finishing = false;
+}
+
+void OrderedTasks::wait(uint64_t max_in_flight) {
+    std::unique_lock<std::mutex> guard(lock);
+    finished_cond.wait(guard, [&] { return next_submit - next_finish <= max_in_flight; });
+}
+
+} // namespace kotekan
@@ -0,0 +1,229 @@
+/**
+ * @file
+ * @brief A shared work stealing thread pool for the stages
+ *  - WorkPool
+ *  - OrderedTasks
+ */
+
+#ifndef WORK_POOL_HPP
+#define WORK_POOL_HPP
+
+#include "Config.hpp" // for Config
+
+#include <atomic>             // for atomic
+#include <condition_variable> // for condition_variable
+#include <deque>              // for deque
+#include <functional>         // for function
+#include <map>                // for map
+#include <memory>             // for shared_ptr, unique_ptr
+#include <mutex>              // for mutex
+#include <stdint.h>           // for uint32_t, uint64_t, int64_t
+#include <thread>             // for thread
+#include <vector>             // for vector
+
+namespace kotekan {
+
+/**
+ * @class WorkPool
+ * @brief A NUMA aware work stealing thread pool shared by all the stages
+ *
+ * Stages with CPU heavy, per frame work submit it here instead of starting
+ * their own worker threads.  Every worker has its own task queue, tasks are
+ * submitted round robin to the workers on the requested NUMA node, and a worker
+ * which runs out of tasks steals from the workers on its own NUMA node first
+ * and then from the others.
+ *
+ * Each worker is pinned to one core of @c cpu_affinity (round robin), and its
+ * NUMA node is the node of that core.
+ *
+ * The pool is started with the @c /work_pool config block by @c kotekanMode,
+ * or with the defaults on the first call to @c submit().
+ *
+ * @conf num_threads   Int. The number of worker threads.
+ *                     Default: the number of cores in @c cpu_affinity, or
+ *                     all the cores if that isn't set.
+ * @conf cpu_affinity  Array of ints. The cores to run the workers on. Default: unpinned
+ *
+ * This class is a singleton, and can be accessed with @c instance()
+ */
+class WorkPool {
+public:
+    /**
+     * @brief Set the config and start the global WorkPool
+     *
+     * Restarts the pool if it was already running.
+     *
+     * @param config The config.
+     * @returns A reference to the global WorkPool instance.
+     */
+    static WorkPool& instance(const Config& config);
+
+    /**
+     * @brief Get the global WorkPool.
+     *
+     * @returns A reference to the global WorkPool instance.
+     **/
+    static WorkPool& instance();
+
+    ~WorkPool();
+
+    /**
+     * @brief Start the worker threads
+     *
+     * @param num_threads   The number of workers, if zero one per core in @c cpu_affinity
+     *                      (or one per core of the system if that is empty).
+     * @param cpu_affinity  The cores the workers are pinned to, empty to not pin them.
+     */
+    void start(uint32_t num_threads, const std::vector<int>& cpu_affinity);
+
+    /**
+     * @brief Finish the queued tasks and join the worker threads
+     *
+     * The tasks which the queued tasks submit are run before the workers exit.
+     * The pool starts again with the defaults if tasks are submitted from outside
+     * it afterwards.
+     */
+    void stop();
+
+    /**
+     * @brief Queue a task to run on one of the workers
+     *
+     * @param task       The task.
+     * @param numa_node  Prefer the workers on this NUMA node, -1 for any worker.
+     */
+    void submit(std::function<void()> task, int numa_node = -1);
+
+    /**
+     * @brief Run @c f(i) for every i in [0, n) in parallel, and wait for them all
+     *
+     * The calling thread runs tasks too, and only waits for the ones which the
+     * helpers have already started, so this is safe to call from a task on the pool.
+     *
+     * @param n            The number of tasks.
+     * @param f            The task.
+     * @param max_helpers  The number of workers to ask for help.
+     * @param numa_node    Prefer the workers on this NUMA node, -1 for any worker.
+     */
+    void parallel_for(size_t n, const std::function<void(size_t)>& f, uint32_t max_helpers,
+                      int numa_node = -1);
+
+    /// The number of worker threads, zero if the pool isn't running
+    uint32_t get_num_threads();
+
+    /// The index of the worker running the calling thread, or -1 if it isn't a pool worker
+    static int get_worker_id();
+
+private:
+    WorkPool() = default;
+
+    struct worker {
+        std::deque<std::function<void()>> queue;
+        std::mutex queue_lock;
+        int numa_node;
+        std::thread thread;
+    };
+
+    // The workers started by one call to start(). They don't change while their threads
+    // run, so the workers can steal from each other without taking the pool lock.
+    struct worker_set {
+        std::vector<std::unique_ptr<worker>> workers;
+
+        // The workers on each NUMA node
+        std::map<int, std::vector<size_t>> node_workers;
+
+        // Workers sleep on this when there are no queued tasks. Tasks are counted after
+        // they are pushed, so the count can briefly go negative if a worker takes one
+        // straight away. The running tasks are counted too, as they can still submit
+        // tasks after the set is stopped.
+        std::mutex sleep_lock;
+        std::condition_variable sleep_cond;
+        int64_t num_queued = 0;
+        uint32_t num_running = 0;
+        bool stop_workers = false;
+
+        std::atomic<uint32_t> next_worker{0};
+    };
+
+    // Start the workers, called with the pool lock held
+    void start_locked(uint32_t num_threads, const std::vector<int>& cpu_affinity);
+
+    // Queue a task on one of the workers of a set
+    static void push(worker_set& set, std::function<void()> task, int numa_node);
+
+    static void worker_thread(worker_set& set, size_t worker_id);
+
+    // Takes the next task for the worker, from its own queue or stolen from another.
+    static bool get_task(worker_set& set, size_t worker_id, std::function<void()>& task);
+
+    // Protects starting and stopping, and the tasks submitted from outside the pool
+    std::mutex pool_lock;
+
+    // The running workers, null if the pool isn't running
+    std::shared_ptr<worker_set> running;
+
+    // The set of the worker running the calling thread, null outside the pool
+    static thread_local worker_set* current_set;
+};
+
+/**
+ * @class OrderedTasks
+ * @brief Runs tasks concurrently on the @c WorkPool, but finishes them in order
+ *
+ * Each task has a @c work part which runs on the pool as soon as a worker is free,
+ * and a @c finish part which runs once the work of this task and every earlier
+ * task is done.  The finish parts run one at a time, in the order the tasks were
+ * submitted, so they can be used to hand off results (e.g. mark output frames as full).
+ */
+class OrderedTasks {
+public:
+    /**
+     * @brief Create a task sequence
+     *
+     * @param numa_node  Run the work on workers on this NUMA node, -1 for any worker.
+     */
+    OrderedTasks(int numa_node = -1);
+
+    /// Waits for all the submitted tasks to finish
+    ~OrderedTasks();
+
+    /**
+     * @brief Submit a task
+     *
+     * @param work    Runs on the pool.
+     * @param finish  Runs after the work of this and all earlier tasks, in submission order.
+     */
+    void submit(std::function<void()> work, std::function<void()> finish);
+
+    /**
+     * @brief Wait until at most @c max_in_flight tasks haven't finished
+     *
+     * @param max_in_flight  Zero to wait for all the submitted tasks.
+     */
+    void wait(uint64_t max_in_flight = 0);
+
+private:
+    // Called by the workers when the work of a task is done
+    void work_done(uint64_t seq);
+
+    int numa_node;
+
+    std::mutex lock;
+    std::condition_variable finished_cond;
+
+    // The sequence number of the next task to submit, and of the next one to finish
+    uint64_t next_submit = 0;
+    uint64_t next_finish = 0;
+
+    // Set while a thread is running finish callbacks
+    bool finishing = false;
+
+    // The finish callbacks of the tasks whose work is done, by sequence number
+    std::map<uint64_t, std::function<void()>> done;
+
+    // The finish callbacks of the tasks still running
+    std::map<uint64_t, std::function<void()>> pending;
+};
+
+} // namespace kotekan
+
+#endif /* WORK_POOL_HPP */
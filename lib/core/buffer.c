@@ -12,45 +12,74 @@
 // IWYU pragma: no_include <asm/mman.h>
 #include <assert.h>   // for assert
 #include <errno.h>    // for errno, ETIMEDOUT
+#include <limits.h>   // for INT_MAX
+#include <math.h>     // for INFINITY
 #include <sched.h>    // for cpu_set_t, CPU_SET, CPU_ZERO
 #include <stdio.h>    // for snprintf
 #include <stdlib.h>   // for free, malloc
 #include <string.h>   // for memset, strerror, memcpy, strdup, strncmp, strncpy
 #include <sys/mman.h> // for mlock, mmap, munmap, MAP_FAILED
 #ifndef MAC_OSX
-#include <linux/mman.h> // for MAP_HUGE_2MB
+#include <linux/futex.h> // for FUTEX_WAIT_BITSET_PRIVATE, FUTEX_WAKE_PRIVATE, FUTEX_CLOCK_...
+#include <linux/mman.h>  // for MAP_HUGE_2MB
+#include <sys/syscall.h> // for SYS_futex // IWYU pragma: keep
+#include <unistd.h>      // for syscall
 #endif
-#include <time.h> // for NULL, size_t, timespec
+#include <time.h> // for NULL, size_t, timespec, clock_gettime, CLOCK_MONOTONIC
 #ifdef WITH_NUMA
-#include <numa.h>   // for numa_allocate_nodemask, numa_bitmask_free, numa_bitmask_setbit
+#include <numa.h>   // for numa_allocate_nodemask, numa_bitmask_free, numa_bitmask_setbit, numa_n...
 #include <numaif.h> // for set_mempolicy, mbind, MPOL_BIND, MPOL_DEFAULT, MPOL_MF_STRICT
 #endif
 
 // It is assumed this is a power of two in the code.
 #define HUGE_PAGE_SIZE 2097152
 
+// Flags in the lock free frame state word, the low MAX_CONSUMERS bits are the
+// consumers which have marked the frame as empty.
+#define FRAME_FULL (1u << 31)
+#define FRAME_RELEASING (1u << 30)
+#define FRAME_SHUTDOWN (1u << 29)
+
 struct zero_frames_thread_args {
     struct Buffer* buf;
     int ID;
 };
 
+// A frame borrowed with share_frame() which has to be handed back to its source buffer.
+// This is done after the borrowing buffer's lock is dropped, so the two locks are never nested.
+struct shared_release {
+    struct Buffer* src_buf;
+    int src_frame_id;
+};
+
 void* private_zero_frames(void* args);
 
+// Starts a detached thread which zeros the frame and then marks it as empty
+void private_start_zero_frame_thread(struct Buffer* buf, const int id);
+
 // Returns -1 if there is no consumer with that name
 int private_get_consumer_id(struct Buffer* buf, const char* name);
 
 // Returns -1 if there is no producer with that name
 int private_get_producer_id(struct Buffer* buf, const char* name);
 
-// Marks the consumer named by `name` as done for the given ID
-void private_mark_consumer_done(struct Buffer* buf, const char* name, const int ID);
+// Marks the consumer in slot `consumer_id` as done for the given ID
+void private_mark_consumer_done(struct Buffer* buf, const int consumer_id, const int ID);
+
+// Marks the producer in slot `producer_id` as done for the given ID
+void private_mark_producer_done(struct Buffer* buf, const int producer_id, const int ID);
 
-// Marks the producer named by `name` as done for the given ID
-void private_mark_producer_done(struct Buffer* buf, const char* name, const int ID);
+// Looks up the slot for the named consumer/producer, asserts that it is registered.
+// Takes the buffer lock, so must be called without it.
+int private_require_consumer_id(struct Buffer* buf, const char* name);
+int private_require_producer_id(struct Buffer* buf, const char* name);
 
 // Returns 1 if all consumers are done for the given ID.
 int private_consumers_done(struct Buffer* buf, const int ID);
 
+// Returns 1 if the frame is full and hasn't been released yet by the given consumer.
+int private_frame_ready_for_consumer(struct Buffer* buf, const int consumer_id, const int ID);
+
 // Returns 1 if all producers are done for the given ID.
 int private_producers_done(struct Buffer* buf, const int ID);
 
@@ -60,18 +89,76 @@ void private_reset_producers(struct Buffer* buf, const int ID);
 // Resets the list of consumers for the given ID
 void private_reset_consumers(struct Buffer* buf, const int ID);
 
+// Returns the CLOCK_MONOTONIC time in nanoseconds, used for the stage timing stats
+uint64_t private_time_ns(void);
+
+// Adds the time since `start_ns` to the time the stage has spent blocked in wait_for_*
+void private_record_wait(struct StageInfo* stage, const uint64_t start_ns);
+
+// Records the residency time of frame ID for the consumer releasing it
+void private_record_residency(struct Buffer* buf, const int consumer_id, const int ID);
+
+// Clears the timing stats of a newly registered stage
+void private_reset_stage_stats(struct StageInfo* stage);
+
+// Wakes the wait sets attached to the consumers of the buffer, must hold the buffer lock.
+void private_notify_wait_sets(struct Buffer* buf);
+
+// Checks without blocking if frame ID is full for the consumer.
+// Returns 0 if it is, 1 if it isn't and -1 if the buffer is shutting down.
+int private_poll_full_frame(struct Buffer* buf, const int consumer_id, const int ID);
+
 /**
  * @brief Marks a frame as empty and if the buffer requires zeroing then it starts
  *        the zeroing thread and delays marking it as empty until the zeroing is done.
  * @param buf The buffer the frame to empty is in.
  * @param id The id of the frame to mark as empty.
+ * @param release Set to the source frame to release if this frame was borrowed.
  * @return 1 if the frame was marked as empty, 0 if it is being zeroed.
  */
-int private_mark_frame_empty(struct Buffer* buf, const int id);
+int private_mark_frame_empty(struct Buffer* buf, const int id, struct shared_release* release);
+
+// The body of mark_frame_empty_by_slot() once any shares of the frame are done with
+void private_release_consumer_frame(struct Buffer* buf, const int consumer_id, const int ID);
+
+// Gives a borrowed frame its own memory back, must hold the buffer lock.
+// Returns the source frame to release with private_release_shared_frame() after unlocking.
+struct shared_release private_unshare_frame(struct Buffer* buf, const int ID);
+
+// Drops the reference a borrowing buffer held on a shared frame, releasing it if it was the last.
+void private_release_shared_frame(struct shared_release release);
+
+// Drops the reference of the consumer which shared the frame (if it did).
+// Returns 1 if other buffers still hold the frame, so the release has to wait for them.
+int private_drop_share_reference(struct Buffer* buf, const int consumer_id, const int ID);
+
+// Lock free versions of the frame handoff, see the `lock_free` option in buffer.h
+uint8_t* private_lf_wait_for_empty_frame(struct Buffer* buf, const int producer_id, const int ID);
+void private_lf_mark_frame_full(struct Buffer* buf, const int producer_id, const int ID);
+int private_lf_wait_for_full_frame(struct Buffer* buf, const int consumer_id, const int ID,
+                                   const struct timespec* timeout);
+void private_lf_mark_frame_empty(struct Buffer* buf, const int consumer_id, const int ID);
+
+// Claims the release of the frame if every registered consumer has marked it as empty.
+// @c state is the last observed value of the frame state word.
+// Returns 1 if this call released the frame.
+int private_lf_try_release(struct Buffer* buf, const int ID, uint32_t state);
+
+// Clears the frame state word once a frame is empty (and zeroed if requested).
+void private_lf_finish_empty(struct Buffer* buf, const int ID);
+
+// Sleep until the frame state word changes from `state`, or the absolute `timeout` passes.
+// Returns ETIMEDOUT on timeout, otherwise 0.
+int private_lf_wait(struct Buffer* buf, const int ID, uint32_t state,
+                    const struct timespec* timeout);
+
+// Wakes all threads sleeping on the frame state word.
+void private_lf_wake(struct Buffer* buf, const int ID);
 
 struct Buffer* create_buffer(int num_frames, size_t len, struct metadataPool* pool,
                              const char* buffer_name, const char* buffer_type, int numa_node,
-                             bool use_hugepages, bool mlock_frames, bool zero_new_frames) {
+                             uint64_t numa_interleave_mask, bool use_hugepages,
+                             bool mlock_frames, bool zero_new_frames, bool lock_free) {
 
     assert(num_frames > 0);
 
@@ -98,9 +185,20 @@ struct Buffer* create_buffer(int num_frames, size_t len, struct metadataPool* po
 
     buf->shutdown_signal = 0;
     buf->numa_node = numa_node;
+    buf->numa_interleave_mask = numa_interleave_mask;
     buf->use_hugepages = use_hugepages;
     buf->mlock_frames = mlock_frames;
 
+#ifdef MAC_OSX
+    if (lock_free) {
+        WARN_F("Lock free buffers need futex support, using the locking mode for %s",
+               buffer_name);
+        lock_free = false;
+    }
+#endif
+    buf->lock_free = lock_free;
+    buf->consumer_mask = 0;
+
     // Copy the buffer name and type.
     buf->buffer_name = strdup(buffer_name);
     buf->buffer_type = strdup(buffer_type);
@@ -127,6 +225,38 @@ struct Buffer* create_buffer(int num_frames, size_t len, struct metadataPool* po
 
     memset(buf->is_full, 0, num_frames * sizeof(int));
 
+    buf->frame_full_time = malloc(num_frames * sizeof(uint64_t));
+    CHECK_MEM_F(buf->frame_full_time);
+    memset(buf->frame_full_time, 0, num_frames * sizeof(uint64_t));
+
+    // Create the lock free frame state words, these are allocated for all buffers
+    // so the status functions don't need to care about the mode.
+    buf->frame_state = malloc(num_frames * sizeof(uint32_t));
+    CHECK_MEM_F(buf->frame_state);
+    memset(buf->frame_state, 0, num_frames * sizeof(uint32_t));
+    buf->frame_waiters = malloc(num_frames * sizeof(int));
+    CHECK_MEM_F(buf->frame_waiters);
+    memset(buf->frame_waiters, 0, num_frames * sizeof(int));
+
+    // Create the arrays for tracking frames shared between buffers
+    buf->frame_share_count = malloc(num_frames * sizeof(int));
+    CHECK_MEM_F(buf->frame_share_count);
+    buf->frame_share_slot = malloc(num_frames * sizeof(int));
+    CHECK_MEM_F(buf->frame_share_slot);
+    buf->shared_src = malloc(num_frames * sizeof(struct Buffer*));
+    CHECK_MEM_F(buf->shared_src);
+    buf->shared_src_frame = malloc(num_frames * sizeof(int));
+    CHECK_MEM_F(buf->shared_src_frame);
+    buf->parked_frames = malloc(num_frames * sizeof(uint8_t*));
+    CHECK_MEM_F(buf->parked_frames);
+    for (int i = 0; i < num_frames; ++i) {
+        buf->frame_share_count[i] = 0;
+        buf->frame_share_slot[i] = -1;
+        buf->shared_src[i] = NULL;
+        buf->shared_src_frame[i] = -1;
+        buf->parked_frames[i] = NULL;
+    }
+
     // Create the array of buffer pointers.
     buf->frames = malloc(num_frames * sizeof(void*));
     CHECK_MEM_F(buf->frames);
@@ -144,7 +274,9 @@ struct Buffer* create_buffer(int num_frames, size_t len, struct metadataPool* po
     }
     for (int i = 0; i < MAX_CONSUMERS; ++i) {
         buf->consumers[i].in_use = 0;
+        buf->consumers[i].wait_set = NULL;
     }
+    buf->num_wait_sets = 0;
 
     // Create the arrays for marking consumers and producers as done.
     buf->producers_done = malloc(num_frames * sizeof(int*));
@@ -167,11 +299,12 @@ struct Buffer* create_buffer(int num_frames, size_t len, struct metadataPool* po
     buf->zero_frames = 0;
 
     buf->last_arrival_time = 0;
+    buf->num_frames_filled = 0;
 
     // Create the frames.
     for (int i = 0; i < num_frames; ++i) {
-        buf->frames[i] = buffer_malloc(buf->aligned_frame_size, numa_node, use_hugepages,
-                                       mlock_frames, zero_new_frames);
+        buf->frames[i] = buffer_malloc(buf->aligned_frame_size, get_frame_numa_node(buf, i),
+                                       use_hugepages, mlock_frames, zero_new_frames);
         if (buf->frames[i] == NULL)
             return NULL;
     }
@@ -189,6 +322,9 @@ struct Buffer* create_buffer(int num_frames, size_t len, struct metadataPool* po
 
 void delete_buffer(struct Buffer* buf) {
     for (int i = 0; i < buf->num_frames; ++i) {
+        // Frames still borrowed at shutdown belong to the other buffer
+        if (buf->shared_src[i] != NULL)
+            buf->frames[i] = buf->parked_frames[i];
         buffer_free(buf->frames[i], buf->aligned_frame_size, buf->use_hugepages);
         free(buf->producers_done[i]);
         free(buf->consumers_done[i]);
@@ -196,6 +332,14 @@ void delete_buffer(struct Buffer* buf) {
 
     free(buf->frames);
     free(buf->is_full);
+    free(buf->frame_full_time);
+    free(buf->frame_state);
+    free(buf->frame_waiters);
+    free(buf->frame_share_count);
+    free(buf->frame_share_slot);
+    free(buf->shared_src);
+    free(buf->shared_src_frame);
+    free(buf->parked_frames);
     free(buf->metadata);
     free(buf->producers_done);
     free(buf->consumers_done);
@@ -209,21 +353,32 @@ void delete_buffer(struct Buffer* buf) {
 }
 
 void mark_frame_full(struct Buffer* buf, const char* name, const int ID) {
+    mark_frame_full_by_slot(buf, private_require_producer_id(buf, name), ID);
+}
+
+void mark_frame_full_by_slot(struct Buffer* buf, const int producer_id, const int ID) {
     assert(ID >= 0);
     assert(ID < buf->num_frames);
+    assert(producer_id >= 0 && producer_id < MAX_PRODUCERS);
 
-    // DEBUG_F("Frame %s[%d] being marked full by producer %s\n", buf->buffer_name, ID, name);
+    if (buf->lock_free) {
+        private_lf_mark_frame_full(buf, producer_id, ID);
+        return;
+    }
 
     CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
 
     int set_full = 0;
     int set_empty = 0;
+    struct shared_release release = {NULL, -1};
 
-    private_mark_producer_done(buf, name, ID);
+    private_mark_producer_done(buf, producer_id, ID);
     if (private_producers_done(buf, ID) == 1) {
         private_reset_producers(buf, ID);
         buf->is_full[ID] = 1;
         buf->last_arrival_time = e_time();
+        __atomic_store_n(&buf->frame_full_time[ID], private_time_ns(), __ATOMIC_RELAXED);
+        __atomic_add_fetch(&buf->num_frames_filled, 1, __ATOMIC_RELAXED);
         set_full = 1;
 
         // If there are no consumers registered then we can just mark the buffer empty
@@ -237,11 +392,16 @@ void mark_frame_full(struct Buffer* buf, const char* name, const int ID) {
             }
             set_empty = 1;
             private_reset_consumers(buf, ID);
+            release = private_unshare_frame(buf, ID);
+        } else if (buf->num_wait_sets > 0) {
+            private_notify_wait_sets(buf);
         }
     }
 
     CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
 
+    private_release_shared_frame(release);
+
     // Signal consumer
     if (set_full == 1) {
         CHECK_ERROR_F(pthread_cond_broadcast(&buf->full_cond));
@@ -271,14 +431,18 @@ void* private_zero_frames(void* args) {
     //    *((uint64_t*)&buf->frames[ID][i*1056]) = 0;
     //}
 
-    CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
+    if (buf->lock_free) {
+        private_lf_finish_empty(buf, ID);
+    } else {
+        CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
 
-    buf->is_full[ID] = 0;
-    private_reset_consumers(buf, ID);
+        buf->is_full[ID] = 0;
+        private_reset_consumers(buf, ID);
 
-    CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
+        CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
 
-    CHECK_ERROR_F(pthread_cond_broadcast(&buf->empty_cond));
+        CHECK_ERROR_F(pthread_cond_broadcast(&buf->empty_cond));
+    }
 
     free(args);
 
@@ -293,45 +457,126 @@ void zero_frames(struct Buffer* buf) {
 }
 
 void mark_frame_empty(struct Buffer* buf, const char* consumer_name, const int ID) {
+    mark_frame_empty_by_slot(buf, private_require_consumer_id(buf, consumer_name), ID);
+}
+
+void mark_frame_empty_by_slot(struct Buffer* buf, const int consumer_id, const int ID) {
     assert(ID >= 0);
     assert(ID < buf->num_frames);
+    assert(consumer_id >= 0 && consumer_id < MAX_CONSUMERS);
+
+    private_record_residency(buf, consumer_id, ID);
+
+    if (private_drop_share_reference(buf, consumer_id, ID) == 1)
+        return;
+
+    private_release_consumer_frame(buf, consumer_id, ID);
+}
+
+void private_release_consumer_frame(struct Buffer* buf, const int consumer_id, const int ID) {
     int broadcast = 0;
+    struct shared_release release = {NULL, -1};
+
+    if (buf->lock_free) {
+        private_lf_mark_frame_empty(buf, consumer_id, ID);
+        return;
+    }
 
     // If we've been asked to zero the buffer do it here.
     // This needs to happen out side of the critical section
     // so that we don't block for a long time here.
     CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
 
-    private_mark_consumer_done(buf, consumer_name, ID);
+    private_mark_consumer_done(buf, consumer_id, ID);
 
     if (private_consumers_done(buf, ID) == 1) {
-        broadcast = private_mark_frame_empty(buf, ID);
+        broadcast = private_mark_frame_empty(buf, ID, &release);
     }
 
     CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
 
+    private_release_shared_frame(release);
+
     // Signal producer
     if (broadcast == 1) {
         CHECK_ERROR_F(pthread_cond_broadcast(&buf->empty_cond));
     }
 }
 
-int private_mark_frame_empty(struct Buffer* buf, const int id) {
+void mark_frames_empty(struct Buffer* buf, const char* consumer_name, const int first_id,
+                       const int n) {
+    mark_frames_empty_by_slot(buf, private_require_consumer_id(buf, consumer_name), first_id, n);
+}
+
+void mark_frames_empty_by_slot(struct Buffer* buf, const int consumer_id, const int first_id,
+                               const int n) {
+    assert(first_id >= 0);
+    assert(first_id < buf->num_frames);
+    assert(n >= 0 && n <= buf->num_frames);
+    assert(consumer_id >= 0 && consumer_id < MAX_CONSUMERS);
     int broadcast = 0;
+
+    for (int i = 0; i < n; ++i)
+        private_record_residency(buf, consumer_id, (first_id + i) % buf->num_frames);
+
+    if (buf->lock_free) {
+        for (int i = 0; i < n; ++i) {
+            int ID = (first_id + i) % buf->num_frames;
+            if (private_drop_share_reference(buf, consumer_id, ID) == 0)
+                private_lf_mark_frame_empty(buf, consumer_id, ID);
+        }
+        return;
+    }
+
+    struct shared_release releases[n > 0 ? n : 1];
+
+    CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
+
+    for (int i = 0; i < n; ++i) {
+        int ID = (first_id + i) % buf->num_frames;
+        releases[i].src_buf = NULL;
+        if (private_drop_share_reference(buf, consumer_id, ID) == 1)
+            continue;
+
+        private_mark_consumer_done(buf, consumer_id, ID);
+
+        if (private_consumers_done(buf, ID) == 1) {
+            broadcast |= private_mark_frame_empty(buf, ID, &releases[i]);
+        }
+    }
+
+    CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
+
+    for (int i = 0; i < n; ++i)
+        private_release_shared_frame(releases[i]);
+
+    // Signal producer once for the whole batch
+    if (broadcast == 1) {
+        CHECK_ERROR_F(pthread_cond_broadcast(&buf->empty_cond));
+    }
+}
+
+void private_start_zero_frame_thread(struct Buffer* buf, const int id) {
+    pthread_t zero_t;
+    struct zero_frames_thread_args* zero_args = malloc(sizeof(struct zero_frames_thread_args));
+    zero_args->ID = id;
+    zero_args->buf = buf;
+
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    // TODO: Move this to the config file (when buffers.c updated to C++11)
+    CPU_SET(5, &cpuset);
+
+    CHECK_ERROR_F(pthread_create(&zero_t, NULL, &private_zero_frames, (void*)zero_args));
+    CHECK_ERROR_F(pthread_setaffinity_np(zero_t, sizeof(cpu_set_t), &cpuset));
+    CHECK_ERROR_F(pthread_detach(zero_t));
+}
+
+int private_mark_frame_empty(struct Buffer* buf, const int id, struct shared_release* release) {
+    int broadcast = 0;
+    *release = private_unshare_frame(buf, id);
     if (buf->zero_frames == 1) {
-        pthread_t zero_t;
-        struct zero_frames_thread_args* zero_args = malloc(sizeof(struct zero_frames_thread_args));
-        zero_args->ID = id;
-        zero_args->buf = buf;
-
-        cpu_set_t cpuset;
-        CPU_ZERO(&cpuset);
-        // TODO: Move this to the config file (when buffers.c updated to C++11)
-        CPU_SET(5, &cpuset);
-
-        CHECK_ERROR_F(pthread_create(&zero_t, NULL, &private_zero_frames, (void*)zero_args));
-        CHECK_ERROR_F(pthread_setaffinity_np(zero_t, sizeof(cpu_set_t), &cpuset));
-        CHECK_ERROR_F(pthread_detach(zero_t));
+        private_start_zero_frame_thread(buf, id);
     } else {
         buf->is_full[id] = 0;
         private_reset_consumers(buf, id);
@@ -345,15 +590,26 @@ int private_mark_frame_empty(struct Buffer* buf, const int id) {
 }
 
 uint8_t* wait_for_empty_frame(struct Buffer* buf, const char* producer_name, const int ID) {
+    return wait_for_empty_frame_by_slot(buf, private_require_producer_id(buf, producer_name), ID);
+}
+
+uint8_t* wait_for_empty_frame_by_slot(struct Buffer* buf, const int producer_id, const int ID) {
     assert(ID >= 0);
     assert(ID < buf->num_frames);
+    assert(producer_id >= 0 && producer_id < MAX_PRODUCERS);
 
     int print_stat = 0;
+    uint64_t start_ns = private_time_ns();
+
+    if (buf->lock_free) {
+        uint8_t* frame = private_lf_wait_for_empty_frame(buf, producer_id, ID);
+        private_record_wait(&buf->producers[producer_id], start_ns);
+        return frame;
+    }
 
     CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
 
-    int producer_id = private_get_producer_id(buf, producer_name);
-    assert(producer_id != -1);
+    assert(buf->producers[producer_id].in_use == 1);
 
     // If the buffer isn't full, i.e. is_full[ID] == 0, then we never sleep on the cond var.
     // The second condition stops us from using a buffer we've already filled,
@@ -361,13 +617,15 @@ uint8_t* wait_for_empty_frame(struct Buffer* buf, const char* producer_name, con
     while ((buf->is_full[ID] == 1 || buf->producers_done[ID][producer_id] == 1)
            && buf->shutdown_signal == 0) {
         DEBUG_F("wait_for_empty_frame: %s waiting for empty frame ID = %d in buffer %s",
-                producer_name, ID, buf->buffer_name);
+                buf->producers[producer_id].name, ID, buf->buffer_name);
         print_stat = 1;
         pthread_cond_wait(&buf->empty_cond, &buf->lock);
     }
 
     CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
 
+    private_record_wait(&buf->producers[producer_id], start_ns);
+
     // TODO: remove this output until we have a solution which has better control over log levels
     // if (print_stat == 1)
     //     print_buffer_status(buf);
@@ -380,7 +638,7 @@ uint8_t* wait_for_empty_frame(struct Buffer* buf, const char* producer_name, con
     return buf->frames[ID];
 }
 
-void register_consumer(struct Buffer* buf, const char* name) {
+int register_consumer(struct Buffer* buf, const char* name) {
     CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
 
     DEBUG_F("Registering consumer %s for buffer %s", name, buf->buffer_name);
@@ -389,7 +647,7 @@ void register_consumer(struct Buffer* buf, const char* name) {
         ERROR_F("You cannot register two consumers with the same name!");
         assert(0); // Optional
         CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
-        return;
+        return -1;
     }
 
     for (int i = 0; i < MAX_CONSUMERS; ++i) {
@@ -398,9 +656,12 @@ void register_consumer(struct Buffer* buf, const char* name) {
             // -1 here means no frame has been acquired/released
             buf->consumers[i].last_frame_acquired = -1;
             buf->consumers[i].last_frame_released = -1;
+            buf->consumers[i].wait_set = NULL;
+            private_reset_stage_stats(&buf->consumers[i]);
             strncpy(buf->consumers[i].name, name, MAX_STAGE_NAME_LEN);
+            __atomic_or_fetch(&buf->consumer_mask, 1u << i, __ATOMIC_SEQ_CST);
             CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
-            return;
+            return i;
         }
     }
 
@@ -408,11 +669,13 @@ void register_consumer(struct Buffer* buf, const char* name) {
     assert(0); // Optional
 
     CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
+    return -1;
 }
 
 void unregister_consumer(struct Buffer* buf, const char* name) {
 
     int broadcast = 0;
+    struct shared_release releases[buf->num_frames];
 
     CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
 
@@ -425,17 +688,29 @@ void unregister_consumer(struct Buffer* buf, const char* name) {
 
     buf->consumers[consumer_id].in_use = 0;
     snprintf(buf->consumers[consumer_id].name, MAX_STAGE_NAME_LEN, "unregistered");
+    if (buf->consumers[consumer_id].wait_set != NULL) {
+        buf->consumers[consumer_id].wait_set = NULL;
+        __atomic_sub_fetch(&buf->num_wait_sets, 1, __ATOMIC_SEQ_CST);
+    }
+    __atomic_and_fetch(&buf->consumer_mask, ~(1u << consumer_id), __ATOMIC_SEQ_CST);
 
     // Check if removing this consumer would cause any of the frames
     // which are currently full to become empty.
     for (int id = 0; id < buf->num_frames; ++id) {
-        if (private_consumers_done(buf, id) == 1) {
-            broadcast |= private_mark_frame_empty(buf, id);
+        releases[id].src_buf = NULL;
+        if (buf->lock_free) {
+            uint32_t state = __atomic_load_n(&buf->frame_state[id], __ATOMIC_SEQ_CST);
+            private_lf_try_release(buf, id, state);
+        } else if (private_consumers_done(buf, id) == 1) {
+            broadcast |= private_mark_frame_empty(buf, id, &releases[id]);
         }
     }
 
     CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
 
+    for (int id = 0; id < buf->num_frames; ++id)
+        private_release_shared_frame(releases[id]);
+
     // Signal producers if we found something could be empty after
     // removal of this consumer.
     if (broadcast == 1) {
@@ -444,14 +719,26 @@ void unregister_consumer(struct Buffer* buf, const char* name) {
 }
 
 
-void register_producer(struct Buffer* buf, const char* name) {
+int register_producer(struct Buffer* buf, const char* name) {
     CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
     DEBUG_F("Buffer: %s Registering producer: %s", buf->buffer_name, name);
     if (private_get_producer_id(buf, name) != -1) {
         ERROR_F("You cannot register two consumers with the same name!");
         assert(0); // Optional
         CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
-        return;
+        return -1;
+    }
+
+    if (buf->lock_free) {
+        for (int i = 0; i < MAX_PRODUCERS; ++i) {
+            if (buf->producers[i].in_use == 1) {
+                ERROR_F("Lock free buffer %s only supports a single producer, cannot register %s",
+                        buf->buffer_name, name);
+                assert(0); // Optional
+                CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
+                return -1;
+            }
+        }
     }
 
     for (int i = 0; i < MAX_PRODUCERS; ++i) {
@@ -460,9 +747,10 @@ void register_producer(struct Buffer* buf, const char* name) {
             // -1 here means no frame has been acquired/released
             buf->producers[i].last_frame_acquired = -1;
             buf->producers[i].last_frame_released = -1;
+            private_reset_stage_stats(&buf->producers[i]);
             strncpy(buf->producers[i].name, name, MAX_STAGE_NAME_LEN);
             CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
-            return;
+            return i;
         }
     }
 
@@ -470,6 +758,7 @@ void register_producer(struct Buffer* buf, const char* name) {
     assert(0); // Optional
 
     CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
+    return -1;
 }
 
 int private_get_consumer_id(struct Buffer* buf, const char* name) {
@@ -494,6 +783,28 @@ int private_get_producer_id(struct Buffer* buf, const char* name) {
     return -1;
 }
 
+int private_require_consumer_id(struct Buffer* buf, const char* name) {
+    CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
+    int consumer_id = private_get_consumer_id(buf, name);
+    CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
+    if (consumer_id == -1) {
+        ERROR_F("The consumer %s hasn't been registered on %s!", name, buf->buffer_name);
+    }
+    assert(consumer_id != -1);
+    return consumer_id;
+}
+
+int private_require_producer_id(struct Buffer* buf, const char* name) {
+    CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
+    int producer_id = private_get_producer_id(buf, name);
+    CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
+    if (producer_id == -1) {
+        ERROR_F("The producer %s hasn't been registered on %s!", name, buf->buffer_name);
+    }
+    assert(producer_id != -1);
+    return producer_id;
+}
+
 void private_reset_producers(struct Buffer* buf, const int ID) {
     memset(buf->producers_done[ID], 0, MAX_PRODUCERS * sizeof(int));
 }
@@ -502,16 +813,12 @@ void private_reset_consumers(struct Buffer* buf, const int ID) {
     memset(buf->consumers_done[ID], 0, MAX_CONSUMERS * sizeof(int));
 }
 
-void private_mark_consumer_done(struct Buffer* buf, const char* name, const int ID) {
-    int consumer_id = private_get_consumer_id(buf, name);
-    if (consumer_id == -1) {
-        ERROR_F("The consumer %s hasn't been registered!", name);
-    }
+void private_mark_consumer_done(struct Buffer* buf, const int consumer_id, const int ID) {
 
     // DEBUG_F("%s->consumers_done[%d][%d] == %d", buf->buffer_name, ID, consumer_id,
     // buf->consumers_done[ID][consumer_id] );
 
-    assert(consumer_id != -1);
+    assert(buf->consumers[consumer_id].in_use == 1);
     // The consumer we are marking as done, shouldn't already be done!
     assert(buf->consumers_done[ID][consumer_id] == 0);
 
@@ -519,20 +826,17 @@ void private_mark_consumer_done(struct Buffer* buf, const char* name, const int
     buf->consumers_done[ID][consumer_id] = 1;
 }
 
-void private_mark_producer_done(struct Buffer* buf, const char* name, const int ID) {
-    int producer_id = private_get_producer_id(buf, name);
-    if (producer_id == -1) {
-        ERROR_F("The producer %s hasn't been registered!", name);
-    }
+void private_mark_producer_done(struct Buffer* buf, const int producer_id, const int ID) {
 
     // DEBUG_F("%s->producers_done[%d][%d] == %d", buf->buffer_name, ID, producer_id,
     // buf->producers_done[ID][producer_id] );
 
-    assert(producer_id != -1);
+    assert(buf->producers[producer_id].in_use == 1);
     // The producer we are marking as done, shouldn't already be done!
     assert(buf->producers_done[ID][producer_id] == 0);
 
     buf->producers[producer_id].last_frame_released = ID;
+    __atomic_add_fetch(&buf->producers[producer_id].num_released, 1, __ATOMIC_RELAXED);
     buf->producers_done[ID][producer_id] = 1;
 }
 
@@ -545,6 +849,10 @@ int private_consumers_done(struct Buffer* buf, const int ID) {
     return 1;
 }
 
+int private_frame_ready_for_consumer(struct Buffer* buf, const int consumer_id, const int ID) {
+    return buf->is_full[ID] == 1 && buf->consumers_done[ID][consumer_id] == 0;
+}
+
 int private_producers_done(struct Buffer* buf, const int ID) {
 
     for (int i = 0; i < MAX_PRODUCERS; ++i) {
@@ -554,6 +862,42 @@ int private_producers_done(struct Buffer* buf, const int ID) {
     return 1;
 }
 
+uint64_t private_time_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+void private_record_wait(struct StageInfo* stage, const uint64_t start_ns) {
+    // Each slot is only waited on by its own stage thread, the atomics are for the readers
+    __atomic_add_fetch(&stage->wait_time_ns, private_time_ns() - start_ns, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stage->num_waits, 1, __ATOMIC_RELAXED);
+}
+
+void private_record_residency(struct Buffer* buf, const int consumer_id, const int ID) {
+    struct StageInfo* stage = &buf->consumers[consumer_id];
+    uint64_t residency_ns =
+        private_time_ns() - __atomic_load_n(&buf->frame_full_time[ID], __ATOMIC_RELAXED);
+
+    // Bin i holds residencies below 2^i microseconds
+    uint64_t residency_us = residency_ns / 1000;
+    int bin = 0;
+    while (bin < BUFFER_LATENCY_BINS - 1 && residency_us >= (1ull << bin))
+        bin++;
+
+    __atomic_add_fetch(&stage->residency_time_ns, residency_ns, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stage->residency_hist[bin], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stage->num_released, 1, __ATOMIC_RELAXED);
+}
+
+void private_reset_stage_stats(struct StageInfo* stage) {
+    stage->wait_time_ns = 0;
+    stage->num_waits = 0;
+    stage->residency_time_ns = 0;
+    stage->num_released = 0;
+    memset(stage->residency_hist, 0, sizeof(stage->residency_hist));
+}
+
 int is_frame_empty(struct Buffer* buf, const int ID) {
     assert(ID >= 0);
     assert(buf != NULL);
@@ -561,6 +905,10 @@ int is_frame_empty(struct Buffer* buf, const int ID) {
 
     int empty = 1;
 
+    if (buf->lock_free) {
+        return (__atomic_load_n(&buf->frame_state[ID], __ATOMIC_SEQ_CST) & FRAME_FULL) ? 0 : 1;
+    }
+
     CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
 
     if (buf->is_full[ID] == 1) {
@@ -573,10 +921,27 @@ int is_frame_empty(struct Buffer* buf, const int ID) {
 }
 
 uint8_t* wait_for_full_frame(struct Buffer* buf, const char* name, const int ID) {
+    return wait_for_full_frame_by_slot(buf, private_require_consumer_id(buf, name), ID);
+}
+
+uint8_t* wait_for_full_frame_by_slot(struct Buffer* buf, const int consumer_id, const int ID) {
+    assert(ID >= 0);
+    assert(ID < buf->num_frames);
+    assert(consumer_id >= 0 && consumer_id < MAX_CONSUMERS);
+
+    uint64_t start_ns = private_time_ns();
+
+    if (buf->lock_free) {
+        int err = private_lf_wait_for_full_frame(buf, consumer_id, ID, NULL);
+        private_record_wait(&buf->consumers[consumer_id], start_ns);
+        if (err != 0)
+            return NULL;
+        return buf->frames[ID];
+    }
+
     CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
 
-    int consumer_id = private_get_consumer_id(buf, name);
-    assert(consumer_id != -1);
+    assert(buf->consumers[consumer_id].in_use == 1);
 
     // This loop exists when is_full == 1 (i.e. a full buffer) AND
     // when this producer hasn't already marked this buffer as
@@ -587,6 +952,8 @@ uint8_t* wait_for_full_frame(struct Buffer* buf, const char* name, const int ID)
 
     CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
 
+    private_record_wait(&buf->consumers[consumer_id], start_ns);
+
     if (buf->shutdown_signal == 1)
         return NULL;
 
@@ -596,10 +963,27 @@ uint8_t* wait_for_full_frame(struct Buffer* buf, const char* name, const int ID)
 
 int wait_for_full_frame_timeout(struct Buffer* buf, const char* name, const int ID,
                                 const struct timespec timeout) {
+    return wait_for_full_frame_timeout_by_slot(buf, private_require_consumer_id(buf, name), ID,
+                                               timeout);
+}
+
+int wait_for_full_frame_timeout_by_slot(struct Buffer* buf, const int consumer_id, const int ID,
+                                        const struct timespec timeout) {
+    assert(ID >= 0);
+    assert(ID < buf->num_frames);
+    assert(consumer_id >= 0 && consumer_id < MAX_CONSUMERS);
+
+    uint64_t start_ns = private_time_ns();
+
+    if (buf->lock_free) {
+        int ret = private_lf_wait_for_full_frame(buf, consumer_id, ID, &timeout);
+        private_record_wait(&buf->consumers[consumer_id], start_ns);
+        return ret;
+    }
+
     CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
 
-    int consumer_id = private_get_consumer_id(buf, name);
-    assert(consumer_id != -1);
+    assert(buf->consumers[consumer_id].in_use == 1);
     int err = 0;
 
     // This loop exists when is_full == 1 (i.e. a full buffer) AND
@@ -611,6 +995,8 @@ int wait_for_full_frame_timeout(struct Buffer* buf, const char* name, const int
 
     CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
 
+    private_record_wait(&buf->consumers[consumer_id], start_ns);
+
     if (buf->shutdown_signal == 1)
         return -1;
 
@@ -621,9 +1007,192 @@ int wait_for_full_frame_timeout(struct Buffer* buf, const char* name, const int
     return 0;
 }
 
+void init_buffer_wait_set(struct bufferWaitSet* set) {
+    CHECK_ERROR_F(pthread_mutex_init(&set->lock, NULL));
+    CHECK_ERROR_F(pthread_cond_init(&set->cond, NULL));
+    set->generation = 0;
+    set->next_start = 0;
+}
+
+void destroy_buffer_wait_set(struct bufferWaitSet* set) {
+    CHECK_ERROR_F(pthread_mutex_destroy(&set->lock));
+    CHECK_ERROR_F(pthread_cond_destroy(&set->cond));
+}
+
+void attach_buffer_wait_set(struct Buffer* buf, const int consumer_id, struct bufferWaitSet* set) {
+    assert(consumer_id >= 0 && consumer_id < MAX_CONSUMERS);
+
+    CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
+
+    assert(buf->consumers[consumer_id].in_use == 1);
+
+    if (buf->consumers[consumer_id].wait_set == NULL && set != NULL)
+        __atomic_add_fetch(&buf->num_wait_sets, 1, __ATOMIC_SEQ_CST);
+    if (buf->consumers[consumer_id].wait_set != NULL && set == NULL)
+        __atomic_sub_fetch(&buf->num_wait_sets, 1, __ATOMIC_SEQ_CST);
+    buf->consumers[consumer_id].wait_set = set;
+
+    CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
+}
+
+void private_notify_wait_sets(struct Buffer* buf) {
+    for (int i = 0; i < MAX_CONSUMERS; ++i) {
+        struct bufferWaitSet* set = buf->consumers[i].wait_set;
+        if (set == NULL)
+            continue;
+
+        CHECK_ERROR_F(pthread_mutex_lock(&set->lock));
+        set->generation++;
+        CHECK_ERROR_F(pthread_mutex_unlock(&set->lock));
+        CHECK_ERROR_F(pthread_cond_broadcast(&set->cond));
+    }
+}
+
+int private_poll_full_frame(struct Buffer* buf, const int consumer_id, const int ID) {
+    assert(ID >= 0);
+    assert(ID < buf->num_frames);
+    assert(consumer_id >= 0 && consumer_id < MAX_CONSUMERS);
+
+    if (buf->lock_free) {
+        uint32_t state = __atomic_load_n(&buf->frame_state[ID], __ATOMIC_SEQ_CST);
+        if (state & FRAME_SHUTDOWN)
+            return -1;
+        return ((state & FRAME_FULL) && !(state & (1u << consumer_id))) ? 0 : 1;
+    }
+
+    CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
+    int status = 1;
+    if (buf->shutdown_signal == 1) {
+        status = -1;
+    } else if (private_frame_ready_for_consumer(buf, consumer_id, ID)) {
+        status = 0;
+    }
+    CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
+
+    return status;
+}
+
+int wait_for_any_full_frame(struct bufferWaitSet* set, struct Buffer** bufs,
+                            const int* consumer_ids, const int* frame_ids, const int n,
+                            const struct timespec* timeout, int* ready) {
+    assert(n > 0);
+
+    uint64_t start_ns = private_time_ns();
+    int err = 0;
+
+    for (;;) {
+        // Take the generation before polling, so a frame arriving after we poll its
+        // buffer changes it and we don't go to sleep.
+        CHECK_ERROR_F(pthread_mutex_lock(&set->lock));
+        uint64_t generation = set->generation;
+        CHECK_ERROR_F(pthread_mutex_unlock(&set->lock));
+
+        for (int k = 0; k < n; ++k) {
+            int i = (set->next_start + k) % n;
+            int status = private_poll_full_frame(bufs[i], consumer_ids[i], frame_ids[i]);
+            if (status == -1)
+                return -1;
+            if (status == 0) {
+                private_record_wait(&bufs[i]->consumers[consumer_ids[i]], start_ns);
+                bufs[i]->consumers[consumer_ids[i]].last_frame_acquired = frame_ids[i];
+                set->next_start = (i + 1) % n;
+                *ready = i;
+                return 0;
+            }
+        }
+
+        if (err == ETIMEDOUT)
+            return 1;
+
+        CHECK_ERROR_F(pthread_mutex_lock(&set->lock));
+        while (set->generation == generation && err == 0) {
+            if (timeout == NULL) {
+                pthread_cond_wait(&set->cond, &set->lock);
+            } else {
+                err = pthread_cond_timedwait(&set->cond, &set->lock, timeout);
+            }
+        }
+        CHECK_ERROR_F(pthread_mutex_unlock(&set->lock));
+    }
+}
+
+int wait_for_full_frames(struct Buffer* buf, const char* name, const int first_id, const int n) {
+    return wait_for_full_frames_by_slot(buf, private_require_consumer_id(buf, name), first_id, n);
+}
+
+int wait_for_full_frames_by_slot(struct Buffer* buf, const int consumer_id, const int first_id,
+                                 const int n) {
+    assert(first_id >= 0);
+    assert(first_id < buf->num_frames);
+    assert(n > 0 && n <= buf->num_frames);
+    assert(consumer_id >= 0 && consumer_id < MAX_CONSUMERS);
+
+    int count = 0;
+    uint64_t start_ns = private_time_ns();
+
+    if (buf->lock_free) {
+        int err = private_lf_wait_for_full_frame(buf, consumer_id, first_id, NULL);
+        private_record_wait(&buf->consumers[consumer_id], start_ns);
+        if (err != 0)
+            return 0;
+
+        // Stop the batch at the first frame which isn't ready, or which has seen the
+        // shutdown signal since the first frame was acquired
+        const uint32_t consumer_bit = 1u << consumer_id;
+        for (count = 1; count < n; ++count) {
+            int ID = (first_id + count) % buf->num_frames;
+            uint32_t state = __atomic_load_n(&buf->frame_state[ID], __ATOMIC_SEQ_CST);
+            if (!(state & FRAME_FULL) || (state & consumer_bit) || (state & FRAME_SHUTDOWN))
+                break;
+        }
+        buf->consumers[consumer_id].last_frame_acquired = (first_id + count - 1) % buf->num_frames;
+        return count;
+    }
+
+    CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
+
+    assert(buf->consumers[consumer_id].in_use == 1);
+
+    // Block for the first frame only, then take however many of the following frames
+    // are already full without waiting for them.
+    while (private_frame_ready_for_consumer(buf, consumer_id, first_id) == 0
+           && buf->shutdown_signal == 0) {
+        pthread_cond_wait(&buf->full_cond, &buf->lock);
+    }
+
+    if (buf->shutdown_signal == 0) {
+        count = 1;
+        while (count < n
+               && private_frame_ready_for_consumer(buf, consumer_id,
+                                                   (first_id + count) % buf->num_frames)
+                      == 1) {
+            ++count;
+        }
+    }
+
+    CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
+
+    private_record_wait(&buf->consumers[consumer_id], start_ns);
+
+    if (buf->shutdown_signal == 1)
+        return 0;
+
+    buf->consumers[consumer_id].last_frame_acquired = (first_id + count - 1) % buf->num_frames;
+    return count;
+}
+
 int get_num_full_frames(struct Buffer* buf) {
     int numFull = 0;
 
+    if (buf->lock_free) {
+        for (int i = 0; i < buf->num_frames; ++i) {
+            if (__atomic_load_n(&buf->frame_state[i], __ATOMIC_SEQ_CST) & FRAME_FULL) {
+                numFull++;
+            }
+        }
+        return numFull;
+    }
+
     CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
 
     for (int i = 0; i < buf->num_frames; ++i) {
@@ -835,6 +1404,9 @@ uint8_t* swap_external_frame(struct Buffer* buf, int frame_id, uint8_t* external
     }
     assert(num_producers == 1);
 
+    // A borrowed frame isn't ours to give away
+    assert(buf->shared_src[frame_id] == NULL);
+
     uint8_t* temp_frame = buf->frames[frame_id];
     buf->frames[frame_id] = external_frame;
 
@@ -862,6 +1434,12 @@ void swap_frames(struct Buffer* from_buf, int from_frame_id, struct Buffer* to_b
     assert(num_producers == 1);
     (void)num_producers;
 
+    // Frames lent or borrowed with share_frame() must stay where they are, so copy them instead
+    if (is_frame_shared(from_buf, from_frame_id) || is_frame_shared(to_buf, to_frame_id)) {
+        memcpy(to_buf->frames[to_frame_id], from_buf->frames[from_frame_id], from_buf->frame_size);
+        return;
+    }
+
     // Swap the frames
     uint8_t* temp_frame = from_buf->frames[from_frame_id];
     from_buf->frames[from_frame_id] = to_buf->frames[to_frame_id];
@@ -892,17 +1470,95 @@ void safe_swap_frame(struct Buffer* src_buf, int src_frame_id, struct Buffer* de
     int num_consumers = get_num_consumers(src_buf);
 
     // Copy or transfer the data part.
-    if (num_consumers == 1) {
+    if (num_consumers == 1 && !is_frame_shared(src_buf, src_frame_id)
+        && !is_frame_shared(dest_buf, dest_frame_id)) {
         // Swap the frames
         uint8_t* temp_frame = src_buf->frames[src_frame_id];
         src_buf->frames[src_frame_id] = dest_buf->frames[dest_frame_id];
         dest_buf->frames[dest_frame_id] = temp_frame;
-    } else if (num_consumers > 1) {
+    } else if (num_consumers >= 1) {
         // Copy the frame data over, leaving the source intact
         memcpy(dest_buf->frames[dest_frame_id], src_buf->frames[src_frame_id], src_buf->frame_size);
     }
 }
 
+void share_frame(struct Buffer* src_buf, const int src_consumer_id, const int src_frame_id,
+                 struct Buffer* dest_buf, const int dest_frame_id) {
+    assert(src_buf != dest_buf);
+    assert(src_frame_id >= 0);
+    assert(src_frame_id < src_buf->num_frames);
+    assert(dest_frame_id >= 0);
+    assert(dest_frame_id < dest_buf->num_frames);
+    assert(src_consumer_id >= 0 && src_consumer_id < MAX_CONSUMERS);
+
+    if (src_buf->frame_size != dest_buf->frame_size) {
+        FATAL_ERROR_F("Buffer sizes must match to share frames (%s.frame_size != %s.frame_size)",
+                      src_buf->buffer_name, dest_buf->buffer_name);
+        return;
+    }
+    if (dest_buf->lock_free || dest_buf->zero_frames) {
+        FATAL_ERROR_F("Cannot share frames into %s, it is lock free or zeroes its frames",
+                      dest_buf->buffer_name);
+        return;
+    }
+
+    // The sharing consumer holds one reference for itself which is dropped by its own
+    // mark_frame_empty() call, and there is one more for every buffer the frame is shared into.
+    int* share_count = &src_buf->frame_share_count[src_frame_id];
+    if (__atomic_load_n(share_count, __ATOMIC_SEQ_CST) == 0) {
+        src_buf->frame_share_slot[src_frame_id] = src_consumer_id;
+        __atomic_store_n(share_count, 2, __ATOMIC_SEQ_CST);
+    } else {
+        assert(src_buf->frame_share_slot[src_frame_id] == src_consumer_id);
+        __atomic_add_fetch(share_count, 1, __ATOMIC_SEQ_CST);
+    }
+
+    CHECK_ERROR_F(pthread_mutex_lock(&dest_buf->lock));
+
+    assert(dest_buf->shared_src[dest_frame_id] == NULL);
+    dest_buf->parked_frames[dest_frame_id] = dest_buf->frames[dest_frame_id];
+    dest_buf->frames[dest_frame_id] = src_buf->frames[src_frame_id];
+    dest_buf->shared_src[dest_frame_id] = src_buf;
+    dest_buf->shared_src_frame[dest_frame_id] = src_frame_id;
+
+    CHECK_ERROR_F(pthread_mutex_unlock(&dest_buf->lock));
+}
+
+int is_frame_shared(struct Buffer* buf, const int ID) {
+    assert(ID >= 0);
+    assert(ID < buf->num_frames);
+    return buf->shared_src[ID] != NULL
+           || __atomic_load_n(&buf->frame_share_count[ID], __ATOMIC_SEQ_CST) > 0;
+}
+
+struct shared_release private_unshare_frame(struct Buffer* buf, const int ID) {
+    struct shared_release release = {buf->shared_src[ID], buf->shared_src_frame[ID]};
+    if (release.src_buf != NULL) {
+        buf->frames[ID] = buf->parked_frames[ID];
+        buf->parked_frames[ID] = NULL;
+        buf->shared_src[ID] = NULL;
+        buf->shared_src_frame[ID] = -1;
+    }
+    return release;
+}
+
+void private_release_shared_frame(struct shared_release release) {
+    struct Buffer* src_buf = release.src_buf;
+    if (src_buf == NULL)
+        return;
+    const int ID = release.src_frame_id;
+    if (__atomic_sub_fetch(&src_buf->frame_share_count[ID], 1, __ATOMIC_SEQ_CST) == 0) {
+        private_release_consumer_frame(src_buf, src_buf->frame_share_slot[ID], ID);
+    }
+}
+
+int private_drop_share_reference(struct Buffer* buf, const int consumer_id, const int ID) {
+    if (__atomic_load_n(&buf->frame_share_count[ID], __ATOMIC_SEQ_CST) == 0
+        || buf->frame_share_slot[ID] != consumer_id)
+        return 0;
+    return __atomic_sub_fetch(&buf->frame_share_count[ID], 1, __ATOMIC_SEQ_CST) != 0;
+}
+
 uint8_t* buffer_malloc(size_t len, int numa_node, bool use_hugepages, bool mlock_frames,
                        bool zero_new_frames) {
 
@@ -1016,11 +1672,234 @@ double get_last_arrival_time(struct Buffer* buf) {
     return buf->last_arrival_time;
 }
 
+double get_latency_bin_upper_bound(const int bin) {
+    assert(bin >= 0 && bin < BUFFER_LATENCY_BINS);
+    if (bin == BUFFER_LATENCY_BINS - 1)
+        return INFINITY;
+    return (double)(1ull << bin) * 1e-6;
+}
+
+uint64_t get_num_frames_filled(struct Buffer* buf) {
+    return __atomic_load_n(&buf->num_frames_filled, __ATOMIC_RELAXED);
+}
+
+int get_frame_numa_node(struct Buffer* buf, const int ID) {
+    assert(ID >= 0);
+    assert(ID < buf->num_frames);
+
+    int num_nodes = __builtin_popcountll(buf->numa_interleave_mask);
+    if (num_nodes == 0)
+        return buf->numa_node;
+
+    // Find the (ID % num_nodes)-th node in the mask
+    int n = ID % num_nodes;
+    for (int node = 0; node < 64; ++node) {
+        if ((buf->numa_interleave_mask >> node) & 1) {
+            if (n == 0)
+                return node;
+            n--;
+        }
+    }
+    return buf->numa_node;
+}
+
+int get_cpu_numa_node(const int cpu_id) {
+#ifdef WITH_NUMA
+    if (numa_available() < 0)
+        return 0;
+    int node = numa_node_of_cpu(cpu_id);
+    return node < 0 ? 0 : node;
+#else
+    (void)cpu_id;
+    return 0;
+#endif
+}
+
+int get_max_numa_node() {
+#ifdef WITH_NUMA
+    if (numa_available() < 0)
+        return -1;
+    return numa_max_node();
+#else
+    return -1;
+#endif
+}
+
 void send_shutdown_signal(struct Buffer* buf) {
     CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
     buf->shutdown_signal = 1;
+    private_notify_wait_sets(buf);
     CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
 
+    if (buf->lock_free) {
+        // Setting the flag changes the futex word, so stages about to sleep won't miss this.
+        for (int i = 0; i < buf->num_frames; ++i) {
+            __atomic_or_fetch(&buf->frame_state[i], FRAME_SHUTDOWN, __ATOMIC_SEQ_CST);
+            private_lf_wake(buf, i);
+        }
+    }
+
     CHECK_ERROR_F(pthread_cond_broadcast(&buf->empty_cond));
     CHECK_ERROR_F(pthread_cond_broadcast(&buf->full_cond));
 }
+
+// *** Lock free frame handoff ***
+
+uint8_t* private_lf_wait_for_empty_frame(struct Buffer* buf, const int producer_id, const int ID) {
+    assert(ID >= 0);
+    assert(ID < buf->num_frames);
+
+    uint32_t state = __atomic_load_n(&buf->frame_state[ID], __ATOMIC_SEQ_CST);
+    while ((state & FRAME_FULL) && !(state & FRAME_SHUTDOWN)) {
+        private_lf_wait(buf, ID, state, NULL);
+        state = __atomic_load_n(&buf->frame_state[ID], __ATOMIC_SEQ_CST);
+    }
+
+    if (state & FRAME_SHUTDOWN)
+        return NULL;
+
+    buf->producers[producer_id].last_frame_acquired = ID;
+    return buf->frames[ID];
+}
+
+void private_lf_mark_frame_full(struct Buffer* buf, const int producer_id, const int ID) {
+    assert(ID >= 0);
+    assert(ID < buf->num_frames);
+
+    buf->producers[producer_id].last_frame_released = ID;
+    __atomic_add_fetch(&buf->producers[producer_id].num_released, 1, __ATOMIC_RELAXED);
+    buf->last_arrival_time = e_time();
+    __atomic_store_n(&buf->frame_full_time[ID], private_time_ns(), __ATOMIC_RELAXED);
+    __atomic_add_fetch(&buf->num_frames_filled, 1, __ATOMIC_RELAXED);
+
+    // If there are no consumers registered then we can just leave the frame empty
+    if (__atomic_load_n(&buf->consumer_mask, __ATOMIC_SEQ_CST) == 0) {
+        DEBUG_F("No consumers are registered on %s dropping data in frame %d...",
+                buf->buffer_name, ID);
+        if (buf->metadata[ID] != NULL) {
+            decrement_metadata_ref_count(buf->metadata[ID]);
+            buf->metadata[ID] = NULL;
+        }
+        return;
+    }
+
+    buf->is_full[ID] = 1;
+    __atomic_or_fetch(&buf->frame_state[ID], FRAME_FULL, __ATOMIC_SEQ_CST);
+    private_lf_wake(buf, ID);
+
+    // Pairs with the increment in attach_buffer_wait_set(), so either we see the set
+    // here or the waiter sees the full frame when it polls after attaching.
+    if (__atomic_load_n(&buf->num_wait_sets, __ATOMIC_SEQ_CST) > 0) {
+        CHECK_ERROR_F(pthread_mutex_lock(&buf->lock));
+        private_notify_wait_sets(buf);
+        CHECK_ERROR_F(pthread_mutex_unlock(&buf->lock));
+    }
+}
+
+int private_lf_wait_for_full_frame(struct Buffer* buf, const int consumer_id, const int ID,
+                                   const struct timespec* timeout) {
+    assert(ID >= 0);
+    assert(ID < buf->num_frames);
+
+    const uint32_t consumer_bit = 1u << consumer_id;
+    int err = 0;
+
+    // Wait until the frame is full and this consumer hasn't already released it.
+    uint32_t state = __atomic_load_n(&buf->frame_state[ID], __ATOMIC_SEQ_CST);
+    while ((!(state & FRAME_FULL) || (state & consumer_bit)) && !(state & FRAME_SHUTDOWN)
+           && err == 0) {
+        err = private_lf_wait(buf, ID, state, timeout);
+        state = __atomic_load_n(&buf->frame_state[ID], __ATOMIC_SEQ_CST);
+    }
+
+    if (state & FRAME_SHUTDOWN)
+        return -1;
+
+    if (err == ETIMEDOUT)
+        return 1;
+
+    buf->consumers[consumer_id].last_frame_acquired = ID;
+    return 0;
+}
+
+void private_lf_mark_frame_empty(struct Buffer* buf, const int consumer_id, const int ID) {
+    assert(ID >= 0);
+    assert(ID < buf->num_frames);
+
+    const uint32_t consumer_bit = 1u << consumer_id;
+
+    // The consumer we are marking as done, shouldn't already be done!
+    assert(buf->consumers_done[ID][consumer_id] == 0);
+    buf->consumers_done[ID][consumer_id] = 1;
+    buf->consumers[consumer_id].last_frame_released = ID;
+
+    uint32_t state = __atomic_or_fetch(&buf->frame_state[ID], consumer_bit, __ATOMIC_SEQ_CST);
+    private_lf_try_release(buf, ID, state);
+}
+
+int private_lf_try_release(struct Buffer* buf, const int ID, uint32_t state) {
+    for (;;) {
+        uint32_t mask = __atomic_load_n(&buf->consumer_mask, __ATOMIC_SEQ_CST);
+        if (!(state & FRAME_FULL) || (state & FRAME_RELEASING) || (state & mask) != mask)
+            return 0;
+
+        // Only one of the consumers (or an unregister call) can win this exchange
+        if (__atomic_compare_exchange_n(&buf->frame_state[ID], &state, state | FRAME_RELEASING,
+                                        false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+            break;
+    }
+
+    if (buf->metadata[ID] != NULL) {
+        decrement_metadata_ref_count(buf->metadata[ID]);
+        buf->metadata[ID] = NULL;
+    }
+
+    if (buf->zero_frames == 1) {
+        private_start_zero_frame_thread(buf, ID);
+    } else {
+        private_lf_finish_empty(buf, ID);
+    }
+    return 1;
+}
+
+void private_lf_finish_empty(struct Buffer* buf, const int ID) {
+    buf->is_full[ID] = 0;
+    private_reset_consumers(buf, ID);
+    // Clear everything except the shutdown flag
+    __atomic_and_fetch(&buf->frame_state[ID], FRAME_SHUTDOWN, __ATOMIC_SEQ_CST);
+    private_lf_wake(buf, ID);
+}
+
+int private_lf_wait(struct Buffer* buf, const int ID, uint32_t state,
+                    const struct timespec* timeout) {
+    int err = 0;
+#ifndef MAC_OSX
+    // The waiter count must be visible before the kernel checks the futex word, the waker
+    // changes the word before reading the count, so one of the two always sees the other.
+    __atomic_add_fetch(&buf->frame_waiters[ID], 1, __ATOMIC_SEQ_CST);
+    if (syscall(SYS_futex, &buf->frame_state[ID], FUTEX_WAIT_BITSET_PRIVATE | FUTEX_CLOCK_REALTIME,
+                state, timeout, NULL, FUTEX_BITSET_MATCH_ANY)
+            == -1
+        && errno == ETIMEDOUT) {
+        err = ETIMEDOUT;
+    }
+    __atomic_sub_fetch(&buf->frame_waiters[ID], 1, __ATOMIC_SEQ_CST);
+#else
+    (void)buf;
+    (void)ID;
+    (void)state;
+    (void)timeout;
+#endif
+    return err;
+}
+
+void private_lf_wake(struct Buffer* buf, const int ID) {
+#ifndef MAC_OSX
+    if (__atomic_load_n(&buf->frame_waiters[ID], __ATOMIC_SEQ_CST) > 0) {
+        syscall(SYS_futex, &buf->frame_state[ID], FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+    }
+#else
+    (void)buf;
+    (void)ID;
+#endif
+}
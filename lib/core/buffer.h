@@ -12,13 +12,17 @@
  *  - mark_frame_empty
  *  - wait_for_empty_frame
  *  - wait_for_full_frame
+ *  - bufferWaitSet
+ *  - wait_for_any_full_frame
  *  - is_frame_empty
  *  - get_num_full_frames
+ *  - get_latency_bin_upper_bound
  *  - print_buffer_status
  *  - allocate_new_metadata_object
  *  - get_metadata
  *  - get_metadata_container
  *  - pass_metadata
+ *  - share_frame
  *  - send_shutdown_signal
  */
 
@@ -53,6 +57,19 @@ extern "C" {
 /// The maximum number of producers that can register on a buffer
 #define MAX_PRODUCERS 10
 
+// The lock free mode packs one bit per consumer into a 32-bit frame state word,
+// and reserves the top bits for the frame flags.
+#if MAX_CONSUMERS > 28
+#error "MAX_CONSUMERS must be <= 28 to fit in the lock free frame state word"
+#endif
+
+/// The number of bins in the frame residency histogram of each consumer.
+/// Bin @c i counts frames held for less than <tt>2^i</tt> microseconds,
+/// the last bin counts everything longer than that.
+#define BUFFER_LATENCY_BINS 24
+
+struct bufferWaitSet;
+
 /**
  * @struct StageInfo
  * @brief Internal structure for tracking consumer and producer names.
@@ -69,6 +86,51 @@ struct StageInfo {
 
     /// Last frame to be released with a call to mark_frame_*
     int last_frame_released;
+
+    /// Total time in nanoseconds spent blocked in calls to wait_for_*
+    uint64_t wait_time_ns;
+
+    /// The number of calls to wait_for_*
+    uint64_t num_waits;
+
+    /**
+     * @brief Total frame residency time in nanoseconds (consumers only).
+     * The residency of a frame is the time from it being marked full
+     * to this consumer marking it as empty.
+     */
+    uint64_t residency_time_ns;
+
+    /// The number of frames released by this stage with mark_frame_*
+    uint64_t num_released;
+
+    /// Histogram of the frame residency times, see @c BUFFER_LATENCY_BINS (consumers only)
+    uint64_t residency_hist[BUFFER_LATENCY_BINS];
+
+    /// Woken whenever a frame is marked full, see @c attach_buffer_wait_set (consumers only)
+    struct bufferWaitSet* wait_set;
+};
+
+/**
+ * @struct bufferWaitSet
+ * @brief Lets a consumer of several buffers sleep until a frame is full on any of them.
+ *
+ * Attach the set to the consumer's slot on each buffer with @c attach_buffer_wait_set,
+ * then wait with @c wait_for_any_full_frame.  Every frame marked full on one of those
+ * buffers, and every shutdown, bumps @c generation and wakes the waiting thread.
+ * Buffers without an attached set don't pay anything for this.
+ */
+struct bufferWaitSet {
+    /// Protects @c generation
+    pthread_mutex_t lock;
+
+    /// Signaled when @c generation changes
+    pthread_cond_t cond;
+
+    /// Incremented on every frame arrival (or shutdown) on the attached buffers
+    uint64_t generation;
+
+    /// The buffer to check first on the next wait, so one busy input can't starve the others
+    int next_start;
 };
 
 /**
@@ -113,12 +175,26 @@ struct StageInfo {
  * the frames and log an INFO statement to notify the user that the data
  * is being dropped.
  *
+ * Each registered stage keeps timing stats in its @c StageInfo: the time spent
+ * blocked in the @c wait_for_* calls, and for consumers the residency time of the
+ * frames they release.  These are exported by @c bufferStatus and @c /buffers/latency.
+ *
  * @conf frame_size The size of the individual ring frames in bytes
  * @conf num_frames The buffer depth of size of the ring
  * @conf metadata_pool The name of the metadata pool to associate with the buffer
  * @conf numa_node The NUMA domain to mbind the memory into.  Default: 1
+ * @conf numa_placement How to choose the NUMA domain of the frames, one of
+ *                      @c fixed (use @c numa_node), @c auto (the domain most of the
+ *                      producer and consumer stages are pinned to with @c cpu_affinity)
+ *                      or @c interleave (like @c auto, but if the stages span more than
+ *                      one domain the frames are spread round robin across them).
+ *                      Default: fixed
  * @conf use_hugepages Allocate 2MB huge pages for the frames. Default: false
  * @conf mlock_frames Lock the frame pages with mlock Default: true
+ * @conf lock_free Use the lock free single producer/multi-consumer frame handoff.
+ *                 Frame state is tracked with one atomic word per frame and waiting
+ *                 stages sleep on a futex, so @c wait_for_* and @c mark_frame_* never
+ *                 take the buffer mutex.  Only one producer may register. Default: false
  *
  * See metadata.h for more information on metadata pools
  *
@@ -192,6 +268,9 @@ struct Buffer {
     /// The last time a frame was marked as full (used for arrival rate)
     double last_arrival_time;
 
+    /// The monotonic time in nanoseconds each frame was last marked as full
+    uint64_t* frame_full_time;
+
     /// Array of buffer info objects, for tracking information about each buffer.
     struct metadataContainer** metadata;
 
@@ -212,6 +291,55 @@ struct Buffer {
 
     /// The NUMA node the frames are allocated in
     int numa_node;
+
+    /**
+     * @brief Bit mask of the NUMA nodes the frames are interleaved over.
+     * Frame @c i is on the <tt>i % n</tt>-th set bit of the @c n set bits.
+     * If zero all the frames are in @c numa_node.
+     */
+    uint64_t numa_interleave_mask;
+
+    /// The total number of frames marked as full (used for throughput)
+    uint64_t num_frames_filled;
+
+    /// The number of consumers with a @c bufferWaitSet attached
+    int num_wait_sets;
+
+    /// Set if the buffer uses the lock free single producer frame handoff
+    bool lock_free;
+
+    /**
+     * @brief Per frame state words for the lock free mode.
+     * Bits [0, MAX_CONSUMERS) are set once the consumer in that slot has marked
+     * the frame as empty, the top bits hold the full, releasing and shutdown flags.
+     * The words are also used as the futex addresses waiting stages sleep on.
+     */
+    uint32_t* frame_state;
+
+    /// The number of threads sleeping on each @c frame_state word (lock free mode)
+    int* frame_waiters;
+
+    /// Bit mask of the registered consumer slots (lock free mode)
+    uint32_t consumer_mask;
+
+    /**
+     * @brief Reference counts for frames lent to other buffers with @c share_frame()
+     * The count includes the consumer which shared the frame (in @c frame_share_slot)
+     * and is zero when the frame isn't shared.
+     */
+    int* frame_share_count;
+
+    /// The consumer slot which shared each frame with @c share_frame()
+    int* frame_share_slot;
+
+    /// For frames borrowed from another buffer, the buffer they came from (or NULL)
+    struct Buffer** shared_src;
+
+    /// For frames borrowed from another buffer, the frame ID in @c shared_src
+    int* shared_src_frame;
+
+    /// Holds this buffer's own memory for frames which are currently borrowed
+    uint8_t** parked_frames;
 };
 
 /**
@@ -227,16 +355,20 @@ struct Buffer {
  * @param[in] buffer_name The unique name of this buffer.
  * @param[in] buffer_type The type of data this buffer contains.
  * @param[in] numa_node The CPU NUMA memory region to allocate memory in.+
+ * @param[in] numa_interleave_mask If non-zero, spread the frames round robin across
+ *                                 the NUMA nodes set in this mask instead.
  * @param[in] use_huge_pages Map huge pages with mmap
  * @param[in] mlock_frames If set, mlock the pages of the frame memory
  * @param[in] zero_new_frames In theory some memory allocators don't zero new allocations
  *                            so by default we zero new frames on startup, but this is expensive
  *                            and can be disabled by setting this to false.
+ * @param[in] lock_free Use the lock free single producer/multi-consumer frame handoff.
  * @returns A buffer object.
  */
 struct Buffer* create_buffer(int num_frames, size_t frame_size, struct metadataPool* pool,
                              const char* buffer_name, const char* buffer_type, int numa_node,
-                             bool use_huge_pages, bool mlock_frames, bool zero_new_frames);
+                             uint64_t numa_interleave_mask, bool use_huge_pages,
+                             bool mlock_frames, bool zero_new_frames, bool lock_free);
 
 /**
  * @brief Deletes a buffer object and frees all frame memory
@@ -258,10 +390,14 @@ void zero_frames(struct Buffer* buf);
  * In order to use a buffer a consumer must first register its name so that
  * the buffer object can track which consumers have signed off on each frame.
  *
+ * The returned slot can be passed to the @c *_by_slot functions, which skips
+ * looking up the consumer by name on every frame.
+ *
  * @param[in] buf The buffer to register on
  * @param[in] name The name of the consumer.
+ * @returns The consumer slot, or -1 if the consumer could not be registered.
  */
-void register_consumer(struct Buffer* buf, const char* name);
+int register_consumer(struct Buffer* buf, const char* name);
 
 /**
  * @brief Removes the consumer with the given name
@@ -282,10 +418,14 @@ void unregister_consumer(struct Buffer* buf, const char* name);
  * In order to use a buffer a producer must first register its name so that
  * the buffer object can track which producers have signed off on each frame.
  *
+ * The returned slot can be passed to the @c *_by_slot functions, which skips
+ * looking up the producer by name on every frame.
+ *
  * @param[in] buf The buffer to register on
  * @param[in] name The name of the producer.
+ * @returns The producer slot, or -1 if the producer could not be registered.
  */
-void register_producer(struct Buffer* buf, const char* name);
+int register_producer(struct Buffer* buf, const char* name);
 
 /**
  * @brief Marks a buffer frame as full.
@@ -299,6 +439,11 @@ void register_producer(struct Buffer* buf, const char* name);
  */
 void mark_frame_full(struct Buffer* buf, const char* producer_name, const int frame_id);
 
+/**
+ * @brief Same as @c mark_frame_full() but with the slot returned by @c register_producer()
+ */
+void mark_frame_full_by_slot(struct Buffer* buf, const int producer_id, const int frame_id);
+
 /**
  * @brief Marks a buffer frame as empty
  *
@@ -310,6 +455,32 @@ void mark_frame_full(struct Buffer* buf, const char* producer_name, const int fr
  */
 void mark_frame_empty(struct Buffer* buf, const char* consumer_name, const int frame_id);
 
+/**
+ * @brief Same as @c mark_frame_empty() but with the slot returned by @c register_consumer()
+ */
+void mark_frame_empty_by_slot(struct Buffer* buf, const int consumer_id, const int frame_id);
+
+/**
+ * @brief Marks a contiguous run of frames as empty
+ *
+ * Equivalent to calling @c mark_frame_empty() on the frames
+ * @c first_id, @c first_id + 1, ... (modulo the number of frames), but done in
+ * a single critical section with at most one wakeup of the producers.
+ *
+ * @param[in] buf The buffer containing the frames to mark as empty
+ * @param[in] consumer_name The name of the consumer registered with @c register_consumer()
+ * @param[in] first_id The first frame ID to be marked as empty
+ * @param[in] n The number of frames to release, may be zero
+ */
+void mark_frames_empty(struct Buffer* buf, const char* consumer_name, const int first_id,
+                       const int n);
+
+/**
+ * @brief Same as @c mark_frames_empty() but with the slot returned by @c register_consumer()
+ */
+void mark_frames_empty_by_slot(struct Buffer* buf, const int consumer_id, const int first_id,
+                               const int n);
+
 /**
  * @brief Blocks until the frame requested by frame_id is empty.
  *
@@ -328,6 +499,12 @@ void mark_frame_empty(struct Buffer* buf, const char* consumer_name, const int f
  */
 uint8_t* wait_for_empty_frame(struct Buffer* buf, const char* producer_name, const int frame_id);
 
+/**
+ * @brief Same as @c wait_for_empty_frame() but with the slot returned by @c register_producer()
+ */
+uint8_t* wait_for_empty_frame_by_slot(struct Buffer* buf, const int producer_id,
+                                      const int frame_id);
+
 /**
  * @brief Blocks until the frame requested by frame_id is full.
  *
@@ -346,6 +523,37 @@ uint8_t* wait_for_empty_frame(struct Buffer* buf, const char* producer_name, con
  */
 uint8_t* wait_for_full_frame(struct Buffer* buf, const char* consumer_name, const int frame_id);
 
+/**
+ * @brief Same as @c wait_for_full_frame() but with the slot returned by @c register_consumer()
+ */
+uint8_t* wait_for_full_frame_by_slot(struct Buffer* buf, const int consumer_id,
+                                     const int frame_id);
+
+/**
+ * @brief Blocks until @c first_id is full, then returns the run of frames ready to read.
+ *
+ * Waits like @c wait_for_full_frame() for the frame @c first_id, then in the same
+ * critical section counts how many of the frames following it (modulo the number
+ * of frames) are also full, without waiting for any of them.
+ * The frames can then be used as if @c wait_for_full_frame() had been called on
+ * each of them, and released with @c mark_frames_empty().
+ *
+ * @param[in] buf The buffer object
+ * @param[in] consumer_name The name of the registered consumer requesting the frames
+ * @param[in] first_id The id of the first frame to wait for.
+ * @param[in] n The maximum number of frames to acquire, at most the number of frames.
+ * @returns The number of frames acquired, between 1 and @c n, or 0 if the buffer
+ *          is shutting down.
+ */
+int wait_for_full_frames(struct Buffer* buf, const char* consumer_name, const int first_id,
+                         const int n);
+
+/**
+ * @brief Same as @c wait_for_full_frames() but with the slot returned by @c register_consumer()
+ */
+int wait_for_full_frames_by_slot(struct Buffer* buf, const int consumer_id, const int first_id,
+                                 const int n);
+
 
 /**
  * @brief Wait for a full frame on the given buffer up to timeout.
@@ -365,6 +573,62 @@ uint8_t* wait_for_full_frame(struct Buffer* buf, const char* consumer_name, cons
 int wait_for_full_frame_timeout(struct Buffer* buf, const char* name, const int ID,
                                 const struct timespec timeout);
 
+/**
+ * @brief Same as @c wait_for_full_frame_timeout() but with the slot returned by
+ *        @c register_consumer()
+ */
+int wait_for_full_frame_timeout_by_slot(struct Buffer* buf, const int consumer_id, const int ID,
+                                        const struct timespec timeout);
+
+/**
+ * @brief Initialise a wait set for use with @c wait_for_any_full_frame
+ * @param[out] set The set to initialise.
+ */
+void init_buffer_wait_set(struct bufferWaitSet* set);
+
+/**
+ * @brief Free the lock of a wait set, once it is detached from all its buffers
+ * @param[in] set The set to destroy.
+ */
+void destroy_buffer_wait_set(struct bufferWaitSet* set);
+
+/**
+ * @brief Wake @c set whenever a frame of @c buf is marked full
+ *
+ * A consumer slot can have at most one set attached at a time.
+ *
+ * @param[in] buf The buffer.
+ * @param[in] consumer_id The slot returned by @c register_consumer().
+ * @param[in] set The set to attach, or NULL to detach the current one.
+ */
+void attach_buffer_wait_set(struct Buffer* buf, const int consumer_id, struct bufferWaitSet* set);
+
+/**
+ * @brief Wait for a full frame on any of several buffers.
+ *
+ * Returns as soon as frame @c frame_ids[i] of @c bufs[i] is full for consumer
+ * @c consumer_ids[i], for any @c i.  The consumer slots must have @c set attached.
+ * When several frames are ready the buffers take turns, starting after the one
+ * returned by the last call.  The time spent waiting is counted against the
+ * consumer of the buffer which became ready.
+ *
+ * @param[in] set The wait set attached to all the buffers.
+ * @param[in] bufs The buffers to wait on.
+ * @param[in] consumer_ids The consumer slot on each buffer.
+ * @param[in] frame_ids The frame to wait for on each buffer.
+ * @param[in] n The number of buffers.
+ * @param[in] timeout Give up after this *absolute* time, NULL to wait forever.
+ * @param[out] ready The index of the buffer with a full frame, if there is one.
+ *
+ * @return Return status:
+ *   - `0`: Success! @c bufs[*ready] has a new frame.
+ *   - `1`: Failure! We timed out waiting.
+ *   - `-1`: Failure! One of the buffers received the thread exit signal.
+ */
+int wait_for_any_full_frame(struct bufferWaitSet* set, struct Buffer** bufs,
+                            const int* consumer_ids, const int* frame_ids, const int n,
+                            const struct timespec* timeout, int* ready);
+
 /**
  * @brief Checks if the requested buffer is empty.
  *
@@ -407,6 +671,41 @@ int get_num_producers(struct Buffer* buf);
  */
 double get_last_arrival_time(struct Buffer* buf);
 
+/**
+ * @brief Returns the upper bound of a frame residency histogram bin
+ * @param bin The histogram bin, less than @c BUFFER_LATENCY_BINS
+ * @return The upper bound in seconds, or INFINITY for the last bin
+ */
+double get_latency_bin_upper_bound(const int bin);
+
+/**
+ * @brief Returns the total number of frames which have been marked as full
+ * @param buf The buffer object
+ * @return The number of frames filled since the buffer was created
+ */
+uint64_t get_num_frames_filled(struct Buffer* buf);
+
+/**
+ * @brief Returns the NUMA node the memory of a frame is allocated in
+ * @param buf The buffer object
+ * @param frame_id The frame to check
+ * @return The NUMA node of the frame
+ */
+int get_frame_numa_node(struct Buffer* buf, const int frame_id);
+
+/**
+ * @brief Returns the NUMA node a CPU core belongs to
+ * @param cpu_id The zero based core number
+ * @return The NUMA node, or 0 if kotekan was built without NUMA support
+ */
+int get_cpu_numa_node(const int cpu_id);
+
+/**
+ * @brief Returns the highest NUMA node of the system
+ * @return The node, or -1 if kotekan was built without NUMA support or it isn't available
+ */
+int get_max_numa_node();
+
 /**
  * @brief Prints a picture of the frames which are currently full.
  *
@@ -588,6 +887,42 @@ void copy_metadata(struct Buffer* from_buf, int from_frame_id, struct Buffer* to
 void safe_swap_frame(struct Buffer* src_buf, int src_frame_id, struct Buffer* dest_buf,
                      int dest_frame_id);
 
+/**
+ * @brief Lends a full frame to another buffer without copying it.
+ *
+ * The memory of the source frame is put in place of the destination frame, and the
+ * source frame stays full until the consumer has called @c mark_frame_empty() on it
+ * and the destination frame has been released by all of its consumers, at which point
+ * the destination frame gets its own memory back.  A frame can be shared into any
+ * number of buffers this way, which avoids a copy per output in fan out stages.
+ *
+ * Must be called by a stage which is a consumer of @c src_buf holding the full frame
+ * @c src_frame_id, and the producer of @c dest_buf holding the empty frame
+ * @c dest_frame_id, before it calls @c mark_frame_full() on it.
+ * Does not pass or copy metadata.
+ *
+ * @warning The consumers of @c dest_buf must treat the frame as read only, and
+ *          must not keep pointers to the frame after releasing it.
+ * @warning The destination buffer must use locking mode and must not zero its frames.
+ *
+ * @param[in] src_buf The buffer to lend the frame from
+ * @param[in] src_consumer_id The consumer slot in @c src_buf holding the frame
+ * @param[in] src_frame_id The frame ID to lend
+ * @param[in] dest_buf The buffer to lend the frame to
+ * @param[in] dest_frame_id The frame ID in @c dest_buf to replace
+ */
+void share_frame(struct Buffer* src_buf, const int src_consumer_id, const int src_frame_id,
+                 struct Buffer* dest_buf, const int dest_frame_id);
+
+/**
+ * @brief Checks if a frame is lent to or borrowed from another buffer with @c share_frame()
+ *
+ * @param[in] buf The buffer object
+ * @param[in] frame_id The frame ID to check
+ * @returns 1 if the frame is shared, 0 otherwise
+ */
+int is_frame_shared(struct Buffer* buf, const int frame_id);
+
 /**
  * @brief Tells the buffers to stop returning full/empty frames to consumers/producers
  *
@@ -2,16 +2,18 @@
 
 #include "Config.hpp"         // for Config
 #include "HFBFrameView.hpp"   // for HFBFrameView
-#include "buffer.h"           // for create_buffer
-#include "kotekanLogging.hpp" // for INFO_NON_OO
+#include "buffer.h"           // for create_buffer, get_cpu_numa_node, get_max_numa_node
+#include "kotekanLogging.hpp" // for INFO_NON_OO, WARN_NON_OO
 #include "metadata.h"         // for metadataPool // IWYU pragma: keep
 #include "visBuffer.hpp"      // for VisFrameView
 
 #include "fmt.hpp" // for format, fmt
 
-#include <cstdint>   // for int32_t, uint32_t
+#include <algorithm> // for min
+#include <cstdint>   // for int32_t, uint32_t, uint64_t
 #include <exception> // for exception
 #include <regex>     // for match_results<>::_Base_type
+#include <set>       // for set
 #include <stddef.h>  // for size_t
 #include <stdexcept> // for runtime_error
 #include <vector>    // for vector
@@ -64,6 +66,15 @@ void bufferFactory::build_from_tree(map<string, struct Buffer*>& buffers, const
     }
 }
 
+// Checks a NUMA node exists (if kotekan can tell), and fits in the 64 bit interleave mask
+static void check_numa_node(int node, const string& name) {
+    int max_node = get_max_numa_node() < 0 ? 63 : std::min(get_max_numa_node(), 63);
+    if (node < 0 || node > max_node)
+        throw std::runtime_error(fmt::format(
+            fmt("The NUMA node {:d} of buffer {:s} is not between 0 and {:d}"), node, name,
+            max_node));
+}
+
 struct Buffer* bufferFactory::new_buffer(const string& type_name, const string& name,
                                          const string& location) {
 
@@ -74,6 +85,35 @@ struct Buffer* bufferFactory::new_buffer(const string& type_name, const string&
     bool use_hugepages = config.get_default<bool>(location, "use_hugepages", false);
     bool mlock_frames = config.get_default<bool>(location, "mlock_frames", true);
     bool zero_new_frames = config.get_default<bool>(location, "zero_new_frames", true);
+    bool lock_free = config.get_default<bool>(location, "lock_free", false);
+    string numa_placement = config.get_default<std::string>(location, "numa_placement", "fixed");
+
+    uint64_t numa_interleave_mask = 0;
+    if (numa_placement == "auto" || numa_placement == "interleave") {
+        std::map<int, int> stage_nodes = stage_numa_nodes(name);
+        if (stage_nodes.empty()) {
+            WARN_NON_OO("No stages using buffer {:s} have a cpu_affinity, using numa_node {:d}",
+                        name, numa_node);
+        } else if (numa_placement == "interleave" && stage_nodes.size() > 1) {
+            for (auto& node : stage_nodes) {
+                check_numa_node(node.first, name);
+                numa_interleave_mask |= (uint64_t)1 << node.first;
+            }
+        } else {
+            // The node with the most stages, the lowest one on a tie
+            int max_stages = 0;
+            for (auto& node : stage_nodes) {
+                if (node.second > max_stages) {
+                    max_stages = node.second;
+                    numa_node = node.first;
+                }
+            }
+        }
+    } else if (numa_placement != "fixed") {
+        throw std::runtime_error(fmt::format(
+            fmt("Unknown numa_placement {:s} for buffer {:s}"), numa_placement, name));
+    }
+    check_numa_node(numa_node, name);
 
     struct metadataPool* pool = nullptr;
     if (metadataPool_name != "none") {
@@ -98,15 +138,63 @@ struct Buffer* bufferFactory::new_buffer(const string& type_name, const string&
     }
 
     INFO_NON_OO("Creating {:s}Buffer named {:s} with {:d} frames, frame size of {:d} and "
-                "metadata pool {:s} on numa_node {:d}",
-                type_name, name, num_frames, frame_size, metadataPool_name, numa_node);
-    struct Buffer* buf =
-        create_buffer(num_frames, frame_size, pool, name.c_str(), type_name.c_str(), numa_node,
-                      use_hugepages, mlock_frames, zero_new_frames);
+                "metadata pool {:s} on numa_node {:d} (interleave mask {:#x})",
+                type_name, name, num_frames, frame_size, metadataPool_name, numa_node,
+                numa_interleave_mask);
+    struct Buffer* buf = create_buffer(num_frames, frame_size, pool, name.c_str(),
+                                       type_name.c_str(), numa_node, numa_interleave_mask,
+                                       use_hugepages, mlock_frames, zero_new_frames, lock_free);
     if (buf == nullptr) {
         throw std::runtime_error(fmt::format(fmt("Could not create the buffer: {:s}"), name));
     }
     return buf;
 }
 
+std::map<int, int> bufferFactory::stage_numa_nodes(const string& name) {
+    std::vector<string> stage_paths;
+    find_buffer_stages(name, config.get_full_config_json(), "", stage_paths);
+
+    std::map<int, int> nodes;
+    for (auto& stage_path : stage_paths) {
+        std::vector<int> cpu_affinity =
+            config.get_default<std::vector<int>>(stage_path, "cpu_affinity", {});
+        std::set<int> stage_nodes;
+        for (int cpu : cpu_affinity)
+            stage_nodes.insert(get_cpu_numa_node(cpu));
+        for (int node : stage_nodes)
+            nodes[node]++;
+    }
+    return nodes;
+}
+
+// Checks if a stage config value names the buffer, directly or in a list/object of buffers
+static bool references_buffer(const json& value, const string& name) {
+    if (value.is_string())
+        return value.get<string>() == name;
+    if (value.is_array() || value.is_object()) {
+        for (auto& item : value)
+            if (references_buffer(item, name))
+                return true;
+    }
+    return false;
+}
+
+void bufferFactory::find_buffer_stages(const string& name, const json& config_tree,
+                                       const string& path, std::vector<string>& stage_paths) {
+    for (json::const_iterator it = config_tree.begin(); it != config_tree.end(); ++it) {
+        if (!it.value().is_object()) {
+            continue;
+        }
+
+        string stage_path = fmt::format(fmt("{:s}/{:s}"), path, it.key());
+        if (it.value().contains("kotekan_stage")) {
+            if (references_buffer(it.value(), name))
+                stage_paths.push_back(stage_path);
+            continue;
+        }
+
+        find_buffer_stages(name, it.value(), stage_path, stage_paths);
+    }
+}
+
 } // namespace kotekan
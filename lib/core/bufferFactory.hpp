@@ -9,6 +9,7 @@
 
 #include <map>    // for map
 #include <string> // for string
+#include <vector> // for vector
 
 namespace kotekan {
 
@@ -27,6 +28,12 @@ private:
     struct Buffer* new_buffer(const std::string& type_name, const std::string& name,
                               const std::string& location);
 
+    // Returns the number of stages referencing the buffer pinned to each NUMA node,
+    // based on the `cpu_affinity` of the stages.
+    std::map<int, int> stage_numa_nodes(const std::string& name);
+    void find_buffer_stages(const std::string& name, const nlohmann::json& config_tree,
+                            const std::string& path, std::vector<std::string>& stage_paths);
+
     Config& config;
     std::map<std::string, struct metadataPool*>& metadataPools;
 };
@@ -1,9 +1,11 @@
 #include "kotekanMode.hpp"
 
 #include "Config.hpp"            // for Config
+#include "FileWriteQueue.hpp"    // for FileWriteQueue
 #include "Stage.hpp"             // for Stage
 #include "StageFactory.hpp"      // for StageFactory
 #include "Telescope.hpp"         // for Telescope
+#include "WorkPool.hpp"          // for WorkPool
 #include "buffer.h"              // for Buffer, StageInfo, get_num_full_frames, delete_buffer
 #include "bufferFactory.hpp"     // for bufferFactory
 #include "configUpdater.hpp"     // for configUpdater
@@ -14,13 +16,16 @@
 #include "metadataFactory.hpp"   // for metadataFactory
 #include "prometheusMetrics.hpp" // for Metrics
 #include "restServer.hpp"        // for restServer, connectionInstance
+#include "util.h"                // for e_time
 
 #include "fmt.hpp"  // for format
 #include "json.hpp" // for basic_json<>::object_t, basic_json<>::value_type, json
 
+#include <algorithm>  // for includes, max, min
 #include <exception>  // for exception
 #include <functional> // for _Bind_helper<>::type, _Placeholder, bind, _1, placeholders
 #include <regex>      // for match_results<>::_Base_type
+#include <set>        // for set
 #include <stdexcept>  // for runtime_error
 #include <stdint.h>   // for uint16_t
 #include <stdlib.h>   // for free
@@ -53,6 +58,10 @@ kotekanMode::~kotekanMode() {
     restServer::instance().remove_get_callback("/config");
     restServer::instance().remove_get_callback("/buffers");
     restServer::instance().remove_get_callback("/pipeline_dot");
+    restServer::instance().remove_get_callback("/buffers/numa");
+    restServer::instance().remove_get_callback("/buffers/latency");
+    restServer::instance().remove_get_callback("/critical_path");
+    restServer::instance().remove_get_callback("/critical_path_dot");
     restServer::instance().remove_all_aliases();
 
     KotekanTrackers::instance().set_kotekan_mode_ptr(nullptr);
@@ -64,6 +73,10 @@ kotekanMode::~kotekanMode() {
         }
     }
 
+    // Only once the stages are gone, they may still be waiting on their tasks
+    WorkPool::instance().stop();
+    FileWriteQueue::instance().stop();
+
     for (auto const& buf : buffers) {
         if (buf.second != nullptr) {
             delete_buffer(buf.second);
@@ -96,6 +109,14 @@ void kotekanMode::initalize_stages() {
     KotekanTrackers::instance(config).register_with_server(&restServer::instance());
     KotekanTrackers::instance().set_kotekan_mode_ptr(this);
 
+    // Start the shared work pool, otherwise it starts with the defaults when first used
+    if (config.exists("/", "work_pool"))
+        WorkPool::instance(config);
+
+    // Start the file write queue, otherwise the files are written synchronously
+    if (config.exists("/", "file_write_queue"))
+        FileWriteQueue::instance(config);
+
     // Create Metadata Pool
     metadataFactory metadata_factory(config);
     metadata_pools = metadata_factory.build_pools();
@@ -118,6 +139,18 @@ void kotekanMode::initalize_stages() {
 
     restServer::instance().register_get_callback(
         "/pipeline_dot", std::bind(&kotekanMode::pipeline_dot_graph_callback, this, _1));
+
+    restServer::instance().register_get_callback(
+        "/buffers/numa", std::bind(&kotekanMode::numa_report_callback, this, _1));
+
+    restServer::instance().register_get_callback(
+        "/buffers/latency", std::bind(&kotekanMode::buffer_latency_callback, this, _1));
+
+    restServer::instance().register_get_callback(
+        "/critical_path", std::bind(&kotekanMode::critical_path_callback, this, _1));
+
+    restServer::instance().register_get_callback(
+        "/critical_path_dot", std::bind(&kotekanMode::critical_path_dot_callback, this, _1));
 }
 
 void kotekanMode::join() {
@@ -128,6 +161,7 @@ void kotekanMode::join() {
 }
 
 void kotekanMode::start_stages() {
+    start_time = e_time();
     for (auto const& stage : stages) {
         INFO_NON_OO("Starting kotekan_stage: {:s}...", stage.first);
         stage.second->start();
@@ -215,7 +249,62 @@ void kotekanMode::buffer_data_callback(connectionInstance& conn) {
     conn.send_json_reply(get_buffer_json());
 }
 
-void kotekanMode::pipeline_dot_graph_callback(connectionInstance& conn) {
+// The blocking time stats of a producer or consumer, and the residency stats for consumers
+static nlohmann::json stage_timing_json(const StageInfo& stage, bool consumer) {
+    nlohmann::json timing;
+    uint64_t num_waits = stage.num_waits;
+    uint64_t num_released = stage.num_released;
+
+    timing["num_waits"] = num_waits;
+    timing["wait_time"] = stage.wait_time_ns * 1e-9;
+    timing["mean_wait_time"] = num_waits ? stage.wait_time_ns * 1e-9 / num_waits : 0.0;
+    timing["frames_released"] = num_released;
+
+    if (consumer) {
+        timing["mean_residency_time"] =
+            num_released ? stage.residency_time_ns * 1e-9 / num_released : 0.0;
+
+        // Cumulative counts, in the style of a prometheus histogram
+        uint64_t count = 0;
+        timing["residency_histogram"] = nlohmann::json::array();
+        for (int i = 0; i < BUFFER_LATENCY_BINS; ++i) {
+            count += stage.residency_hist[i];
+            double le = get_latency_bin_upper_bound(i);
+            timing["residency_histogram"].push_back(
+                {{"le", i == BUFFER_LATENCY_BINS - 1 ? "+Inf" : fmt::format("{:g}", le)},
+                 {"count", count}});
+        }
+    }
+    return timing;
+}
+
+void kotekanMode::buffer_latency_callback(connectionInstance& conn) {
+    nlohmann::json reply = {};
+
+    for (auto& buf : buffer_container.get_buffer_map()) {
+        nlohmann::json buf_info = {};
+        buf_info["consumers"] = nlohmann::json::object();
+        buf_info["producers"] = nlohmann::json::object();
+        for (int i = 0; i < MAX_CONSUMERS; ++i) {
+            if (buf.second->consumers[i].in_use)
+                buf_info["consumers"][buf.second->consumers[i].name] =
+                    stage_timing_json(buf.second->consumers[i], true);
+        }
+        for (int i = 0; i < MAX_PRODUCERS; ++i) {
+            if (buf.second->producers[i].in_use)
+                buf_info["producers"][buf.second->producers[i].name] =
+                    stage_timing_json(buf.second->producers[i], false);
+        }
+        reply[buf.first] = buf_info;
+    }
+
+    conn.send_json_reply(reply);
+}
+
+std::string kotekanMode::pipeline_dot_graph(
+    const std::function<std::string(const std::string&, const std::string&)>& stage_node,
+    const std::function<std::string(const std::string&, const std::string&, const std::string&)>&
+        edge_attrs) {
     const std::string prefix = "    ";
     std::string dot =
         "# This is a DOT formatted pipeline graph, use the graphviz package to plot.\n";
@@ -231,27 +320,199 @@ void kotekanMode::pipeline_dot_graph_callback(connectionInstance& conn) {
 
     // Setup stage nodes
     for (auto& stage : stages) {
-        dot += stage.second->dot_string(prefix);
+        dot += stage_node(prefix, stage.first);
     }
 
     // Generate graph edges (producer/consumer relations)
     for (auto& buf : buffer_container.get_buffer_map()) {
         for (int i = 0; i < MAX_CONSUMERS; ++i) {
             if (buf.second->consumers[i].in_use) {
-                dot += fmt::format("{:s}\"{:s}\" -> \"{:s}\";\n", prefix, buf.first,
-                                   buf.second->consumers[i].name);
+                std::string attrs =
+                    edge_attrs(buf.first, "consumer", buf.second->consumers[i].name);
+                dot += fmt::format("{:s}\"{:s}\" -> \"{:s}\"{:s};\n", prefix, buf.first,
+                                   buf.second->consumers[i].name, attrs);
             }
         }
         for (int i = 0; i < MAX_PRODUCERS; ++i) {
             if (buf.second->producers[i].in_use) {
-                dot += fmt::format("{:s}\"{:s}\" -> \"{:s}\";\n", prefix,
-                                   buf.second->producers[i].name, buf.first);
+                std::string attrs =
+                    edge_attrs(buf.first, "producer", buf.second->producers[i].name);
+                dot += fmt::format("{:s}\"{:s}\" -> \"{:s}\"{:s};\n", prefix,
+                                   buf.second->producers[i].name, buf.first, attrs);
             }
         }
     }
 
     dot += "}\n";
-    conn.send_text_reply(dot);
+    return dot;
+}
+
+void kotekanMode::pipeline_dot_graph_callback(connectionInstance& conn) {
+    conn.send_text_reply(pipeline_dot_graph(
+        [&](const std::string& prefix, const std::string& stage) {
+            return stages[stage]->dot_string(prefix);
+        },
+        [](const std::string&, const std::string&, const std::string&) { return ""; }));
+}
+
+void kotekanMode::numa_report_callback(connectionInstance& conn) {
+    nlohmann::json reply;
+    reply["edges"] = nlohmann::json::array();
+
+    double now = e_time();
+    for (auto& buf : buffer_container.get_buffer_map()) {
+        std::set<int> buffer_nodes;
+        for (int i = 0; i < buf.second->num_frames; ++i)
+            buffer_nodes.insert(get_frame_numa_node(buf.second, i));
+
+        // Throughput since the last report
+        uint64_t frames_filled = get_num_frames_filled(buf.second);
+        double bytes_per_second = 0;
+        if (numa_report_samples.count(buf.first) && now > numa_report_samples[buf.first].second) {
+            auto& sample = numa_report_samples[buf.first];
+            bytes_per_second = (double)(frames_filled - sample.first) * buf.second->frame_size
+                               / (now - sample.second);
+        }
+        numa_report_samples[buf.first] = {frames_filled, now};
+
+        auto add_edge = [&](const StageInfo& stage, const std::string& role) {
+            std::vector<int> cpu_affinity =
+                config.get_default<std::vector<int>>(stage.name, "cpu_affinity", {});
+            std::set<int> stage_nodes;
+            for (int cpu : cpu_affinity)
+                stage_nodes.insert(get_cpu_numa_node(cpu));
+
+            if (std::includes(buffer_nodes.begin(), buffer_nodes.end(), stage_nodes.begin(),
+                              stage_nodes.end()))
+                return;
+
+            nlohmann::json edge;
+            edge["buffer"] = buf.first;
+            edge["stage"] = stage.name;
+            edge["role"] = role;
+            edge["buffer_numa_nodes"] = buffer_nodes;
+            edge["stage_numa_nodes"] = stage_nodes;
+            edge["bytes_per_second"] = bytes_per_second;
+            reply["edges"].push_back(edge);
+        };
+
+        for (int i = 0; i < MAX_PRODUCERS; ++i) {
+            if (buf.second->producers[i].in_use)
+                add_edge(buf.second->producers[i], "producer");
+        }
+        for (int i = 0; i < MAX_CONSUMERS; ++i) {
+            if (buf.second->consumers[i].in_use)
+                add_edge(buf.second->consumers[i], "consumer");
+        }
+    }
+
+    conn.send_json_reply(reply);
+}
+
+nlohmann::json kotekanMode::get_critical_path_json(edgeSampleMap& samples) {
+    nlohmann::json reply;
+    reply["edges"] = nlohmann::json::array();
+
+    double now = e_time();
+    std::map<std::string, double> stage_wait;
+    std::set<std::string> stage_has_input;
+
+    auto add_edge = [&](const std::string& buf_name, struct Buffer* buf, const StageInfo& stage,
+                        const std::string& role) {
+        uint64_t wait_time_ns = __atomic_load_n(&stage.wait_time_ns, __ATOMIC_RELAXED);
+        uint64_t num_released = __atomic_load_n(&stage.num_released, __ATOMIC_RELAXED);
+
+        auto key = std::make_tuple(buf_name, role, std::string(stage.name));
+        edgeSample last = {0, 0, start_time};
+        if (samples.count(key))
+            last = samples[key];
+        samples[key] = {wait_time_ns, num_released, now};
+
+        double elapsed = now - last.time;
+        double slack = 0;
+        double frame_rate = 0;
+        if (elapsed > 0) {
+            slack = (wait_time_ns - last.wait_time_ns) * 1e-9 / elapsed;
+            slack = std::min(std::max(slack, 0.0), 1.0);
+            frame_rate = (num_released - last.num_released) / elapsed;
+        }
+        stage_wait[stage.name] += slack;
+        if (role == "consumer")
+            stage_has_input.insert(stage.name);
+
+        nlohmann::json edge;
+        edge["buffer"] = buf_name;
+        edge["stage"] = stage.name;
+        edge["role"] = role;
+        edge["slack"] = slack;
+        edge["frames_per_second"] = frame_rate;
+        edge["bytes_per_second"] = frame_rate * buf->frame_size;
+        edge["buffer_fill"] = (double)get_num_full_frames(buf) / buf->num_frames;
+        reply["edges"].push_back(edge);
+    };
+
+    for (auto& buf : buffer_container.get_buffer_map()) {
+        for (int i = 0; i < MAX_PRODUCERS; ++i) {
+            if (buf.second->producers[i].in_use)
+                add_edge(buf.first, buf.second, buf.second->producers[i], "producer");
+        }
+        for (int i = 0; i < MAX_CONSUMERS; ++i) {
+            if (buf.second->consumers[i].in_use)
+                add_edge(buf.first, buf.second, buf.second->consumers[i], "consumer");
+        }
+    }
+
+    // A stage which spends the least time blocked on its buffers is the one limiting
+    // the pipeline, everything upstream waits for it to empty frames and everything
+    // downstream waits for it to fill them. Sources are never picked: they block on
+    // things other than buffers (network, GPU), so they would always look busy.
+    reply["stages"] = nlohmann::json::object();
+    reply["limiting_stage"] = nullptr;
+    double max_busy = -1;
+    for (auto& stage : stage_wait) {
+        double busy = std::max(1.0 - stage.second, 0.0);
+        bool source = !stage_has_input.count(stage.first);
+        reply["stages"][stage.first]["busy"] = busy;
+        reply["stages"][stage.first]["source"] = source;
+        if (!source && busy > max_busy) {
+            max_busy = busy;
+            reply["limiting_stage"] = stage.first;
+        }
+    }
+
+    return reply;
+}
+
+void kotekanMode::critical_path_callback(connectionInstance& conn) {
+    conn.send_json_reply(get_critical_path_json(critical_path_samples));
+}
+
+void kotekanMode::critical_path_dot_callback(connectionInstance& conn) {
+    nlohmann::json critical_path = get_critical_path_json(critical_path_dot_samples);
+
+    std::map<std::tuple<std::string, std::string, std::string>, std::string> edge_labels;
+    for (auto& edge : critical_path["edges"]) {
+        auto key = std::make_tuple(edge["buffer"].get<std::string>(),
+                                   edge["role"].get<std::string>(),
+                                   edge["stage"].get<std::string>());
+        edge_labels[key] = fmt::format(" [label=\"slack {:.1f}%\\n{:.1f} frames/s\"]",
+                                       edge["slack"].get<double>() * 100,
+                                       edge["frames_per_second"].get<double>());
+    }
+
+    conn.send_text_reply(pipeline_dot_graph(
+        [&](const std::string& prefix, const std::string& stage) {
+            if (!critical_path["stages"].contains(stage))
+                return stages[stage]->dot_string(prefix);
+            bool limiting = (critical_path["limiting_stage"] == stage);
+            return fmt::format(
+                "{:s}\"{:s}\" [label=<{:s}<BR/>busy {:.1f}%> shape=box, color={:s}];\n", prefix,
+                stage, stage, critical_path["stages"][stage]["busy"].get<double>() * 100,
+                limiting ? "red" : "darkgreen");
+        },
+        [&](const std::string& buf_name, const std::string& role, const std::string& stage) {
+            return edge_labels[std::make_tuple(buf_name, role, stage)];
+        }));
 }
 
 } // namespace kotekan
@@ -12,8 +12,12 @@
 
 #include "json.hpp" // for json
 
-#include <map>    // for map
-#include <string> // for string
+#include <functional> // for function
+#include <map>        // for map
+#include <stdint.h>   // for uint64_t
+#include <string>     // for string
+#include <tuple>      // for tuple
+#include <utility>    // for pair
 
 
 // doxygen wants the namespace to be documented somewhere
@@ -57,7 +61,72 @@ public:
     // HTTP callback that dumps the current pipeline graph in `dot` format.
     void pipeline_dot_graph_callback(connectionInstance& conn);
 
+    /**
+     * @brief HTTP callback with the blocking and frame residency times of every stage
+     *
+     * For each buffer lists the time its producers and consumers have spent blocked
+     * in @c wait_for_* and, for consumers, the frame residency time and histogram.
+     */
+    void buffer_latency_callback(connectionInstance& conn);
+
+    /**
+     * @brief HTTP callback listing the producer/consumer edges which cross NUMA nodes
+     *
+     * An edge crosses NUMA nodes when the stage's @c cpu_affinity includes cores
+     * outside the NUMA nodes the buffer frames are allocated in.  The data rate
+     * of each edge is the buffer throughput since the previous request.
+     */
+    void numa_report_callback(connectionInstance& conn);
+
+    // HTTP callback with the result of get_critical_path_json()
+    void critical_path_callback(connectionInstance& conn);
+
+    // HTTP callback with the pipeline `dot` graph annotated with the critical path
+    void critical_path_dot_callback(connectionInstance& conn);
+
 private:
+    /// The blocking time, released frames and time of the last critical path sample of an edge
+    struct edgeSample {
+        uint64_t wait_time_ns;
+        uint64_t num_released;
+        double time;
+    };
+
+    /// The last critical path sample of each edge, indexed by buffer, role and stage name
+    using edgeSampleMap = std::map<std::tuple<std::string, std::string, std::string>, edgeSample>;
+
+    /**
+     * @brief Builds the pipeline graph in `dot` format
+     *
+     * @param stage_node  Returns the node of a stage, given the line prefix and the stage name
+     * @param edge_attrs  Returns the attributes of an edge (or an empty string), given the
+     *                    buffer name, role and stage name
+     *
+     * @return The graph with the buffer and stage nodes and the producer/consumer edges
+     */
+    std::string pipeline_dot_graph(
+        const std::function<std::string(const std::string&, const std::string&)>& stage_node,
+        const std::function<std::string(const std::string&, const std::string&,
+                                        const std::string&)>& edge_attrs);
+
+    /**
+     * @brief Finds the throughput limiting stage and the slack on every pipeline edge
+     *
+     * Uses the blocking times recorded by the buffers since the previous call with
+     * the same @p samples, so each endpoint keeps its own sampling window.
+     * The slack of an edge is the fraction of the time the stage spent blocked
+     * waiting on that buffer, and a stage is busy for the rest of the time.
+     * The stage with the highest busy fraction is the one limiting the throughput.
+     * Stages with no input buffers (sources) are flagged with @c source and never
+     * picked, as they block outside the buffers (network, GPU) and always look busy.
+     *
+     * @param samples  The last sample of each edge, updated with the new ones
+     *
+     * @return JSON with the @c stages (busy fraction), the @c edges (slack, frame rate
+     *         and buffer fill fraction) and the name of the @c limiting_stage
+     */
+    nlohmann::json get_critical_path_json(edgeSampleMap& samples);
+
     Config& config;
     bufferContainer buffer_container;
 #if !defined(MAC_OSX)
@@ -67,6 +136,16 @@ private:
     std::map<std::string, Stage*> stages;
     std::map<std::string, struct metadataPool*> metadata_pools;
     std::map<std::string, struct Buffer*> buffers;
+
+    /// The frame count and time of the last NUMA report for each buffer
+    std::map<std::string, std::pair<uint64_t, double>> numa_report_samples;
+
+    /// The critical path samples of the JSON and the `dot` endpoints
+    edgeSampleMap critical_path_samples;
+    edgeSampleMap critical_path_dot_samples;
+
+    /// The time the stages were started, the first critical path sample is relative to this
+    double start_time = 0;
 };
 
 } // namespace kotekan
@@ -1,45 +1,50 @@
 #include "metadata.h"
 
-#include "errors.h" // for CHECK_ERROR_F, CHECK_MEM_F
-
-#include <assert.h> // for assert
-#include <stdlib.h> // for malloc, free
-#include <string.h> // for memset
+#include "errors.h" // for CHECK_ERROR_F, CHECK_MEM_F, ERROR_F, WARN_F
+
+// IWYU pragma: no_include <asm/mman-common.h>
+// IWYU pragma: no_include <asm/mman.h>
+#include <assert.h>   // for assert
+#include <errno.h>    // for errno
+#include <stdlib.h>   // for free, malloc, posix_memalign, exit
+#include <string.h>   // for memset, strdup, strerror
+#include <sys/mman.h> // for mmap, munmap, MAP_FAILED
+#ifndef MAC_OSX
+#include <linux/mman.h> // for MAP_HUGE_2MB
+#endif
+
+// The size of the huge pages the slab is mapped on, a power of two.
+#define METADATA_HUGE_PAGE_SIZE 2097152
+
+// Marks the end of the free list.
+#define METADATA_FREE_LIST_END UINT32_MAX
+
+// Round `size` up to a multiple of `align`, which must be a power of two.
+static size_t private_align_up(size_t size, size_t align) {
+    return (size + align - 1) & ~(align - 1);
+}
 
 // *** Metadata object section ***
 
-struct metadataContainer* create_metadata(size_t object_size, struct metadataPool* parent_pool) {
-
-    struct metadataContainer* metadata_container;
-    metadata_container = malloc(sizeof(struct metadataContainer));
-    CHECK_MEM_F(metadata_container);
-
-    metadata_container->metadata = malloc(object_size);
-    CHECK_MEM_F(metadata_container->metadata);
-    metadata_container->metadata_size = object_size;
+// Set up a container in the slab, with its metadata straight after it.
+static void private_init_container(struct metadataContainer* container, size_t object_size,
+                                   struct metadataPool* parent_pool) {
 
-    metadata_container->ref_count = 0;
-    metadata_container->parent_pool = parent_pool;
+    size_t header_size = private_align_up(sizeof(struct metadataContainer), METADATA_CACHE_LINE);
+    container->metadata = (uint8_t*)container + header_size;
+    container->metadata_size = object_size;
 
-    reset_metadata_object(metadata_container);
+    container->ref_count = 0;
+    container->parent_pool = parent_pool;
+    container->next_free = METADATA_FREE_LIST_END;
 
-    CHECK_ERROR_F(pthread_mutex_init(&metadata_container->metadata_lock, NULL));
+    reset_metadata_object(container);
 
-    return metadata_container;
-}
-
-void delete_metadata(struct metadataContainer* container) {
-    // We might shutdown the system without actually flushing all the buffer
-    // chains, so we don't need to assert that the ref_count be 0,
-    // at least for now...
-    // assert(container->ref_count == 0);
-    free(container->metadata);
-    CHECK_ERROR_F(pthread_mutex_destroy(&container->metadata_lock));
-    free(container);
+    CHECK_ERROR_F(pthread_mutex_init(&container->metadata_lock, NULL));
 }
 
 void reset_metadata_object(struct metadataContainer* container) {
-    assert(container->ref_count == 0);
+    assert(__atomic_load_n(&container->ref_count, __ATOMIC_RELAXED) == 0);
     memset(container->metadata, 0, container->metadata_size);
 }
 
@@ -52,39 +57,57 @@ void unlock_metadata(struct metadataContainer* container) {
 }
 
 void increment_metadata_ref_count(struct metadataContainer* container) {
-    lock_metadata(container);
-    container->ref_count += 1;
-    unlock_metadata(container);
+    // The caller already holds a reference, so this can't race with the return to the pool
+    __atomic_add_fetch(&container->ref_count, 1, __ATOMIC_RELAXED);
 }
 
 void decrement_metadata_ref_count(struct metadataContainer* container) {
-    uint32_t local_ref_count;
-
-    lock_metadata(container);
+    // Release our writes to the metadata, and acquire everyone else's before the reset
+    uint32_t old_ref_count = __atomic_fetch_sub(&container->ref_count, 1, __ATOMIC_ACQ_REL);
+    assert(old_ref_count > 0);
 
-    assert(container->ref_count > 0);
-
-    container->ref_count -= 1;
-    local_ref_count = container->ref_count;
-
-    unlock_metadata(container);
-
-    if (local_ref_count == 0) {
+    if (old_ref_count == 1) {
         return_metadata_to_pool(container->parent_pool, container);
     }
 }
 
 // *** Metadata pool section ***
 
+// Allocate the slab, on huge pages if requested and there are some available.
+static void private_alloc_slab(struct metadataPool* pool, bool use_hugepages) {
+    pool->use_hugepages = false;
+
+#ifndef MAC_OSX
+    if (use_hugepages) {
+        size_t len = private_align_up(pool->slab_size, METADATA_HUGE_PAGE_SIZE);
+        void* mapped = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB, -1, 0);
+        if (mapped != MAP_FAILED) {
+            pool->slab = (uint8_t*)mapped;
+            pool->slab_size = len;
+            pool->use_hugepages = true;
+            return;
+        }
+        WARN_F("Couldn't map huge pages for the metadata pool `%s`, using normal pages: %s (%d)",
+               pool->unique_name, strerror(errno), errno);
+    }
+#else
+    (void)use_hugepages;
+#endif
+
+    CHECK_ERROR_F(posix_memalign((void**)&pool->slab, METADATA_CACHE_LINE, pool->slab_size));
+    CHECK_MEM_F(pool->slab);
+}
+
 struct metadataPool* create_metadata_pool(int num_metadata_objects, size_t object_size,
-                                          const char* unique_name, const char* type_name) {
+                                          const char* unique_name, const char* type_name,
+                                          bool use_hugepages) {
     struct metadataPool* pool;
     pool = malloc(sizeof(struct metadataPool));
     CHECK_MEM_F(pool);
 
     pool->pool_size = num_metadata_objects;
     pool->metadata_object_size = object_size;
-    CHECK_ERROR_F(pthread_mutex_init(&pool->pool_lock, NULL));
 
     pool->unique_name = strdup(unique_name);
     CHECK_MEM_F(pool->unique_name);
@@ -92,48 +115,65 @@ struct metadataPool* create_metadata_pool(int num_metadata_objects, size_t objec
     pool->type_name = strdup(type_name);
     CHECK_MEM_F(pool->type_name);
 
-    pool->in_use = malloc(pool->pool_size * sizeof(int));
-    CHECK_MEM_F(pool->in_use);
-    pool->metadata_objects = malloc(pool->pool_size * sizeof(struct metadataContainer*));
-    CHECK_MEM_F(pool->metadata_objects);
+    // Each slot is a container followed by its metadata, both cache line aligned
+    pool->slot_size = private_align_up(sizeof(struct metadataContainer), METADATA_CACHE_LINE)
+                      + private_align_up(object_size, METADATA_CACHE_LINE);
+    pool->slab_size = pool->slot_size * pool->pool_size;
+    private_alloc_slab(pool, use_hugepages);
 
+    // Chain all the containers into the free list, lowest index first
     for (unsigned int i = 0; i < pool->pool_size; ++i) {
-        pool->metadata_objects[i] = create_metadata(object_size, pool);
-        pool->in_use[i] = 0;
+        struct metadataContainer* container = get_pool_metadata_container(pool, i);
+        private_init_container(container, object_size, pool);
+        container->next_free = (i + 1 < pool->pool_size) ? i + 1 : METADATA_FREE_LIST_END;
     }
+    pool->free_head = (pool->pool_size > 0) ? 0 : METADATA_FREE_LIST_END;
 
     return pool;
 }
 
 void delete_metadata_pool(struct metadataPool* pool) {
+    // We might shutdown the system without actually flushing all the buffer
+    // chains, so we don't need to assert that the containers are all free.
     for (unsigned int i = 0; i < pool->pool_size; ++i) {
-        delete_metadata(pool->metadata_objects[i]);
+        struct metadataContainer* container = get_pool_metadata_container(pool, i);
+        CHECK_ERROR_F(pthread_mutex_destroy(&container->metadata_lock));
     }
 
-    CHECK_ERROR_F(pthread_mutex_destroy(&pool->pool_lock));
+    if (pool->use_hugepages) {
+        munmap(pool->slab, pool->slab_size);
+    } else {
+        free(pool->slab);
+    }
     free(pool->unique_name);
     free(pool->type_name);
-    free(pool->in_use);
-    free(pool->metadata_objects);
+}
+
+struct metadataContainer* get_pool_metadata_container(struct metadataPool* pool,
+                                                      uint32_t index) {
+    assert(index < pool->pool_size);
+    return (struct metadataContainer*)(pool->slab + (size_t)index * pool->slot_size);
 }
 
 struct metadataContainer* request_metadata_object(struct metadataPool* pool) {
     struct metadataContainer* container = NULL;
 
-    CHECK_ERROR_F(pthread_mutex_lock(&pool->pool_lock));
-
-    // TODO there are better data structures for this.
-    for (unsigned int i = 0; i < pool->pool_size; ++i) {
-        if (pool->in_use[i] == 0) {
-            // DEBUG_F("pool->metadata_objects[%d] == %p", i, pool->metadata_objects[i]);
-            container = pool->metadata_objects[i];
-            assert(container->ref_count == 0); // Shouldn't give an inuse object (!)
-            container->ref_count = 1;
-            pool->in_use[i] = 1;
+    // Pop the top of the free list.  The update count in the high bits makes the CAS
+    // fail if the top was popped and pushed back while we were reading its next pointer.
+    uint64_t head = __atomic_load_n(&pool->free_head, __ATOMIC_ACQUIRE);
+    for (;;) {
+        uint32_t index = (uint32_t)head;
+        if (index == METADATA_FREE_LIST_END) {
+            container = NULL;
             break;
         }
+        container = get_pool_metadata_container(pool, index);
+        uint32_t next = __atomic_load_n(&container->next_free, __ATOMIC_RELAXED);
+        uint64_t new_head = ((head >> 32) + 1) << 32 | next;
+        if (__atomic_compare_exchange_n(&pool->free_head, &head, new_head, true,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+            break;
     }
-    CHECK_ERROR_F(pthread_mutex_unlock(&pool->pool_lock));
 
     if (container == NULL) {
         ERROR_F("The metadata pool `%s` is out of metadata objects, try increasing "
@@ -143,24 +183,29 @@ struct metadataContainer* request_metadata_object(struct metadataPool* pool) {
         exit(-1);
     }
 
+    // Shouldn't give an inuse object (!)
+    assert(__atomic_load_n(&container->ref_count, __ATOMIC_RELAXED) == 0);
+    __atomic_store_n(&container->ref_count, 1, __ATOMIC_RELAXED);
+
     return container;
 }
 
 void return_metadata_to_pool(struct metadataPool* pool, struct metadataContainer* info) {
 
-    CHECK_ERROR_F(pthread_mutex_lock(&pool->pool_lock));
+    // We should be returning a container from this pool (!)
+    assert((uint8_t*)info >= pool->slab
+           && (uint8_t*)info < pool->slab + pool->slot_size * pool->pool_size);
+    assert(__atomic_load_n(&info->ref_count, __ATOMIC_RELAXED) == 0);
 
-    // DEBUG_F("Called return_metadata_to_pool");
-    for (unsigned int i = 0; i < pool->pool_size; ++i) {
-        // Pointer check
-        if (pool->metadata_objects[i] == info) {
-            assert(pool->in_use[i] == 1); // Should be in-use if we are returning it!
+    uint32_t index = ((uint8_t*)info - pool->slab) / pool->slot_size;
 
-            reset_metadata_object(pool->metadata_objects[i]);
-            pool->in_use[i] = 0;
-            CHECK_ERROR_F(pthread_mutex_unlock(&pool->pool_lock));
-            return;
-        }
-    }
-    assert(0 == 1); // We should have found the info object in the pool (!)
+    reset_metadata_object(info);
+
+    // Push it onto the free list, releasing the reset above to the next user
+    uint64_t head = __atomic_load_n(&pool->free_head, __ATOMIC_RELAXED);
+    do {
+        __atomic_store_n(&info->next_free, (uint32_t)head, __ATOMIC_RELAXED);
+    } while (!__atomic_compare_exchange_n(&pool->free_head, &head,
+                                          ((head >> 32) + 1) << 32 | index, true,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
 }
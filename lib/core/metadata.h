@@ -4,8 +4,6 @@
  * Most of these functions are used by buffer.c internally and not
  * intended for use outside of the buffer content.
  * - metadataContainer
- * -- create_metadata
- * -- delete_metadata
  * -- reset_metadata_object
  * -- increment_metadata_ref_count
  * -- decrement_metadata_ref_count
@@ -22,9 +20,13 @@
 #define METADATA_H
 
 #include <pthread.h> // for pthread_mutex_t
-#include <stdint.h>  // for uint32_t
+#include <stdbool.h> // for bool
+#include <stdint.h>  // for uint32_t, uint64_t, uint8_t
 #include <stdio.h>   // for size_t
 
+/// The containers and their metadata are aligned to this many bytes
+#define METADATA_CACHE_LINE 64
+
 struct metadataPool;
 
 #ifdef __cplusplus
@@ -41,7 +43,8 @@ extern "C" {
  * as well as the pointer to the actual metadata memory and it's expected size.
  *
  * This container always belongs to a pool of metadata containers,
- * see @c metadataPool for more informaiton
+ * see @c metadataPool for more informaiton.  It lives in the pool's slab,
+ * directly followed by its metadata.
  *
  * @author Andre Renard
  */
@@ -56,40 +59,22 @@ struct metadataContainer {
      * @brief Pointer reference count.
      * Tracks references to this object,
      * and returns the object to the associated @c metadataPool, once
-     * the counter reaches zero.
+     * the counter reaches zero.  Only changed with atomic operations.
      */
     uint32_t ref_count;
 
     /**
-     * @brief Lock for variables in this object.
-     * Can also be used to lock access to metadata values.
+     * @brief Lock for the metadata values.
+     * Not needed for the reference count.
      */
     pthread_mutex_t metadata_lock;
 
     /// Reference to metadataPool that this object belongs too.
     struct metadataPool* parent_pool;
-};
-
-/**
- * @brief Creates a metadata container with a metadata memory block of the requested size.
- *
- * This function is normally just used by the @c create_metadata_pool to create
- * the container for a given metadata type
- *
- * Note there isn't an explicit type here, just the size of the struct used
- * to contain whatever type of metadata the user wants.
- *
- * @param[in] object_size The size of the metadata struct to be stored in this container
- * @param[in] parent_pool The pool this container will belong too.
- * @return A @c metadataContainer object with the @c metadata memory allocated
- */
-struct metadataContainer* create_metadata(size_t object_size, struct metadataPool* parent_pool);
 
-/**
- * @brief Frees the memory associated with a metadataContainer
- * @param[in] container The @c metadataContainer to free
- */
-void delete_metadata(struct metadataContainer* container);
+    /// The index of the next container in the pool's free list, while this one is free.
+    uint32_t next_free;
+};
 
 /**
  * @brief Zeros the metadata memory region.
@@ -115,7 +100,7 @@ void decrement_metadata_ref_count(struct metadataContainer* container);
 /**
  * @brief Request the lock on the metadata container
  *
- * Used for example when changing the reference counter
+ * Used for example when changing metadata values shared between stages
  *
  * @param[in] container The container to request the lock for
  */
@@ -142,27 +127,39 @@ void unlock_metadata(struct metadataContainer* container);
  * When the a metadata container's reference counter reaches zero, it returns
  * itself back to its associated pool
  *
+ * All the containers are allocated in one slab (optionally backed by huge pages).
+ * Each slot holds a container followed by its metadata, both starting on a cache
+ * line, so neighbouring containers never share a cache line.  The free containers
+ * are kept in a lock free stack, so requesting and returning them never blocks.
+ *
  * @author Andre Renard
  */
 struct metadataPool {
-    /// The array of pointer to the metadata container objects.
-    struct metadataContainer** metadata_objects;
+    /// The memory holding all the containers and their metadata.
+    uint8_t* slab;
+
+    /// The size of the @c slab in bytes.
+    size_t slab_size;
+
+    /// The size of one container and its metadata in the @c slab.
+    size_t slot_size;
+
+    /// True if the @c slab is mapped on huge pages.
+    bool use_hugepages;
 
     /**
-     * @brief An array to indicate the use state of each pointer in the @c metadata_objects array
-     * A value of 1 indicates the pointer is in use and should have a reference count > 0
+     * @brief The top of the free list.
+     * The low 32 bits are the index of the first free container (UINT32_MAX if
+     * there are none), the high 32 bits count the updates to avoid the ABA problem.
      */
-    int* in_use;
+    uint64_t free_head;
 
-    /// The size of the @c metadataContainer array.
+    /// The number of containers in the pool.
     unsigned int pool_size;
 
     /// The size of the object stored by the metadata containers
     size_t metadata_object_size;
 
-    /// Locks requests for metadata to avoid race conditions.
-    pthread_mutex_t pool_lock;
-
     /// Name of the metadata pool
     char* unique_name;
 
@@ -176,10 +173,13 @@ struct metadataPool {
  * @param[in] object_size The size of the actual metadata contained in each container.
  * @param[in] unique_name The name of the pool generated from the config path.
  * @param[in] type_name The data type name of the pool.
+ * @param[in] use_hugepages Try to put the containers on huge pages, falls back
+ *                          to normal pages if there aren't any available.
  * @return A metadata pool which can then be associated to one or more buffers.
  */
 struct metadataPool* create_metadata_pool(int num_metadata_objects, size_t object_size,
-                                          const char* unique_name, const char* type_name);
+                                          const char* unique_name, const char* type_name,
+                                          bool use_hugepages);
 
 /**
  * @brief Deletes a memdata pool and frees all memory associated with its containers.
@@ -193,10 +193,18 @@ void delete_metadata_pool(struct metadataPool* pool);
  * @brief Returns a metadata container with a reference count of 1.
  * @param[in] pool The pool to get the metadata object from.
  * @return A metadata container, or NULL if no containers are available.
- * @todo For now this asserts when unable to return a container, that should be fixed.
+ * @todo For now this exits when unable to return a container, that should be fixed.
  */
 struct metadataContainer* request_metadata_object(struct metadataPool* pool);
 
+/**
+ * @brief Get a container of the pool by its index
+ * @param[in] pool The pool.
+ * @param[in] index The index of the container, less than @c pool_size.
+ * @return The container.
+ */
+struct metadataContainer* get_pool_metadata_container(struct metadataPool* pool, uint32_t index);
+
 /**
  * @brief Returns a metadata container with a reference count of zero to its pool
  * @param[in] pool The pool to return the container too.
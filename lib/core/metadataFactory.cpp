@@ -73,36 +73,38 @@ struct metadataPool* metadataFactory::new_pool(const std::string& pool_type,
                 location);
 
     uint32_t num_metadata_objects = config.get<uint32_t>(location, "num_metadata_objects");
+    // Put the containers on huge pages, if there are any left over after the buffers
+    bool use_hugepages = config.get_default<bool>(location, "use_hugepages", false);
 
     if (pool_type == "oneHotMetadata") {
         INFO_NON_OO("OneHotMetadata size: {:d}", sizeof(struct oneHotMetadata));
         return create_metadata_pool(num_metadata_objects, sizeof(struct oneHotMetadata),
-                                    location.c_str(), pool_type.c_str());
+                                    location.c_str(), pool_type.c_str(), use_hugepages);
     }
 
     if (pool_type == "chimeMetadata") {
         return create_metadata_pool(num_metadata_objects, sizeof(struct chimeMetadata),
-                                    location.c_str(), pool_type.c_str());
+                                    location.c_str(), pool_type.c_str(), use_hugepages);
     }
 
     if (pool_type == "VisMetadata") {
         return create_metadata_pool(num_metadata_objects, sizeof(struct VisMetadata),
-                                    location.c_str(), pool_type.c_str());
+                                    location.c_str(), pool_type.c_str(), use_hugepages);
     }
 
     if (pool_type == "HFBMetadata") {
         return create_metadata_pool(num_metadata_objects, sizeof(struct HFBMetadata),
-                                    location.c_str(), pool_type.c_str());
+                                    location.c_str(), pool_type.c_str(), use_hugepages);
     }
 
     if (pool_type == "BeamMetadata") {
         return create_metadata_pool(num_metadata_objects, sizeof(struct BeamMetadata),
-                                    location.c_str(), pool_type.c_str());
+                                    location.c_str(), pool_type.c_str(), use_hugepages);
     }
 
     if (pool_type == "BasebandMetadata") {
         return create_metadata_pool(num_metadata_objects, sizeof(struct BasebandMetadata),
-                                    location.c_str(), pool_type.c_str());
+                                    location.c_str(), pool_type.c_str(), use_hugepages);
     }
     // No metadata found
     throw std::runtime_error(fmt::format(fmt("No metadata object named: {:s}"), pool_type));
@@ -1,14 +1,16 @@
 #include "BaseWriter.hpp"
 
+#include "BufferHandle.hpp"      // for BufferConsumer, BufferProducer
 #include "Config.hpp"            // for Config
 #include "FrameView.hpp"         // for FrameView
 #include "Hash.hpp"              // for operator<
-#include "buffer.h"              // for mark_frame_empty, register_consumer, wait_for_full_frame
+#include "buffer.h"              // for Buffer, create_buffer, delete_buffer
 #include "bufferContainer.hpp"   // for bufferContainer
 #include "datasetManager.hpp"    // for dset_id_t, fingerprint_t, datasetManager
 #include "datasetState.hpp"      // for metadataState, _factory_aliasdatasetState
 #include "factory.hpp"           // for FACTORY
 #include "kotekanLogging.hpp"    // for INFO, WARN, FATAL_ERROR, DEBUG, logLevel
+#include "metadata.h"            // for create_metadata_pool, delete_metadata_pool, metadataPool
 #include "prometheusMetrics.hpp" // for Counter, Metrics, MetricFamily, Gauge
 #include "restServer.hpp"        // for HTTP_RESPONSE, connectionInstance, restServer
 #include "version.h"             // for get_git_commit_hash
@@ -21,13 +23,18 @@
 #include <deque>      // for deque
 #include <exception>  // for exception
 #include <functional> // for _Bind_helper<>::type, bind, function
+#include <mutex>      // for lock_guard
 #include <regex>      // for match_results<>::_Base_type
-#include <stdexcept>  // for runtime_error, out_of_range
+#include <stdexcept>  // for runtime_error, out_of_range, invalid_argument
+#include <stdlib.h>   // for free
+#include <thread>     // for thread
 #include <time.h>     // for timespec
 #include <utility>    // for pair
 #include <vector>     // for vector
 
 
+using kotekan::BufferConsumer;
+using kotekan::BufferProducer;
 using kotekan::bufferContainer;
 using kotekan::Config;
 using kotekan::Stage;
@@ -52,10 +59,14 @@ BaseWriter::BaseWriter(Config& config, const std::string& unique_name,
     root_path = config.get_default<std::string>(unique_name, "root_path", ".");
     acq_timeout = config.get_default<double>(unique_name, "acq_timeout", 300);
     ignore_version = config.get_default<bool>(unique_name, "ignore_version", false);
+    acq_threads = config.get_default<bool>(unique_name, "acq_threads", false);
+    acq_queue_length = config.get_default<uint32_t>(unique_name, "acq_queue_length", 4);
+    if (acq_queue_length == 0)
+        throw std::invalid_argument("BaseWriter: acq_queue_length has to be at least 1.");
 
     // Get the list of buffers that this stage should connect to
     in_buf = get_buffer("in_buf");
-    register_consumer(in_buf, unique_name.c_str());
+    in_consumer = BufferConsumer(in_buf, unique_name);
 
     // Get the type of the file we are writing
     // TODO: we may want to validate here rather than at creation time
@@ -101,13 +112,13 @@ void BaseWriter::main_thread() {
     while (!stop_thread) {
 
         // Wait for the buffer to be filled with data
-        auto status = wait_for_full_frame_timeout(in_buf, unique_name.c_str(), frame_id, timeout);
+        auto status = in_consumer.wait_for_full_frame_timeout(frame_id, timeout);
         if (status == 0) {
-            // Write frame
+            // Write frame, or queue it for the acquisition thread
             write_data(in_buf, frame_id);
 
             // Mark the buffer and move on
-            mark_frame_empty(in_buf, unique_name.c_str(), frame_id++);
+            in_consumer.mark_frame_empty(frame_id++);
         } else if (status == -1) {
             break;
         }
@@ -115,6 +126,12 @@ void BaseWriter::main_thread() {
         // Clean out any acquisitions that have been inactive long
         close_old_acqs();
     }
+
+    // Write out the queued frames while the derived class can still make views of them
+    for (auto& acq : acqs)
+        acq.second->writer.reset();
+    for (auto& acq : acqs_fingerprint)
+        acq.second->writer.reset();
 }
 
 void BaseWriter::init_acq(dset_id_t ds_id) {
@@ -156,11 +173,17 @@ void BaseWriter::init_acq(dset_id_t ds_id) {
             kotekan::logLevel(_member_log_level), ds_id, file_length);
     } catch (std::exception& e) {
         FATAL_ERROR("Failed creating file bundle for new acquisition: {:s}", e.what());
+        return;
+    }
+
+    if (acq_threads) {
+        std::string name = fmt::format("{:s}/acq_{:d}", unique_name, num_acqs++);
+        acq.writer = std::make_unique<acqWriter>(*this, acq, name, acq_queue_length);
     }
 }
 
-void BaseWriter::write_frame(const FrameView& frame, dset_id_t dataset_id, uint32_t freq_id,
-                             time_ctype time) {
+void BaseWriter::write_frame(const FrameView& frame, int frame_id, dset_id_t dataset_id,
+                             uint32_t freq_id, time_ctype time) {
 
     // Check the dataset ID hasn't changed
     if (acqs.count(dataset_id) == 0) {
@@ -196,26 +219,91 @@ void BaseWriter::write_frame(const FrameView& frame, dset_id_t dataset_id, uint3
         // Get frequency of the frame
         uint32_t freq_ind = acq.freq_id_map.at(freq_id);
 
-        // Add all the new information to the file.
-        bool late;
-        double start = current_time();
+        if (acq.writer) {
+            acq.writer->submit(frame_id, time, freq_id, freq_ind);
+        } else {
+            write_sample(acq, frame, freq_id, freq_ind, time);
+        }
+        acq.last_update = current_time();
+    }
+}
 
-        // Write data
-        late = acq.file_bundle->add_sample(time, freq_ind, frame);
+void BaseWriter::write_sample(acqState& acq, const FrameView& frame, uint32_t freq_id,
+                              uint32_t freq_ind, time_ctype time) {
 
-        acq.last_update = current_time();
-        double elapsed = acq.last_update - start;
+    // Add all the new information to the file.
+    bool late;
+    double start = current_time();
 
-        DEBUG("Written frequency {:d} in {:.5f} s", freq_id, elapsed);
+    // Write data
+    late = acq.file_bundle->add_sample(time, freq_ind, frame);
 
-        // Increase metric count if we dropped a frame at write time
-        if (late) {
-            late_frame_counter.labels({std::to_string(freq_id)}).inc();
-        }
+    double elapsed = current_time() - start;
+
+    DEBUG("Written frequency {:d} in {:.5f} s", freq_id, elapsed);
+
+    // Increase metric count if we dropped a frame at write time
+    if (late) {
+        late_frame_counter.labels({std::to_string(freq_id)}).inc();
+    }
+
+    // Update average write time in prometheus
+    std::lock_guard<std::mutex> lock(write_time_lock);
+    write_time.add_sample(elapsed);
+    write_time_metric.set(write_time.average());
+}
+
+BaseWriter::acqWriter::acqWriter(BaseWriter& base, acqState& acq, const std::string& name,
+                                 uint32_t queue_length) :
+    base(base), acq(acq), queue(queue_length) {
+
+    // A private buffer like the input, so the frames can be swapped into it
+    Buffer* in_buf = base.in_buf;
+    pool = create_metadata_pool(queue_length, in_buf->metadata_pool->metadata_object_size,
+                                name.c_str(), in_buf->metadata_pool->type_name, false);
+    buf = create_buffer(queue_length, in_buf->frame_size, pool, name.c_str(),
+                        in_buf->buffer_type, in_buf->numa_node, 0, in_buf->use_hugepages,
+                        in_buf->mlock_frames, false, false);
+    if (buf == nullptr)
+        throw std::runtime_error(fmt::format("Failed to create the buffer {:s}", name));
+    producer = BufferProducer(buf, name);
+    consumer = BufferConsumer(buf, name);
+
+    thread = std::thread(&acqWriter::main_thread, this);
+}
+
+BaseWriter::acqWriter::~acqWriter() {
+
+    // Queue a frame telling the thread to stop once it has written the rest
+    producer.wait_for_empty_frame(next_submit);
+    queue[next_submit].stop = true;
+    producer.mark_frame_full(next_submit);
+    thread.join();
+
+    delete_buffer(buf);
+    free(buf);
+    delete_metadata_pool(pool);
+    free(pool);
+}
+
+void BaseWriter::acqWriter::submit(int frame_id, time_ctype time, uint32_t freq_id,
+                                   uint32_t freq_ind) {
+    producer.wait_for_empty_frame(next_submit);
+    FrameView::copy_frame(base.in_buf, frame_id, buf, next_submit);
+    queue[next_submit] = {time, freq_id, freq_ind, false};
+    producer.mark_frame_full(next_submit);
+    next_submit = (next_submit + 1) % queue.size();
+}
+
+void BaseWriter::acqWriter::main_thread() {
+    for (int frame_id = 0;; frame_id = (frame_id + 1) % queue.size()) {
+        consumer.wait_for_full_frame(frame_id);
+        const queuedFrame& q = queue[frame_id];
+        if (q.stop)
+            break;
 
-        // Update average write time in prometheus
-        write_time.add_sample(elapsed);
-        write_time_metric.set(write_time.average());
+        base.write_sample(acq, *base.make_view(buf, frame_id), q.freq_id, q.freq_ind, q.time);
+        consumer.mark_frame_empty(frame_id);
     }
 }
 
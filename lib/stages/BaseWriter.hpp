@@ -6,12 +6,14 @@
 #ifndef BASE_WRITER_HPP
 #define BASE_WRITER_HPP
 
+#include "BufferHandle.hpp"      // for BufferConsumer, BufferProducer
 #include "Config.hpp"            // for Config
 #include "FrameView.hpp"         // for FrameView
 #include "Stage.hpp"             // for Stage
 #include "buffer.h"              // for Buffer
 #include "bufferContainer.hpp"   // for bufferContainer
 #include "datasetManager.hpp"    // for dset_id_t, fingerprint_t
+#include "metadata.h"            // for metadataPool
 #include "prometheusMetrics.hpp" // for Counter, MetricFamily, Gauge
 #include "visFile.hpp"           // for visFileBundle
 #include "visUtil.hpp"           // for movingAverage, time_ctype
@@ -19,9 +21,12 @@
 #include <cstdint> // for uint32_t, int64_t
 #include <map>     // for map
 #include <memory>  // for shared_ptr, unique_ptr
+#include <mutex>   // for mutex
 #include <set>     // for set
 #include <stdio.h> // for size_t
 #include <string>  // for string
+#include <thread>  // for thread
+#include <vector>  // for vector
 
 /**
  * @class BaseWriter
@@ -32,6 +37,7 @@
  * make_metadata(dset_id_t ds_id);
  * get_dataset_state(dset_id_t ds_id);
  * write_data(const FrameView& frame);
+ * make_view(Buffer* buf, int frame_id);
  *
  * This stage writes out the data it receives with minimal processing.
  * Removing certain fields from the output must be done in a prior
@@ -83,6 +89,14 @@
  * @conf   critical_states  List of strings. A list of state types to consider
  *                          critical. That is, if they change in the incoming
  *                          data stream then a new acquisition will be started.
+ * @conf   acq_threads      Bool (default False). Write each acquisition on its
+ *                          own thread, so a slow file only holds up its own
+ *                          acquisition. The frames are moved (or copied, if
+ *                          there are other consumers of @c in_buf) into a queue
+ *                          for the acquisition, and released straight away.
+ * @conf   acq_queue_length Int (default 4). The number of frames each acquisition
+ *                          can have queued when using @c acq_threads. Reading
+ *                          from @c in_buf stops while a queue is full.
  *
  * @par Metrics
  * @metric kotekan_writer_write_time_seconds
@@ -109,10 +123,12 @@ public:
     };
 
 protected:
-    /// Write frame
-    void write_frame(const FrameView& frame, dset_id_t dataset_id, uint32_t freq_id,
+    /// Write frame `frame_id` of `in_buf`, or queue it for the acquisition thread
+    void write_frame(const FrameView& frame, int frame_id, dset_id_t dataset_id, uint32_t freq_id,
                      time_ctype time);
 
+    class acqWriter;
+
     /// Hold the internal state of an acquisition (one per dataset ID)
     /// Note that we create an acqState even for invalid datasets that we will
     /// reject all data from
@@ -132,6 +148,47 @@ protected:
 
         /// Last update
         double last_update;
+
+        /// The thread writing the acquisition, if using `acq_threads`. This is
+        /// stopped before the files are closed.
+        std::unique_ptr<acqWriter> writer;
+    };
+
+    /// Writes the frames of one acquisition on its own thread, from a private
+    /// buffer of the frames queued for it
+    class acqWriter {
+    public:
+        acqWriter(BaseWriter& base, acqState& acq, const std::string& name,
+                  uint32_t queue_length);
+
+        /// Writes out the queued frames and stops the thread
+        ~acqWriter();
+
+        /// Queue a frame of `in_buf` to be written, blocks while the queue is full
+        void submit(int frame_id, time_ctype time, uint32_t freq_id, uint32_t freq_ind);
+
+    private:
+        void main_thread();
+
+        /// Where to write each frame in the queue
+        struct queuedFrame {
+            time_ctype time;
+            uint32_t freq_id;
+            uint32_t freq_ind;
+            bool stop;
+        };
+
+        BaseWriter& base;
+        acqState& acq;
+
+        metadataPool* pool;
+        Buffer* buf;
+        kotekan::BufferProducer producer;
+        kotekan::BufferConsumer consumer;
+        std::vector<queuedFrame> queue;
+        int next_submit = 0;
+
+        std::thread thread;
     };
 
     /// The set of open acquisitions, keyed by the dataset_id. Multiple
@@ -158,6 +215,13 @@ private:
     /// Write data using FrameView
     virtual void write_data(Buffer* in_buf, int frame_id) = 0;
 
+    /// Create a view of a frame, used to write the frames queued with `acq_threads`
+    virtual std::unique_ptr<FrameView> make_view(Buffer* buf, int frame_id) = 0;
+
+    /// Write a frame into the files of the acquisition and update the metrics
+    void write_sample(acqState& acq, const FrameView& frame, uint32_t freq_id, uint32_t freq_ind,
+                      time_ctype time);
+
     /// Setup the acquisition
     void init_acq(dset_id_t ds_id);
 
@@ -192,15 +256,22 @@ private:
     size_t window;
     bool ignore_version;
     double acq_timeout;
+    bool acq_threads;
+    uint32_t acq_queue_length;
 
     /// Input buffer to read from
     Buffer* in_buf;
+    kotekan::BufferConsumer in_consumer;
+
+    /// The number of acquisitions started, to name their buffers
+    uint32_t num_acqs = 0;
 
     /// Next sweep
     double next_sweep = 0.0;
 
-    /// Keep track of the average write time
+    /// Keep track of the average write time, locked as the acquisition threads update it
     movingAverage write_time;
+    std::mutex write_time_lock;
 
     kotekan::prometheus::MetricFamily<kotekan::prometheus::Counter>& late_frame_counter;
     kotekan::prometheus::MetricFamily<kotekan::prometheus::Counter>& bad_dataset_frame_counter;
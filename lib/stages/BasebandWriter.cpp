@@ -219,6 +219,8 @@ void BasebandWriter::write_data(Buffer* in_buf, int frame_id) {
             write_time.add_sample(elapsed);
             write_time_metric.set(write_time.average());
         }
+        DEBUG("Finished writing data for event {:d}, freq {:d} to {:s}", event_id, freq_id,
+              file_name);
     } catch (std::exception& e) {
         ERROR("Exception in BasebandWriter: {:s}", e.what());
         throw;
@@ -226,7 +228,6 @@ void BasebandWriter::write_data(Buffer* in_buf, int frame_id) {
         ERROR("Unknown exception in BasebandWriter");
         throw;
     }
-    DEBUG("Finished writing data for event {:d}, freq {:d} to {:s}", event_id, freq_id, file_name);
 }
 
 
@@ -1,7 +1,8 @@
 #include "BufferSplit.hpp"
 
+#include "BufferHandle.hpp" // for BatchedBufferConsumer, BufferConsumer
 #include "StageFactory.hpp" // for REGISTER_KOTEKAN_STAGE, StageMakerTemplate
-#include "buffer.h"         // for mark_frame_empty, mark_frame_full, pass_metadata, register_c...
+#include "buffer.h"         // for mark_frame_full, pass_metadata, register_producer, safe_swa...
 #include "visUtil.hpp"      // for frameID, modulo
 
 #include <algorithm> // for max
@@ -9,11 +10,15 @@
 #include <memory>    // for allocator_traits<>::value_type
 #include <stdint.h>  // for uint8_t, uint32_t
 
+using kotekan::BatchedBufferConsumer;
+using kotekan::BufferConsumer;
+
 REGISTER_KOTEKAN_STAGE(BufferSplit);
 
 STAGE_CONSTRUCTOR(BufferSplit) {
     in_buf = get_buffer("in_buf");
-    register_consumer(in_buf, unique_name.c_str());
+    int batch_size = config.get_default<int>(unique_name, "batch_size", 1);
+    in_frames = BatchedBufferConsumer(BufferConsumer(in_buf, unique_name), batch_size);
 
     out_bufs = get_buffer_array("out_bufs");
     for (struct Buffer* out_buf : out_bufs)
@@ -28,13 +33,12 @@ void BufferSplit::main_thread() {
     for (auto& out_buf : out_bufs)
         output_frame_ids.push_back(frameID(out_buf));
 
-    frameID input_frame_id(in_buf);
-
     while (!stop_thread) {
         for (uint32_t i = 0; i < out_bufs.size(); ++i) {
-            uint8_t* input = wait_for_full_frame(in_buf, unique_name.c_str(), input_frame_id);
+            uint8_t* input = in_frames.wait_for_full_frame();
             if (input == nullptr)
                 break;
+            int input_frame_id = in_frames.get_frame_id();
             uint8_t* output =
                 wait_for_empty_frame(out_bufs.at(i), unique_name.c_str(), output_frame_ids.at(i));
             if (output == nullptr)
@@ -44,7 +48,7 @@ void BufferSplit::main_thread() {
 
             pass_metadata(in_buf, input_frame_id, out_bufs.at(i), output_frame_ids.at(i));
 
-            mark_frame_empty(in_buf, unique_name.c_str(), input_frame_id++);
+            in_frames.mark_frame_empty();
             mark_frame_full(out_bufs.at(i), unique_name.c_str(), output_frame_ids.at(i)++);
         }
     }
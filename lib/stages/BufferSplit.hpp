@@ -1,6 +1,7 @@
 #ifndef BUFFER_SPLIT_HPP
 #define BUFFER_SPLIT_HPP
 
+#include "BufferHandle.hpp"    // for BatchedBufferConsumer
 #include "Config.hpp"          // for Config
 #include "Stage.hpp"           // for Stage
 #include "bufferContainer.hpp" // for bufferContainer
@@ -23,6 +24,9 @@
  *        @buffer_format any, but all must be the same type and match in_buf
  *        @buffer_metadata any, but all must be the same type match in_buf
  *
+ * @conf  batch_size  Int. Maximum number of input frames to acquire and release
+ *                    at once. Default is 1.
+ *
  * @author Andre Renard
  */
 class BufferSplit : public kotekan::Stage {
@@ -40,6 +44,7 @@ public:
 private:
     /// Input buffer
     struct Buffer* in_buf;
+    kotekan::BatchedBufferConsumer in_frames;
 
     /// The output buffers to put frames into
     std::vector<struct Buffer*> out_bufs;
@@ -48,7 +48,11 @@ EigenVisIter::EigenVisIter(Config& config, const std::string& unique_name,
     eigenvalue_convergence_metric(Metrics::instance().add_gauge(
         "kotekan_eigenvisiter_eigenvalue_convergence", unique_name, {"freq_id"})),
     eigenvector_convergence_metric(Metrics::instance().add_gauge(
-        "kotekan_eigenvisiter_eigenvector_convergence", unique_name, {"freq_id"})) {
+        "kotekan_eigenvisiter_eigenvector_convergence", unique_name, {"freq_id"})),
+    converged_metric(Metrics::instance().add_gauge("kotekan_eigenvisiter_converged", unique_name,
+                                                   {"freq_id"})),
+    warm_start_metric(Metrics::instance().add_gauge("kotekan_eigenvisiter_warm_start",
+                                                    unique_name, {"freq_id"})) {
 
     in_buf = get_buffer("in_buf");
     register_consumer(in_buf, unique_name.c_str());
@@ -70,6 +74,7 @@ EigenVisIter::EigenVisIter(Config& config, const std::string& unique_name,
     _max_iterations = config.get_default<uint32_t>(unique_name, "max_iterations", 15);
     _krylov = config.get_default<uint32_t>(unique_name, "krylov", 2);
     _subspace = config.get_default<uint32_t>(unique_name, "subspace", 3);
+    _warm_start = config.get_default<bool>(unique_name, "warm_start", false);
 
     // Create the state describing the eigenvalues
     auto& dm = datasetManager::instance();
@@ -112,6 +117,9 @@ void EigenVisIter::main_thread() {
         if (input_dset_id != input_frame.dataset_id) {
             input_dset_id = input_frame.dataset_id;
             _output_dset_id = change_dataset_state(input_dset_id);
+
+            // The previous eigenpairs may not describe the new data
+            last_eigpairs.clear();
         }
 
         // Check that we have the full triangle
@@ -134,10 +142,26 @@ void EigenVisIter::main_thread() {
         // Copy the visibilties into a blaze container
         DynamicHermitian<cfloat> vis = to_blaze_herm(input_frame.vis);
 
-        // Perform the actual eigen-decomposition
+        // Perform the actual eigen-decomposition, starting from the last result for this
+        // frequency if we have one
+        const eig_t<cfloat>* initial = nullptr;
+        auto last = last_eigpairs.find(input_frame.freq_id);
+        if (_warm_start && last != last_eigpairs.end()) {
+            initial = &last->second;
+        }
         std::tie(eigpair, stats) =
             eigen_masked_subspace(vis, mask, _num_eigenvectors, _tol_eval, _tol_evec,
-                                  _max_iterations, _num_ev_conv, _krylov, _subspace);
+                                  _max_iterations, _num_ev_conv, _krylov, _subspace, initial);
+
+        // Only start from results we trust
+        if (_warm_start) {
+            if (stats.converged) {
+                last_eigpairs[input_frame.freq_id] = eigpair;
+            } else {
+                last_eigpairs.erase(input_frame.freq_id);
+            }
+        }
+
         auto& evals = eigpair.first;
         auto& evecs = eigpair.second;
 
@@ -151,8 +175,9 @@ void EigenVisIter::main_thread() {
             str_evals = fmt::format(fmt("{:s} {}"), str_evals, evals[i]);
         }
         DEBUG("Found eigenvalues: {:s}, with RMS residuals: {:e}, in {:4.2f} s. Took {:d}/{:d} "
-              "iterations.",
-              str_evals, stats.rms, elapsed_time, stats.iterations, _max_iterations);
+              "iterations{:s}.",
+              str_evals, stats.rms, elapsed_time, stats.iterations, _max_iterations,
+              stats.warm_start ? " from a warm start" : "");
 
         // Update Prometheus metrics
         update_metrics(input_frame.freq_id, input_frame.dataset_id, elapsed_time, eigpair, stats);
@@ -216,6 +241,8 @@ void EigenVisIter::update_metrics(uint32_t freq_id, dset_id_t dset_id, double el
     iterations_metric.labels(labels).set(stats.iterations);
     eigenvalue_convergence_metric.labels(labels).set(stats.eps_eval);
     eigenvector_convergence_metric.labels(labels).set(stats.eps_evec);
+    converged_metric.labels(labels).set(stats.converged);
+    warm_start_metric.labels(labels).set(stats.warm_start);
 }
 
 
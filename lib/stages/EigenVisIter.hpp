@@ -63,6 +63,10 @@
  * @conf  num_ev_conv      UInt. Test only the top `num_ev_conv` eigenpairs for convergence.
  * @conf  krylov           UInt, default 2. Size of the Krylov basis to use.
  * @conf  subspace         UInt, default 3. Number of subspace iteration substeps.
+ * @conf  warm_start       Bool, default false. Start the iteration for each frequency from
+ *                         the eigenpairs found for the last frame of that frequency, rather
+ *                         than from a random subspace. These are forgotten when the dataset
+ *                         changes or if the last frame didn't converge.
  *
  * @par Metrics
  * @metric kotekan_eigenvisiter_comp_time_seconds
@@ -76,6 +80,10 @@
  *         Eigenvalue convergence parameter of the last sample.
  * @metric kotekan_eigenvisiter_eigenvector_convergence
  *         Eigenvector convergence parameter of the last sample.
+ * @metric kotekan_eigenvisiter_converged
+ *         Whether the last sample converged (1) or not (0).
+ * @metric kotekan_eigenvisiter_warm_start
+ *         Whether the last sample was started from the previous eigenpairs (1) or not (0).
  *
  * @author Richard Shaw, Kiyoshi Masui
  */
@@ -110,6 +118,10 @@ private:
     uint32_t _max_iterations;
     uint32_t _krylov;
     uint32_t _subspace;
+    bool _warm_start;
+
+    /// The last converged eigenpairs for each frequency, to start the next frame from
+    std::map<uint32_t, eig_t<cfloat>> last_eigpairs;
 
     /// Parameters for masking the matrix
     std::vector<uint32_t> _exclude_inputs;
@@ -127,6 +139,8 @@ private:
     kotekan::prometheus::MetricFamily<kotekan::prometheus::Gauge>& iterations_metric;
     kotekan::prometheus::MetricFamily<kotekan::prometheus::Gauge>& eigenvalue_convergence_metric;
     kotekan::prometheus::MetricFamily<kotekan::prometheus::Gauge>& eigenvector_convergence_metric;
+    kotekan::prometheus::MetricFamily<kotekan::prometheus::Gauge>& converged_metric;
+    kotekan::prometheus::MetricFamily<kotekan::prometheus::Gauge>& warm_start_metric;
 };
 
 #endif
@@ -1,10 +1,11 @@
 #include "HFBAccumulate.hpp"
 
+#include "BufferHandle.hpp"   // for BatchedBufferConsumer, BufferConsumer
 #include "HFBFrameView.hpp"   // for HFBFrameView
 #include "Hash.hpp"           // for operator!=
 #include "StageFactory.hpp"   // for REGISTER_KOTEKAN_STAGE, StageMakerTemplate
 #include "Telescope.hpp"      // for Telescope
-#include "buffer.h"           // for mark_frame_empty, register_consumer, wait_for_empty_frame
+#include "buffer.h"           // for register_producer, wait_for_empty_frame, mark_frame_full
 #include "chimeMetadata.hpp"  // for get_fpga_seq_num, get_lost_timesamples
 #include "datasetManager.hpp" // for state_id_t, dset_id_t, datasetManager
 #include "datasetState.hpp"   // for beamState, freqState, metadataState, subfreqState
@@ -14,7 +15,7 @@
 
 #include "gsl-lite.hpp" // for span
 
-#include <algorithm>  // for max, fill, transform, copy
+#include <algorithm>  // for max, min, fill, transform, copy
 #include <atomic>     // for atomic_bool
 #include <cstdint>    // for uint32_t, int32_t
 #include <exception>  // for exception
@@ -30,6 +31,8 @@
 #include <utility>    // for pair
 #include <vector>     // for vector, vector<>::iterator
 
+using kotekan::BatchedBufferConsumer;
+using kotekan::BufferConsumer;
 using kotekan::bufferContainer;
 using kotekan::Config;
 using kotekan::Stage;
@@ -47,8 +50,11 @@ HFBAccumulate::HFBAccumulate(Config& config_, const std::string& unique_name,
     _samples_per_data_set(config.get<uint32_t>(unique_name, "samples_per_data_set")),
     _good_samples_threshold(config.get<float>(unique_name, "good_samples_threshold")) {
 
-    register_consumer(in_buf, unique_name.c_str());
-    register_consumer(cls_buf, unique_name.c_str());
+    int batch_size = config.get_default<int>(unique_name, "batch_size", 1);
+    in_frames = BatchedBufferConsumer(BufferConsumer(in_buf, unique_name),
+                                      std::min(batch_size, in_buf->num_frames));
+    cls_frames = BatchedBufferConsumer(BufferConsumer(cls_buf, unique_name),
+                                       std::min(batch_size, cls_buf->num_frames));
     register_producer(out_buf, unique_name.c_str());
 
     hfb1.resize(_num_frb_total_beams * _factor_upchan, 0.0);
@@ -135,7 +141,7 @@ void HFBAccumulate::normalise_frame(const uint32_t in_frame_id) {
 
 void HFBAccumulate::main_thread() {
 
-    frameID in_frame_id(in_buf), out_frame_id(out_buf), cls_frame_id(cls_buf);
+    frameID out_frame_id(out_buf);
     dset_id_t ds_id_in = dset_id_t::null;
     int first = 1;
     int64_t fpga_seq_num_end_old = 0;
@@ -157,11 +163,13 @@ void HFBAccumulate::main_thread() {
 
     while (!stop_thread) {
         // Get an input buffer. This call is blocking!
-        uint8_t* in_frame_ptr = wait_for_full_frame(in_buf, unique_name.c_str(), in_frame_id);
+        uint8_t* in_frame_ptr = in_frames.wait_for_full_frame();
         if (in_frame_ptr == nullptr)
             return;
-        if (wait_for_full_frame(cls_buf, unique_name.c_str(), cls_frame_id) == nullptr)
+        if (cls_frames.wait_for_full_frame() == nullptr)
             return;
+        const int in_frame_id = in_frames.get_frame_id();
+        const int cls_frame_id = cls_frames.get_frame_id();
 
         // Check if dataset ID changed
         dset_id_t ds_id_in_new = get_dataset_id(in_buf, in_frame_id);
@@ -187,14 +195,14 @@ void HFBAccumulate::main_thread() {
             DEBUG("Dropping incoming HFB frame to sync up. HFB frame: {}; Compressed Lost Samples "
                   "frame: {}, diff {}",
                   hfb_seq_num, cls_seq_num, hfb_seq_num - cls_seq_num);
-            mark_frame_empty(in_buf, unique_name.c_str(), in_frame_id++);
+            in_frames.mark_frame_empty();
             continue;
         }
         if (cls_seq_num < hfb_seq_num) {
             DEBUG("Dropping incoming Compressed Lost Samples frame to sync up. HFB frame: {}; "
                   "Compressed Lost Samples frame: {}, diff {}",
                   hfb_seq_num, cls_seq_num, hfb_seq_num - cls_seq_num);
-            mark_frame_empty(cls_buf, unique_name.c_str(), cls_frame_id++);
+            cls_frames.mark_frame_empty();
             continue;
         }
         DEBUG2("Frames are synced. HFB frame: {}; Compressed Lost Samples frame: {}, diff {}",
@@ -362,8 +370,8 @@ void HFBAccumulate::main_thread() {
         fpga_seq_num_end_old = fpga_seq_num_end;
 
         // Release the input buffers
-        mark_frame_empty(in_buf, unique_name.c_str(), in_frame_id++);
-        mark_frame_empty(cls_buf, unique_name.c_str(), cls_frame_id++);
+        in_frames.mark_frame_empty();
+        cls_frames.mark_frame_empty();
 
     } // end stop thread
 }
@@ -7,6 +7,7 @@
 #ifndef HFB_ACCUMULATE_STAGE
 #define HFB_ACCUMULATE_STAGE
 
+#include "BufferHandle.hpp"    // for BatchedBufferConsumer
 #include "Config.hpp"          // for Config
 #include "Stage.hpp"           // for Stage
 #include "buffer.h"            // for Buffer
@@ -52,6 +53,8 @@
  *                                  been integrated for.
  * @conf   good_samples_threshold   Float. Required fraction of good samples in
  *                                  integration before it is recorded.
+ * @conf   batch_size               Int. Maximum number of input frames to acquire and
+ *                                  release at once. Default is 1.
  *
  * @author James Willis
  *
@@ -82,6 +85,10 @@ private:
     Buffer* cls_buf;
     Buffer* out_buf;
 
+    /// Readers for the input buffers, which take frames in batches
+    kotekan::BatchedBufferConsumer in_frames;
+    kotekan::BatchedBufferConsumer cls_frames;
+
     /// View of the output frame data.
     gsl::span<float> out_hfb;
 
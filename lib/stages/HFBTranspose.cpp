@@ -167,6 +167,9 @@ bool HFBTranspose::get_dataset_state(dset_id_t ds_id) {
     frac_lost.resize(chunk_t * chunk_f, 1.);
     dset_id.resize(chunk_t * chunk_f);
 
+    hfb_tiles.resize(chunk_f, eff_data_dim, num_threads - 1);
+    hfb_weight_tiles.resize(chunk_f, eff_data_dim, num_threads - 1);
+
     // Initialise dataset ID array with null IDs
     std::string null_ds_id = fmt::format("{}", dset_id_t::null);
     for (auto& ds : dset_id) {
@@ -188,10 +191,12 @@ void HFBTranspose::write_chunk(size_t t_ind, size_t f_ind) {
     DEBUG("Writing block of {:d} freqs and {:d} times. data: {}...{}...{}", write_f, write_t,
           hfb[0], hfb[write_t], hfb[write_t * 2]);
 
-    file->write_block("hfb", f_ind, t_ind, write_f, write_t, hfb.data());
-    file->write_block("hfb_weight", f_ind, t_ind, write_f, write_t, hfb_weight.data());
-    file->write_block("flags/frac_lost", f_ind, t_ind, write_f, write_t, frac_lost.data());
-    file->write_block("flags/dataset_id", f_ind, t_ind, write_f, write_t, dset_id.data());
+    queue_block(file, "hfb", f_ind, t_ind, hfb, {f_ind, 0, 0, t_ind},
+                {write_f, num_subfreq, num_beams, write_t});
+    queue_block(file, "flags/hfb_weight", f_ind, t_ind, hfb_weight, {f_ind, 0, 0, t_ind},
+                {write_f, num_subfreq, num_beams, write_t});
+    queue_block(file, "flags/frac_lost", f_ind, t_ind, frac_lost);
+    queue_block(file, "flags/dataset_id", f_ind, t_ind, dset_id);
 }
 
 // increment between chunks
@@ -230,28 +235,26 @@ void HFBTranspose::copy_frame_data(uint32_t freq_index, uint32_t time_index) {
 
     auto frame = HFBFrameView(in_buf, frame_id);
 
-    std::vector<float> data_cpy(frame.hfb.data(), frame.hfb.data() + eff_data_dim);
-    std::vector<float> weight_cpy(frame.weight.data(), frame.weight.data() + eff_data_dim);
+    float* hfb_row = hfb_tiles.row(freq_index, time_index);
+    float* weight_row = hfb_weight_tiles.row(freq_index, time_index);
 
-// Transpose beam and sub-frequency order
+// Transpose beam and sub-frequency order while staging the frame
 #ifdef _OPENMP
 #pragma omp parallel for
 #endif
     for (uint32_t n = 0; n < eff_data_dim; n++) {
         uint32_t i = n / num_beams;
         uint32_t j = n % num_beams;
-        frame.hfb[n] = data_cpy[j * num_subfreq + i];
-        frame.weight[n] = weight_cpy[j * num_subfreq + i];
+        hfb_row[n] = frame.hfb[j * num_subfreq + i];
+        weight_row[n] = frame.weight[j * num_subfreq + i];
     }
 
     // Collect frames until a chunk is filled
     // Time-transpose as frames come in
     // Fastest varying is time (needs to be consistent with reader!)
     uint32_t offset = freq_index * write_t;
-    strided_copy(frame.hfb.data(), hfb.data(), offset * eff_data_dim + time_index, write_t,
-                 eff_data_dim);
-    strided_copy(frame.weight.data(), hfb_weight.data(), offset * eff_data_dim + time_index,
-                 write_t, eff_data_dim);
+    hfb_tiles.commit(hfb.data(), freq_index, time_index, write_t);
+    hfb_weight_tiles.commit(hfb_weight.data(), freq_index, time_index, write_t);
     frac_lost[offset + time_index] =
         frame.fpga_seq_length == 0 ? 1. : 1. - float(frame.fpga_seq_total) / frame.fpga_seq_length;
 }
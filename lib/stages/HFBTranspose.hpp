@@ -8,7 +8,7 @@
 
 #include "Config.hpp"          // for Config
 #include "HFBFileArchive.hpp"  // for HFBFileArchive
-#include "Transpose.hpp"       // for Transpose
+#include "Transpose.hpp"       // for Transpose, tiledTranspose
 #include "bufferContainer.hpp" // for bufferContainer
 #include "datasetManager.hpp"  // for dset_id_t
 #include "visUtil.hpp"         // for cfloat, time_ctype, freq_ctype, input_ctype, prod_ctype
@@ -65,6 +65,10 @@ private:
     std::vector<float> hfb_weight;
     std::vector<float> frac_lost;
 
+    // Frames staged to be transposed into the datasets
+    tiledTranspose<float> hfb_tiles;
+    tiledTranspose<float> hfb_weight_tiles;
+
     /// The list of frequencies and inputs that get written into the index maps
     /// of the HDF5 files
     std::vector<time_ctype> times;
@@ -3,31 +3,35 @@
 #include "Config.hpp"         // for Config
 #include "HFBFrameView.hpp"   // for HFBFrameView
 #include "StageFactory.hpp"   // for REGISTER_KOTEKAN_STAGE, StageMakerTemplate
+#include "WorkPool.hpp"       // for WorkPool
 #include "buffer.h"           // for wait_for_full_frame, allocate_new_metadata_object, mark_fr...
 #include "kotekanLogging.hpp" // for DEBUG
-#include "truncate.hpp"       // for bit_truncate_float
+#include "truncate.hpp"       // for bit_truncate_float_array
 #include "visUtil.hpp"        // for cfloat
 
 #include "gsl-lite.hpp" // for span
 
-#include <atomic>      // for atomic_bool
-#include <cmath>       // for abs, sqrt
-#include <cstdint>     // for int32_t
-#include <cstring>     // for memset, size_t
-#include <exception>   // for exception
-#include <functional>  // for _Bind_helper<>::type, bind, function
-#include <immintrin.h> // for _mm256_broadcast_ss, _mm256_div_ps, _mm256_loadu_ps, _mm25...
-#include <mm_malloc.h> // for _mm_free, _mm_malloc
-#include <regex>       // for match_results<>::_Base_type
-#include <vector>      // for vector
+#include <algorithm>  // for min
+#include <atomic>     // for atomic, atomic_bool
+#include <cmath>      // for abs, sqrt
+#include <exception>  // for exception
+#include <functional> // for _Bind_helper<>::type, bind, function
+#include <regex>      // for match_results<>::_Base_type
+#include <stddef.h>   // for size_t
+#include <stdexcept>  // for invalid_argument
+#include <vector>     // for vector
 
 
 using kotekan::bufferContainer;
 using kotekan::Config;
 using kotekan::Stage;
+using kotekan::WorkPool;
 
 REGISTER_KOTEKAN_STAGE(HFBTruncate);
 
+// The number of values truncated at a time by each thread
+#define HFB_TRUNCATE_CHUNK_SIZE 1024
+
 HFBTruncate::HFBTruncate(Config& config, const std::string& unique_name,
                          bufferContainer& buffer_container) :
     Stage(config, unique_name, buffer_container, std::bind(&HFBTruncate::main_thread, this)) {
@@ -50,6 +54,10 @@ HFBTruncate::HFBTruncate(Config& config, const std::string& unique_name,
     if (hfb_prec < 0)
         FATAL_ERROR("HFBTruncate: config: data_fixed_precision should be positive (is %f).",
                     hfb_prec);
+
+    num_frame_threads = config.get_default<uint32_t>(unique_name, "num_frame_threads", 1);
+    if (num_frame_threads == 0)
+        throw std::invalid_argument("HFBTruncate: num_frame_threads has to be at least 1.");
 }
 
 void HFBTruncate::main_thread() {
@@ -57,31 +65,11 @@ void HFBTruncate::main_thread() {
     frameID frame_id(in_buf), output_frame_id(out_buf);
     const float err_init = 0.5 * err_sq_lim;
 
-    float err, tr_hfb;
-    const __m256 err_init_vec = _mm256_set1_ps(err_init);
-    __m256 err_vec, wgt_vec;
-    int32_t i_vec;
-    float* err_all;
-
-    // get the first frame (just to find out about data size)
-    // (we don't mark it empty, so it's read again in the main loop)
-    if (wait_for_full_frame(in_buf, unique_name.c_str(), frame_id) == nullptr)
-        return;
-    auto frame = HFBFrameView(in_buf, frame_id);
-
-    uint32_t data_size = frame.num_beams * frame.num_subfreq;
-
-    // reserve enough memory for all err to be computed per frame
-    // 32byte-aligned memory allocation (_m256_store_ps() asks for it)
-    err_all = (float*)_mm_malloc(sizeof(float) * data_size, 32);
-    std::memset(err_all, 0, sizeof(float) * data_size);
-
     while (!stop_thread) {
         // Wait for the buffer to be filled with data
         if ((wait_for_full_frame(in_buf, unique_name.c_str(), frame_id)) == nullptr) {
             break;
         }
-        auto frame = HFBFrameView(in_buf, frame_id);
 
         // Wait for empty frame
         if ((wait_for_empty_frame(out_buf, unique_name.c_str(), output_frame_id)) == nullptr) {
@@ -91,39 +79,41 @@ void HFBTruncate::main_thread() {
         // Copy frame into output buffer
         auto output_frame = HFBFrameView::copy_frame(in_buf, frame_id, out_buf, output_frame_id);
 
-        // truncate absorber data and weights (8 at a time)
-        for (i_vec = 0; i_vec < int32_t(data_size) - 7; i_vec += 8) {
-            wgt_vec = _mm256_loadu_ps(&output_frame.weight[i_vec]);
-            err_vec = _mm256_div_ps(err_init_vec, wgt_vec);
-            err_vec = _mm256_sqrt_ps(err_vec);
-            _mm256_store_ps(err_all + i_vec, err_vec);
-        }
-        // use std::sqrt for the last few (less than 8)
-        for (i_vec = (data_size < 8) ? 0 : i_vec - 8; i_vec < int32_t(data_size); i_vec++)
-            err_all[i_vec] = std::sqrt(0.5 / output_frame.weight[i_vec] * err_sq_lim);
-
-#pragma omp parallel for private(err, tr_hfb)
-        for (size_t i = 0; i < data_size; i++) {
-            // Get truncation precision from weights
-            if (output_frame.weight[i] == 0.) {
-                zero_weight_found = true;
-                err = hfb_prec * std::abs(output_frame.hfb[i]);
-            } else {
-                err = err_all[i];
+        // Get raw pointers to avoid the gsl::span bounds checking
+        float* hfb = output_frame.hfb.data();
+        float* weight = output_frame.weight.data();
+        size_t data_size = output_frame.num_beams * output_frame.num_subfreq;
+        std::atomic<bool> zero_weight_found(false);
+
+        // truncate absorber data and weights, a chunk at a time
+        size_t num_chunks = (data_size + HFB_TRUNCATE_CHUNK_SIZE - 1) / HFB_TRUNCATE_CHUNK_SIZE;
+        auto truncate_chunk = [&](size_t chunk) {
+            size_t start = chunk * HFB_TRUNCATE_CHUNK_SIZE;
+            size_t n = std::min<size_t>(HFB_TRUNCATE_CHUNK_SIZE, data_size - start);
+
+            float err[HFB_TRUNCATE_CHUNK_SIZE];
+            float err_weight[HFB_TRUNCATE_CHUNK_SIZE];
+            for (size_t j = 0; j < n; j++) {
+                size_t i = start + j;
+                // Get truncation precision from weights
+                if (weight[i] == 0.) {
+                    zero_weight_found = true;
+                    err[j] = hfb_prec * std::abs(hfb[i]);
+                } else {
+                    err[j] = std::sqrt(err_init / weight[i]);
+                }
+                // truncate weights to fixed precision
+                err_weight[j] = w_prec * weight[i];
             }
-            // truncate hfb using weights
-            tr_hfb = bit_truncate_float(output_frame.hfb[i], err);
-            output_frame.hfb[i] = tr_hfb;
-            // truncate weights to fixed precision
-            output_frame.weight[i] =
-                bit_truncate_float(output_frame.weight[i], w_prec * output_frame.weight[i]);
-        }
+            bit_truncate_float_array(hfb + start, err, n);
+            bit_truncate_float_array(weight + start, err_weight, n);
+        };
+        WorkPool::instance().parallel_for(num_chunks, truncate_chunk, num_frame_threads - 1);
 
         if (zero_weight_found) {
             DEBUG("HFBTruncate: Frame {:d} has at least one weight value "
                   "being zero.",
                   frame_id);
-            zero_weight_found = false;
         }
 
         // mark as full
@@ -131,5 +121,4 @@ void HFBTruncate::main_thread() {
         // move to next frame
         mark_frame_empty(in_buf, unique_name.c_str(), frame_id++);
     }
-    _mm_free(err_all);
 }
@@ -6,18 +6,16 @@
 #include "buffer.h"
 #include "bufferContainer.hpp"
 
-#include <string> // for string
+#include <stdint.h> // for uint32_t
+#include <string>   // for string
 
 /**
  * @class HFBTruncate
  * @brief Truncates absorber data and weight values.
  *
  * Absorber values are truncated to a precision based on their
- * weight.
- *
- * @warning Don't run this anywhere but on the transpose (gossec) node.
- * The OpenMP calls could cause issues on systems using kotekan pin
- * priority threads (likely the GPU nodes).
+ * weight. The truncation is vectorized, and the chunks of each frame can
+ * be shared out over the work pool.
  *
  * @par Buffers
  * @buffer in_buf The input stream.
@@ -31,6 +29,8 @@
  * @conf   weight_fixed_precision   Fixed precision for weight truncation.
  * @conf   data_fixed_precision     Fixed precision for absorber truncation (if
  *                                  weights are zero).
+ * @conf   num_frame_threads        Int, default 1. The number of threads truncating
+ *                                  each frame, using the work pool.
  *
  * @author James Willis
  */
@@ -54,8 +54,7 @@ private:
     float w_prec;
     float hfb_prec;
 
-    // Flag for frame with a zero weight
-    bool zero_weight_found;
+    uint32_t num_frame_threads;
 };
 
 #endif
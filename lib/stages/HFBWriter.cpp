@@ -22,7 +22,7 @@
 #include <exception>    // for exception
 #include <future>       // for async, future
 #include <map>          // for map, map<>::mapped_type
-#include <memory>       // for __shared_ptr_access, shared_ptr
+#include <memory>       // for __shared_ptr_access, shared_ptr, make_unique, unique_ptr
 #include <regex>        // for match_results<>::_Base_type
 #include <stdexcept>    // for out_of_range
 #include <string>       // for string, to_string
@@ -115,5 +115,9 @@ void HFBWriter::write_data(Buffer* in_buf, int frame_id) {
     uint64_t fpga_seq_start = frame.fpga_seq_start;
     time_ctype t = {fpga_seq_start, ts_to_double(time)};
 
-    write_frame(frame, frame.dataset_id, frame.freq_id, t);
+    write_frame(frame, frame_id, frame.dataset_id, frame.freq_id, t);
+}
+
+std::unique_ptr<FrameView> HFBWriter::make_view(Buffer* buf, int frame_id) {
+    return std::make_unique<HFBFrameView>(buf, frame_id);
 }
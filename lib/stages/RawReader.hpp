@@ -18,29 +18,35 @@
 #include "kotekanLogging.hpp" // for INFO, FATAL_ERROR, DEBUG, WARN, ERROR
 #include "metadata.h"         // for metadataContainer
 #include "version.h"          // for get_git_commit_hash
+#include "visFileRaw.hpp"     // for rawIndexEntry
 #include "visUtil.hpp"        // for freq_ctype (ptr only), input_ctype, prod_ctype, rstack_ctype
 
 #include "fmt.hpp"  // for format, fmt
 #include "json.hpp" // for json
 
-#include <cstring>    // for strerror, memcpy
-#include <errno.h>    // for errno
-#include <exception>  // for exception
-#include <fcntl.h>    // for open, posix_fadvise, O_RDONLY, POSIX_FADV_DONTNEED
-#include <fstream>    // for ifstream, ios_base::failure, ios_base, basic_ios, basic_i...
-#include <functional> // for _Bind_helper<>::type, bind, function
-#include <map>        // for map
-#include <regex>      // for match_results<>::_Base_type
-#include <stddef.h>   // for size_t
-#include <stdexcept>  // for runtime_error, invalid_argument, out_of_range
-#include <stdint.h>   // for uint32_t, uint8_t
-#include <string>     // for string
-#include <sys/mman.h> // for madvise, mmap, munmap, MADV_DONTNEED, MADV_WILLNEED, MAP_...
-#include <sys/stat.h> // for stat
-#include <time.h>     // for nanosleep, timespec
-#include <unistd.h>   // for close, off_t
-#include <utility>    // for pair
-#include <vector>     // for vector
+#include <algorithm>          // for find_if, min
+#include <condition_variable> // for condition_variable
+#include <cstring>            // for strerror, memcpy
+#include <errno.h>            // for errno
+#include <exception>          // for exception
+#include <fcntl.h>            // for open, posix_fadvise, O_RDONLY, POSIX_FADV_DONTNEED
+#include <fstream>            // for ifstream, ios_base::failure, ios_base, basic_ios, basic_i...
+#include <functional>         // for _Bind_helper<>::type, bind, function
+#include <map>                // for map
+#include <mutex>              // for mutex, unique_lock
+#include <regex>              // for match_results<>::_Base_type
+#include <set>                // for set
+#include <stddef.h>           // for size_t
+#include <stdexcept>          // for runtime_error, invalid_argument, out_of_range
+#include <stdint.h>           // for uint32_t, uint8_t
+#include <string>             // for string
+#include <sys/mman.h>         // for madvise, mmap, munmap, MADV_DONTNEED, MADV_WILLNEED, MAP_...
+#include <sys/stat.h>         // for stat
+#include <thread>             // for thread
+#include <time.h>             // for nanosleep, timespec
+#include <unistd.h>           // for close, off_t, pread
+#include <utility>            // for pair
+#include <vector>             // for vector
 
 using kotekan::bufferContainer;
 using kotekan::Config;
@@ -68,6 +74,19 @@ using nlohmann::json;
  * is to enable compression and try to optimise for certain IO patterns
  * (i.e. read a few frequencies for many times).
  *
+ * Only part of the file can be read by selecting a range of times with
+ * `start_time` and `end_time`, and a subset of the frequencies with `freq_ids`.
+ * The frames outside the selection are never touched, so a short stretch of a
+ * long acquisition can be replayed without reading through the file up to it.
+ * If the file has an `.index` (see `visFileRaw`), it is used to skip the empty
+ * frames without reading them, and to register the dataset IDs in the file
+ * before streaming starts.
+ *
+ * By default the OS is advised to read ahead of the current frame. With
+ * `prefetch_threads` set, that many threads read the next `readahead_blocks`
+ * frames of the selection into the page cache instead, which keeps several
+ * reads in flight on disks that need them to reach their full bandwidth.
+ *
  * @par Buffers
  * @buffer out_buf The data read from the raw file.
  *         @buffer_format Buffer structured
@@ -75,6 +94,16 @@ using nlohmann::json;
  *
  * @conf    readahead_blocks       Int. Number of blocks to advise OS to read ahead
  *                                 of current read.
+ * @conf    prefetch_threads       Int. Number of threads reading the next
+ *                                 `readahead_blocks` frames into the page cache.
+ *                                 If zero (default) the OS is advised to read them
+ *                                 instead.
+ * @conf    start_time             Double. Only read the times from this UNIX time
+ *                                 on. Default is the start of the file.
+ * @conf    end_time               Double. Only read the times before this UNIX time.
+ *                                 Default is the end of the file.
+ * @conf    freq_ids               Array of ints. Only read these frequency IDs.
+ *                                 Default is all the frequencies in the file.
  * @conf    chunk_size             Array of [int, int, int]. Read chunk size (freq,
  *                                 prod, time). If not specified will read file
  *                                 contiguously.
@@ -112,14 +141,14 @@ public:
     void main_thread() override;
 
     /**
-     * @brief Get the times in the file.
+     * @brief Get the times read from the file.
      **/
     const std::vector<time_ctype>& times() {
         return _times;
     }
 
     /**
-     * @brief Get the frequencies in the file.
+     * @brief Get the frequencies read from the file.
      **/
     const std::vector<std::pair<uint32_t, freq_ctype>>& freqs() {
         return _freqs;
@@ -194,6 +223,28 @@ private:
      **/
     int position_map(int ind);
 
+    /**
+     * @brief Map a position in the selected times and frequencies to the file.
+     *
+     * @param pos The position, as returned by `position_map`.
+     * @returns The frame index into the file.
+     **/
+    size_t file_index(size_t pos);
+
+    /**
+     * @brief Read the `.index` file, if there is one.
+     *
+     * This fills `frame_valid` and `index_dataset_ids`.
+     **/
+    void read_index();
+
+    /**
+     * @brief Read the frames ahead of the current one into the page cache.
+     *
+     * @param nframe The number of frames to read.
+     **/
+    void prefetch_thread(size_t nframe);
+
     // The metadata
     nlohmann::json _metadata;
     std::vector<time_ctype> _times;
@@ -221,9 +272,30 @@ private:
 
     size_t file_frame_size, data_size, nfreq, ntime;
 
+    // The size of the file, ntime and nfreq are the size of the selection
+    size_t file_nfreq, file_ntime;
+
+    // The time and frequency indices in the file of the selected samples
+    std::vector<size_t> time_inds, freq_inds;
+
+    // Whether each selected frame was written, from the `.index` file. Empty if
+    // there is no index, in which case the first byte of the frame is checked.
+    std::vector<uint8_t> frame_valid;
+
+    // The dataset IDs of the selected frames in the `.index` file
+    std::set<dset_id_t> index_dataset_ids;
+
     // Number of blocks to read ahead while reading from disk
     size_t readahead_blocks;
 
+    // The threads reading ahead, and the frames they have still to read, up to
+    // `readahead_blocks` past the frame being read by the main thread
+    uint32_t num_prefetch_threads;
+    std::mutex prefetch_lock;
+    std::condition_variable prefetch_cond;
+    size_t prefetch_ind, prefetch_read_ind;
+    bool prefetch_done;
+
     // the dataset state for the time axis
     state_id_t tstate_id;
 
@@ -244,6 +316,7 @@ RawReader<T>::RawReader(Config& config, const std::string& unique_name,
 
     filename = config.get<std::string>(unique_name, "infile");
     readahead_blocks = config.get<size_t>(unique_name, "readahead_blocks");
+    num_prefetch_threads = config.get_default<uint32_t>(unique_name, "prefetch_threads", 0);
     max_read_rate = config.get_default<double>(unique_name, "max_read_rate", 0.0);
     sleep_time = config.get_default<float>(unique_name, "sleep_time", -1);
     update_dataset_id = config.get_default<bool>(unique_name, "update_dataset_id", true);
@@ -345,6 +418,56 @@ RawReader<T>::RawReader(Config& config, const std::string& unique_name,
     DEBUG("Metadata fields. frame_size: {}, metadata_size: {}, data_size: {}, nfreq: {}, ntime: {}",
           file_frame_size, metadata_size, data_size, nfreq, ntime);
 
+    // Select the times and frequencies to read
+    file_ntime = ntime;
+    file_nfreq = nfreq;
+    double start_time = config.get_default<double>(unique_name, "start_time", 0.0);
+    double end_time = config.get_default<double>(unique_name, "end_time", -1.0);
+
+    std::vector<time_ctype> sel_times;
+    for (size_t ti = 0; ti < file_ntime; ti++) {
+        double t = _times[ti].ctime;
+        if (t >= start_time && (end_time < 0 || t < end_time)) {
+            time_inds.push_back(ti);
+            sel_times.push_back(_times[ti]);
+        }
+    }
+
+    std::vector<std::pair<uint32_t, freq_ctype>> sel_freqs;
+    std::set<uint32_t> freq_ids;
+    if (config.exists(unique_name, "freq_ids")) {
+        for (auto id : config.get<std::vector<uint32_t>>(unique_name, "freq_ids")) {
+            if (std::find_if(_freqs.begin(), _freqs.end(), [id](auto& f) { return f.first == id; })
+                == _freqs.end())
+                throw std::invalid_argument(
+                    fmt::format(fmt("RawReader: config: Frequency ID {:d} is not in file {:s}."),
+                                id, filename));
+            freq_ids.insert(id);
+        }
+    }
+    // Keep the frequencies in the order of the file
+    for (size_t fi = 0; fi < file_nfreq; fi++) {
+        if (freq_ids.empty() || freq_ids.count(_freqs[fi].first)) {
+            freq_inds.push_back(fi);
+            sel_freqs.push_back(_freqs[fi]);
+        }
+    }
+
+    if (time_inds.empty() || freq_inds.empty())
+        throw std::invalid_argument(fmt::format(
+            fmt("RawReader: config: The time and frequency selection contains none of file {:s} "
+                "({:d} times and {:d} frequencies)."),
+            filename, time_inds.size(), freq_inds.size()));
+
+    bool freq_subset = (sel_freqs.size() != _freqs.size());
+    _times = std::move(sel_times);
+    _freqs = std::move(sel_freqs);
+    ntime = _times.size();
+    nfreq = _freqs.size();
+
+    INFO("Reading {:d} of {:d} times and {:d} of {:d} frequencies.", ntime, file_ntime, nfreq,
+         file_nfreq);
+
     if (chunked) {
         // Special case if dimensions less than chunk size
         chunk_f = std::min(chunk_f, nfreq);
@@ -370,7 +493,11 @@ RawReader<T>::RawReader(Config& config, const std::string& unique_name,
         datasetManager& dm = datasetManager::instance();
         tstate_id = dm.create_state<timeState>(_times).first;
 
-        if (!use_comet) {
+        if (use_comet && freq_subset) {
+            // Replace the frequencies of the datasets in the file too
+            states.push_back(tstate_id);
+            states.push_back(dm.create_state<freqState>(_freqs).first);
+        } else if (!use_comet) {
             // Add the states: metadata, time, freq
             states.push_back(tstate_id);
             states.push_back(dm.create_state<freqState>(_freqs).first);
@@ -387,16 +514,18 @@ RawReader<T>::RawReader(Config& config, const std::string& unique_name,
         throw std::runtime_error(
             fmt::format(fmt("Failed to open file {:s}.data: {:s}."), filename, strerror(errno)));
     }
-    mapped_file =
-        (uint8_t*)mmap(nullptr, ntime * nfreq * file_frame_size, PROT_READ, MAP_SHARED, fd, 0);
+    mapped_file = (uint8_t*)mmap(nullptr, file_ntime * file_nfreq * file_frame_size, PROT_READ,
+                                 MAP_SHARED, fd, 0);
     if (mapped_file == MAP_FAILED)
         throw std::runtime_error(fmt::format(fmt("Failed to map file {:s}.data to memory: {:s}."),
                                              filename, strerror(errno)));
+
+    read_index();
 }
 
 template<typename T>
 RawReader<T>::~RawReader() {
-    if (munmap(mapped_file, ntime * nfreq * file_frame_size) == -1) {
+    if (munmap(mapped_file, file_ntime * file_nfreq * file_frame_size) == -1) {
         // Make sure kotekan is exiting...
         FATAL_ERROR("Failed to unmap file {:s}.data: {:s}.", filename, strerror(errno));
     }
@@ -411,7 +540,7 @@ void RawReader<T>::main_thread() {
     frameID frame_id(out_buf);
     uint8_t* frame;
 
-    size_t ind = 0, read_ind = 0, file_ind;
+    size_t ind = 0, read_ind = 0, pos, file_ind;
 
     size_t nframe = nfreq * ntime;
 
@@ -422,8 +551,20 @@ void RawReader<T>::main_thread() {
     DEBUG("Minimum read time per frame {}s", min_read_time);
 
     readahead_blocks = std::min(nframe, readahead_blocks);
-    // Initial readahead for frames
-    for (read_ind = 0; read_ind < readahead_blocks; read_ind++) {
+
+    // Register the datasets in the index now, rather than while streaming
+    for (auto& ds_id : index_dataset_ids)
+        get_dataset_state(ds_id);
+
+    // Start the threads reading ahead, or do the initial readahead for frames
+    std::vector<std::thread> prefetchers;
+    prefetch_ind = 0;
+    prefetch_read_ind = 0;
+    prefetch_done = false;
+    for (uint32_t i = 0; i < num_prefetch_threads; i++) {
+        prefetchers.emplace_back(&RawReader<T>::prefetch_thread, this, nframe);
+    }
+    for (read_ind = 0; num_prefetch_threads == 0 && read_ind < readahead_blocks; read_ind++) {
         read_ahead(read_ind);
     }
 
@@ -438,18 +579,21 @@ void RawReader<T>::main_thread() {
         }
 
         // Issue the read ahead request
-        if (read_ind < (ntime * nfreq)) {
+        if (num_prefetch_threads == 0 && read_ind < nframe) {
             read_ahead(read_ind);
         }
 
         // Get the index into the file
-        file_ind = position_map(ind);
+        pos = position_map(ind);
+        file_ind = file_index(pos);
 
         // Allocate the metadata space
         allocate_new_metadata_object(out_buf, frame_id);
 
-        // Check first byte indicating empty frame
-        if (*(mapped_file + file_ind * file_frame_size) != 0) {
+        // Check the index, or the first byte, indicating empty frame
+        bool valid = frame_valid.empty() ? *(mapped_file + file_ind * file_frame_size) != 0
+                                         : frame_valid[pos] != 0;
+        if (valid) {
             // Copy the metadata from the file
             std::memcpy(out_buf->metadata[frame_id]->metadata,
                         mapped_file + file_ind * file_frame_size + 1, metadata_size);
@@ -484,6 +628,13 @@ void RawReader<T>::main_thread() {
         read_ind++;
         ind++;
 
+        // Let the prefetch threads move on
+        if (num_prefetch_threads > 0) {
+            std::lock_guard<std::mutex> lock(prefetch_lock);
+            prefetch_read_ind = ind;
+            prefetch_cond.notify_all();
+        }
+
         // Get the end time for the loop and sleep for long enough to satisfy
         // the max rate
         end_time = current_time();
@@ -495,6 +646,15 @@ void RawReader<T>::main_thread() {
         }
     }
 
+    // Stop the prefetch threads
+    {
+        std::lock_guard<std::mutex> lock(prefetch_lock);
+        prefetch_done = true;
+        prefetch_cond.notify_all();
+    }
+    for (auto& t : prefetchers)
+        t.join();
+
     if (sleep_time > 0) {
         INFO("Read all data. Sleeping and then exiting kotekan...");
         timespec ts = double_to_ts(sleep_time);
@@ -526,7 +686,7 @@ dset_id_t RawReader<T>::get_dataset_state(dset_id_t ds_id) {
     } else if (use_comet) {
         INFO("Registering new dataset with broker based on {}.", ds_id);
         datasetManager& dm = datasetManager::instance();
-        new_id = dm.add_dataset(tstate_id, ds_id);
+        new_id = states.empty() ? dm.add_dataset(tstate_id, ds_id) : dm.add_dataset(states, ds_id);
     } else {
         new_id = static_out_dset_id;
     }
@@ -538,7 +698,7 @@ dset_id_t RawReader<T>::get_dataset_state(dset_id_t ds_id) {
 template<typename T>
 void RawReader<T>::read_ahead(int ind) {
 
-    off_t offset = position_map(ind) * file_frame_size;
+    off_t offset = file_index(position_map(ind)) * file_frame_size;
 
     if (madvise(mapped_file + offset, file_frame_size, MADV_WILLNEED) == -1)
         DEBUG("madvise failed: {:s}", strerror(errno));
@@ -565,6 +725,99 @@ int RawReader<T>::position_map(int ind) {
     return ind;
 }
 
+template<typename T>
+size_t RawReader<T>::file_index(size_t pos) {
+    return time_inds[pos / nfreq] * file_nfreq + freq_inds[pos % nfreq];
+}
+
+template<typename T>
+void RawReader<T>::read_index() {
+
+    std::string index_filename = filename + ".index";
+    int index_fd = open(index_filename.c_str(), O_RDONLY);
+    if (index_fd == -1) {
+        DEBUG("No index file {:s}, checking the frames for data instead.", index_filename);
+        return;
+    }
+
+    auto& structure = metadata_json["structure"];
+    if (structure.find("index_entry_size") == structure.end()
+        || structure["index_entry_size"].template get<size_t>() != sizeof(rawIndexEntry)) {
+        WARN("Ignoring index file {:s}, as it doesn't match this version of kotekan.",
+             index_filename);
+        close(index_fd);
+        return;
+    }
+
+    // Read a row of the index at a time, the frames past the end of the file
+    // (if the writer stopped early) are left empty
+    std::vector<rawIndexEntry> row(file_nfreq);
+    size_t num_valid = 0, num_bad_freq = 0;
+    frame_valid.assign(ntime * nfreq, 0);
+
+    for (size_t ti = 0; ti < ntime; ti++) {
+        size_t row_bytes = file_nfreq * sizeof(rawIndexEntry);
+        std::fill(row.begin(), row.end(), rawIndexEntry{0, 0, dset_id_t::null});
+        ssize_t nread = TEMP_FAILURE_RETRY(
+            pread(index_fd, row.data(), row_bytes, time_inds[ti] * row_bytes));
+        if (nread == -1) {
+            close(index_fd);
+            throw std::runtime_error(fmt::format(fmt("Failed to read index file {:s}: {:s}."),
+                                                 index_filename, strerror(errno)));
+        }
+
+        for (size_t fi = 0; fi < nfreq; fi++) {
+            const rawIndexEntry& entry = row[freq_inds[fi]];
+            if (!entry.valid)
+                continue;
+            if (entry.freq_id != _freqs[fi].first)
+                num_bad_freq++;
+            frame_valid[ti * nfreq + fi] = 1;
+            index_dataset_ids.insert(entry.dataset_id);
+            num_valid++;
+        }
+    }
+    close(index_fd);
+
+    if (num_bad_freq > 0)
+        WARN("{:d} frames in index file {:s} have different frequency IDs than the file metadata.",
+             num_bad_freq, index_filename);
+
+    INFO("Index file {:s} has {:d} of the {:d} selected frames, in {:d} datasets.", index_filename,
+         num_valid, frame_valid.size(), index_dataset_ids.size());
+}
+
+template<typename T>
+void RawReader<T>::prefetch_thread(size_t nframe) {
+
+    std::vector<uint8_t> scratch(file_frame_size);
+    std::unique_lock<std::mutex> lock(prefetch_lock);
+
+    while (true) {
+        prefetch_cond.wait(lock, [&]() {
+            return prefetch_done || prefetch_ind >= nframe
+                   || prefetch_ind < prefetch_read_ind + readahead_blocks;
+        });
+        if (prefetch_done || prefetch_ind >= nframe)
+            break;
+
+        // Skip the frames the main thread has already got to
+        size_t ind = std::max(prefetch_ind, prefetch_read_ind);
+        prefetch_ind = ind + 1;
+        if (ind >= nframe)
+            continue;
+        size_t pos = position_map(ind);
+        if (!frame_valid.empty() && !frame_valid[pos])
+            continue;
+
+        lock.unlock();
+        off_t offset = file_index(pos) * file_frame_size;
+        if (TEMP_FAILURE_RETRY(pread(fd, scratch.data(), file_frame_size, offset)) == -1)
+            DEBUG("prefetch failed: {:s}", strerror(errno));
+        lock.lock();
+    }
+}
+
 
 /**
  * @class ensureOrdered
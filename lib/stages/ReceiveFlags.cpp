@@ -35,41 +35,50 @@ using kotekan::Stage;
 using kotekan::prometheus::Metrics;
 
 REGISTER_KOTEKAN_STAGE(ReceiveFlags);
+REGISTER_VIS_OPERATION(ReceiveFlagsOperation, "ReceiveFlags");
 
 
 ReceiveFlags::ReceiveFlags(Config& config, const std::string& unique_name,
                            bufferContainer& buffer_container) :
     Stage(config, unique_name, buffer_container, std::bind(&ReceiveFlags::main_thread, this)),
-    receiveflags_late_frame_counter(
-        Metrics::instance().add_counter("kotekan_receiveflags_late_frame_count", unique_name)),
-    receiveflags_update_age_metric(
-        Metrics::instance().add_gauge("kotekan_receiveflags_update_age_seconds", unique_name)),
-    late_updates_counter(
-        Metrics::instance().add_counter("kotekan_receiveflags_late_update_count", unique_name)) {
+    flags_op(config, unique_name) {
     // Setup the buffers
     buf_in = get_buffer("in_buf");
     buf_out = get_buffer("out_buf");
     register_consumer(buf_in, unique_name.c_str());
     register_producer(buf_out, unique_name.c_str());
+}
 
+ReceiveFlagsOperation::ReceiveFlagsOperation(Config& config, const std::string& path) :
+    VisOperation(config, path),
+    receiveflags_late_frame_counter(
+        Metrics::instance().add_counter("kotekan_receiveflags_late_frame_count", path)),
+    receiveflags_update_age_metric(
+        Metrics::instance().add_gauge("kotekan_receiveflags_update_age_seconds", path)),
+    late_updates_counter(
+        Metrics::instance().add_counter("kotekan_receiveflags_late_update_count", path)) {
     // Apply kotekan config
-    int num = config.get<int>(unique_name, "num_elements");
+    int num = config.get<int>(path, "num_elements");
     if (num < 0)
         throw std::invalid_argument("ReceiveFlags: config: invalid value for"
                                     " num_elements: "
                                     + std::to_string(num));
     num_elements = static_cast<size_t>(num);
-    num_kept_updates = config.get_default<uint32_t>(unique_name, "num_kept_updates", 5);
+    num_kept_updates = config.get_default<uint32_t>(path, "num_kept_updates", 5);
 
     /// FIFO for flags updates
     flags.resize(num_kept_updates);
 
+    receiveflags_update_age_metric.set(0);
+
     // we are ready to receive updates with the callback function now!
     // register as a subscriber with configUpdater
-    configUpdater::instance().subscribe(this, std::bind(&ReceiveFlags::flags_callback, this, _1));
+    configUpdater::instance().subscribe(
+        config.get<std::string>(path, "updatable_config"),
+        std::bind(&ReceiveFlagsOperation::flags_callback, this, _1));
 }
 
-bool ReceiveFlags::flags_callback(nlohmann::json& json) {
+bool ReceiveFlagsOperation::flags_callback(nlohmann::json& json) {
     std::vector<float> flags_received(num_elements);
     std::fill(flags_received.begin(), flags_received.end(), 1.0);
     double ts;
@@ -142,10 +151,6 @@ void ReceiveFlags::main_thread() {
     frameID frame_id_in(buf_in);
     frameID frame_id_out(buf_out);
 
-    timespec ts_late = {0, 0};
-
-    receiveflags_update_age_metric.set(-ts_to_double(ts_late));
-
     while (!stop_thread) {
 
         // Wait for an input frame
@@ -160,11 +165,8 @@ void ReceiveFlags::main_thread() {
         // Copy frame into output buffer
         auto frame_out = VisFrameView::copy_frame(buf_in, frame_id_in, buf_out, frame_id_out);
 
-        // get the frames timestamp
-        ts_frame = std::get<1>(frame_out.time);
-
         // Output frame is only valid if we have a valid update for this frame
-        bool success = copy_flags_into_frame(frame_out);
+        bool success = flags_op.prepare(frame_out);
 
         // Mark input frame empty
         mark_frame_empty(buf_in, unique_name.c_str(), frame_id_in++);
@@ -175,9 +177,12 @@ void ReceiveFlags::main_thread() {
     }
 }
 
-bool ReceiveFlags::copy_flags_into_frame(const VisFrameView& frame_out) {
+bool ReceiveFlagsOperation::prepare(VisFrameView& frame_out) {
     auto& dm = datasetManager::instance();
 
+    // get the frames timestamp
+    ts_frame = std::get<1>(frame_out.time);
+
     std::lock_guard<std::mutex> lock(flags_lock);
 
     // Get and unpack the update
@@ -8,6 +8,7 @@
 
 #include "Config.hpp"            // for Config
 #include "Stage.hpp"             // for Stage
+#include "VisOperation.hpp"      // for VisOperation
 #include "buffer.h"              // for Buffer
 #include "bufferContainer.hpp"   // for bufferContainer
 #include "datasetManager.hpp"    // for dset_id_t, state_id_t
@@ -26,28 +27,18 @@
 #include <vector>   // for vector
 
 /**
- * @class ReceiveFlags
- * @brief Receives input flags and adds them to the output buffer.
+ * @class ReceiveFlagsOperation
+ * @brief Sets the input flags of visibility frames from an updatable config block.
  *
- * This stage registeres as a subscriber to an updatable config block. The
- * full name of the block should be defined in the value \<updatable_block\>
- *
- * @note If there are no other consumers on the input buffer it will be able to
- *       do a much faster zero copy transfer of the frame from input to output
- *       buffer.
- *
- * @par Buffers
- * @buffer in_buf The input stream.
- *         @buffer_format VisBuffer.
- *         @buffer_metadata VisMetadata
- * @buffer out_buf The output stream.
- *         @buffer_format VisBuffer.
- *         @buffer_metadata VisMetadata
+ * The work of @c ReceiveFlags, usable in a @c VisChain. It subscribes to the
+ * updatable config block named by @c updatable_config, and drops frames older than
+ * all of the updates it still holds.
  *
- * @conf   num_elements     Int.    The number of elements (i.e. inputs) in the
+ * @conf   num_elements      Int. The number of elements (i.e. inputs) in the
  *   correlator data.
- * @conf   updatable_block  String. The full name of the updatable_block that
+ * @conf   updatable_config  String. The full name of the updatable_block that
  *   will provide new flagging values (e.g. "/dynamic_block/flagging").
+ * @conf   num_kept_updates  Int, default 5. The number of flag updates to keep.
  *
  * @par Metrics
  * @metric kotekan_receiveflags_late_update_count The number of updates received
@@ -59,26 +50,20 @@
  * @metric kotekan_receiveflags_update_age_seconds The time difference in
  *   seconds between the current frame being processed and the time stamp of
  *   the flag update being applied.
- *
- * @author Rick Nitsche
  */
-class ReceiveFlags : public kotekan::Stage {
+class ReceiveFlagsOperation : public VisOperation {
 public:
-    /// Constructor
-    ReceiveFlags(kotekan::Config& config, const std::string& unique_name,
-                 kotekan::bufferContainer& buffer_container);
+    /// Constructor, subscribes to the flag updates
+    ReceiveFlagsOperation(kotekan::Config& config, const std::string& path);
 
-    /// Main loop, saves flags in the frames
-    void main_thread() override;
+    /// Copy the freshest flags into the frame or return false if no valid update for
+    /// this frame is available
+    bool prepare(VisFrameView& frame) override;
 
     /// This will be called by configUpdater
     bool flags_callback(nlohmann::json& json);
 
 private:
-    /// Copy the freshest flags into the frame or return false if no valid update for
-    /// this frame is available
-    bool copy_flags_into_frame(const VisFrameView& frame_out);
-
     // this is faster than std::queue/deque
     /// The bad_input chan_id's and when to start applying them in a FIFO
     /// (len set by config)
@@ -89,12 +74,6 @@ private:
     // timesamples coming out of order.
     std::map<std::pair<state_id_t, dset_id_t>, dset_id_t> output_dataset_ids;
 
-    /// Input buffer
-    Buffer* buf_in;
-
-    /// Output buffer
-    Buffer* buf_out;
-
     /// To make sure flags are not modified and saved at the same time
     std::mutex flags_lock;
 
@@ -118,4 +97,46 @@ private:
     uint32_t num_kept_updates;
 };
 
+/**
+ * @class ReceiveFlags
+ * @brief Receives input flags and adds them to the output buffer.
+ *
+ * This stage registeres as a subscriber to an updatable config block. The
+ * full name of the block should be defined in the value \<updatable_config\>
+ * See @c ReceiveFlagsOperation for the config and metrics.
+ *
+ * @note If there are no other consumers on the input buffer it will be able to
+ *       do a much faster zero copy transfer of the frame from input to output
+ *       buffer.
+ *
+ * @par Buffers
+ * @buffer in_buf The input stream.
+ *         @buffer_format VisBuffer.
+ *         @buffer_metadata VisMetadata
+ * @buffer out_buf The output stream.
+ *         @buffer_format VisBuffer.
+ *         @buffer_metadata VisMetadata
+ *
+ * @author Rick Nitsche
+ */
+class ReceiveFlags : public kotekan::Stage {
+public:
+    /// Constructor
+    ReceiveFlags(kotekan::Config& config, const std::string& unique_name,
+                 kotekan::bufferContainer& buffer_container);
+
+    /// Main loop, saves flags in the frames
+    void main_thread() override;
+
+private:
+    /// Input buffer
+    Buffer* buf_in;
+
+    /// Output buffer
+    Buffer* buf_out;
+
+    /// Sets the flags of each frame
+    ReceiveFlagsOperation flags_op;
+};
+
 #endif /* RECEIVEFLAGS_H */
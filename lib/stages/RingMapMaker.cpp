@@ -4,6 +4,7 @@
 #include "Stack.hpp"             // for chimeFeed
 #include "StageFactory.hpp"      // for REGISTER_KOTEKAN_STAGE, StageMakerTemplate
 #include "Telescope.hpp"         // for Telescope
+#include "WorkPool.hpp"          // for OrderedTasks
 #include "dataset.hpp"           // for dataset
 #include "datasetManager.hpp"    // for datasetManager, dset_id_t, state_id_t, fingerprint_t
 #include "kotekanLogging.hpp"    // for FATAL_ERROR, WARN, INFO
@@ -13,7 +14,7 @@
 #include "gsl-lite.hpp" // for span, span<>::iterator
 
 #include <atomic>       // for atomic_bool
-#include <cblas.h>      // for cblas_cgemv, CblasNoTrans, CblasRowMajor
+#include <cblas.h>      // for cblas_cgemm, CblasNoTrans, CblasRowMajor, CblasTrans
 #include <complex>      // for operator*, complex, operator/, norm, operator-, operato...
 #include <cstdint>      // for uint64_t, uint32_t
 #include <cxxabi.h>     // for __forced_unwind
@@ -21,7 +22,7 @@
 #include <functional>   // for _Bind_helper<>::type, _Placeholder, bind, _1, function, _2
 #include <future>       // for async, future
 #include <iterator>     // for begin, end, back_insert_iterator, back_inserter
-#include <memory>       // for allocator_traits<>::value_type
+#include <memory>       // for allocator_traits<>::value_type, make_shared, shared_ptr
 #include <numeric>      // for iota
 #include <optional>     // for optional
 #include <regex>        // for match_results<>::_Base_type
@@ -34,6 +35,7 @@ using namespace std::placeholders;
 using kotekan::bufferContainer;
 using kotekan::Config;
 using kotekan::HTTP_RESPONSE;
+using kotekan::OrderedTasks;
 using kotekan::restServer;
 using kotekan::Stage;
 using kotekan::prometheus::Metrics;
@@ -61,14 +63,14 @@ RingMapMaker::RingMapMaker(Config& config, const std::string& unique_name,
     if (apod_param.count(apodization) == 0)
         FATAL_ERROR("Unknown apodization window '{}'", apodization);
     exclude_autos = config.get_default<bool>(unique_name, "exclude_autos", true);
+    batch_size = config.get_default<uint32_t>(unique_name, "batch_size", 1);
+    num_threads = config.get_default<uint32_t>(unique_name, "num_threads", 1);
+    if (batch_size == 0)
+        throw std::invalid_argument("RingMapMaker: batch_size has to be at least 1.");
 }
 
 void RingMapMaker::main_thread() {
 
-    // coefficients of CBLAS multiplication
-    float alpha = 1.;
-    float beta = 0.;
-
     frameID in_frame_id(in_buf);
 
     if (!setup(in_frame_id))
@@ -78,11 +80,23 @@ void RingMapMaker::main_thread() {
     // TODO: this is not at all generic
     size_t offset;
     uint p_special = 2; // This is the pol that is shorter than the others
-    std::vector<cfloat> special_vis(num_bl);
     // We will need to cast weights into complex
     std::vector<float> frame_var(num_stack);
-    // Buffers to hold result before saving real part
-    std::vector<cfloat> tmp_vismap(num_pix);
+
+    // The samples waiting to be made into maps, for each frequency
+    std::map<uint32_t, timeBatch> batches;
+
+    // Make the maps for a batch, on the work pool if we are using more than one thread
+    OrderedTasks tasks;
+    auto submit_batch = [&](uint32_t f_id, timeBatch&& batch) {
+        if (num_threads <= 1) {
+            make_maps(f_id, batch);
+            return;
+        }
+        tasks.wait(num_threads - 1);
+        auto b = std::make_shared<timeBatch>(std::move(batch));
+        tasks.submit([this, f_id, b]() { make_maps(f_id, *b); }, nullptr);
+    };
 
     auto& dm = datasetManager::instance();
 
@@ -121,10 +135,13 @@ void RingMapMaker::main_thread() {
             if (state_id != fstate_id)
                 WARN("Freq state has changed from {} to {}.", fstate_id, state_id);
 
-            // Wipe map and regenerate matrices
+            // Wipe map and regenerate matrices, once nothing is using them
             WARN("Clearing maps and regenerating matrices...");
+            tasks.wait();
+            batches.clear();
             if (!setup(in_frame_id))
                 return;
+            frame_var.resize(num_stack);
         }
 
         // Find the time index to append to
@@ -135,10 +152,19 @@ void RingMapMaker::main_thread() {
             std::transform(input_frame.weight.begin(), input_frame.weight.begin() + num_stack,
                            frame_var.begin(),
                            [](const float& a) { return (a != 0.) ? 1. / a : 0.; });
-            mtx.lock();
+
+            timeBatch& batch = batches[f_id];
+            if (batch.ctime.empty()) {
+                batch.vis.resize(num_pol * batch_size * num_bl);
+                batch.weight.resize(num_pol * batch_size);
+                batch.ctime.reserve(batch_size);
+            }
+            size_t s = batch.ctime.size();
+            batch.ctime.push_back(t.ctime);
+
             for (uint p = 0; p < num_pol; p++) {
-                // Pointer to the span of visibilities for this pol
-                cfloat* input_vis;
+                // Where this sample goes in the batch
+                cfloat* batch_vis = batch.vis.data() + (p * batch_size + s) * num_bl;
 
                 // Sum of variances for this pol
                 float var = 0.;
@@ -147,44 +173,77 @@ void RingMapMaker::main_thread() {
                 if (p != p_special) {
                     // Need offset to account for missing cross-pol
                     offset -= (p > p_special);
-                    input_vis = input_frame.vis.data() + offset;
+                    std::copy(input_frame.vis.begin() + offset,
+                              input_frame.vis.begin() + offset + num_bl, batch_vis);
                 } else {
-                    // For now just copy the visibility. This might be slow...
                     std::copy(input_frame.vis.begin() + p * num_bl,
-                              input_frame.vis.begin() + (p + 1) * num_bl - 1,
-                              special_vis.begin() + 1);
+                              input_frame.vis.begin() + (p + 1) * num_bl - 1, batch_vis + 1);
                     // Add missing cross-pol
-                    special_vis.at(0) = conj(input_frame.vis.at((p - 1) * num_bl));
+                    batch_vis[0] = conj(input_frame.vis.at((p - 1) * num_bl));
                     var = frame_var.at((p - 1) * num_bl);
-
-                    input_vis = special_vis.data();
-                }
-                // transform into map slice
-                std::fill(tmp_vismap.begin(), tmp_vismap.end(), cfloat(0., 0.));
-
-                // NOTE: in here we explicitly cast down to float, to fit the API of old versions of
-                // OpenBLAS which require (float *) for complex arrays. Newer versions just accept
-                // (void *).
-                cblas_cgemv(CblasRowMajor, CblasNoTrans, num_pix, num_bl, &alpha,
-                            (float*)vis2map.at(f_id).data(), num_bl, (float*)input_vis, 1, &beta,
-                            (float*)tmp_vismap.data(), 1);
-
-                // keep real part only
-                for (size_t i = 0; i < num_pix; i++) {
-                    map.at(f_id).at(p).at(t_ind * num_pix + i) = tmp_vismap.at(i).real();
                 }
                 // accumulate variances. for special pol, we already have the first entry
                 for (size_t i = 0; i < num_pix - (p == p_special); i++) {
                     var += frame_var.at(offset + i);
                 }
                 // variance of real part is half, we've divided by number of baselines
-                wgt.at(f_id).at(p).at(t_ind) = (var != 0.) ? 2. * num_bl * num_bl / var : 0.;
+                batch.weight[p * batch_size + s] = (var != 0.) ? 2. * num_bl * num_bl / var : 0.;
+            }
+
+            if (batch.ctime.size() == batch_size) {
+                submit_batch(f_id, std::move(batch));
+                batches.erase(f_id);
             }
-            mtx.unlock();
         }
         // Move to next frame
         mark_frame_empty(in_buf, unique_name.c_str(), in_frame_id++);
     }
+
+    // Make maps from the partial batches we have left
+    for (auto& [f_id, batch] : batches) {
+        submit_batch(f_id, std::move(batch));
+    }
+    tasks.wait();
+}
+
+void RingMapMaker::make_maps(uint32_t f_id, const timeBatch& batch) {
+
+    // coefficients of CBLAS multiplication
+    cfloat alpha = 1.;
+    cfloat beta = 0.;
+
+    size_t num_samples = batch.ctime.size();
+    const std::vector<cfloat>& m = vis2map.at(f_id);
+
+    // Buffers to hold result before saving real part
+    std::vector<cfloat> tmp_vismap(num_pix * num_samples);
+
+    for (uint p = 0; p < num_pol; p++) {
+        // transform all the samples into map slices at once, the samples are the
+        // rows of the batch so we multiply by its transpose
+        // NOTE: in here we explicitly cast down to float, to fit the API of old versions of
+        // OpenBLAS which require (float *) for complex arrays. Newer versions just accept
+        // (void *).
+        cblas_cgemm(CblasRowMajor, CblasNoTrans, CblasTrans, num_pix, num_samples, num_bl,
+                    (float*)&alpha, (float*)m.data(), num_bl,
+                    (float*)(batch.vis.data() + p * batch_size * num_bl), num_bl, (float*)&beta,
+                    (float*)tmp_vismap.data(), num_samples);
+
+        std::lock_guard<std::mutex> lock(mtx);
+        for (size_t s = 0; s < num_samples; s++) {
+            // The time may have been dropped from the map while this sample was waiting
+            auto t = times_map.find(batch.ctime[s]);
+            if (t == times_map.end())
+                continue;
+            size_t t_ind = t->second;
+
+            // keep real part only
+            for (size_t i = 0; i < num_pix; i++) {
+                map.at(f_id).at(p).at(t_ind * num_pix + i) = tmp_vismap[i * num_samples + s].real();
+            }
+            wgt.at(f_id).at(p).at(t_ind) = batch.weight[p * batch_size + s];
+        }
+    }
 }
 
 void RingMapMaker::rest_callback_get(kotekan::connectionInstance& conn) {
@@ -39,6 +39,13 @@
  * @conf feed_sep       Float, default 0.3048. The separation between feeds (in m)
  * @conf apodization    String, default nuttall. The type of window to use for apodization.
  * @conf exclude_autos  Bool, default true. Exclude the autos from the maps.
+ * @conf batch_size     Int, default 1. The number of time samples of each frequency to
+ *                      collect before making their maps with one matrix multiplication.
+ *                      Larger batches make better use of the map making matrices, but
+ *                      delay the maps by up to this many samples.
+ * @conf num_threads    Int, default 1. The number of batches to make maps from at once,
+ *                      on the work pool. With one thread the maps are made on the stage
+ *                      thread.
  *
  *
  * @author Tristan Pinsonneault-Marotte
@@ -69,6 +76,19 @@ private:
 
     int64_t resolve_time(time_ctype t);
 
+    /// The time samples of one frequency waiting to be made into maps
+    struct timeBatch {
+        /// Visibilities, packed as [pol][sample][baseline] with room for batch_size samples
+        std::vector<cfloat> vis;
+        /// Map weights, packed as [pol][sample]
+        std::vector<float> weight;
+        /// The time of each sample
+        std::vector<double> ctime;
+    };
+
+    /// Make the maps for a batch of samples and copy them into the ringmap.
+    void make_maps(uint32_t f_id, const timeBatch& batch);
+
     inline float wl(float freq) {
         return 299.792458 / freq;
     };
@@ -110,6 +130,8 @@ private:
     float feed_sep;
     std::string apodization;
     bool exclude_autos;
+    uint32_t batch_size;
+    uint32_t num_threads;
 
     // Mutex for reading and writing to maps
     std::mutex mtx;
@@ -3,6 +3,7 @@
 #include "Config.hpp"            // for Config
 #include "Hash.hpp"              // for Hash, operator!=
 #include "SystemInterface.hpp"   // for get_hostname, get_username
+#include "WorkPool.hpp"          // for WorkPool, OrderedTasks
 #include "buffer.h"              // for wait_for_full_frame, mark_frame_empty, register_consumer
 #include "bufferContainer.hpp"   // for bufferContainer
 #include "dataset.hpp"           // for dataset
@@ -16,7 +17,7 @@
 #include "fmt.hpp" // for format
 
 #include <algorithm>    // for max, fill, min
-#include <atomic>       // for atomic_bool
+#include <atomic>       // for atomic_bool, atomic
 #include <cxxabi.h>     // for __forced_unwind
 #include <exception>    // for exception
 #include <functional>   // for _Bind_helper<>::type, bind, function
@@ -27,11 +28,13 @@
 #include <stdexcept>    // for out_of_range, invalid_argument
 #include <stdint.h>     // for uint32_t, uint64_t
 #include <system_error> // for system_error
+#include <utility>      // for pair
 
 
 using kotekan::bufferContainer;
 using kotekan::Config;
 using kotekan::Stage;
+using kotekan::WorkPool;
 using kotekan::prometheus::Metrics;
 
 Transpose::Transpose(Config& config, const std::string& unique_name,
@@ -48,6 +51,12 @@ Transpose::Transpose(Config& config, const std::string& unique_name,
     timeout =
         std::chrono::duration<float>(config.get_default<float>(unique_name, "comet_timeout", 60.));
 
+    num_threads = config.get_default<uint32_t>(unique_name, "num_threads", 1);
+    chunks_in_flight = config.get_default<uint32_t>(unique_name, "chunks_in_flight", 2);
+    if (num_threads < 1 || chunks_in_flight < 1)
+        throw std::invalid_argument("Transpose: Config: num_threads and chunks_in_flight need to "
+                                    "be equal to or greater than one.");
+
     // Collect some metadata. The rest is requested from the datasetManager,
     // once we received the first frame.
     metadata["notes"] = "";
@@ -183,6 +192,7 @@ void Transpose::main_thread() {
         if (ti == write_t) {
             // chunk is complete
             write_chunk(t_ind, f_ind);
+            submit_chunk();
             // increment between chunks
             increment_chunk(t_ind, f_ind, t_edge, f_edge);
             fi = 0;
@@ -195,11 +205,61 @@ void Transpose::main_thread() {
         frames_so_far++;
         // Exit when all frames have been written
         if (frames_so_far == num_time * num_freq) {
+            write_tasks.wait();
             INFO("Done. Exiting.");
             exit_kotekan(ReturnCode::CLEAN_EXIT);
             return;
         }
     }
+
+    write_tasks.wait();
+}
+
+void Transpose::submit_chunk() {
+
+    // Limit the number of chunk copies held
+    write_tasks.wait(chunks_in_flight - 1);
+
+    auto blocks = std::make_shared<std::vector<queuedBlock>>();
+    blocks->swap(queued_blocks);
+
+    // List the HDF5 chunks of all the blocks, to compress them all in parallel
+    auto chunks = std::make_shared<std::vector<std::pair<size_t, size_t>>>();
+    for (size_t b = 0; b < blocks->size(); b++) {
+        for (size_t i = 0; i < (*blocks)[b].num_chunks; i++)
+            chunks->emplace_back(b, i);
+    }
+    auto failed = std::make_shared<std::atomic<bool>>(false);
+
+    write_tasks.submit(
+        [this, blocks, chunks, failed]() {
+            auto compress = [&](size_t n) {
+                auto [b, i] = (*chunks)[n];
+                try {
+                    (*blocks)[b].compress(i);
+                } catch (std::exception& e) {
+                    ERROR("Failed to compress a chunk: {:s}", e.what());
+                    *failed = true;
+                }
+            };
+            WorkPool::instance().parallel_for(chunks->size(), compress, num_threads - 1);
+
+            // Release the copies of the uncompressed data
+            for (auto& block : *blocks)
+                block.compress = nullptr;
+        },
+        [this, blocks, failed]() {
+            if (*failed) {
+                FATAL_ERROR("Couldn't compress the chunk.");
+                return;
+            }
+            try {
+                for (auto& block : *blocks)
+                    block.write();
+            } catch (std::exception& e) {
+                FATAL_ERROR("Failed to write a chunk: {:s}", e.what());
+            }
+        });
 }
 
 dset_id_t Transpose::base_dset(dset_id_t ds_id) {
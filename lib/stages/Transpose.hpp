@@ -8,21 +8,26 @@
 
 
 #include "Config.hpp"          // for Config
+#include "FileArchive.hpp"     // for FileArchive::compressedChunk, FileArchive
 #include "H5Support.hpp"       // for AtomicType<>::AtomicType, dset_id_str
 #include "Stage.hpp"           // for Stage
+#include "WorkPool.hpp"        // for OrderedTasks
 #include "buffer.h"            // for Buffer
 #include "bufferContainer.hpp" // for bufferContainer
 #include "datasetManager.hpp"  // for dset_id_t
+#include "transposeUtil.hpp"   // for strided_copy, tiledTranspose
 #include "visUtil.hpp"         // for cfloat, time_ctype, freq_ctype, input_ctype, prod_ctype
 
 #include "json.hpp" // for json
 
 #include <chrono>
-#include <stddef.h> // for size_t
-#include <stdint.h> // for uint32_t
-#include <string>   // for string
-#include <tuple>    // for tuple
-#include <vector>   // for vector
+#include <functional> // for function
+#include <memory>     // for shared_ptr, make_shared
+#include <stddef.h>   // for size_t
+#include <stdint.h>   // for uint32_t
+#include <string>     // for string
+#include <tuple>      // for tuple
+#include <vector>     // for vector
 
 
 /**
@@ -40,6 +45,8 @@
  *  write_chunk(size_t t_ind, size_t f_ind);
  *  increment_chunk(size_t &t_ind, size_t &f_ind, bool &t_edge, bool &f_edge);
  *
+ * @c write_chunk should pass each dataset of the chunk to @c queue_block.
+ *
  * The data is received as one-dimensional arrays
  * that represent flattened-out time-X-frequency matrices. These are transposed
  * and flattened out again to be written to a file. In other words,
@@ -48,6 +55,13 @@
  * This stage expects the data to be ordered like RawReader does.
  * Other stages might not guarentee this same order.
  *
+ * Once a chunk is complete it is copied, so the next one can be filled while
+ * it is written. If kotekan was built with @c USE_BITSHUFFLE the compressed
+ * datasets are split into their HDF5 chunks, which are compressed on the
+ * WorkPool and written with direct chunk writes. The HDF5 library is then only
+ * used for the writes themselves, which are done one chunk at a time and in
+ * order. Otherwise HDF5 compresses the chunks as they are written.
+ *
  * @warning Don't run this anywhere but on the transpose (gossec) node.
  * The OpenMP calls could cause issues on systems using kotekan pin
  * priority threads (likely the GPU nodes).
@@ -63,6 +77,11 @@
  *                              write to (e.g. "/path/to/0000_000", without .h5).
  * @conf   comet_timeout        Float, default 60. Timeout for communications with
  *                              dataset broker.
+ * @conf   num_threads          Int, default 1. The number of threads transposing
+ *                              the frames into each chunk, and compressing it.
+ * @conf   chunks_in_flight     Int, default 2. The number of complete chunks which
+ *                              can be waiting to be compressed or written. Reading
+ *                              from @c in_buf stops while there are this many.
  *
  * @par Metrics
  * @metric kotekan_transpose_data_transposed_bytes
@@ -84,6 +103,7 @@ protected:
     // Config values
     std::string filename;
     std::chrono::duration<float> timeout;
+    uint32_t num_threads;
 
     // Buffers
     Buffer* in_buf;
@@ -119,6 +139,26 @@ protected:
     // Datasets to be stored until ready to write
     std::vector<dset_id_str> dset_id;
 
+    /**
+     * @brief Queue a block of a dataset to be written with the current chunk
+     *
+     * The data is copied. If the archive can write the block with direct chunk
+     * writes it is compressed on the WorkPool, otherwise it is written with
+     * @c write_block.
+     *
+     * @param file    The archive.
+     * @param name    The dataset.
+     * @param f_ind   Frequency index of the chunk.
+     * @param t_ind   Time index of the chunk.
+     * @param data    The block, dense in the shape @c count.
+     * @param offset  Start of the block in the dataset, if it is compressed.
+     * @param count   Shape of the block, if it is compressed.
+     **/
+    template<typename A, typename T>
+    void queue_block(std::shared_ptr<A> file, const std::string& name, size_t f_ind,
+                     size_t t_ind, const std::vector<T>& data, std::vector<size_t> offset = {},
+                     std::vector<size_t> count = {});
+
 private:
     /// Request dataset states from the datasetManager and prepare all metadata
     /// that is not already set in the constructor.
@@ -144,15 +184,45 @@ private:
 
     /// Extract the base dataset ID
     dset_id_t base_dset(dset_id_t ds_id);
+
+    /// Compress and write the blocks queued for the current chunk
+    void submit_chunk();
+
+    /// A block of a dataset waiting to be written
+    struct queuedBlock {
+        /// The number of HDF5 chunks to compress, zero if HDF5 compresses them
+        size_t num_chunks;
+        std::function<void(size_t)> compress;
+        std::function<void()> write;
+    };
+    std::vector<queuedBlock> queued_blocks;
+
+    uint32_t chunks_in_flight;
+
+    /// Compresses the chunks on the pool, and writes them in order
+    kotekan::OrderedTasks write_tasks;
 };
 
-template<typename T>
-inline void strided_copy(T* in, T* out, size_t offset, size_t stride, size_t n_val) {
-#ifdef _OPENMP
-#pragma omp parallel for
-#endif
-    for (size_t i = 0; i < n_val; i++) {
-        out[offset + i * stride] = in[i];
+template<typename A, typename T>
+inline void Transpose::queue_block(std::shared_ptr<A> file, const std::string& name,
+                                   size_t f_ind, size_t t_ind, const std::vector<T>& data,
+                                   std::vector<size_t> offset, std::vector<size_t> count) {
+    auto block = std::make_shared<std::vector<T>>(data);
+
+    if (file->direct_chunk_write(name, offset, count)) {
+        size_t n = file->num_chunks(name, count);
+        auto chunks = std::make_shared<std::vector<FileArchive::compressedChunk>>(n);
+        queued_blocks.push_back(
+            {n,
+             [file, name, offset, count, block, chunks](size_t i) {
+                 (*chunks)[i] = file->compress_chunk(name, offset, count, block->data(), i);
+             },
+             [file, name, chunks]() { file->write_chunks(name, *chunks); }});
+    } else {
+        size_t f = write_f, t = write_t;
+        queued_blocks.push_back({0, nullptr, [file, name, f_ind, t_ind, f, t, block]() {
+                                     file->write_block(name, f_ind, t_ind, f, t, block->data());
+                                 }});
     }
 }
 
@@ -0,0 +1,99 @@
+#include "VisChain.hpp"
+
+#include "BufferHandle.hpp"      // for BufferConsumer, BufferProducer
+#include "Config.hpp"            // for Config
+#include "StageFactory.hpp"      // for REGISTER_KOTEKAN_STAGE, StageMakerTemplate
+#include "VisOperation.hpp"      // for VisOperation, FACTORY
+#include "WorkPool.hpp"          // for WorkPool
+#include "buffer.h"              // for Buffer
+#include "bufferContainer.hpp"   // for bufferContainer
+#include "prometheusMetrics.hpp" // for Metrics
+#include "visBuffer.hpp"         // for VisFrameView
+#include "visUtil.hpp"           // for frameID, modulo
+
+#include <algorithm>  // for min
+#include <atomic>     // for atomic_bool
+#include <exception>  // for exception
+#include <functional> // for _Bind_helper<>::type, bind, function
+#include <regex>      // for match_results<>::_Base_type
+#include <stdexcept>  // for invalid_argument
+
+using kotekan::bufferContainer;
+using kotekan::Config;
+using kotekan::Stage;
+using kotekan::WorkPool;
+using kotekan::prometheus::Metrics;
+
+REGISTER_KOTEKAN_STAGE(VisChain);
+
+// The number of products every operation is applied to in turn, small enough that
+// the visibilities and weights stay in the L2 cache
+#define VIS_CHAIN_TILE_SIZE 4096
+
+VisChain::VisChain(Config& config, const std::string& unique_name,
+                   bufferContainer& buffer_container) :
+    Stage(config, unique_name, buffer_container, std::bind(&VisChain::main_thread, this)),
+    in_buf(get_buffer("in_buf")), out_buf(get_buffer("out_buf")),
+    in_consumer(in_buf, unique_name), out_producer(out_buf, unique_name) {
+
+    num_frame_threads = config.get_default<uint32_t>(unique_name, "num_frame_threads", 1);
+    if (num_frame_threads == 0)
+        throw std::invalid_argument("VisChain: num_frame_threads has to be at least 1.");
+
+    for (const auto& name : config.get<std::vector<std::string>>(unique_name, "operations")) {
+        std::string path = unique_name + "/" + name;
+        std::string type = config.get<std::string>(path, "type");
+        operations.push_back(FACTORY(VisOperation)::create_unique(type, config, path));
+        operation_paths.push_back(path);
+    }
+    if (operations.empty())
+        throw std::invalid_argument("VisChain: needs at least one operation.");
+}
+
+VisChain::~VisChain() {
+    operations.clear();
+    for (const auto& path : operation_paths)
+        Metrics::instance().remove_stage_metrics(path);
+}
+
+void VisChain::main_thread() {
+
+    frameID in_frame_id(in_buf);
+    frameID out_frame_id(out_buf);
+
+    while (!stop_thread) {
+
+        if (in_consumer.wait_for_full_frame(in_frame_id) == nullptr)
+            break;
+        if (out_producer.wait_for_empty_frame(out_frame_id) == nullptr)
+            break;
+
+        auto frame = VisFrameView::copy_frame(in_buf, in_frame_id, out_buf, out_frame_id);
+
+        // Prepare the frame for each operation in turn, if one drops it we're done
+        bool keep = true;
+        for (auto& op : operations) {
+            if (!op->prepare(frame)) {
+                keep = false;
+                break;
+            }
+        }
+
+        in_consumer.mark_frame_empty(in_frame_id++);
+        if (!keep)
+            continue;
+
+        // Apply all the operations to one tile of products before the next
+        size_t num_prod = frame.num_prod;
+        size_t num_tiles = (num_prod + VIS_CHAIN_TILE_SIZE - 1) / VIS_CHAIN_TILE_SIZE;
+        auto apply_tile = [&](size_t tile) {
+            size_t start = tile * VIS_CHAIN_TILE_SIZE;
+            size_t end = std::min(start + VIS_CHAIN_TILE_SIZE, num_prod);
+            for (auto& op : operations)
+                op->apply(frame, start, end);
+        };
+        WorkPool::instance().parallel_for(num_tiles, apply_tile, num_frame_threads - 1);
+
+        out_producer.mark_frame_full(out_frame_id++);
+    }
+}
@@ -0,0 +1,82 @@
+/*****************************************
+@file
+@brief Run a chain of visibility operations on each frame in one pass.
+- VisChain : public kotekan::Stage
+*****************************************/
+#ifndef VIS_CHAIN_HPP
+#define VIS_CHAIN_HPP
+
+#include "BufferHandle.hpp"    // for BufferConsumer, BufferProducer
+#include "Config.hpp"          // for Config
+#include "Stage.hpp"           // for Stage
+#include "VisOperation.hpp"    // for VisOperation
+#include "buffer.h"            // for Buffer
+#include "bufferContainer.hpp" // for bufferContainer
+
+#include <memory>   // for unique_ptr
+#include <stdint.h> // for uint32_t
+#include <string>   // for string
+#include <vector>   // for vector
+
+/**
+ * @class VisChain
+ * @brief Applies a chain of operations to each visibility frame, in place.
+ *
+ * Running stages like @c applyGains, @c ReceiveFlags and @c VisTruncate one after
+ * another copies each frame between buffers and makes a pass over all of it in
+ * every stage. This stage runs the same work as a chain of @c VisOperation,
+ * copying each frame once (or swapping it, if this is the only consumer of
+ * @c in_buf) and making a single pass over the products.
+ *
+ * Each frame is first prepared by each operation in turn, which sets the
+ * dataset ID and anything else that isn't per product. If any of them drop the
+ * frame the rest never see it, as if they were separate stages. The products are
+ * then processed in tiles of @c VIS_CHAIN_TILE_SIZE, with every operation
+ * applied to a tile while it is in cache before moving onto the next one.
+ *
+ * The operations take their config from a block of this stage with the same name,
+ * which holds a @c type, the name of the stage they replace, and the config that
+ * stage would take. They register the same dataset states as that stage would.
+ * Stages which change the shape of the frame, like @c baselineCompression, have to
+ * stay separate.
+ *
+ * @par Buffers
+ * @buffer in_buf The input stream.
+ *         @buffer_format VisBuffer.
+ *         @buffer_metadata VisMetadata
+ * @buffer out_buf The output stream.
+ *         @buffer_format VisBuffer.
+ *         @buffer_metadata VisMetadata
+ *
+ * @conf   operations         List of strings. The names of the config blocks of
+ *                            the operations, in the order to apply them.
+ * @conf   num_frame_threads  Int, default 1. The number of threads processing
+ *                            the tiles of each frame, using the work pool.
+ */
+class VisChain : public kotekan::Stage {
+public:
+    /// Constructor, creates the operations
+    VisChain(kotekan::Config& config, const std::string& unique_name,
+             kotekan::bufferContainer& buffer_container);
+
+    /// Destructor, removes the metrics of the operations
+    ~VisChain();
+
+    /// Main loop over buffer frames
+    void main_thread() override;
+
+private:
+    Buffer* in_buf;
+    Buffer* out_buf;
+
+    kotekan::BufferConsumer in_consumer;
+    kotekan::BufferProducer out_producer;
+
+    /// The operations and the paths to their config, in the order they are applied
+    std::vector<std::unique_ptr<VisOperation>> operations;
+    std::vector<std::string> operation_paths;
+
+    uint32_t num_frame_threads;
+};
+
+#endif
@@ -0,0 +1,11 @@
+#include "VisOperation.hpp"
+
+#include "Config.hpp"    // for Config
+#include "visBuffer.hpp" // for VisFrameView
+
+VisOperation::VisOperation(kotekan::Config& config, const std::string& path) {
+    set_log_level(config.get<std::string>(path, "log_level"));
+    set_log_prefix(path);
+}
+
+void VisOperation::apply(VisFrameView&, size_t, size_t) {}
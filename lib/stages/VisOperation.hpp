@@ -0,0 +1,72 @@
+/*****************************************
+@file
+@brief Operations on visibility frames which can be applied in place.
+- VisOperation
+*****************************************/
+#ifndef VIS_OPERATION_HPP
+#define VIS_OPERATION_HPP
+
+#include "Config.hpp"         // for Config
+#include "factory.hpp"        // for REGISTER_NAMED_TYPE_WITH_FACTORY, CREATE_FACTORY, Factory
+#include "kotekanLogging.hpp" // for kotekanLogging
+#include "visBuffer.hpp"      // for VisFrameView
+
+#include <stddef.h> // for size_t
+#include <string>   // for string
+
+/**
+ * @class VisOperation
+ * @brief Base class for the per frame work of a visibility stage, done in place.
+ *
+ * This splits out what a stage like @c ReceiveFlags does to each frame, so that
+ * @c VisChain can run several of them on the same frame. Each frame goes through
+ * two steps:
+ *  - @c prepare is called on every frame, in order. It does all the work which
+ *    isn't per product (the dataset ID, flags, gains, eigenvectors) and can drop
+ *    the frame.
+ *  - @c apply is then called on ranges of products. Different ranges of the
+ *    same frame may be processed in parallel.
+ *
+ * @conf  log_level  String. The logging level of the operation.
+ **/
+class VisOperation : public kotekan::kotekanLogging {
+public:
+    /**
+     * @brief Create the operation.
+     *
+     * @param  config  Kotekan configuration.
+     * @param  path    Path of the config block of the operation. This is the
+     *                 stage name when a stage runs the operation itself.
+     **/
+    VisOperation(kotekan::Config& config, const std::string& path);
+
+    virtual ~VisOperation() = default;
+
+    /**
+     * @brief Set up the frame and everything in it that isn't per product.
+     *
+     * @param  frame  The frame to modify.
+     *
+     * @return        False if the frame should be dropped.
+     **/
+    virtual bool prepare(VisFrameView& frame) = 0;
+
+    /**
+     * @brief Apply the operation to the products in [start, end).
+     *
+     * The default does nothing, for operations which only change the
+     * per frame data.
+     *
+     * @param  frame  A frame which has been through @c prepare.
+     * @param  start  The first product.
+     * @param  end    One past the last product.
+     **/
+    virtual void apply(VisFrameView& frame, size_t start, size_t end);
+};
+
+// Create the abstract factory for generating operations
+CREATE_FACTORY(VisOperation, kotekan::Config&, const std::string&);
+#define REGISTER_VIS_OPERATION(OperationType, name)                                                \
+    REGISTER_NAMED_TYPE_WITH_FACTORY(VisOperation, OperationType, name)
+
+#endif
@@ -176,6 +176,12 @@ bool VisTranspose::get_dataset_state(dset_id_t ds_id) {
     input_flags.resize(chunk_t * num_input, 0.);
     dset_id.resize(chunk_t * chunk_f);
 
+    vis_tiles.resize(chunk_f, eff_data_dim, num_threads - 1);
+    vis_weight_tiles.resize(chunk_f, eff_data_dim, num_threads - 1);
+    eval_tiles.resize(chunk_f, num_ev, num_threads - 1);
+    evec_tiles.resize(chunk_f, num_ev * num_input, num_threads - 1);
+    gain_tiles.resize(chunk_f, num_input, num_threads - 1);
+
     // Initialise dataset ID array with null IDs
     std::string null_ds_id = fmt::format("{}", dset_id_t::null);
     for (auto& ds : dset_id) {
@@ -196,25 +202,28 @@ void VisTranspose::write_chunk(size_t t_ind, size_t f_ind) {
     DEBUG("Writing at freq {:d} and time {:d}", f_ind, t_ind);
     DEBUG("Writing block of {:d} freqs and {:d} times", write_f, write_t);
 
-    file->write_block("vis", f_ind, t_ind, write_f, write_t, vis.data());
+    queue_block(file, "vis", f_ind, t_ind, vis, {f_ind, 0, t_ind},
+                {write_f, eff_data_dim, write_t});
 
-    file->write_block("vis_weight", f_ind, t_ind, write_f, write_t, vis_weight.data());
+    queue_block(file, "flags/vis_weight", f_ind, t_ind, vis_weight, {f_ind, 0, t_ind},
+                {write_f, eff_data_dim, write_t});
 
     if (num_ev > 0) {
-        file->write_block("eval", f_ind, t_ind, write_f, write_t, eval.data());
-        file->write_block("evec", f_ind, t_ind, write_f, write_t, evec.data());
-        file->write_block("erms", f_ind, t_ind, write_f, write_t, erms.data());
+        queue_block(file, "eval", f_ind, t_ind, eval);
+        queue_block(file, "evec", f_ind, t_ind, evec, {f_ind, 0, 0, t_ind},
+                    {write_f, num_ev, num_input, write_t});
+        queue_block(file, "erms", f_ind, t_ind, erms);
     }
 
-    file->write_block("gain", f_ind, t_ind, write_f, write_t, gain.data());
+    queue_block(file, "gain", f_ind, t_ind, gain, {f_ind, 0, t_ind}, {write_f, num_input, write_t});
 
-    file->write_block("flags/frac_lost", f_ind, t_ind, write_f, write_t, frac_lost.data());
+    queue_block(file, "flags/frac_lost", f_ind, t_ind, frac_lost);
 
-    file->write_block("flags/frac_rfi", f_ind, t_ind, write_f, write_t, frac_rfi.data());
+    queue_block(file, "flags/frac_rfi", f_ind, t_ind, frac_rfi);
 
-    file->write_block("flags/inputs", f_ind, t_ind, write_f, write_t, input_flags.data());
+    queue_block(file, "flags/inputs", f_ind, t_ind, input_flags);
 
-    file->write_block("flags/dataset_id", f_ind, t_ind, write_f, write_t, dset_id.data());
+    queue_block(file, "flags/dataset_id", f_ind, t_ind, dset_id);
 }
 
 // increment between chunks
@@ -266,25 +275,20 @@ void VisTranspose::copy_frame_data(uint32_t freq_index, uint32_t time_index) {
     // Time-transpose as frames come in
     // Fastest varying is time (needs to be consistent with reader!)
     uint32_t offset = freq_index * write_t;
-    strided_copy(frame.vis.data(), vis.data(), offset * eff_data_dim + time_index, write_t,
-                 eff_data_dim);
-    strided_copy(frame.weight.data(), vis_weight.data(), offset * eff_data_dim + time_index,
-                 write_t, eff_data_dim);
+    vis_tiles.copy(frame.vis.data(), vis.data(), freq_index, time_index, write_t);
+    vis_weight_tiles.copy(frame.weight.data(), vis_weight.data(), freq_index, time_index,
+                          write_t);
 
-    strided_copy(frame.eval.data(), eval.data(), freq_index * num_ev * write_t + time_index,
-                 write_t, num_ev);
+    eval_tiles.copy(frame.eval.data(), eval.data(), freq_index, time_index, write_t);
 
-    strided_copy(frame.evec.data(), evec.data(),
-                 freq_index * num_ev * num_input * write_t + time_index, write_t,
-                 num_ev * num_input);
+    evec_tiles.copy(frame.evec.data(), evec.data(), freq_index, time_index, write_t);
 
     erms[offset + time_index] = frame.erms;
     frac_lost[offset + time_index] =
         frame.fpga_seq_length == 0 ? 1. : 1. - float(frame.fpga_seq_total) / frame.fpga_seq_length;
     frac_rfi[offset + time_index] =
         frame.fpga_seq_length == 0 ? 0. : float(frame.rfi_total) / frame.fpga_seq_length;
-    strided_copy(frame.gain.data(), gain.data(), offset * num_input + time_index, write_t,
-                 num_input);
+    gain_tiles.copy(frame.gain.data(), gain.data(), freq_index, time_index, write_t);
 }
 
 void VisTranspose::copy_flags(uint32_t time_index) {
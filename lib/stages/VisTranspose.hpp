@@ -6,8 +6,8 @@
 #ifndef VIS_TRANSPOSE_HPP
 #define VIS_TRANSPOSE_HPP
 
-#include "Config.hpp" // for Config
-#include "Transpose.hpp"
+#include "Config.hpp"          // for Config
+#include "Transpose.hpp"       // for Transpose, tiledTranspose
 #include "bufferContainer.hpp" // for bufferContainer
 #include "datasetManager.hpp"  // for dset_id_t
 #include "visFileArchive.hpp"  // for visFileArchive
@@ -71,6 +71,13 @@ private:
     std::vector<float> input_flags;
     std::vector<rstack_ctype> reverse_stack;
 
+    // Frames staged to be transposed into the datasets
+    tiledTranspose<cfloat> vis_tiles;
+    tiledTranspose<float> vis_weight_tiles;
+    tiledTranspose<float> eval_tiles;
+    tiledTranspose<cfloat> evec_tiles;
+    tiledTranspose<cfloat> gain_tiles;
+
     /// The list of frequencies and inputs that get written into the index maps
     /// of the HDF5 files
     std::vector<time_ctype> times;
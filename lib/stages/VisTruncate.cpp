@@ -2,36 +2,44 @@
 
 #include "Config.hpp"         // for Config
 #include "StageFactory.hpp"   // for REGISTER_KOTEKAN_STAGE, StageMakerTemplate
+#include "WorkPool.hpp"       // for WorkPool
 #include "buffer.h"           // for wait_for_full_frame, allocate_new_metadata_object, mark_fr...
 #include "kotekanLogging.hpp" // for DEBUG
-#include "truncate.hpp"       // for bit_truncate_float
+#include "truncate.hpp"       // for bit_truncate_float_array, bit_truncate_cfloat_array, bit...
 #include "visBuffer.hpp"      // for VisFrameView
 #include "visUtil.hpp"        // for cfloat
 
 #include "gsl-lite.hpp" // for span
 
-#include <atomic>      // for atomic_bool
-#include <cmath>       // for abs, sqrt
-#include <complex>     // for complex
-#include <cstdint>     // for int32_t
-#include <cstring>     // for memset, size_t
-#include <exception>   // for exception
-#include <functional>  // for _Bind_helper<>::type, bind, function
-#include <immintrin.h> // for _mm256_broadcast_ss, _mm256_div_ps, _mm256_loadu_ps, _mm25...
-#include <mm_malloc.h> // for _mm_free, _mm_malloc
-#include <regex>       // for match_results<>::_Base_type
-#include <vector>      // for vector
+#include <algorithm>  // for min
+#include <atomic>     // for atomic_bool
+#include <cmath>      // for abs, sqrt
+#include <complex>    // for complex
+#include <exception>  // for exception
+#include <functional> // for _Bind_helper<>::type, bind, function
+#include <regex>      // for match_results<>::_Base_type
+#include <stdexcept>  // for invalid_argument
+#include <tuple>      // for get
+#include <vector>     // for vector
 
 
 using kotekan::bufferContainer;
 using kotekan::Config;
 using kotekan::Stage;
+using kotekan::WorkPool;
 
 REGISTER_KOTEKAN_STAGE(VisTruncate);
+REGISTER_VIS_OPERATION(VisTruncateOperation, "VisTruncate");
+
+// The number of products each thread truncates at a time
+#define VIS_TRUNCATE_BLOCK_SIZE 4096
+// The number of products whose errors are computed at once, small enough to stay on the stack
+#define VIS_TRUNCATE_CHUNK_SIZE 256
 
 VisTruncate::VisTruncate(Config& config, const std::string& unique_name,
                          bufferContainer& buffer_container) :
-    Stage(config, unique_name, buffer_container, std::bind(&VisTruncate::main_thread, this)) {
+    Stage(config, unique_name, buffer_container, std::bind(&VisTruncate::main_thread, this)),
+    truncate_op(config, unique_name) {
 
     // Fetch the buffers, register
     in_buf = get_buffer("in_buf");
@@ -39,15 +47,23 @@ VisTruncate::VisTruncate(Config& config, const std::string& unique_name,
     out_buf = get_buffer("out_buf");
     register_producer(out_buf, unique_name.c_str());
 
+    num_frame_threads = config.get_default<uint32_t>(unique_name, "num_frame_threads", 1);
+    if (num_frame_threads == 0)
+        throw std::invalid_argument("VisTruncate: num_frame_threads has to be at least 1.");
+}
+
+VisTruncateOperation::VisTruncateOperation(Config& config, const std::string& path) :
+    VisOperation(config, path) {
+
     // Get truncation parameters from config
-    err_sq_lim = config.get<float>(unique_name, "err_sq_lim");
+    err_sq_lim = config.get<float>(path, "err_sq_lim");
     if (err_sq_lim < 0)
         FATAL_ERROR("VisTruncate: config: err_sq_lim should be positive (is %f).", err_sq_lim);
-    w_prec = config.get<float>(unique_name, "weight_fixed_precision");
+    w_prec = config.get<float>(path, "weight_fixed_precision");
     if (w_prec < 0)
         FATAL_ERROR("VisTruncate: config: weight_fixed_precision should be positive (is %f).",
                     w_prec);
-    vis_prec = config.get<float>(unique_name, "data_fixed_precision");
+    vis_prec = config.get<float>(path, "data_fixed_precision");
     if (vis_prec < 0)
         FATAL_ERROR("VisTruncate: config: data_fixed_precision should be positive (is %f).",
                     vis_prec);
@@ -57,32 +73,12 @@ void VisTruncate::main_thread() {
 
     unsigned int frame_id = 0;
     unsigned int output_frame_id = 0;
-    const float err_init = 0.5 * err_sq_lim;
-
-    float err_r, err_i;
-    const __m256 err_init_vec = _mm256_set1_ps(err_init);
-    cfloat tr_vis, tr_evec;
-    __m256 err_vec, wgt_vec;
-    int32_t i_vec;
-    float* err_all;
-
-    // get the first frame (just to find out about num_prod)
-    // (we don't mark it empty, so it's read again in the main loop)
-    if (wait_for_full_frame(in_buf, unique_name.c_str(), frame_id) == nullptr)
-        return;
-    auto frame = VisFrameView(in_buf, frame_id);
-
-    // reserve enough memory for all err_r to be computed per frame
-    // 32byte-aligned memory allocation (_m256_store_ps() asks for it)
-    err_all = (float*)_mm_malloc(sizeof(float) * frame.num_prod, 32);
-    std::memset(err_all, 0, sizeof(float) * (frame.num_prod));
 
     while (!stop_thread) {
         // Wait for the buffer to be filled with data
         if ((wait_for_full_frame(in_buf, unique_name.c_str(), frame_id)) == nullptr) {
             break;
         }
-        auto frame = VisFrameView(in_buf, frame_id);
 
         // Wait for empty frame
         if ((wait_for_empty_frame(out_buf, unique_name.c_str(), output_frame_id)) == nullptr) {
@@ -92,64 +88,17 @@ void VisTruncate::main_thread() {
         // Copy frame into output buffer
         auto output_frame = VisFrameView::copy_frame(in_buf, frame_id, out_buf, output_frame_id);
 
-        // truncate visibilities and weights (8 at a time)
-        for (i_vec = 0; i_vec < int32_t(frame.num_prod) - 7; i_vec += 8) {
-            wgt_vec = _mm256_loadu_ps(&output_frame.weight[i_vec]);
-            err_vec = _mm256_div_ps(err_init_vec, wgt_vec);
-            err_vec = _mm256_sqrt_ps(err_vec);
-            _mm256_store_ps(err_all + i_vec, err_vec);
-        }
-        // use std::sqrt for the last few (less than 8)
-        for (i_vec = (frame.num_prod < 8) ? 0 : i_vec - 8; i_vec < int32_t(frame.num_prod); i_vec++)
-            err_all[i_vec] = std::sqrt(0.5 / output_frame.weight[i_vec] * err_sq_lim);
-
-#pragma omp parallel for private(err_r, err_i, tr_vis)
-        for (size_t i = 0; i < frame.num_prod; i++) {
-            // Get truncation precision from weights
-            if (output_frame.weight[i] == 0.) {
-                zero_weight_found = true;
-                err_r = vis_prec * std::abs(output_frame.vis[i].real());
-                err_i = vis_prec * std::abs(output_frame.vis[i].imag());
-            } else {
-                err_r = err_all[i];
-                err_i = err_r;
-            }
-            // truncate vis using weights
-            tr_vis = {bit_truncate_float(output_frame.vis[i].real(), err_r),
-                      bit_truncate_float(output_frame.vis[i].imag(), err_i)};
-            output_frame.vis[i] = tr_vis;
-            // truncate weights to fixed precision
-            output_frame.weight[i] =
-                bit_truncate_float(output_frame.weight[i], w_prec * output_frame.weight[i]);
-        }
-// truncate eigenvectors
-#pragma omp parallel for private(err_r, err_i, tr_evec)
-        for (size_t i = 0; i < output_frame.evec.size(); i++) {
-            // Truncate to fixed precision
-            tr_evec = {bit_truncate_float(output_frame.evec[i].real(),
-                                          std::abs(vis_prec * output_frame.evec[i].real())),
-                       bit_truncate_float(output_frame.evec[i].imag(),
-                                          std::abs(vis_prec * output_frame.evec[i].imag()))};
-            output_frame.evec[i] = tr_evec;
-        }
+        truncate_op.prepare(output_frame);
 
-// truncate gains using same precision as eigenvectors
-#pragma omp parallel for private(tr_evec)
-        for (size_t i = 0; i < output_frame.gain.size(); i++) {
-
-            tr_evec = {bit_truncate_float(output_frame.gain[i].real(),
-                                          std::abs(vis_prec * output_frame.gain[i].real())),
-                       bit_truncate_float(output_frame.gain[i].imag(),
-                                          std::abs(vis_prec * output_frame.gain[i].imag()))};
-            output_frame.gain[i] = tr_evec;
-        }
-
-        if (zero_weight_found) {
-            DEBUG("VisTruncate: Frame {:d} has at least one weight value "
-                  "being zero.",
-                  frame_id);
-            zero_weight_found = false;
-        }
+        // truncate visibilities and weights, sharing out the blocks of products
+        size_t num_prod = output_frame.num_prod;
+        size_t num_blocks = (num_prod + VIS_TRUNCATE_BLOCK_SIZE - 1) / VIS_TRUNCATE_BLOCK_SIZE;
+        auto truncate_block = [&](size_t block) {
+            size_t start = block * VIS_TRUNCATE_BLOCK_SIZE;
+            truncate_op.apply(output_frame, start,
+                              std::min(start + VIS_TRUNCATE_BLOCK_SIZE, num_prod));
+        };
+        WorkPool::instance().parallel_for(num_blocks, truncate_block, num_frame_threads - 1);
 
         // mark as full
         mark_frame_full(out_buf, unique_name.c_str(), output_frame_id);
@@ -158,5 +107,63 @@ void VisTruncate::main_thread() {
         mark_frame_empty(in_buf, unique_name.c_str(), frame_id);
         frame_id = (frame_id + 1) % in_buf->num_frames;
     }
-    _mm_free(err_all);
+}
+
+bool VisTruncateOperation::prepare(VisFrameView& frame) {
+
+    // truncate eigenvectors, and the gains using the same precision, as pairs of floats
+    bit_truncate_float_array_fixed(reinterpret_cast<float*>(frame.evec.data()), vis_prec,
+                                   2 * frame.evec.size());
+    bit_truncate_float_array_fixed(reinterpret_cast<float*>(frame.gain.data()), vis_prec,
+                                   2 * frame.gain.size());
+
+    return true;
+}
+
+void VisTruncateOperation::apply(VisFrameView& frame, size_t start, size_t end) {
+
+    const float err_init = 0.5 * err_sq_lim;
+    bool zero_weight_found = false;
+
+    // Get raw pointers to avoid the gsl::span bounds checking
+    cfloat* vis = frame.vis.data();
+    float* weight = frame.weight.data();
+
+    // The truncation errors of a chunk of visibilities and weights
+    float err[VIS_TRUNCATE_CHUNK_SIZE];
+    float err_parts[2 * VIS_TRUNCATE_CHUNK_SIZE];
+    float err_weight[VIS_TRUNCATE_CHUNK_SIZE];
+
+    for (size_t i = start; i < end; i += VIS_TRUNCATE_CHUNK_SIZE) {
+        size_t n = std::min<size_t>(VIS_TRUNCATE_CHUNK_SIZE, end - i);
+
+        // Get truncation precision from weights
+        bool zero_weight = false;
+        for (size_t j = 0; j < n; j++) {
+            zero_weight |= (weight[i + j] == 0.f);
+            err[j] = std::sqrt(err_init / weight[i + j]);
+            // truncate weights to fixed precision
+            err_weight[j] = w_prec * weight[i + j];
+        }
+
+        if (!zero_weight) {
+            bit_truncate_cfloat_array(vis + i, err, n);
+        } else {
+            // Get truncation precision from the data if there is no weight
+            zero_weight_found = true;
+            for (size_t j = 0; j < n; j++) {
+                bool zero = (weight[i + j] == 0.f);
+                err_parts[2 * j] = zero ? vis_prec * std::abs(vis[i + j].real()) : err[j];
+                err_parts[2 * j + 1] = zero ? vis_prec * std::abs(vis[i + j].imag()) : err[j];
+            }
+            bit_truncate_float_array(reinterpret_cast<float*>(vis + i), err_parts, 2 * n);
+        }
+        bit_truncate_float_array(weight + i, err_weight, n);
+    }
+
+    if (zero_weight_found) {
+        DEBUG("VisTruncate: Frame with FPGA sequence number {:d} has at least one weight value "
+              "being zero.",
+              std::get<0>(frame.time));
+    }
 }
@@ -2,11 +2,44 @@
 #define VISTRUNCATE
 
 #include "Config.hpp"
-#include "Stage.hpp" // for Stage
+#include "Stage.hpp"        // for Stage
+#include "VisOperation.hpp" // for VisOperation
 #include "buffer.h"
 #include "bufferContainer.hpp"
+#include "visBuffer.hpp" // for VisFrameView
 
-#include <string> // for string
+#include <stddef.h> // for size_t
+#include <stdint.h> // for uint32_t
+#include <string>   // for string
+
+/**
+ * @class VisTruncateOperation
+ * @brief Truncates visibility, eigenvector, gain and weight values in place.
+ *
+ * The work of @c VisTruncate, usable in a @c VisChain.
+ *
+ * @conf   err_sq_lim               Limit for the error of visibility truncation.
+ * @conf   weight_fixed_precision   Fixed precision for weight truncation.
+ * @conf   data_fixed_precision     Fixed precision for eigenvector and visibility truncation (if
+ * weights are zero).
+ */
+class VisTruncateOperation : public VisOperation {
+public:
+    /// Constructor; loads parameters from config
+    VisTruncateOperation(kotekan::Config& config, const std::string& path);
+
+    /// Truncates the eigenvectors and gains
+    bool prepare(VisFrameView& frame) override;
+
+    /// Truncates the visibilities and weights
+    void apply(VisFrameView& frame, size_t start, size_t end) override;
+
+private:
+    // Truncation parameters
+    float err_sq_lim;
+    float w_prec;
+    float vis_prec;
+};
 
 /**
  * @class VisTruncate
@@ -14,11 +47,8 @@
  *
  * eigenvalues and weights are truncated with a fixed precision that is set in
  * the config. visibility values are truncated to a precision based on their
- * weight.
- *
- * @warning Don't run this anywhere but on the transpose (gossec) node.
- * The OpenMP calls could cause issues on systems using kotekan pin
- * priority threads (likely the GPU nodes).
+ * weight. The truncation is vectorized, and the blocks of products of each
+ * frame can be shared out over the work pool.
  *
  * @par Buffers
  * @buffer in_buf The input stream.
@@ -28,10 +58,10 @@
  *         @buffer_format VisBuffer.
  *         @buffer_metadata VisMetadata
  *
- * @conf   err_sq_lim               Limit for the error of visibility truncation.
- * @conf   weight_fixed_precision   Fixed precision for weight truncation.
- * @conf   data_fixed_precision     Fixed precision for eigenvector and visibility truncation (if
- * weights are zero).
+ * @conf   num_frame_threads  Int, default 1. The number of threads truncating
+ *                            each frame, using the work pool.
+ *
+ * See @c VisTruncateOperation for the rest of the config.
  *
  * @author Tristan Pinsonneault-Marotte, Rick Nitsche
  */
@@ -50,13 +80,10 @@ private:
     Buffer* in_buf;
     Buffer* out_buf;
 
-    // Truncation parameters
-    float err_sq_lim;
-    float w_prec;
-    float vis_prec;
+    // Does the truncation
+    VisTruncateOperation truncate_op;
 
-    // Flag for frame with a zero weight
-    bool zero_weight_found;
+    uint32_t num_frame_threads;
 };
 
 #endif
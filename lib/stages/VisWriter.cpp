@@ -21,7 +21,7 @@
 #include <exception>    // for exception
 #include <future>       // for async, future
 #include <map>          // for map, map<>::mapped_type
-#include <memory>       // for __shared_ptr_access, shared_ptr
+#include <memory>       // for __shared_ptr_access, shared_ptr, make_unique, unique_ptr
 #include <stdexcept>    // for out_of_range
 #include <string>       // for string
 #include <sys/types.h>  // for uint
@@ -111,5 +111,9 @@ void VisWriter::write_data(Buffer* in_buf, int frame_id) {
     auto ftime = frame.time;
     time_ctype t = {std::get<0>(ftime), ts_to_double(std::get<1>(ftime))};
 
-    write_frame(frame, frame.dataset_id, frame.freq_id, t);
+    write_frame(frame, frame_id, frame.dataset_id, frame.freq_id, t);
+}
+
+std::unique_ptr<FrameView> VisWriter::make_view(Buffer* buf, int frame_id) {
+    return std::make_unique<VisFrameView>(buf, frame_id);
 }
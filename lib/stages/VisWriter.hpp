@@ -8,11 +8,13 @@
 
 #include "BaseWriter.hpp"      // for BaseWriter
 #include "Config.hpp"          // for Config
+#include "FrameView.hpp"       // for FrameView
 #include "buffer.h"            // for Buffer
 #include "bufferContainer.hpp" // for bufferContainer
 #include "datasetManager.hpp"  // for dset_id_t
 
 #include <map>    // for map
+#include <memory> // for unique_ptr
 #include <string> // for string
 
 /**
@@ -36,6 +38,9 @@ protected:
 
     /// Write data using VisFrameView
     void write_data(Buffer* in_buf, int frame_id) override;
+
+    /// Create a VisFrameView
+    std::unique_ptr<FrameView> make_view(Buffer* buf, int frame_id) override;
 };
 
 #endif
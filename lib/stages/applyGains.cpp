@@ -4,7 +4,8 @@
 #include "H5Support.hpp"         // IWYU pragma: keep
 #include "Hash.hpp"              // for operator<
 #include "StageFactory.hpp"      // for REGISTER_KOTEKAN_STAGE, StageMakerTemplate
-#include "buffer.h"              // for mark_frame_empty, wait_for_full_frame, allocate_new...
+#include "applyGainsRow.hpp"     // for apply_gains_row
+#include "buffer.h"              // for allocate_new_metadata_object
 #include "bufferContainer.hpp"   // for bufferContainer
 #include "configUpdater.hpp"     // for configUpdater
 #include "datasetManager.hpp"    // for dset_id_t, datasetManager, state_id_t
@@ -14,12 +15,12 @@
 #include "prometheusMetrics.hpp" // for Metrics, Counter, Gauge
 #include "restClient.hpp"        // for restClient::restReply, restClient
 #include "visBuffer.hpp"         // for VisFrameView, VisField, VisField::vis, VisField::we...
-#include "visUtil.hpp"           // for cfloat, modulo, double_to_ts, ts_to_double, frameID
+#include "visUtil.hpp"           // for cfloat, modulo, double_to_ts, ts_to_double
 
 #include "fmt.hpp"      // for format, fmt
 #include "gsl-lite.hpp" // for span
 
-#include <algorithm>                 // for max, copy, copy_backward
+#include <algorithm>                 // for max, min, copy, copy_backward
 #include <assert.h>                  // for assert
 #include <chrono>                    // for operator""s, chrono_literals
 #include <cmath>                     // for abs, pow
@@ -56,60 +57,78 @@ using kotekan::Stage;
 using kotekan::prometheus::Metrics;
 
 REGISTER_KOTEKAN_STAGE(applyGains);
+REGISTER_VIS_OPERATION(applyGainsOperation, "applyGains");
 
 
 applyGains::applyGains(Config& config, const std::string& unique_name,
                        bufferContainer& buffer_container) :
     Stage(config, unique_name, buffer_container, std::bind(&applyGains::main_thread, this)),
-    in_buf(get_buffer("in_buf")), out_buf(get_buffer("out_buf")), frame_id_in(in_buf),
-    frame_id_out(out_buf), update_age_metric(Metrics::instance().add_gauge(
-                               "kotekan_applygains_update_age_seconds", unique_name)),
+    in_buf(get_buffer("in_buf")), out_buf(get_buffer("out_buf")),
+    in_consumer(in_buf, unique_name), out_producer(out_buf, unique_name),
+    gains_op(config, unique_name),
+    frame_map(in_consumer, out_producer, unique_name,
+              config.get_default<uint32_t>(unique_name, "num_threads", 1)) {}
+
+
+applyGainsOperation::applyGainsOperation(Config& config, const std::string& path) :
+    VisOperation(config, path),
+    update_age_metric(Metrics::instance().add_gauge("kotekan_applygains_update_age_seconds", path)),
     late_update_counter(
-        Metrics::instance().add_counter("kotekan_applygains_late_update_count", unique_name)),
+        Metrics::instance().add_counter("kotekan_applygains_late_update_count", path)),
     late_frames_counter(
-        Metrics::instance().add_counter("kotekan_applygains_late_frame_count", unique_name)),
+        Metrics::instance().add_counter("kotekan_applygains_late_frame_count", path)),
     client(restClient::instance()) {
 
-    // Setup the input buffer
-    register_consumer(in_buf, unique_name.c_str());
-
-    // Setup the output buffer
-    register_producer(out_buf, unique_name.c_str());
-
     // Apply config.
     // Number of gain versions kept. Default is 5.
-    num_kept_updates = config.get_default<uint64_t>(unique_name, "num_kept_updates", 5);
+    num_kept_updates = config.get_default<uint64_t>(path, "num_kept_updates", 5);
     if (num_kept_updates < 1)
         throw std::invalid_argument("applyGains: config: num_kept_updates has"
                                     "to be equal or greater than one (is "
                                     + std::to_string(num_kept_updates) + ").");
 
     // Get the parameters for how to fetch gains from the cal_broker
-    read_from_file = config.get_default<bool>(unique_name, "read_from_file", false);
+    read_from_file = config.get_default<bool>(path, "read_from_file", false);
     if (read_from_file) {
-        gains_dir = config.get<std::string>(unique_name, "gains_dir");
+        gains_dir = config.get<std::string>(path, "gains_dir");
     } else {
-        broker_host = config.get<std::string>(unique_name, "broker_host");
-        broker_port = config.get<unsigned int>(unique_name, "broker_port");
+        broker_host = config.get<std::string>(path, "broker_host");
+        broker_port = config.get<unsigned int>(path, "broker_port");
     }
 
-    num_threads = config.get_default<uint32_t>(unique_name, "num_threads", 1);
-    if (num_threads == 0)
-        throw std::invalid_argument("applyGains: num_threads has to be at least 1.");
-
     // FIFO for gains and weights updates
     gains_fifo.resize(num_kept_updates);
 
     // subscribe to gain timestamp updates
-    configUpdater::instance().subscribe(this, std::bind(&applyGains::receive_update, this, _1));
+    configUpdater::instance().subscribe(
+        config.get<std::string>(path, "updatable_config"),
+        std::bind(&applyGainsOperation::receive_update, this, _1));
+
+    // Create a cpu_set for the cores we want to bind the fetch thread onto
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    for (auto& i : config.get<std::vector<int>>(path, "cpu_affinity"))
+        CPU_SET(i, &cpuset);
+
+    // Create a thread for fetching gains from cal broker
+    DEBUG("Creating worker fetch thread id");
+    fetch_thread = std::thread(&applyGainsOperation::fetch_gains_loop, this);
+    pthread_setaffinity_np(fetch_thread.native_handle(), sizeof(cpu_set_t), &cpuset);
+}
+
+applyGainsOperation::~applyGainsOperation() {
+    // Join fetch thread
+    stop_fetch = true;
+    update_fetch_queue.cancel();
+    fetch_thread.join();
 }
 
-bool applyGains::fexists(const std::string& filename) const {
+bool applyGainsOperation::fexists(const std::string& filename) const {
     struct stat buf;
     return (stat(filename.c_str(), &buf) == 0);
 }
 
-bool applyGains::receive_update(json& json) {
+bool applyGainsOperation::receive_update(json& json) {
 
     double new_ts;
     std::string gains_path;
@@ -181,175 +200,152 @@ bool applyGains::receive_update(json& json) {
 
 
 void applyGains::main_thread() {
+    frame_map.run(stop_thread, std::bind(&applyGains::prepare_frame, this, _1),
+                  std::bind(&applyGains::apply_frame, this, _1, _2, _3));
+}
 
-    std::thread fetch_thread;
-    std::vector<std::thread> apply_thread_handles;
-
-    // Create a cpu_set for the cores we want to bind the worker threads onto
-    cpu_set_t cpuset;
-    CPU_ZERO(&cpuset);
-    for (auto& i : config.get<std::vector<int>>(unique_name, "cpu_affinity"))
-        CPU_SET(i, &cpuset);
+std::optional<applyGains::frameGains> applyGains::prepare_frame(int input_frame_id) {
+    return gains_op.calculate_frame_gains(VisFrameView(in_buf, input_frame_id));
+}
 
-    // Create a thread for fetching gains from cal broker
-    DEBUG("Creating worker fetch thread id");
-    fetch_thread = std::thread(&applyGains::fetch_thread, this);
-    pthread_setaffinity_np(fetch_thread.native_handle(), sizeof(cpu_set_t), &cpuset);
+void applyGains::apply_frame(frameGains& gains, int input_frame_id, int output_frame_id) {
 
-    // Fetch the first frame to initialise various parameters
-    initialise();
+    auto input_frame = VisFrameView(in_buf, input_frame_id);
 
-    // Sleep briefly here. This is to give the fetch_thread chance to spin up
-    // and read the initial gains
-    std::this_thread::sleep_for(0.5s);
+    allocate_new_metadata_object(out_buf, output_frame_id);
 
-    for (uint32_t i = 0; i < num_threads; i++) {
-        DEBUG("Creating worker thread id={}", i);
-        auto& thread = apply_thread_handles.emplace_back(&applyGains::apply_thread, this);
-        pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set_t), &cpuset);
-    }
+    // Create view to output frame
+    auto output_frame =
+        VisFrameView::create_frame_view(out_buf, output_frame_id, input_frame.num_elements,
+                                        input_frame.num_prod, input_frame.num_ev);
 
-    // Join the threads
-    for (auto& thread : apply_thread_handles)
-        thread.join();
+    // Copy over the data we won't modify
+    output_frame.copy_metadata(input_frame);
+    output_frame.copy_data(input_frame, {VisField::vis, VisField::weight});
+    output_frame.dataset_id = gains.dataset_id;
 
-    // Join fetch thread
-    update_fetch_queue.cancel();
-    fetch_thread.join();
+    gains_op.apply_gains(gains, input_frame, output_frame, 0, input_frame.num_prod);
+    gains_op.apply_input_gains(gains, input_frame, output_frame);
 }
 
-void applyGains::apply_thread() {
+
+std::optional<applyGainsOperation::frameGains>
+applyGainsOperation::calculate_frame_gains(const VisFrameView& frame) {
 
     auto& dm = datasetManager::instance();
 
-    int output_frame_id;
-    int input_frame_id;
+    // Use the first frame to initialise various parameters
+    if (!started) {
+        initialise(frame);
 
-    // Get the current values of the shared frame IDs and increment them.
-    {
-        std::lock_guard<std::mutex> lock_frame_ids(m_frame_ids);
-        output_frame_id = frame_id_out++;
-        input_frame_id = frame_id_in++;
+        // Sleep briefly here. This is to give the fetch thread chance to spin up
+        // and read the initial gains
+        std::this_thread::sleep_for(0.5s);
     }
 
-    // Vectors for storing gains computed on the fly, keep out here so they are
-    // only allocated once
-    std::vector<cfloat> gain(num_elements.value());
-    std::vector<cfloat> gain_conj(num_elements.value());
-    std::vector<float> weight_factor(num_elements.value());
-
-    while (!stop_thread) {
-
-        // Wait for the input buffer to be filled with data
-        if (wait_for_full_frame(in_buf, unique_name.c_str(), input_frame_id) == nullptr) {
-            break;
-        }
-
-        // Create view to input frame
-        auto input_frame = VisFrameView(in_buf, input_frame_id);
-
-        // Check that the input frame has the right sizes
-        if (!validate_frame(input_frame))
-            return;
+    // Check that the input frame has the right sizes
+    if (!validate_frame(frame))
+        return std::nullopt;
 
-        // get the frames timestamp
-        ts_frame.store(std::get<1>(input_frame.time));
+    // get the frames timestamp
+    ts_frame.store(std::get<1>(frame.time));
 
-        // Get the frequency index of this ID. The map will have been set by initialise
-        // Also get the UNIX timestamp
-        auto freq_ind = freq_map.at(input_frame.freq_id);
-        auto frame_time = ts_to_double(std::get<1>(input_frame.time));
+    // Get the frequency index of this ID. The map will have been set by initialise
+    // Also get the UNIX timestamp
+    auto freq_ind = freq_map.at(frame.freq_id);
+    auto frame_time = ts_to_double(std::get<1>(frame.time));
 
-        // Calculate the gain factors we need to apply to this frame
-        auto [late, age, state_id] =
-            calculate_gain(frame_time, freq_ind, gain, gain_conj, weight_factor);
+    frameGains gains;
 
-        // Report number of frames received late and skip the frame entirely
-        if (late) {
-            late_frames_counter.inc();
-            std::lock_guard<std::mutex> lock_frame_ids(m_frame_ids);
-            mark_frame_empty(in_buf, unique_name.c_str(), input_frame_id);
-            input_frame_id = frame_id_in++;
-            continue;
-        }
+    // Calculate the gain factors we need to apply to this frame
+    auto [late, age, state_id] = calculate_gain(frame_time, freq_ind, gains.factors);
 
-        // Wait for the output buffer to be empty of data
-        if (wait_for_empty_frame(out_buf, unique_name.c_str(), output_frame_id) == nullptr) {
-            break;
-        }
-        allocate_new_metadata_object(out_buf, output_frame_id);
+    // Report number of frames received late and skip the frame entirely
+    if (late) {
+        late_frames_counter.inc();
+        return std::nullopt;
+    }
 
-        // Create view to output frame
-        auto output_frame =
-            VisFrameView::create_frame_view(out_buf, output_frame_id, input_frame.num_elements,
-                                            input_frame.num_prod, input_frame.num_ev);
+    // Report how old the gains being applied to the current data are.
+    update_age_metric.set(age);
 
+    // Check if we have already registered this gain update against this
+    // input dataset, do so if we haven't, and then label the output data
+    // with the new id. The frames are prepared in order, so this doesn't need a lock.
+    std::pair<state_id_t, dset_id_t> key = {state_id, frame.dataset_id};
+    if (output_dataset_ids.count(key) == 0) {
+        output_dataset_ids[key] = dm.add_dataset(state_id, frame.dataset_id);
+    }
+    gains.dataset_id = output_dataset_ids[key];
 
-        // Copy over the data we won't modify
-        output_frame.copy_metadata(input_frame);
-        output_frame.copy_data(input_frame, {VisField::vis, VisField::weight});
+    return gains;
+}
 
-        // Check if we have already registered this gain update against this
-        // input dataset, do so if we haven't, and then label the output data
-        // with the new id. This must be done while locked as the underlying map
-        // could change
-        {
-            std::scoped_lock<std::mutex> lock_frame_ids(m_frame_ids);
-            std::pair<state_id_t, dset_id_t> key = {state_id, input_frame.dataset_id};
-            if (output_dataset_ids.count(key) == 0) {
-                output_dataset_ids[key] = dm.add_dataset(state_id, input_frame.dataset_id);
-            }
-            output_frame.dataset_id = output_dataset_ids[key];
-        }
+void applyGainsOperation::apply_gains(const frameGains& gains, const VisFrameView& in,
+                                      VisFrameView& out, size_t start, size_t end) const {
+
+    // Get raw pointers to avoid the gsl::span bounds checking
+    cfloat* out_vis = out.vis.data();
+    const cfloat* in_vis = in.vis.data();
+    float* out_weight = out.weight.data();
+    const float* in_weight = in.weight.data();
+    const cfloat* gain = gains.factors->gain.data();
+    const cfloat* gain_conj = gains.factors->gain_conj.data();
+    const float* weight_factor = gains.factors->weight_factor.data();
+
+    // For now this doesn't try to do any type of check on the
+    // ordering of products in vis and elements in gains.
+    // Also assumes the ordering of freqs in gains is standard
+
+    // Find the pair of inputs of the first product
+    uint32_t num_elem = in.num_elements;
+    uint32_t ii = 0;
+    size_t row_start = 0;
+    while (row_start + (num_elem - ii) <= start) {
+        row_start += num_elem - ii;
+        ii++;
+    }
+    uint32_t jj = ii + (start - row_start);
+
+    // Go through the products a row of the triangle at a time
+    size_t idx = start;
+    while (idx < end) {
+        size_t n = std::min<size_t>(num_elem - jj, end - idx);
+        apply_gains_row(gain[ii], weight_factor[ii], gain_conj + jj, weight_factor + jj, n,
+                        in_vis + idx, out_vis + idx, in_weight + idx, out_weight + idx);
+        idx += n;
+        ii++;
+        jj = ii;
+    }
+}
 
-        // Get raw pointers to avoid the gsl::span bounds checking
-        cfloat* out_vis = output_frame.vis.data();
-        cfloat* in_vis = input_frame.vis.data();
-        float* out_weight = output_frame.weight.data();
-        float* in_weight = input_frame.weight.data();
-
-        // For now this doesn't try to do any type of check on the
-        // ordering of products in vis and elements in gains.
-        // Also assumes the ordering of freqs in gains is standard
-        uint32_t idx = 0;
-        for (uint32_t ii = 0; ii < input_frame.num_elements; ii++) {
-            for (uint32_t jj = ii; jj < input_frame.num_elements; jj++) {
-                // Gains are to be multiplied to vis
-                out_vis[idx] = in_vis[idx] * gain[ii] * gain_conj[jj];
-
-                // Update the weights take care not to generate NaN's if both the gain
-                // was zero and the weight was infinite (which can happen if a channel
-                // was turned off)
-                float wp = weight_factor[ii] * weight_factor[jj];
-                out_weight[idx] = (wp == 0 ? 0.0 : in_weight[idx] * wp);
-                idx++;
-            }
-            // Update the gains.
-            output_frame.gain[ii] = input_frame.gain[ii] * gain[ii];
-        }
+void applyGainsOperation::apply_input_gains(const frameGains& gains, const VisFrameView& in,
+                                            VisFrameView& out) const {
+    for (uint32_t ii = 0; ii < in.num_elements; ii++) {
+        out.gain[ii] = in.gain[ii] * gains.factors->gain[ii];
+    }
+}
 
-        // Report how old the gains being applied to the current data are.
-        update_age_metric.set(age);
+bool applyGainsOperation::prepare(VisFrameView& frame) {
+    current_gains = calculate_frame_gains(frame);
+    if (!current_gains)
+        return false;
 
-        // Mark the buffers and move on
-        mark_frame_full(out_buf, unique_name.c_str(), output_frame_id);
-        mark_frame_empty(in_buf, unique_name.c_str(), input_frame_id);
+    frame.dataset_id = current_gains->dataset_id;
+    apply_input_gains(*current_gains, frame, frame);
+    return true;
+}
 
-        // Get the current values of the shared frame IDs.
-        {
-            std::lock_guard<std::mutex> lock_frame_ids(m_frame_ids);
-            output_frame_id = frame_id_out++;
-            input_frame_id = frame_id_in++;
-        }
-    }
+void applyGainsOperation::apply(VisFrameView& frame, size_t start, size_t end) {
+    apply_gains(*current_gains, frame, frame, start, end);
 }
 
 
-void applyGains::fetch_thread() {
+void applyGainsOperation::fetch_gains_loop() {
 
     auto& dm = datasetManager::instance();
 
-    while (!stop_thread) {
+    while (!stop_fetch) {
 
         // Wait until we've start receiving data before fetching any updates. By
         // waiting until then before reading the gains we can test for
@@ -365,7 +361,7 @@ void applyGains::fetch_thread() {
 
         auto [update_id, transition_interval, new_ts, new_state] = *update;
 
-        std::optional<applyGains::GainData> gain_data;
+        std::optional<GainData> gain_data;
         if (read_from_file) {
             DEBUG("Reading gains from file...");
             gain_data = read_gain_file(update_id);
@@ -406,7 +402,8 @@ void applyGains::fetch_thread() {
 }
 
 
-std::optional<applyGains::GainData> applyGains::read_gain_file(std::string update_id) const {
+std::optional<applyGainsOperation::GainData>
+applyGainsOperation::read_gain_file(std::string update_id) const {
 
     // Define the output arrays
     std::vector<std::vector<cfloat>> gain_read;
@@ -511,7 +508,8 @@ std::vector<std::vector<U>> unpack_2d(const std::vector<T>& arr1d, uint32_t nr,
 }
 
 
-std::optional<applyGains::GainData> applyGains::fetch_gains(std::string update_id) const {
+std::optional<applyGainsOperation::GainData>
+applyGainsOperation::fetch_gains(std::string update_id) const {
 
     // query cal broker
     json json_request;
@@ -560,20 +558,12 @@ std::optional<applyGains::GainData> applyGains::fetch_gains(std::string update_i
 }
 
 
-void applyGains::initialise() {
+void applyGainsOperation::initialise(const VisFrameView& frame) {
 
     if (started) {
         FATAL_ERROR("We should not end up here if we've already started processing.");
     }
 
-    // Wait for the input buffer to be filled with data
-    if (wait_for_full_frame(in_buf, unique_name.c_str(), 0) == nullptr) {
-        return;
-    }
-
-    // Create view to input frame
-    auto frame = VisFrameView(in_buf, 0);
-
     auto& dm = datasetManager::instance();
     auto* fstate = dm.dataset_state<freqState>(frame.dataset_id);
     auto* istate = dm.dataset_state<inputState>(frame.dataset_id);
@@ -597,12 +587,13 @@ void applyGains::initialise() {
     num_freq = freqs.size();
     num_elements = istate->get_inputs().size();
     num_prod = num_elements.value() * (num_elements.value() + 1) / 2;
+    gains_cache.resize(num_freq.value());
 
     started = true;
 }
 
 
-bool applyGains::validate_frame(const VisFrameView& frame) const {
+bool applyGainsOperation::validate_frame(const VisFrameView& frame) const {
 
     // TODO: this should validate that the hashes of the input and frequencies
     // dataset states have not changed whenever the dataset_id changes
@@ -626,7 +617,7 @@ bool applyGains::validate_frame(const VisFrameView& frame) const {
 }
 
 
-bool applyGains::validate_gain(const applyGains::GainData& data) const {
+bool applyGainsOperation::validate_gain(const GainData& data) const {
 
     // If we haven't got the freq and elements numbers set we can't actually
     // check. This should not happen.
@@ -658,21 +649,12 @@ bool applyGains::validate_gain(const applyGains::GainData& data) const {
 }
 
 std::tuple<bool, double, state_id_t>
-applyGains::calculate_gain(double timestamp, uint32_t freq_ind, std::vector<cfloat>& gain,
-                           std::vector<cfloat>& gain_conj,
-                           std::vector<float>& weight_factor) const {
+applyGainsOperation::calculate_gain(double timestamp, uint32_t freq_ind,
+                                    std::shared_ptr<const GainFactors>& factors) {
     using namespace std::complex_literals;
 
     size_t num_elem = num_elements.value();
 
-    // Check that the input vectors are large enough
-    assert(gain.size() == num_elem);
-    assert(gain_conj.size() == num_elem);
-    assert(weight_factor.size() == num_elem);
-
-    // Pointers to which ever set of gains we are using
-    const cfloat* gain_ptr = nullptr;
-
     // Check to see if any gains are available at all.
     if (gains_fifo.size() == 0) {
         ERROR("No initial gains available.");
@@ -703,22 +685,46 @@ applyGains::calculate_gain(double timestamp, uint32_t freq_ind, std::vector<cflo
 
     // Now we know how long to combine over, we can see if there's
     // another gain update within that time window
-    const auto update_old =
+    auto update_old =
         gains_fifo.get_update(double_to_ts(timestamp - update_new->transition_interval)).second;
+    if (update_old == update_new)
+        update_old = nullptr;
+
+    float coeff_new = 1;
+    if (update_old != nullptr)
+        coeff_new = age / update_new->transition_interval;
+
+    // Reuse the last gain factors of this frequency if nothing has changed
+    auto& cached = gains_cache.at(freq_ind);
+    if (cached.factors && cached.update_new == update_new && cached.update_old == update_old
+        && cached.coeff_new == coeff_new) {
+        factors = cached.factors;
+        return {false, age, update_new->state_id};
+    }
 
     const auto& new_gain = update_new->data.gain.at(freq_ind);
     const auto& weights = update_new->data.weight.at(freq_ind);
     assert(new_gain.size() == num_elem);
     assert(weights.size() == num_elem);
 
-    if (update_old == nullptr || update_new == update_old) {
+    auto new_factors = std::make_shared<GainFactors>();
+    auto& gain = new_factors->gain;
+    auto& gain_conj = new_factors->gain_conj;
+    auto& weight_factor = new_factors->weight_factor;
+    gain.resize(num_elem);
+    gain_conj.resize(num_elem);
+    weight_factor.resize(num_elem);
+
+    // Pointers to which ever set of gains we are using
+    const cfloat* gain_ptr = nullptr;
+
+    if (update_old == nullptr) {
         gain_ptr = new_gain.data();
     } else {
 
         auto& old_gain = update_old->data.gain.at(freq_ind);
         assert(old_gain.size() == num_elem);
 
-        float coeff_new = age / update_new->transition_interval;
         float coeff_old = 1 - coeff_new;
 
         for (uint32_t ii = 0; ii < num_elem; ii++) {
@@ -736,5 +742,8 @@ applyGains::calculate_gain(double timestamp, uint32_t freq_ind, std::vector<cflo
         gain_conj[ii] = std::conj(gain[ii]);
     }
 
+    cached = {update_new, update_old, coeff_new, new_factors};
+    factors = std::move(new_factors);
+
     return {false, age, update_new->state_id};
 }
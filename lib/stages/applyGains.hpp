@@ -1,9 +1,12 @@
 #ifndef APPLY_GAINS_HPP
 #define APPLY_GAINS_HPP
 
+#include "BufferHandle.hpp"      // for BufferConsumer, BufferProducer
 #include "Config.hpp"            // for Config
+#include "ParallelFrameMap.hpp"  // for ParallelFrameMap
 #include "Stage.hpp"             // for Stage
 #include "SynchronizedQueue.hpp" // for SynchronizedQueue
+#include "VisOperation.hpp"      // for VisOperation
 #include "buffer.h"              // for Buffer
 #include "bufferContainer.hpp"   // for bufferContainer
 #include "datasetManager.hpp"    // for dset_id_t, state_id_t
@@ -11,28 +14,31 @@
 #include "restClient.hpp"        // for restClient
 #include "updateQueue.hpp"       // for updateQueue
 #include "visBuffer.hpp"         // for VisFrameView
-#include "visUtil.hpp"           // for cfloat, frameID
+#include "visUtil.hpp"           // for cfloat
 
 #include "json.hpp" // for json
 
 #include <atomic>       // for atomic
 #include <ctime>        // for timespec, size_t
 #include <map>          // for map
-#include <mutex>        // for mutex
+#include <memory>       // for shared_ptr
 #include <optional>     // for optional
 #include <shared_mutex> // for shared_mutex
+#include <stddef.h>     // for size_t
 #include <stdint.h>     // for uint32_t, uint64_t
 #include <string>       // for string
+#include <thread>       // for thread
 #include <tuple>        // for tuple
 #include <utility>      // for pair
 #include <vector>       // for vector
 
 /**
- * @class applyGains
- * @brief Receives gains and apply them to the output buffer.
+ * @class applyGainsOperation
+ * @brief Receives gains and applies them to visibility frames.
  *
- * This stage registers as a subscriber to an updatable config block. The
- * full name of the block should be defined in the value @c updatable_block
+ * The work of @c applyGains, usable in a @c VisChain. It registers as a subscriber
+ * to the updatable config block named by @c updatable_config, and fetches the gains
+ * for each update from file or the calibration broker on its own thread.
  *
  * Gain updates *must* match the frequencies expected to be present in the
  * input stream. That is there must be exactly as many frequencies in the gain
@@ -40,20 +46,16 @@
  * The number of elements must also match those on the incoming
  * stream.
  *
- * The number of frequencies and inputs is locked in
+ * The number of frequencies and inputs is locked in by the first frame.
  *
- *
- * @par Buffers
- * @buffer in_buf The input stream.
- *         @buffer_format VisBuffer.
- *         @buffer_metadata VisMetadata
- * @buffer out_buf The output stream.
- *         @buffer_format VisBuffer.
- *         @buffer_metadata VisMetadata
+ * The gain factors of each frequency are kept, and only recalculated when a
+ * frame needs a different update, or while blending between two updates.
+ * They are applied to the products one row of the triangle at a time with
+ * AVX, building the outer product of the gains as they go.
  *
  * @conf   num_elements     Int.    The number of elements (i.e. inputs) in the
  *                                  correlator data.
- * @conf   updatable_block  String. The full name of the updatable_block that
+ * @conf   updatable_config String. The full name of the updatable_block that
  *                                  will provide new flagging values (e.g. "/dynamic_block/gains").
  * @conf   gains_dir        String. The path to the directory holding the gains file.
  * @conf   broker_host      String. Calibration broker host.
@@ -63,7 +65,7 @@
  * @conf   tcombine         Double. Time (in seconds) over which to combine old and new gains to
  *                                  prevent discontinuities. Default is 5 minutes.
  * @conf   num_kept_updates Int.    The number of gain updates stored in a FIFO.
- * @conf   num_threads      Int.    Number of threads to run. Default is 1.
+ * @conf   cpu_affinity     List of ints. The cores to run the thread fetching the gains on.
  *
  * @par Metrics
  * @metric kotekan_applygains_late_update_count The number of updates received
@@ -78,15 +80,46 @@
  *
  * @author Mateus Fandino, Tristan Pinsonneault-Marotte and Richard Shaw
  */
-class applyGains : public kotekan::Stage {
+class applyGainsOperation : public VisOperation {
 
 public:
-    /// Default constructor
-    applyGains(kotekan::Config& config, const std::string& unique_name,
-               kotekan::bufferContainer& buffer_container);
+    /// Constructor, subscribes to the gain updates and starts fetching them
+    applyGainsOperation(kotekan::Config& config, const std::string& path);
 
-    /// Main loop for the stage
-    void main_thread() override;
+    /// Destructor, stops the fetch thread
+    ~applyGainsOperation();
+
+    /// The gain factors of each input at one frequency
+    struct GainFactors {
+        std::vector<cfloat> gain;
+        std::vector<cfloat> gain_conj;
+        std::vector<float> weight_factor;
+    };
+
+    /// The gains to apply to one frame and its output dataset
+    struct frameGains {
+        std::shared_ptr<const GainFactors> factors;
+        dset_id_t dataset_id;
+    };
+
+    /// Calculates the gains for a frame. This must be called on the frames in order.
+    /// Returns nothing if the frame is late and should be dropped.
+    std::optional<frameGains> calculate_frame_gains(const VisFrameView& frame);
+
+    /// Applies the gains to the products [start, end) of @c in and writes them to
+    /// @c out, which can be the same frame.
+    void apply_gains(const frameGains& gains, const VisFrameView& in, VisFrameView& out,
+                     size_t start, size_t end) const;
+
+    /// Applies the gains to the per input gains of @c in and writes them to @c out.
+    void apply_input_gains(const frameGains& gains, const VisFrameView& in,
+                           VisFrameView& out) const;
+
+    /// Calculates the gains and sets the dataset and the per input gains of the frame
+    bool prepare(VisFrameView& frame) override;
+
+    /// Applies the gains calculated by the last @c prepare
+    void apply(VisFrameView& frame, size_t start, size_t end) override;
 
     /// Callback function to receive updates on timestamps from configUpdater
     bool receive_update(nlohmann::json& json);
@@ -123,11 +156,6 @@ private:
     /// The gains and when to start applying them in a FIFO (len set by config)
     updateQueue<GainUpdate> gains_fifo;
 
-    /// Input buffer to read from
-    Buffer* in_buf;
-    /// Output buffer with gains applied
-    Buffer* out_buf;
-
     /// Mutex to protect access to gains and freq map
     std::shared_mutex gain_mtx;
     std::shared_mutex freqmap_mtx;
@@ -135,24 +163,15 @@ private:
     /// Timestamp of the current frame
     std::atomic<timespec> ts_frame{{0, 0}};
 
-    /// Entrancepoint for n threads. Each thread takes frames with a
-    /// different frame_id from the buffer and applies gains.
-    void apply_thread();
+    /// The gains of the frame being processed by @c prepare and @c apply
+    std::optional<frameGains> current_gains;
 
     /// Thread for getting gains from cal broker
-    void fetch_thread();
-
-    /// Number of parallel threads accessing the same buffers (default 1)
-    uint32_t num_threads;
-
-    /// Input frame ID, shared by apply threads.
-    frameID frame_id_in;
+    std::thread fetch_thread;
+    void fetch_gains_loop();
 
-    /// Output frame ID, shared by apply threads.
-    frameID frame_id_out;
-
-    /// Mutex protecting shared frame IDs.
-    std::mutex m_frame_ids;
+    /// Tells the fetch thread to exit
+    std::atomic<bool> stop_fetch = false;
 
     // Prometheus metrics
     kotekan::prometheus::Gauge& update_age_metric;
@@ -178,16 +197,16 @@ private:
     restClient& client;
 
 
-    /// Wait until the first frame comes in and read its metadata to determine
-    /// what frequencies and inputs we will get
-    void initialise();
+    /// Read the metadata of the first frame to determine what frequencies and
+    /// inputs we will get
+    void initialise(const VisFrameView& frame);
 
-    /// Calculate the gain for this time and frequency
-    /// Returns false if there was no appropriate gain and we need to skip
-    std::tuple<bool, double, state_id_t> calculate_gain(double timestamp, uint32_t freq_id,
-                                                        std::vector<cfloat>& gain,
-                                                        std::vector<cfloat>& gain_conj,
-                                                        std::vector<float>& weight_factor) const;
+    /// Calculate the gain factors for this time and frequency, or reuse the last
+    /// ones for the frequency if they came from the same updates and blend.
+    /// The first value is true if there was no appropriate gain and we need to skip
+    std::tuple<bool, double, state_id_t>
+    calculate_gain(double timestamp, uint32_t freq_ind,
+                   std::shared_ptr<const GainFactors>& factors);
 
     /// Test that the frame is valid. On failure it will call FATAL_ERROR and
     /// return false
@@ -211,11 +230,80 @@ private:
     // Mapping from frequency ID to index (in the gain file)
     std::map<uint32_t, uint32_t> freq_map;
 
+    // The gain factors last calculated for a frequency, with the updates and the
+    // blend they were calculated from
+    struct CachedGains {
+        std::shared_ptr<const GainUpdate> update_new;
+        std::shared_ptr<const GainUpdate> update_old;
+        float coeff_new;
+        std::shared_ptr<const GainFactors> factors;
+    };
+
+    // The cached gain factors by frequency index. These are only used by the
+    // thread calculating the frame gains, so don't need a lock.
+    std::vector<CachedGains> gains_cache;
+
     // Map from the state being applied and input dataset to the output dataset.
     // This is used to keep track of the labels we should be applying for
     // timesamples coming out of order.
     std::map<std::pair<state_id_t, dset_id_t>, dset_id_t> output_dataset_ids;
 };
 
+/**
+ * @class applyGains
+ * @brief Receives gains and apply them to the output buffer.
+ *
+ * This stage registers as a subscriber to an updatable config block. The
+ * full name of the block should be defined in the value @c updatable_config.
+ * See @c applyGainsOperation for the details, config and metrics.
+ *
+ * @par Buffers
+ * @buffer in_buf The input stream.
+ *         @buffer_format VisBuffer.
+ *         @buffer_metadata VisMetadata
+ * @buffer out_buf The output stream.
+ *         @buffer_format VisBuffer.
+ *         @buffer_metadata VisMetadata
+ *
+ * @conf   num_threads      Int.    Number of frames to apply the gains to in parallel on
+ *                                  the work pool. Default is 1.
+ *
+ * @author Mateus Fandino, Tristan Pinsonneault-Marotte and Richard Shaw
+ */
+class applyGains : public kotekan::Stage {
+
+public:
+    /// Default constructor
+    applyGains(kotekan::Config& config, const std::string& unique_name,
+               kotekan::bufferContainer& buffer_container);
+
+    /// Main loop for the stage
+    void main_thread() override;
+
+private:
+    using frameGains = applyGainsOperation::frameGains;
+
+    /// Input buffer to read from
+    Buffer* in_buf;
+    /// Output buffer with gains applied
+    Buffer* out_buf;
+
+    kotekan::BufferConsumer in_consumer;
+    kotekan::BufferProducer out_producer;
+
+    /// Keeps track of the gains
+    applyGainsOperation gains_op;
+
+    /// Calculates the gains for a frame, in order on the stage thread.
+    /// Returns nothing if the frame is late and should be dropped.
+    std::optional<frameGains> prepare_frame(int input_frame_id);
+
+    /// Applies the gains to one frame, runs on the work pool.
+    void apply_frame(frameGains& gains, int input_frame_id, int output_frame_id);
+
+    /// Runs apply_frame on the work pool
+    kotekan::ParallelFrameMap<frameGains> frame_map;
+};
+
 
 #endif
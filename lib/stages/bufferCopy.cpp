@@ -29,9 +29,10 @@ bufferCopy::bufferCopy(Config& config, const std::string& unique_name,
     Stage(config, unique_name, buffer_container, std::bind(&bufferCopy::main_thread, this)) {
 
     in_buf = get_buffer("in_buf");
-    register_consumer(in_buf, unique_name.c_str());
+    in_consumer_id = register_consumer(in_buf, unique_name.c_str());
 
     _copy_metadata = config.get_default<bool>(unique_name, "copy_metadata", false);
+    _zero_copy = config.get_default<bool>(unique_name, "zero_copy", false);
 
     json buffer_list = config.get<std::vector<json>>(unique_name, "out_bufs");
     Buffer* out_buf = nullptr;
@@ -67,6 +68,12 @@ bufferCopy::bufferCopy(Config& config, const std::string& unique_name,
                                                     buffer_name));
         }
 
+        if (_zero_copy && out_buf->lock_free) {
+            throw std::invalid_argument(
+                fmt::format(fmt("Cannot share frames into lock free buffer '{:s}'."),
+                            buffer_name));
+        }
+
         register_producer(out_buf, unique_name.c_str());
         INFO("Adding buffer: {:s}:{:s}", internal_name, out_buf->buffer_name);
         out_bufs.push_back(std::make_tuple(internal_name, out_buf, frameID(out_buf)));
@@ -110,8 +117,11 @@ void bufferCopy::main_thread() {
                     pass_metadata(in_buf, in_frame_id, out_buf, out_frame_id);
             }
 
-            // Copy the frame.
-            std::memcpy(output_frame, input_frame, in_buf->frame_size);
+            // Copy the frame, or lend it to the output buffer
+            if (_zero_copy)
+                share_frame(in_buf, in_consumer_id, in_frame_id, out_buf, out_frame_id);
+            else
+                std::memcpy(output_frame, input_frame, in_buf->frame_size);
 
             mark_frame_full(out_buf, unique_name.c_str(), out_frame_id);
             out_frame_id++;
@@ -31,6 +31,15 @@
  *        @buffer_format any, but all must be the same type.
  *        @buffer_metadata any, but all must be the same type.
  *
+ * @conf copy_metadata  Bool. Default false. Make a deep copy of the metadata
+ *                      for each output instead of passing a reference.
+ * @conf zero_copy      Bool. Default false. Instead of copying the frame, lend
+ *                      the input frame to every output buffer (see @c share_frame).
+ *                      The input frame is only released once all the outputs
+ *                      are done with it, and the downstream stages must not
+ *                      modify the frames. The output buffers must not be
+ *                      lock free or zero their frames.
+ *
  * @author James Willis
  */
 class bufferCopy : public kotekan::Stage {
@@ -49,9 +58,14 @@ protected:
     /// The input buffer to copy frames from
     struct Buffer* in_buf;
 
+    /// Our consumer slot on the input buffer
+    int in_consumer_id;
+
     /// Config variables
     /// Flag to copy metadata or not
     bool _copy_metadata;
+    /// Flag to lend the input frames instead of copying them
+    bool _zero_copy;
 
     /// Array of output buffers to copy frames into
     /// Items are "internal_name", "buffer", "frame_id", "use_memcpy"
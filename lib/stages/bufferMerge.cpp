@@ -1,5 +1,6 @@
 #include "bufferMerge.hpp"
 
+#include "BufferHandle.hpp"    // for BufferConsumer, BufferWaitSet
 #include "Config.hpp"          // for Config
 #include "StageFactory.hpp"    // for REGISTER_KOTEKAN_STAGE, StageMakerTemplate
 #include "buffer.h"            // for Buffer, get_num_consumers, get_num_producers, mark_frame_...
@@ -18,6 +19,7 @@
 #include <functional> // for _Bind_helper<>::type, bind, function
 #include <regex>      // for match_results<>::_Base_type
 #include <stdexcept>  // for runtime_error, invalid_argument
+#include <vector>     // for vector
 
 using nlohmann::json;
 
@@ -32,10 +34,16 @@ bufferMerge::bufferMerge(Config& config, const std::string& unique_name,
     Stage(config, unique_name, buffer_container, std::bind(&bufferMerge::main_thread, this)) {
 
     _timeout = config.get_default<double>(unique_name, "timeout", -1.0);
+    _zero_copy = config.get_default<bool>(unique_name, "zero_copy", false);
 
     out_buf = get_buffer("out_buf");
     register_producer(out_buf, unique_name.c_str());
 
+    if (_zero_copy && out_buf->lock_free) {
+        throw std::invalid_argument(fmt::format(
+            fmt("Cannot share frames into lock free buffer '{:s}'."), out_buf->buffer_name));
+    }
+
     json buffer_list = config.get<std::vector<json>>(unique_name, "in_bufs");
     Buffer* in_buf = nullptr;
     std::string internal_name;
@@ -66,7 +74,9 @@ bufferMerge::bufferMerge(Config& config, const std::string& unique_name,
                                                     buffer_name));
         }
 
-        register_consumer(in_buf, unique_name.c_str());
+        kotekan::BufferConsumer consumer(in_buf, unique_name);
+        in_consumer_ids[in_buf] = consumer.get_slot();
+        in_wait_set.add(consumer);
         INFO("Adding buffer: {:s}:{:s}", internal_name, in_buf->buffer_name);
         in_bufs.push_back(std::make_tuple(internal_name, in_buf, frameID(in_buf)));
     }
@@ -90,55 +100,75 @@ void bufferMerge::main_thread() {
     }
 
     while (!stop_thread) {
-        for (auto& buffer_info : in_bufs) {
-            const std::string& internal_buffer_name = std::get<0>(buffer_info);
-            Buffer* in_buf = std::get<1>(buffer_info);
-            frameID& in_frame_id = std::get<2>(buffer_info);
+        if (_timeout < 0) {
+            // Take a frame from each input in turn
+            for (auto& buffer_info : in_bufs) {
+                Buffer* in_buf = std::get<1>(buffer_info);
+                frameID& in_frame_id = std::get<2>(buffer_info);
 
-            /// Wait for an input frame
-            if (_timeout < 0) {
+                /// Wait for an input frame
                 DEBUG2("Waiting for {:s}[{:d}]", in_buf->buffer_name, in_frame_id);
                 uint8_t* input_frame =
                     wait_for_full_frame(in_buf, unique_name.c_str(), in_frame_id);
                 if (input_frame == nullptr)
-                    goto exit_loop; // Shutdown condition
-            } else {
-                auto timeout = double_to_ts(current_time() + _timeout);
-                int status =
-                    wait_for_full_frame_timeout(in_buf, unique_name.c_str(), in_frame_id, timeout);
-                if (status == 1)
-                    continue;
-                if (status == -1)
-                    goto exit_loop; // Got shutdown signal
-            }
-
-            if (select_frame(internal_buffer_name, in_buf, in_frame_id)) {
+                    return; // Shutdown condition
 
-                uint8_t* output_frame =
-                    wait_for_empty_frame(out_buf, unique_name.c_str(), out_frame_id);
-                if (output_frame == nullptr)
-                    break;
+                if (!merge_frame(buffer_info, out_frame_id))
+                    return;
+            }
+        } else {
+            // Take the frames in whichever order they arrive
+            std::vector<int> in_frame_ids;
+            for (auto& buffer_info : in_bufs)
+                in_frame_ids.push_back(std::get<2>(buffer_info));
+
+            auto timeout = double_to_ts(current_time() + _timeout);
+            int ready;
+            int status = in_wait_set.wait_for_any_full_frame(in_frame_ids, ready, &timeout);
+            if (status == 1)
+                continue;
+            if (status == -1)
+                return; // Got shutdown signal
+
+            if (!merge_frame(in_bufs[ready], out_frame_id))
+                return;
+        }
+    }
+}
 
-                // Move the metadata over to the new frame
-                pass_metadata(in_buf, in_frame_id, out_buf, out_frame_id);
+bool bufferMerge::merge_frame(std::tuple<std::string, Buffer*, frameID>& buffer_info,
+                              frameID& out_frame_id) {
+    const std::string& internal_buffer_name = std::get<0>(buffer_info);
+    Buffer* in_buf = std::get<1>(buffer_info);
+    frameID& in_frame_id = std::get<2>(buffer_info);
 
-                // Copy or swap the frame.
-                if (get_num_consumers(in_buf) > 1) {
-                    std::memcpy(output_frame, in_buf->frames[in_frame_id], in_buf->frame_size);
-                } else {
-                    swap_frames(in_buf, in_frame_id, out_buf, out_frame_id);
-                }
+    if (select_frame(internal_buffer_name, in_buf, in_frame_id)) {
 
-                mark_frame_full(out_buf, unique_name.c_str(), out_frame_id);
-                out_frame_id++;
-            }
+        uint8_t* output_frame = wait_for_empty_frame(out_buf, unique_name.c_str(), out_frame_id);
+        if (output_frame == nullptr)
+            return false;
 
-            // We always release the input buffer even if it isn't selected.
-            mark_frame_empty(in_buf, unique_name.c_str(), in_frame_id);
+        // Move the metadata over to the new frame
+        pass_metadata(in_buf, in_frame_id, out_buf, out_frame_id);
 
-            // Increase the in_frame_id for the input buffer
-            in_frame_id++;
+        // Copy, lend or swap the frame.
+        if (get_num_consumers(in_buf) > 1 && _zero_copy) {
+            share_frame(in_buf, in_consumer_ids.at(in_buf), in_frame_id, out_buf, out_frame_id);
+        } else if (get_num_consumers(in_buf) > 1) {
+            std::memcpy(output_frame, in_buf->frames[in_frame_id], in_buf->frame_size);
+        } else {
+            swap_frames(in_buf, in_frame_id, out_buf, out_frame_id);
         }
+
+        mark_frame_full(out_buf, unique_name.c_str(), out_frame_id);
+        out_frame_id++;
     }
-exit_loop:;
+
+    // We always release the input buffer even if it isn't selected.
+    mark_frame_empty(in_buf, unique_name.c_str(), in_frame_id);
+
+    // Increase the in_frame_id for the input buffer
+    in_frame_id++;
+
+    return true;
 }
@@ -1,12 +1,14 @@
 #ifndef BUFFER_MERGE_HPP
 #define BUFFER_MERGE_HPP
 
+#include "BufferHandle.hpp"    // for BufferWaitSet
 #include "Config.hpp"          // for Config
 #include "Stage.hpp"           // for Stage
 #include "buffer.h"            // for Buffer
 #include "bufferContainer.hpp" // for bufferContainer
 #include "visUtil.hpp"         // for frameID
 
+#include <map>      // for map
 #include <stdint.h> // for uint32_t
 #include <string>   // for string
 #include <tuple>    // for tuple
@@ -47,7 +49,14 @@
  *
  * @conf timeout       Double. Default -1.0   Timeout in seconds for waiting
  *                       for a frame on any of the input buffers.
- *                       Set to a negative number for no timeout.
+ *                       Set to a negative number for no timeout, in which case the
+ *                       frames are taken from each input buffer in turn.  With a
+ *                       timeout they are taken from whichever input has one first.
+ * @conf zero_copy     Bool. Default false. When an input buffer has other
+ *                       consumers, lend its frames to @c out_buf instead of
+ *                       copying them (see @c share_frame). The input frame is only
+ *                       released once the consumers of @c out_buf are done with it,
+ *                       and they must not modify it.
  *
  * @author Andre Renard
  */
@@ -77,16 +86,30 @@ public:
     /// Thread for merging the frames.
     void main_thread() override;
 
+private:
+    /// Moves the current frame of an input to @c out_buf if it is selected, and releases it.
+    /// Returns false if the output buffer is shutting down.
+    bool merge_frame(std::tuple<std::string, Buffer*, frameID>& buffer_info, frameID& out_frame_id);
+
 protected:
     /// Array of input buffers to get frames from
     /// Items are "internal_name", "buffer", "frame_id", "use_memcpy"
     std::vector<std::tuple<std::string, Buffer*, frameID>> in_bufs;
 
+    /// Our consumer slot on each of the input buffers
+    std::map<Buffer*, int> in_consumer_ids;
+
+    /// Wakes us when any of the input buffers has a frame, in the same order as @c in_bufs
+    kotekan::BufferWaitSet in_wait_set;
+
     /// The output buffer to put frames into
     struct Buffer* out_buf;
 
     /// The in seconds to wait for a new frame on one of the input buffers.
     double _timeout;
+
+    /// Lend frames to @c out_buf instead of copying them.
+    bool _zero_copy;
 };
 
 #endif
@@ -2,18 +2,20 @@
 
 #include "Config.hpp"            // for Config
 #include "StageFactory.hpp"      // for REGISTER_KOTEKAN_STAGE, StageMakerTemplate
-#include "buffer.h"              // for get_num_full_frames, print_buffer_status, Buffer
+#include "buffer.h"              // for get_num_full_frames, print_buffer_status, Buffer, Sta...
 #include "bufferContainer.hpp"   // for bufferContainer
 #include "kotekanLogging.hpp"    // for INFO
 #include "prometheusMetrics.hpp" // for Metrics, Gauge, MetricFamily
 #include "visUtil.hpp"           // for current_time
 
+#include "fmt.hpp" // for format
+
 #include <atomic>     // for atomic_bool
 #include <exception>  // for exception
 #include <functional> // for _Bind_helper<>::type, bind, function
 #include <regex>      // for match_results<>::_Base_type
 #include <stdexcept>  // for runtime_error
-#include <stdint.h>   // for uint32_t
+#include <stdint.h>   // for uint32_t, uint64_t
 #include <string>     // for string, allocator
 #include <unistd.h>   // for usleep
 #include <utility>    // for pair
@@ -45,6 +47,14 @@ void bufferStatus::main_thread() {
         metrics.add_gauge("kotekan_bufferstatus_frames_total", unique_name, {"buffer_name"});
     auto& full_frames_counter =
         metrics.add_gauge("kotekan_bufferstatus_full_frames_total", unique_name, {"buffer_name"});
+    auto& wait_time_counter = metrics.add_gauge("kotekan_bufferstatus_wait_seconds_total",
+                                                unique_name, {"buffer_name", "client", "role"});
+    auto& released_counter = metrics.add_gauge("kotekan_bufferstatus_released_frames_total",
+                                               unique_name, {"buffer_name", "client", "role"});
+    auto& residency_counter = metrics.add_gauge("kotekan_bufferstatus_residency_seconds_total",
+                                                unique_name, {"buffer_name", "client"});
+    auto& residency_hist = metrics.add_gauge("kotekan_bufferstatus_residency_seconds_bucket",
+                                             unique_name, {"buffer_name", "client", "le"});
 
     double last_print_time = current_time();
 
@@ -59,6 +69,37 @@ void bufferStatus::main_thread() {
             std::string buffer_name = buf_entry.first;
             full_frames_counter.labels({buffer_name}).set(num_full_frames);
             frames_counter.labels({buffer_name}).set(buf_entry.second->num_frames);
+
+            for (int i = 0; i < MAX_PRODUCERS; ++i) {
+                const StageInfo& producer = buf_entry.second->producers[i];
+                if (!producer.in_use)
+                    continue;
+                wait_time_counter.labels({buffer_name, producer.name, "producer"})
+                    .set(producer.wait_time_ns * 1e-9);
+                released_counter.labels({buffer_name, producer.name, "producer"})
+                    .set(producer.num_released);
+            }
+
+            for (int i = 0; i < MAX_CONSUMERS; ++i) {
+                const StageInfo& consumer = buf_entry.second->consumers[i];
+                if (!consumer.in_use)
+                    continue;
+                wait_time_counter.labels({buffer_name, consumer.name, "consumer"})
+                    .set(consumer.wait_time_ns * 1e-9);
+                released_counter.labels({buffer_name, consumer.name, "consumer"})
+                    .set(consumer.num_released);
+                residency_counter.labels({buffer_name, consumer.name})
+                    .set(consumer.residency_time_ns * 1e-9);
+
+                uint64_t count = 0;
+                for (int b = 0; b < BUFFER_LATENCY_BINS; ++b) {
+                    count += consumer.residency_hist[b];
+                    std::string le = (b == BUFFER_LATENCY_BINS - 1)
+                                         ? "+Inf"
+                                         : fmt::format("{:g}", get_latency_bin_upper_bound(b));
+                    residency_hist.labels({buffer_name, consumer.name, le}).set(count);
+                }
+            }
         }
 
         if (print_status && (now - last_print_time) > ((double)time_delay / 1000000.0)) {
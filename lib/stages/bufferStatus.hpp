@@ -32,6 +32,14 @@
  *         The number of full frames for a given buffer
  * @metric kotekan_bufferstatus_frames_total
  *         The total number of frames in a given buffer (buffer depth)
+ * @metric kotekan_bufferstatus_wait_seconds_total
+ *         The time a producer or consumer of a buffer has spent blocked in @c wait_for_*
+ * @metric kotekan_bufferstatus_released_frames_total
+ *         The number of frames a producer or consumer has released
+ * @metric kotekan_bufferstatus_residency_seconds_total
+ *         The summed time from frames being marked full to a consumer releasing them
+ * @metric kotekan_bufferstatus_residency_seconds_bucket
+ *         Cumulative histogram of the frame residency time of each consumer
  *
  * @author Jacob Taylor, Andre Renard
  */
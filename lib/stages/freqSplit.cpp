@@ -1,9 +1,10 @@
 #include "freqSplit.hpp"
 
+#include "BufferHandle.hpp"    // for BatchedBufferConsumer, BufferConsumer
 #include "Config.hpp"          // for Config
 #include "Hash.hpp"            // for operator!=
 #include "StageFactory.hpp"    // for REGISTER_KOTEKAN_STAGE, StageMakerTemplate
-#include "buffer.h"            // for wait_for_full_frame, allocate_new_metadata_object, mark_f...
+#include "buffer.h"            // for wait_for_empty_frame, mark_frame_full, register_producer
 #include "bufferContainer.hpp" // for bufferContainer
 #include "datasetManager.hpp"  // for dset_id_t, datasetManager, state_id_t
 #include "datasetState.hpp"    // for freqState, datasetState, state_uptr
@@ -25,6 +26,8 @@
 #include <tuple>        // for tie, tuple
 
 
+using kotekan::BatchedBufferConsumer;
+using kotekan::BufferConsumer;
 using kotekan::bufferContainer;
 using kotekan::Config;
 using kotekan::Stage;
@@ -42,7 +45,8 @@ freqSplit::freqSplit(Config& config, const std::string& unique_name,
 
     // Setup the input buffer
     in_buf = get_buffer("in_buf");
-    register_consumer(in_buf, unique_name.c_str());
+    int batch_size = config.get_default<int>(unique_name, "batch_size", 1);
+    in_frames = BatchedBufferConsumer(BufferConsumer(in_buf, unique_name), batch_size);
 
     // Fetch the output buffers, register them, and store them in our buffer vector
     for (auto name : output_buffer_names) {
@@ -91,7 +95,6 @@ void freqSplit::main_thread() {
 
     struct Buffer* buf;
     unsigned int frame_id = 0;
-    unsigned int input_frame_id = 0;
     unsigned int freq;
     unsigned int buf_ind;
 
@@ -99,18 +102,19 @@ void freqSplit::main_thread() {
     std::array<dset_id_t, 2> output_dset_id = {{dset_id_t::null, dset_id_t::null}};
 
     // Wait for a frame in the input buffer in order to get the dataset ID
-    if (wait_for_full_frame(in_buf, unique_name.c_str(), input_frame_id) == nullptr) {
+    if (in_frames.wait_for_full_frame() == nullptr) {
         return;
     }
-    input_dset_id = VisFrameView(in_buf, input_frame_id).dataset_id;
+    input_dset_id = VisFrameView(in_buf, in_frames.get_frame_id()).dataset_id;
     _output_dset_id = std::async(&freqSplit::change_dataset_state, this, input_dset_id);
 
     while (!stop_thread) {
 
         // Wait for the input buffer to be filled with data
-        if (wait_for_full_frame(in_buf, unique_name.c_str(), input_frame_id) == nullptr) {
+        if (in_frames.wait_for_full_frame() == nullptr) {
             break;
         }
+        int input_frame_id = in_frames.get_frame_id();
 
         // Create view to input frame
         auto input_frame = VisFrameView(in_buf, input_frame_id);
@@ -152,11 +156,10 @@ void freqSplit::main_thread() {
         frame.dataset_id = output_dset_id.at(buf_ind);
 
         // Mark the buffers and move on
-        mark_frame_empty(in_buf, unique_name.c_str(), input_frame_id);
+        in_frames.mark_frame_empty();
         mark_frame_full(buf, unique_name.c_str(), frame_id);
 
         // Advance the current frame ids
         std::get<1>(buffer_pair) = (frame_id + 1) % buf->num_frames;
-        input_frame_id = (input_frame_id + 1) % in_buf->num_frames;
     }
 }
@@ -6,6 +6,7 @@
 #ifndef FREQ_SPLIT_HPP
 #define FREQ_SPLIT_HPP
 
+#include "BufferHandle.hpp" // for BatchedBufferConsumer
 #include "Config.hpp"
 #include "Stage.hpp" // for Stage
 #include "buffer.h"
@@ -41,6 +42,8 @@
  *                              at. Lower frequencies got to the first output
  *                              buffer, equal and higher frequencies go to the
  *                              second. Default 512.
+ * @conf batch_size             Int. Maximum number of input frames to acquire
+ *                              and release at once. Default is 1.
  *
  * @todo Generalise to arbitary frequency splits.
  * @author Mateus Fandino
@@ -62,6 +65,7 @@ private:
     // Vector of the buffers we are using and their current frame ids.
     std::vector<std::pair<Buffer*, unsigned int>> out_bufs;
     Buffer* in_buf;
+    kotekan::BatchedBufferConsumer in_frames;
 
     std::future<std::array<dset_id_t, 2>> _output_dset_id;
 
@@ -1,10 +1,13 @@
 #include "visAccumulate.hpp"
 
+#include "BufferHandle.hpp"      // for BufferProducer, BatchedBufferConsumer, BufferConsumer
 #include "Config.hpp"            // for Config
 #include "Hash.hpp"              // for operator!=
 #include "StageFactory.hpp"      // for REGISTER_KOTEKAN_STAGE, StageMakerTemplate
 #include "Telescope.hpp"         // for Telescope
-#include "buffer.h"              // for register_producer, Buffer, allocate_new_metadata_object
+#include "WorkPool.hpp"          // for WorkPool
+#include "accumulateFrame.hpp"   // for accumulate_frame
+#include "buffer.h"              // for Buffer, allocate_new_metadata_object
 #include "bufferContainer.hpp"   // for bufferContainer
 #include "chimeMetadata.hpp"     // for chimeMetadata, get_dataset_id, get_fpga_seq_num, get_lo...
 #include "configUpdater.hpp"     // for configUpdater
@@ -22,12 +25,11 @@
 #include "gsl-lite.hpp" // for span<>::iterator, span
 #include "json.hpp"     // for json, basic_json, iteration_proxy_value, basic_json<>::...
 
-#include <algorithm>  // for copy, max, fill, copy_backward, equal, transform
+#include <algorithm>  // for copy, max, min, fill, copy_backward, equal, transform
 #include <assert.h>   // for assert
 #include <atomic>     // for atomic_bool
 #include <cmath>      // for pow
 #include <complex>    // for operator*, complex
-#include <cstring>    // for memcpy
 #include <exception>  // for exception
 #include <iterator>   // for back_insert_iterator, begin, end, back_inserter
 #include <mutex>      // for lock_guard, mutex
@@ -43,11 +45,15 @@
 
 using namespace std::placeholders;
 
+using kotekan::BatchedBufferConsumer;
+using kotekan::BufferConsumer;
 using kotekan::bufferContainer;
+using kotekan::BufferProducer;
 using kotekan::Config;
 using kotekan::configUpdater;
 using kotekan::Stage;
 using kotekan::prometheus::Metrics;
+using kotekan::WorkPool;
 
 REGISTER_KOTEKAN_STAGE(visAccumulate);
 
@@ -66,10 +72,13 @@ visAccumulate::visAccumulate(Config& config, const std::string& unique_name,
     block_size = config.get<size_t>(unique_name, "block_size");
     samples_per_data_set = config.get<size_t>(unique_name, "samples_per_data_set");
     max_age = config.get_default<float>(unique_name, "max_age", 60.0);
+    num_threads = config.get_default<uint32_t>(unique_name, "num_threads", 1);
+    if (num_threads == 0)
+        throw std::invalid_argument("visAccumulate: num_threads has to be at least 1.");
 
     // Get the indices for reordering
     auto input_reorder = parse_reorder_default(config, unique_name);
-    input_remap = std::get<0>(input_reorder);
+    input_remap = VisTriangleMap(std::get<0>(input_reorder), block_size, num_elements);
 
     float int_time = config.get_default<float>(unique_name, "integration_time", -1.0);
 
@@ -137,10 +146,12 @@ visAccumulate::visAccumulate(Config& config, const std::string& unique_name,
     register_base_dataset_states(instrument_name, freqs, inputs, prods);
 
     in_buf = get_buffer("in_buf");
-    register_consumer(in_buf, unique_name.c_str());
+    int batch_size = config.get_default<int>(unique_name, "batch_size", 1);
+    in_frames = BatchedBufferConsumer(BufferConsumer(in_buf, unique_name),
+                                      std::min(batch_size, in_buf->num_frames));
 
     out_buf = get_buffer("out_buf");
-    register_producer(out_buf, unique_name.c_str());
+    BufferProducer out_producer(out_buf, unique_name);
 
     // Because we reserve `num_freq_in_frame` output frames for each input frame, the output
     // buffer must have at least `num_freq_in_frame` frames allocated.
@@ -152,7 +163,7 @@ visAccumulate::visAccumulate(Config& config, const std::string& unique_name,
 
     // Create the state for the main visibility accumulation
     gated_datasets.emplace_back(
-        out_buf, gateSpec::create("uniform", "vis", kotekan::logLevel(_member_log_level)),
+        out_producer, gateSpec::create("uniform", "vis", kotekan::logLevel(_member_log_level)),
         num_prod_gpu);
 
     // Get and validate any gating config
@@ -207,11 +218,12 @@ visAccumulate::visAccumulate(Config& config, const std::string& unique_name,
 
         // Fetch and register the buffer
         auto buf = buffer_container.get_buffer(buffer_name);
-        register_producer(buf, unique_name.c_str());
+        BufferProducer producer(buf, unique_name);
 
         // Create the gated datasets and register the update callback
         gated_datasets.emplace_back(
-            buf, gateSpec::create(mode, name, kotekan::logLevel(_member_log_level)), num_prod_gpu);
+            producer, gateSpec::create(mode, name, kotekan::logLevel(_member_log_level)),
+            num_prod_gpu);
 
         auto& state = gated_datasets.back();
         callbacks[name] = [&state](nlohmann::json& json) -> bool {
@@ -257,8 +269,6 @@ dset_id_t visAccumulate::register_gate_dataset(const gateSpec& spec) {
 
 void visAccumulate::main_thread() {
 
-    frameID in_frame_id(in_buf);
-
     std::optional<dset_id_t> ds_id_in = std::nullopt;
 
     // Hold the gated datasets that are enabled;
@@ -271,6 +281,9 @@ void visAccumulate::main_thread() {
     std::vector<int32_t> vis_even(2 * num_prod_gpu);
     int32_t samples_even = 0;
 
+    // The visibility sums each frame is accumulated into
+    std::vector<int32_t*> accumulate_vis1;
+
     auto& tel = Telescope::instance();
 
     // Have we initialised a frame for writing yet
@@ -284,9 +297,10 @@ void visAccumulate::main_thread() {
     while (!stop_thread) {
 
         // Fetch a new frame and get its sequence id
-        uint8_t* in_frame = wait_for_full_frame(in_buf, unique_name.c_str(), in_frame_id);
+        uint8_t* in_frame = in_frames.wait_for_full_frame();
         if (in_frame == nullptr)
             break;
+        const int in_frame_id = in_frames.get_frame_id();
 
         // Check if dataset ID changed
         dset_id_t ds_id_in_new = get_dataset_id(in_buf, in_frame_id);
@@ -331,11 +345,13 @@ void visAccumulate::main_thread() {
 
             // Debias the weights estimate, by subtracting out the bias estimation
             float w = d0.weight_diff_sum / pow(d0.sample_weight_total, 2);
-            for (size_t i = 0; i < num_prod_gpu; i++) {
-                float di = d0.vis1[2 * i];
-                float dr = d0.vis1[2 * i + 1];
-                d0.vis2[i] -= w * (dr * dr + di * di);
-            }
+            run_sharded(num_prod_gpu, [&](size_t start, size_t end) {
+                for (size_t i = start; i < end; i++) {
+                    float di = d0.vis1[2 * i];
+                    float dr = d0.vis1[2 * i + 1];
+                    d0.vis2[i] -= w * (dr * dr + di * di);
+                }
+            });
 
             // Iterate over *only* the gated datasets (remember that element
             // zero is the vis), and remove the bias and copy in the variance
@@ -394,8 +410,9 @@ void visAccumulate::main_thread() {
 
             int32_t samples_in_frame = samples_per_data_set - lost_in_frame;
 
-            // Accumulate the weighted data into each dataset. At the moment this
+            // Find the datasets to accumulate this frame into. At the moment this
             // doesn't really work if there are multiple frequencies in the same buffer..
+            accumulate_vis1.clear();
             for (internalState& dset : enabled_gated_datasets) {
 
                 float freq_in_MHz = tel.to_freq(dset.frames[0].freq_id);
@@ -409,9 +426,7 @@ void visAccumulate::main_thread() {
                 // not doing this because I don't want to burn cycles doing the
                 // multiplications
                 // Perform primary accumulation (assume that the weight is one)
-                for (size_t i = 0; i < 2 * num_prod_gpu; i++) {
-                    dset.vis1[i] += input[i];
-                }
+                accumulate_vis1.push_back(dset.vis1.data());
 
                 dset.sample_weight_total += samples_in_frame;
 
@@ -426,34 +441,33 @@ void visAccumulate::main_thread() {
             }
 
             // We are calculating the weights by differencing even and odd samples.
-            // Every even sample we save the set of visibilities...
-            if (frame_count % 2 == 0) {
-                std::memcpy(vis_even.data(), input, 8 * num_prod_gpu);
-                samples_even = samples_in_frame;
-            }
-            // ... every odd sample we accumulate the squared differences into the weight dataset
+            // Every even sample we save the set of visibilities, every odd sample
+            // we accumulate the squared differences into the weight dataset.
             // NOTE: this incrementally calculates the variance, but eventually
             // output_frame.weight will hold the *inverse* variance
             // TODO: we might need to account for packet loss in here too, but it
             // would require some awkward rescalings
-            else {
-                internalState& d0 = enabled_gated_datasets.at(0); // Save into the main vis dataset
-                for (size_t i = 0; i < num_prod_gpu; i++) {
-                    // NOTE: avoid using the slow std::complex routines in here
-                    float di = input[2 * i] - vis_even[2 * i];
-                    float dr = input[2 * i + 1] - vis_even[2 * i + 1];
-                    d0.vis2[i] += (dr * dr + di * di);
-                }
+            bool even = (frame_count % 2 == 0);
+            float* vis2 = even ? nullptr : enabled_gated_datasets.at(0).get().vis2.data();
+
+            // Do both in one pass over the frame
+            run_sharded(num_prod_gpu, [&](size_t start, size_t end) {
+                accumulate_frame(input, accumulate_vis1, vis_even.data(), vis2, even, start, end);
+            });
 
+            if (even) {
+                samples_even = samples_in_frame;
+            } else {
                 // Accumulate the squared samples difference which we need for
                 // debiasing the variance estimate
+                internalState& d0 = enabled_gated_datasets.at(0);
                 float samples_diff = samples_in_frame - samples_even;
                 d0.weight_diff_sum += samples_diff * samples_diff;
             }
         }
 
         // Move the input buffer on one step
-        mark_frame_empty(in_buf, unique_name.c_str(), in_frame_id++);
+        in_frames.mark_frame_empty();
         last_frame_count = frame_count;
         frames_in_this_cycle++;
     }
@@ -466,8 +480,7 @@ bool visAccumulate::initialise_output(visAccumulate::internalState& state, int i
 
     for (size_t freq_ind = 0; freq_ind < num_freq_in_frame; freq_ind++) {
 
-        if (wait_for_empty_frame(state.buf, unique_name.c_str(), state.frame_id + freq_ind)
-            == nullptr) {
+        if (state.producer.wait_for_empty_frame(state.frame_id + freq_ind) == nullptr) {
             return true;
         }
 
@@ -510,19 +523,21 @@ void visAccumulate::combine_gated(visAccumulate::internalState& gate,
 
     // Subtract out the bias from the gated data
     float scl = gate.sample_weight_total / vis.sample_weight_total;
-    for (size_t i = 0; i < 2 * num_prod_gpu; i++) {
-        gate.vis1[i] -= (int32_t)(scl * vis.vis1[i]);
-    }
+    run_sharded(num_prod_gpu, [&](size_t start, size_t end) {
+        for (size_t i = 2 * start; i < 2 * end; i++) {
+            gate.vis1[i] -= (int32_t)(scl * vis.vis1[i]);
+        }
+
+        // Copy in the proto weight data
+        for (size_t i = start; i < end; i++) {
+            gate.vis2[i] = scl * (1.0 - scl) * vis.vis2[i];
+        }
+    });
 
     // TODO: very strong assumption that the weights are one (when on) baked in
     // here.
     gate.sample_weight_total = vis.sample_weight_total - gate.sample_weight_total;
 
-    // Copy in the proto weight data
-    for (size_t i = 0; i < num_prod_gpu; i++) {
-        gate.vis2[i] = scl * (1.0 - scl) * vis.vis2[i];
-    }
-
     // The number of FPGA frames that went into this integration is the same as
     // for the ungated dataset. If we don't correct this, only the on gates are
     // counted.
@@ -543,10 +558,12 @@ void visAccumulate::finalise_output(visAccumulate::internalState& state,
 
     bool blocked = false;
 
-    // Loop over the frequencies in the frame and unpack the accumulates
-    // into the output frame...
+    // The frequencies which are going to be output
+    std::vector<size_t> output_freqs;
+
+    // Loop over the frequencies in the frame and find which ones to output...
     for (size_t freq_ind = 0; freq_ind < num_freq_in_frame; freq_ind++) {
-        auto output_frame = state.frames[freq_ind];
+        auto& output_frame = state.frames[freq_ind];
 
         // Check if we need to skip the frame.
         //
@@ -570,27 +587,44 @@ void visAccumulate::finalise_output(visAccumulate::internalState& state,
             continue;
         }
 
-        // Copy the visibilities into place
-        map_vis_triangle(input_remap, block_size, num_elements, freq_ind,
-                         [&](int32_t pi, int32_t bi, bool conj) {
-                             cfloat t = {(float)state.vis1[2 * bi + 1], (float)state.vis1[2 * bi]};
-                             t = !conj ? t : std::conj(t);
-                             output_frame.vis[pi] = iw * t;
-                         });
-
-        // Unpack and invert the weights
-        map_vis_triangle(input_remap, block_size, num_elements, freq_ind,
-                         [&](int32_t pi, int32_t bi, bool conj) {
-                             (void)conj;
-                             float t = state.vis2[bi];
-                             output_frame.weight[pi] = w * w / t;
-                         });
-
-        mark_frame_full(state.buf, unique_name.c_str(), state.frame_id++);
+        output_freqs.push_back(freq_ind);
+    }
+
+    // ... unpack the accumulates into their output frames ...
+    run_sharded(output_freqs.size(), [&](size_t start, size_t end) {
+        for (size_t i = start; i < end; i++) {
+            auto& output_frame = state.frames[output_freqs[i]];
+
+            // Copy the visibilities into place
+            input_remap.copy_vis(state.vis1.data(), output_frame.vis, output_freqs[i], iw);
+
+            // Unpack and invert the weights
+            input_remap.copy_inverse(state.vis2.data(), output_frame.weight, output_freqs[i],
+                                     w * w);
+        }
+    });
+
+    // ... and release them in order
+    for (size_t i = 0; i < output_freqs.size(); i++) {
+        state.producer.mark_frame_full(state.frame_id++);
     }
 }
 
 
+void visAccumulate::run_sharded(size_t n, const std::function<void(size_t, size_t)>& f) {
+    size_t num_shards = std::min<size_t>(num_threads, n);
+    if (num_shards <= 1) {
+        f(0, n);
+        return;
+    }
+
+    WorkPool::instance().parallel_for(
+        num_shards,
+        [&](size_t shard) { f(n * shard / num_shards, n * (shard + 1) / num_shards); },
+        num_shards - 1);
+}
+
+
 bool visAccumulate::reset_state(visAccumulate::internalState& state, timespec t) {
 
     // Reset the internal counters
@@ -630,7 +664,8 @@ bool visAccumulate::reset_state(visAccumulate::internalState& state, timespec t)
 }
 
 
-visAccumulate::internalState::internalState(Buffer* out_buf, std::unique_ptr<gateSpec> gate_spec,
-                                            size_t nprod) :
-    buf(out_buf),
+visAccumulate::internalState::internalState(const BufferProducer& out,
+                                            std::unique_ptr<gateSpec> gate_spec, size_t nprod) :
+    producer(out),
+    buf(out.buffer()),
     frame_id(buf), spec(std::move(gate_spec)), changed(true), vis1(2 * nprod), vis2(nprod) {}
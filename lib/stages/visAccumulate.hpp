@@ -7,6 +7,7 @@
 #ifndef VIS_ACCUMULATE_HPP
 #define VIS_ACCUMULATE_HPP
 
+#include "BufferHandle.hpp"      // for BatchedBufferConsumer, BufferProducer
 #include "Config.hpp"            // for Config
 #include "Stage.hpp"             // for Stage
 #include "buffer.h"              // for Buffer
@@ -15,7 +16,7 @@
 #include "gateSpec.hpp"          // for gateSpec
 #include "prometheusMetrics.hpp" // for Counter, MetricFamily
 #include "visBuffer.hpp"         // for VisFrameView
-#include "visUtil.hpp"           // for frameID, freq_ctype, input_ctype, prod_ctype
+#include "visUtil.hpp"           // for frameID, freq_ctype, input_ctype, prod_ctype, VisTri...
 
 #include <cstdint>    // for uint32_t, int32_t
 #include <deque>      // for deque
@@ -72,6 +73,12 @@
  *                              Default 0..1023.
  * @conf  max_age               Float. Drop frames later than this number of seconds.
  *                              Default is 60.0
+ * @conf  batch_size            Int. Maximum number of GPU frames to acquire and release
+ *                              at once. Default is 1.
+ * @conf  num_threads           Int. Number of threads to split the accumulation and
+ *                              unpacking of each frame over. The products (or the
+ *                              frequencies when unpacking) are divided into this many
+ *                              shards, which run on the work pool. Default 1.
  *
  * @par Metrics
  * @metric  kotekan_visaccumulate_skipped_frame_total
@@ -102,15 +109,19 @@ private:
          * Everything else will be set by the reset_state call during
          * initialisation.
          *
-         * @param  out_buf    Buffer we will output into.
+         * @param  out        Producer handle for the buffer we will output into.
          * @param  gate_spec  Specification of how any gating is done.
          * @param  nprod      Number of products.
          **/
-        internalState(Buffer* out_buf, std::unique_ptr<gateSpec> gate_spec, size_t nprod);
+        internalState(const kotekan::BufferProducer& out, std::unique_ptr<gateSpec> gate_spec,
+                      size_t nprod);
 
         /// View of the data accessed by their freq_ind
         std::vector<VisFrameView> frames;
 
+        /// Our producer registration on the output buffer
+        kotekan::BufferProducer producer;
+
         /// The buffer we are outputting too
         Buffer* buf;
 
@@ -151,6 +162,7 @@ private:
     // Buffers to read/write
     Buffer* in_buf;
     Buffer* out_buf; // Output for the main vis dataset only
+    kotekan::BatchedBufferConsumer in_frames;
 
     // Parameters saved from the config files
     size_t num_elements;
@@ -160,15 +172,27 @@ private:
     size_t num_gpu_frames;
     size_t minimum_samples;
     float max_age;
+    uint32_t num_threads;
 
     // Derived from config
     size_t num_prod_gpu;
 
-    // The mapping from buffer element order to output file element ordering
-    std::vector<uint32_t> input_remap;
+    // The mapping from the GPU buffer to the output visibility triangle
+    VisTriangleMap input_remap;
 
     // Helper methods to make code clearer
 
+    /**
+     * @brief Split a range into `num_threads` shards and process them in parallel.
+     *
+     * The shards run on the calling thread and up to `num_threads - 1` workers
+     * of the work pool. Returns once all of them are done.
+     *
+     * @param  n  The size of the range.
+     * @param  f  Function to process the shard [start, end).
+     **/
+    void run_sharded(size_t n, const std::function<void(size_t start, size_t end)>& f);
+
     /**
      * @brief Construct the correct gated visibilities from the gated and
      *        ungated dataset.
@@ -2,34 +2,32 @@
 
 #include "Config.hpp"            // for Config
 #include "Hash.hpp"              // for Hash, operator<
-#include "Stack.hpp"             // for stack_chime_in_cyl, stack_diagonal
+#include "Stack.hpp"             // for stack_chime_in_cyl, stack_diagonal, StackPlan
 #include "StageFactory.hpp"      // for REGISTER_KOTEKAN_STAGE, StageMakerTemplate
-#include "buffer.h"              // for wait_for_full_frame, mark_frame_empty, mark_frame_full
+#include "WorkPool.hpp"          // for WorkPool
+#include "buffer.h"              // for Buffer
 #include "bufferContainer.hpp"   // for bufferContainer
 #include "datasetManager.hpp"    // for dset_id_t, state_id_t, datasetManager
 #include "datasetState.hpp"      // for stackState, prodState, inputState
 #include "kotekanLogging.hpp"    // for INFO, DEBUG, ERROR, FATAL_ERROR
 #include "prometheusMetrics.hpp" // for Gauge, Counter, Metrics, MetricFamily
 #include "visBuffer.hpp"         // for VisFrameView, VisField, VisField::vis, VisField::weight
-#include "visUtil.hpp"           // for current_time, modulo, rstack_ctype, cfloat, frameID
+#include "visUtil.hpp"           // for current_time, modulo, rstack_ctype, cfloat
 
 #include "gsl-lite.hpp" // for span
 
-#include <algorithm>    // for copy, max, fill, copy_backward, equal
+#include <algorithm>    // for copy, max, min, fill, copy_backward, equal
 #include <atomic>       // for atomic_bool
 #include <complex>      // for complex, norm
-#include <cxxabi.h>     // for __forced_unwind
-#include <deque>        // for deque
 #include <exception>    // for exception
 #include <functional>   // for _Bind_helper<>::type, bind, function, placeholders
 #include <future>       // for async, future
 #include <iterator>     // for begin, end
 #include <memory>       // for allocator_traits<>::value_type
-#include <pthread.h>    // for pthread_setaffinity_np
+#include <optional>     // for optional
 #include <regex>        // for match_results<>::_Base_type
-#include <sched.h>      // for cpu_set_t, CPU_SET, CPU_ZERO
-#include <stdexcept>    // for invalid_argument, out_of_range, runtime_error
-#include <system_error> // for system_error
+#include <stdexcept>    // for out_of_range, runtime_error
+#include <string>       // for string, to_string
 #include <tuple>        // for tuple, tie
 #include <vector>       // for vector, __alloc_traits<>::value_type
 
@@ -43,22 +41,25 @@ using kotekan::prometheus::Metrics;
 
 REGISTER_KOTEKAN_STAGE(baselineCompression);
 
+// The number of stacks in a tile
+#define STACK_TILE_SIZE 4096
+
 
 baselineCompression::baselineCompression(Config& config, const std::string& unique_name,
                                          bufferContainer& buffer_container) :
     Stage(config, unique_name, buffer_container,
           std::bind(&baselineCompression::main_thread, this)),
-    in_buf(get_buffer("in_buf")), out_buf(get_buffer("out_buf")), frame_id_in(in_buf),
-    frame_id_out(out_buf), compression_residuals_metric(Metrics::instance().add_gauge(
-                               "kotekan_baselinecompression_residuals", unique_name, {"freq_id"})),
+    in_buf(get_buffer("in_buf")), out_buf(get_buffer("out_buf")),
+    in_consumer(in_buf, unique_name), out_producer(out_buf, unique_name),
+    frame_map(in_consumer, out_producer, unique_name,
+              config.get_default<uint32_t>(unique_name, "num_threads", 1)),
+    compression_residuals_metric(Metrics::instance().add_gauge(
+        "kotekan_baselinecompression_residuals", unique_name, {"freq_id"})),
     compression_time_seconds_metric(Metrics::instance().add_gauge(
         "kotekan_baselinecompression_time_seconds", unique_name, {"thread_id"})),
     compression_frame_counter(Metrics::instance().add_counter(
         "kotekan_baselinecompression_frame_total", unique_name, {"thread_id"})) {
 
-    register_consumer(in_buf, unique_name.c_str());
-    register_producer(out_buf, unique_name.c_str());
-
     // Fill out the map of stack types
     stack_type_defs["diagonal"] = stack_diagonal;
     stack_type_defs["chime_in_cyl"] = stack_chime_in_cyl;
@@ -76,31 +77,14 @@ baselineCompression::baselineCompression(Config& config, const std::string& uniq
         exclude_inputs = config.get<std::vector<uint32_t>>(unique_name, "exclude_inputs");
     }
 
-    num_threads = config.get_default<uint32_t>(unique_name, "num_threads", 1);
-    if (num_threads == 0)
-        throw std::invalid_argument("baselineCompression: num_threads has to be at least 1.");
+    num_frame_threads = config.get_default<uint32_t>(unique_name, "num_frame_threads", 1);
+    if (num_frame_threads == 0)
+        throw std::invalid_argument("baselineCompression: num_frame_threads has to be at least 1.");
 }
 
 void baselineCompression::main_thread() {
-
-    // Create the threads
-    thread_handles.resize(num_threads);
-    for (uint32_t i = 0; i < num_threads; ++i) {
-        thread_handles[i] = std::thread(&baselineCompression::compress_thread, this, i);
-
-        cpu_set_t cpuset;
-        CPU_ZERO(&cpuset);
-        INFO("Setting thread affinity");
-        for (auto& i : config.get<std::vector<int>>(unique_name, "cpu_affinity"))
-            CPU_SET(i, &cpuset);
-
-        pthread_setaffinity_np(thread_handles[i].native_handle(), sizeof(cpu_set_t), &cpuset);
-    }
-
-    // Join the threads
-    for (uint32_t i = 0; i < num_threads; ++i) {
-        thread_handles[i].join();
-    }
+    frame_map.run(stop_thread, std::bind(&baselineCompression::prepare_frame, this, _1),
+                  std::bind(&baselineCompression::compress_frame, this, _1, _2, _3));
 }
 
 void baselineCompression::change_dataset_state(dset_id_t input_ds_id) {
@@ -130,136 +114,87 @@ void baselineCompression::change_dataset_state(dset_id_t input_ds_id) {
         auto [state_id, sstate_ptr] =
             dm.create_state<stackState>(sspec.first, std::move(sspec.second));
 
+        // Work out which products go into each stack
+        const StackPlan* plan = &(stack_plans[fprint] = StackPlan(
+                                      sstate_ptr->get_num_stack(), sstate_ptr->get_rstack_map(),
+                                      pstate_ptr->get_prods()));
+
         // Insert state into map
-        state_map[fprint] = {state_id, sstate_ptr, pstate_ptr};
+        state_map[fprint] = {state_id, sstate_ptr, pstate_ptr, plan};
     }
 
 
-    auto [state_id, sstate, pstate] = state_map.at(fprint);
+    auto [state_id, sstate, pstate, plan] = state_map.at(fprint);
     auto new_ds_id = dm.add_dataset(state_id, input_ds_id);
 
-    dset_id_map[input_ds_id] = {new_ds_id, sstate, pstate};
+    dset_id_map[input_ds_id] = {new_ds_id, sstate, pstate, plan};
 
     INFO("Created new stack update and registering. Took {:.2f}s", current_time() - start_time);
 }
 
-void baselineCompression::compress_thread(uint32_t thread_id) {
-
-    int input_frame_id;
-    int output_frame_id;
+std::optional<baselineCompression::frameState>
+baselineCompression::prepare_frame(int input_frame_id) {
 
-    // Get the current values of the shared frame IDs.
-    {
-        std::lock_guard<std::mutex> lock_frame_ids(m_frame_ids);
-        output_frame_id = frame_id_out++;
-        input_frame_id = frame_id_in++;
-    }
-
-    // Wait for the input buffer to be filled with data
-    // in order to get dataset ID
-    if (wait_for_full_frame(in_buf, unique_name.c_str(), input_frame_id) == nullptr) {
-        return;
-    }
     auto input_frame = VisFrameView(in_buf, input_frame_id);
 
-    while (!stop_thread) {
-
-        // Wait for the input buffer to be filled with data
-        if (wait_for_full_frame(in_buf, unique_name.c_str(), input_frame_id) == nullptr) {
-            break;
-        }
-
-        double start_time = current_time();
-
-        // Get a view of the current frame
-        auto input_frame = VisFrameView(in_buf, input_frame_id);
-
-        dset_id_t new_dset_id;
-        const stackState* sstate_ptr = nullptr;
-        const prodState* pstate_ptr = nullptr;
-
-        // If the input dataset has changed construct a new stack spec for the
-        // datasetManager
-        {
-            std::lock_guard<std::mutex> _lock(m_dset_map);
-            if (dset_id_map.count(input_frame.dataset_id) == 0) {
-                change_dataset_state(input_frame.dataset_id);
-            }
-            std::tie(new_dset_id, sstate_ptr, pstate_ptr) = dset_id_map.at(input_frame.dataset_id);
-        }
-
-        const auto& stack_map = sstate_ptr->get_rstack_map();
-        const auto& prods = pstate_ptr->get_prods();
-        auto num_stack = sstate_ptr->get_num_stack();
-
-        std::vector<float> stack_norm(sstate_ptr->get_num_stack(), 0.0);
-        std::vector<float> stack_v2(sstate_ptr->get_num_stack(), 0.0);
-
-        // Wait for the output buffer frame to be free
-        if (wait_for_empty_frame(out_buf, unique_name.c_str(), output_frame_id) == nullptr) {
-            break;
-        }
-
-        // Create view to output frame
-        auto output_frame = VisFrameView::create_frame_view(
-            out_buf, output_frame_id, input_frame.num_elements, num_stack, input_frame.num_ev);
-
-        // Copy over the data we won't modify
-        output_frame.copy_metadata(input_frame);
-        output_frame.copy_data(input_frame, {VisField::vis, VisField::weight});
-        output_frame.dataset_id = new_dset_id;
+    // If the input dataset has changed construct a new stack spec for the
+    // datasetManager
+    if (dset_id_map.count(input_frame.dataset_id) == 0) {
+        change_dataset_state(input_frame.dataset_id);
+    }
 
-        // Zero the output frame
-        std::fill(std::begin(output_frame.vis), std::end(output_frame.vis), 0.0);
-        std::fill(std::begin(output_frame.weight), std::end(output_frame.weight), 0.0);
+    frameState state;
+    std::tie(state.dset_id, state.sstate, state.pstate, state.plan) =
+        dset_id_map.at(input_frame.dataset_id);
+    return state;
+}
 
-        // Flag out the excluded inputs
-        for (auto& input : exclude_inputs) {
-            output_frame.flags[input] = 0.0;
-        }
+void baselineCompression::compress_frame(frameState& state, int input_frame_id,
+                                         int output_frame_id) {
 
-        auto in_vis = input_frame.vis.data();
-        auto out_vis = output_frame.vis.data();
-        auto in_weight = input_frame.weight.data();
-        auto out_weight = output_frame.weight.data();
-        auto flags = output_frame.flags.data();
+    double start_time = current_time();
 
-        // Iterate over all the products and average together
-        for (uint32_t prod_ind = 0; prod_ind < prods.size(); prod_ind++) {
-            // TODO: if the weights are ever different from 0 or 1, we will
-            // definitely need to rewrite this.
+    // Get a view of the current frame
+    auto input_frame = VisFrameView(in_buf, input_frame_id);
 
-            // Alias the parts of the data we are going to stack
-            cfloat vis = in_vis[prod_ind];
-            float weight = in_weight[prod_ind];
+    auto num_stack = state.sstate->get_num_stack();
 
-            auto& p = prods[prod_ind];
-            auto& s = stack_map[prod_ind];
+    // Create view to output frame
+    auto output_frame = VisFrameView::create_frame_view(
+        out_buf, output_frame_id, input_frame.num_elements, num_stack, input_frame.num_ev);
 
-            // If the weight is zero, completely skip this iteration
-            if (weight == 0 || flags[p.input_a] == 0 || flags[p.input_b] == 0)
-                continue;
+    // Copy over the data we won't modify
+    output_frame.copy_metadata(input_frame);
+    output_frame.copy_data(input_frame, {VisField::vis, VisField::weight});
+    output_frame.dataset_id = state.dset_id;
 
-            vis = s.conjugate ? conj(vis) : vis;
+    // Flag out the excluded inputs
+    for (auto& input : exclude_inputs) {
+        output_frame.flags[input] = 0.0;
+    }
 
-            // First summation of the visibilities (dividing by the total weight will be done later)
-            out_vis[s.stack] += vis;
+    std::vector<float> stack_norm(num_stack);
+    std::vector<float> stack_v2(num_stack);
 
-            // Accumulate the square for variance calculation
-            stack_v2[s.stack] += fast_norm(vis);
+    // Stack a tile of stacks at a time, so the outputs of a tile stay in cache
+    size_t num_tiles = (num_stack + STACK_TILE_SIZE - 1) / STACK_TILE_SIZE;
+    std::vector<float> tile_vart(num_tiles, 0.0);
+    std::vector<float> tile_normt(num_tiles, 0.0);
 
-            // Accumulate the weighted *variances*. Normalising and inversion
-            // will be done later
-            out_weight[s.stack] += (1.0 / weight);
+    auto stack_tile = [&](size_t tile) {
+        uint32_t start = tile * STACK_TILE_SIZE;
+        uint32_t end = std::min<uint32_t>(start + STACK_TILE_SIZE, num_stack);
 
-            // Accumulate the weights so we can normalize correctly
-            stack_norm[s.stack] += 1.0;
-        }
+        // Sum the visibilities, their squares and variances, and the number of
+        // products. Normalising and inversion will be done later
+        // TODO: if the weights are ever different from 0 or 1, we will
+        // definitely need to rewrite this.
+        state.plan->stack(input_frame.vis.data(), input_frame.weight.data(),
+                          output_frame.flags.data(), start, end, output_frame.vis.data(),
+                          stack_v2.data(), output_frame.weight.data(), stack_norm.data());
 
         // Loop over the stacks and normalise (and invert the variances)
-        float vart = 0.0;
-        float normt = 0.0;
-        for (uint32_t stack_ind = 0; stack_ind < num_stack; stack_ind++) {
+        for (uint32_t stack_ind = start; stack_ind < end; stack_ind++) {
 
             // Calculate the mean and accumulate weight and place in the frame
             float norm = stack_norm[stack_ind];
@@ -274,30 +209,28 @@ void baselineCompression::compress_thread(uint32_t thread_id) {
             output_frame.weight[stack_ind] = norm * norm * iwgt;
 
             // Accumulate to calculate the variance of the residuals
-            vart += stack_v2[stack_ind] - std::norm(output_frame.vis[stack_ind]) * norm;
-            normt += norm;
+            tile_vart[tile] += stack_v2[stack_ind] - std::norm(output_frame.vis[stack_ind]) * norm;
+            tile_normt[tile] += norm;
         }
+    };
+    kotekan::WorkPool::instance().parallel_for(num_tiles, stack_tile, num_frame_threads - 1);
+
+    float vart = 0.0;
+    float normt = 0.0;
+    for (size_t tile = 0; tile < num_tiles; tile++) {
+        vart += tile_vart[tile];
+        normt += tile_normt[tile];
+    }
 
-        // Mark the buffers and move on
-        mark_frame_full(out_buf, unique_name.c_str(), output_frame_id);
-        mark_frame_empty(in_buf, unique_name.c_str(), input_frame_id);
-
-        // Calculate residuals (return zero if no data for this freq)
-        float residual = (normt != 0.0) ? (vart / normt) : 0.0;
-
-        // Update prometheus metrics
-        double elapsed = current_time() - start_time;
-        compression_residuals_metric.labels({std::to_string(output_frame.freq_id)}).set(residual);
-        compression_time_seconds_metric.labels({std::to_string(thread_id)}).set(elapsed);
-        compression_frame_counter.labels({std::to_string(thread_id)}).inc();
+    // Calculate residuals (return zero if no data for this freq)
+    float residual = (normt != 0.0) ? (vart / normt) : 0.0;
 
-        // Get the current values of the shared frame IDs and increment them.
-        {
-            std::lock_guard<std::mutex> lock_frame_ids(m_frame_ids);
-            output_frame_id = frame_id_out++;
-            input_frame_id = frame_id_in++;
-        }
+    // Update prometheus metrics
+    double elapsed = current_time() - start_time;
+    std::string thread_id = std::to_string(kotekan::WorkPool::get_worker_id());
+    compression_residuals_metric.labels({std::to_string(output_frame.freq_id)}).set(residual);
+    compression_time_seconds_metric.labels({thread_id}).set(elapsed);
+    compression_frame_counter.labels({thread_id}).inc();
 
-        DEBUG("Compression time {:.4f}", elapsed);
-    }
+    DEBUG("Compression time {:.4f}", elapsed);
 }
@@ -6,21 +6,23 @@
 #ifndef VIS_COMPRESSION_HPP
 #define VIS_COMPRESSION_HPP
 
+#include "BufferHandle.hpp"      // for BufferConsumer, BufferProducer
 #include "Config.hpp"            // for Config
+#include "ParallelFrameMap.hpp"  // for ParallelFrameMap
+#include "Stack.hpp"             // for StackPlan
 #include "Stage.hpp"             // for Stage
 #include "buffer.h"              // for Buffer
 #include "bufferContainer.hpp"   // for bufferContainer
 #include "datasetManager.hpp"    // for dset_id_t, state_id_t, fingerprint_t
 #include "datasetState.hpp"      // for prodState, stackState
 #include "prometheusMetrics.hpp" // for MetricFamily, Gauge, Counter
-#include "visUtil.hpp"           // for frameID, rstack_ctype, input_ctype, prod_ctype
+#include "visUtil.hpp"           // for rstack_ctype, input_ctype, prod_ctype
 
 #include <cstdint>    // for uint32_t
 #include <functional> // for function
 #include <map>        // for map
-#include <mutex>      // for mutex
+#include <optional>   // for optional
 #include <string>     // for string
-#include <thread>     // for thread
 #include <tuple>      // for tuple
 #include <utility>    // for pair
 #include <vector>     // for vector
@@ -47,15 +49,24 @@
  *                              details.
  * @conf exclude_inputs         List of ints. Extra inputs to exclude from
  *                              stack.
+ * @conf num_threads            Int. The number of frames to compress in parallel
+ *                              on the work pool. Default 1.
+ * @conf num_frame_threads      Int. The number of threads stacking each frame. The
+ *                              stacks of a frame are split into tiles which are
+ *                              shared out over this many work pool workers. Default 1.
  *
  * @par Metrics
  * @metric kotekan_baselinecompression_residuals
- *      The variance of the residuals.
+ *      The variance of the residuals. It is summed a tile of stacks at a time, so
+ *      it can differ from a sum in stack order by rounding.
  * @metric kotekan_baselinecompression_time_seconds
  *      The time elapsed to process one frame.
  * @metric kotekan_baselinecompression_frame_total
  *      Number of frames seen by each thread.
  *
+ * The frames are compressed on the shared @c WorkPool by a @c ParallelFrameMap,
+ * which also exports its metrics. The @c thread_id labels are the work pool worker.
+ *
  * @author Richard Shaw
  */
 class baselineCompression : public kotekan::Stage {
@@ -65,20 +76,27 @@ public:
     baselineCompression(kotekan::Config& config, const std::string& unique_name,
                         kotekan::bufferContainer& buffer_container);
 
-    // Main loop for the stage: Creates n threads that do the compression.
+    // Main loop for the stage: hands the frames to the work pool to compress.
     void main_thread() override;
 
 private:
-    /// Entrancepoint for n threads. Each thread takes frames with a
-    /// different frame_id from the buffer and compresses them.
-    void compress_thread(uint32_t thread_id);
+    /// The output dataset and stack of a frame
+    struct frameState {
+        dset_id_t dset_id;
+        const stackState* sstate;
+        const prodState* pstate;
+        const StackPlan* plan;
+    };
+
+    /// Looks up the output dataset and stack of a frame, in order on the stage thread.
+    std::optional<frameState> prepare_frame(int input_frame_id);
+
+    /// Compresses one frame, runs on the work pool.
+    void compress_frame(frameState& state, int input_frame_id, int output_frame_id);
 
     /// Tracks input dataset ID and gets output dataset IDs from manager
     void change_dataset_state(dset_id_t input_ds_id);
 
-    /// Vector to hold the thread handles
-    std::vector<std::thread> thread_handles;
-
     // The extra inputs we are excluding
     std::vector<uint32_t> exclude_inputs;
 
@@ -96,24 +114,30 @@ private:
     /// The stack function to use.
     stack_def_fn calculate_stack;
 
-    /// Number of parallel threads accessing the same buffers (default 1)
-    uint32_t num_threads;
-
     // Buffers to read/write
     Buffer* in_buf;
     Buffer* out_buf;
+    kotekan::BufferConsumer in_consumer;
+    kotekan::BufferProducer out_producer;
+
+    // Runs compress_frame on the work pool
+    kotekan::ParallelFrameMap<frameState> frame_map;
 
-    // Frame IDs, shared by compress threads and their mutex.
-    frameID frame_id_in;
-    frameID frame_id_out;
-    std::mutex m_frame_ids;
-    std::mutex m_dset_map;
+    // The number of threads stacking each frame
+    uint32_t num_frame_threads;
 
     // Map the incoming ID to an outgoing one
-    std::map<dset_id_t, std::tuple<dset_id_t, const stackState*, const prodState*>> dset_id_map;
+    std::map<dset_id_t,
+             std::tuple<dset_id_t, const stackState*, const prodState*, const StackPlan*>>
+        dset_id_map;
 
     // Map from the critical incoming states to the correct stackState
-    std::map<fingerprint_t, std::tuple<state_id_t, const stackState*, const prodState*>> state_map;
+    std::map<fingerprint_t,
+             std::tuple<state_id_t, const stackState*, const prodState*, const StackPlan*>>
+        state_map;
+
+    // The stacking plan for each set of critical incoming states
+    std::map<fingerprint_t, StackPlan> stack_plans;
 
     kotekan::prometheus::MetricFamily<kotekan::prometheus::Gauge>& compression_residuals_metric;
     kotekan::prometheus::MetricFamily<kotekan::prometheus::Gauge>& compression_time_seconds_metric;
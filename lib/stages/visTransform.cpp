@@ -1,9 +1,10 @@
 #include "visTransform.hpp"
 
+#include "BufferHandle.hpp" // for BufferConsumer, BufferProducer
 #include "Config.hpp"       // for Config
 #include "StageFactory.hpp" // for REGISTER_KOTEKAN_STAGE, StageMakerTemplate
 #include "Telescope.hpp"
-#include "buffer.h"            // for Buffer, allocate_new_metadata_object, mark_frame_empty
+#include "buffer.h"            // for Buffer, allocate_new_metadata_object
 #include "bufferContainer.hpp" // for bufferContainer
 #include "chimeMetadata.hpp"   // for chimeMetadata
 #include "datasetManager.hpp"  // for state_id_t, datasetManager, dset_id_t
@@ -12,7 +13,7 @@
 #include "metadata.h"          // for metadataContainer
 #include "version.h"           // for get_git_commit_hash
 #include "visBuffer.hpp"       // for VisFrameView
-#include "visUtil.hpp"         // for prod_ctype, input_ctype, freq_ctype, copy_vis_triangle
+#include "visUtil.hpp"         // for prod_ctype, input_ctype, freq_ctype, VisTriangleMap
 
 #include "gsl-lite.hpp" // for span<>::iterator, span
 
@@ -25,10 +26,12 @@
 #include <numeric>    // for iota
 #include <regex>      // for match_results<>::_Base_type
 #include <stdexcept>  // for runtime_error
-#include <tuple>      // for get, tie, tuple
+#include <tuple>      // for get
 
 
+using kotekan::BufferConsumer;
 using kotekan::bufferContainer;
+using kotekan::BufferProducer;
 using kotekan::Config;
 using kotekan::Stage;
 
@@ -50,19 +53,19 @@ visTransform::visTransform(Config& config, const std::string& unique_name,
     // Fetch the input buffers, register them, and store them in our buffer vector
     for (auto name : input_buffer_names) {
         auto buf = buffer_container.get_buffer(name);
-        register_consumer(buf, unique_name.c_str());
-        in_bufs.push_back({buf, 0});
+        in_bufs.add(BufferConsumer(buf, unique_name));
+        in_frame_ids.push_back(0);
     }
 
     // Setup the output vector
     out_buf = get_buffer("out_buf");
-    register_producer(out_buf, unique_name.c_str());
+    out_producer = BufferProducer(out_buf, unique_name);
 
     // Get the indices for reordering
     auto input_reorder = parse_reorder_default(config, unique_name);
 
     // Get the indices for reordering
-    input_remap = std::get<0>(input_reorder);
+    input_remap = VisTriangleMap(std::get<0>(input_reorder), block_size, num_elements);
 
     // Get everything we need for registering dataset states
 
@@ -108,67 +111,58 @@ void visTransform::main_thread() {
 
     uint8_t* frame = nullptr;
     Buffer* buf;
-    unsigned int frame_id = 0;
     unsigned int output_frame_id = 0;
 
     while (!stop_thread) {
 
-        // This is where all the main set of work happens. Iterate over the
-        // available buffers, wait for data to appear and transform into
-        // VisBuffer style data
-        for (auto& buffer_pair : in_bufs) {
-            std::tie(buf, frame_id) = buffer_pair;
-
-            // Calculate the timeout
-            auto timeout = double_to_ts(current_time() + 0.1);
-
-            // Find the next available buffer
-            int status = wait_for_full_frame_timeout(buf, unique_name.c_str(), frame_id, timeout);
-            if (status == 1)
-                continue; // Timed out, try next buffer
-            if (status == -1)
-                break; // Got shutdown signal
-
-            INFO("Got full buffer {:s} with frame_id={:d}", buf->buffer_name, frame_id);
-
-            frame = buf->frames[frame_id];
-
-            // Wait for the buffer to be filled with data
-            if (wait_for_empty_frame(out_buf, unique_name.c_str(), output_frame_id) == nullptr) {
-                break;
-            }
-
-            // Create view to output frame
-            auto output_frame = VisFrameView::create_frame_view(
-                out_buf, output_frame_id, num_elements, num_elements * (num_elements + 1) / 2,
-                num_eigenvectors);
-
-            // TODO: multifrequency support
-            // Copy over the metadata
-            output_frame.fill_chime_metadata(
-                (const chimeMetadata*)buf->metadata[frame_id]->metadata, 0);
-
-            // Copy the visibility data into a proper triangle and write into
-            // the file
-            copy_vis_triangle((int32_t*)frame, input_remap, block_size, num_elements,
-                              output_frame.vis);
-
-            // Fill other datasets with reasonable values
-            std::fill(output_frame.weight.begin(), output_frame.weight.end(), 1.0);
-            std::fill(output_frame.flags.begin(), output_frame.flags.end(), 1.0);
-            std::fill(output_frame.evec.begin(), output_frame.evec.end(), 0.0);
-            std::fill(output_frame.eval.begin(), output_frame.eval.end(), 0.0);
-            output_frame.erms = 0;
-            std::fill(output_frame.gain.begin(), output_frame.gain.end(), 1.0);
-
-            // Mark the buffers and move on
-            mark_frame_empty(buf, unique_name.c_str(), frame_id);
-            mark_frame_full(out_buf, unique_name.c_str(), output_frame_id);
-
-            // Advance the current frame ids
-            std::get<1>(buffer_pair) = (frame_id + 1) % buf->num_frames;
-            output_frame_id = (output_frame_id + 1) % out_buf->num_frames;
+        // This is where all the main set of work happens. Wait for data to
+        // appear on any of the buffers and transform into VisBuffer style data
+        int ready;
+        if (in_bufs.wait_for_any_full_frame(in_frame_ids, ready) != 0)
+            break; // Got shutdown signal
+
+        BufferConsumer& consumer = in_bufs.consumer(ready);
+        int frame_id = in_frame_ids[ready];
+        buf = consumer.buffer();
+
+        INFO("Got full buffer {:s} with frame_id={:d}", buf->buffer_name, frame_id);
+
+        frame = buf->frames[frame_id];
+
+        // Wait for the buffer to be filled with data
+        if (out_producer.wait_for_empty_frame(output_frame_id) == nullptr) {
+            break;
         }
+
+        // Create view to output frame
+        auto output_frame = VisFrameView::create_frame_view(out_buf, output_frame_id, num_elements,
+                                                            num_elements * (num_elements + 1) / 2,
+                                                            num_eigenvectors);
+
+        // TODO: multifrequency support
+        // Copy over the metadata
+        output_frame.fill_chime_metadata((const chimeMetadata*)buf->metadata[frame_id]->metadata,
+                                         0);
+
+        // Copy the visibility data into a proper triangle and write into
+        // the file
+        input_remap.copy_vis((int32_t*)frame, output_frame.vis);
+
+        // Fill other datasets with reasonable values
+        std::fill(output_frame.weight.begin(), output_frame.weight.end(), 1.0);
+        std::fill(output_frame.flags.begin(), output_frame.flags.end(), 1.0);
+        std::fill(output_frame.evec.begin(), output_frame.evec.end(), 0.0);
+        std::fill(output_frame.eval.begin(), output_frame.eval.end(), 0.0);
+        output_frame.erms = 0;
+        std::fill(output_frame.gain.begin(), output_frame.gain.end(), 1.0);
+
+        // Mark the buffers and move on
+        consumer.mark_frame_empty(frame_id);
+        out_producer.mark_frame_full(output_frame_id);
+
+        // Advance the current frame ids
+        in_frame_ids[ready] = (frame_id + 1) % buf->num_frames;
+        output_frame_id = (output_frame_id + 1) % out_buf->num_frames;
     }
 }
 
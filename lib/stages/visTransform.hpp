@@ -6,12 +6,13 @@
 #ifndef VISTRANSFORM_H
 #define VISTRANSFORM_H
 
+#include "BufferHandle.hpp" // for BufferProducer, BufferWaitSet
 #include "Config.hpp"
 #include "Stage.hpp" // for Stage
 #include "buffer.h"
 #include "bufferContainer.hpp"
 #include "datasetManager.hpp" // for dset_id_t
-#include "visUtil.hpp"        // for input_ctype, prod_ctype, freq_ctype (ptr only)
+#include "visUtil.hpp"        // for input_ctype, prod_ctype, freq_ctype, VisTriangleMap
 
 #include <stddef.h> // for size_t
 #include <stdint.h> // for uint32_t
@@ -29,7 +30,8 @@
  * for the receiver.
  *
  * @par Buffers
- * @buffer in_bufs The set of buffers coming out the GPU buffers
+ * @buffer in_bufs The set of buffers coming out the GPU buffers, the frames
+ *         are taken from whichever buffer has one first
  *         @buffer_format GPU packed upper triangle
  *         @buffer_metadata chimeMetadata
  * @buffer out_buf The merged and transformed buffer
@@ -63,12 +65,14 @@ private:
     // Parameters saved from the config files
     size_t num_elements, num_eigenvectors, block_size;
 
-    // Vector of the buffers we are using and their current frame ids.
-    std::vector<std::pair<Buffer*, unsigned int>> in_bufs;
+    // The buffers we are using and their current frame ids.
+    kotekan::BufferWaitSet in_bufs;
+    std::vector<int> in_frame_ids;
     Buffer* out_buf;
+    kotekan::BufferProducer out_producer;
 
-    // The mapping from buffer element order to output file element ordering
-    std::vector<uint32_t> input_remap;
+    // The mapping from the GPU buffer to the output visibility triangle
+    VisTriangleMap input_remap;
 
     // dataset ID written to output frames
     dset_id_t _ds_id_out;
@@ -1,17 +1,18 @@
 #include "BasebandFileRaw.hpp"
 
-#include "visFile.hpp" // for create_lockfile
+#include "FileWriteQueue.hpp" // for AsyncFileWriter, FileWriteQueue
+#include "visFile.hpp"        // for create_lockfile
 
 #include "fmt.hpp" // for format, fmt
 
 #include <assert.h>   // for assert
 #include <cstdio>     // for remove
 #include <errno.h>    // for errno
-#include <fcntl.h>    // for fallocate, open, posix_fadvise, sync_file_range, FALLOC_FL_KEEP_SIZE
+#include <fcntl.h>    // for fallocate, open, FALLOC_FL_KEEP_SIZE, O_DIRECT
 #include <stdexcept>  // for runtime_error
 #include <string.h>   // for strerror
 #include <sys/stat.h> // for S_IRGRP, S_IROTH, S_IRUSR, S_IWGRP, S_IWUSR
-#include <unistd.h>   // for pwrite, close, lseek, TEMP_FAILURE_RETRY, off_t, ssize_t
+#include <unistd.h>   // for close, lseek, off_t
 
 
 BasebandFileRaw::BasebandFileRaw(const std::string& name, const uint32_t frame_size) :
@@ -19,15 +20,24 @@ BasebandFileRaw::BasebandFileRaw(const std::string& name, const uint32_t frame_s
 
     write_index = 0;
 
+    // Bypass the page cache if asked to and the frames are aligned for it
+    int oflags = O_CREAT | O_WRONLY;
+#ifdef O_DIRECT
+    if (FileWriteQueue::instance().get_direct_io()
+        && frame_size % FileWriteQueue::DIRECT_IO_ALIGNMENT == 0)
+        oflags |= O_DIRECT;
+#endif
+
     // Create the lock file and then open other files
     DEBUG("Opening baseband file {:s}", name);
     lock_filename = create_lockfile(name);
-    if ((fd = open((name + ".data").c_str(), O_CREAT | O_WRONLY,
+    if ((fd = open((name + ".data").c_str(), oflags,
                    S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH))
         == -1) {
         throw std::runtime_error(
             fmt::format(fmt("Failed to open file {:s}.data: {:s}."), name, strerror(errno)));
     }
+    writer = std::make_unique<AsyncFileWriter>(fd, name + ".data");
 
     // Get the current file size
     off_t file_size = lseek(fd, 0, SEEK_END);
@@ -46,6 +56,7 @@ BasebandFileRaw::BasebandFileRaw(const std::string& name, const uint32_t frame_s
 
 BasebandFileRaw::~BasebandFileRaw() {
     DEBUG("Closing baseband file {}: {}", name, fd);
+    writer.reset();
     close(fd);
 
     std::remove(lock_filename.c_str());
@@ -65,31 +76,14 @@ int32_t BasebandFileRaw::write_frame(const BasebandFrameView& frame) {
     ftruncate(fd, write_index * (frame_size + 1));
 #endif
 
-    // Write in a retry macro loop incase the write was interrupted by a signal
-    ssize_t nbytes = TEMP_FAILURE_RETRY(
-        pwrite(fd, (void*)frame.metadata(), metadata_size, write_index * frame_size));
-
-    if (nbytes < 0) {
-        ERROR("Write error attempting to write metadata {:d} bytes into file {:s}: {:s}",
-              metadata_size, name, strerror(errno));
+    // The write errors are logged by the writer, possibly after an earlier frame was queued
+    if (!writer->write(write_index * frame_size, frame_size,
+                       {{frame.metadata(), metadata_size}, {frame.data(), frame.data_size()}})) {
         return 0;
     }
 
-    nbytes = TEMP_FAILURE_RETRY(pwrite(fd, (void*)frame.data(), frame.data_size(),
-                                       write_index * frame_size + metadata_size));
-
-    if (nbytes < 0) {
-        ERROR("Write error attempting to write data {:d} bytes into file {:s}: {:s}",
-              frame.data_size(), name, strerror(errno));
-        return 0;
-    }
-
-#ifdef __linux__
-    sync_file_range(fd, write_index * frame_size, frame_size,
-                    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE
-                        | SYNC_FILE_RANGE_WAIT_AFTER);
-    posix_fadvise(fd, write_index * frame_size, frame_size, POSIX_FADV_DONTNEED);
-#endif
+    // Flush out the frame and clear it from the page cache once written
+    writer->flush(write_index * frame_size, frame_size, true);
 
     write_index++;
     return 1;
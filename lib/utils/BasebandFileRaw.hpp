@@ -8,8 +8,10 @@
 
 #include "BasebandFrameView.hpp" // for BasebandFrameView
 #include "BasebandMetadata.hpp"  // for BasebandMetadata
+#include "FileWriteQueue.hpp"    // for AsyncFileWriter
 #include "kotekanLogging.hpp"    // for kotekanLogging
 
+#include <memory>   // for unique_ptr
 #include <stdint.h> // for uint32_t, int32_t
 #include <string>   // for string
 
@@ -23,6 +25,11 @@
  *  - BasebandMetadata struct dump
  *  - baseband buffer frame contents
  *
+ * The frames are written through the @c FileWriteQueue, and each is flushed to
+ * disk and evicted from the page cache once written. The file is opened with
+ * @c O_DIRECT if the queue asks for it and the frame size is a multiple of
+ * @c FileWriteQueue::DIRECT_IO_ALIGNMENT.
+ *
  * @author Davor Cubranic
  */
 class BasebandFileRaw : public kotekan::kotekanLogging {
@@ -32,6 +39,14 @@ public:
 
     ~BasebandFileRaw();
 
+    /**
+     * @brief Write a frame at the end of the file
+     *
+     * @param frame The frame to write.
+     *
+     * @returns 1 if the frame was written or queued, 0 if this or an earlier
+     *          write failed, and -1 if the file is corrupt.
+     */
     int32_t write_frame(const BasebandFrameView& frame);
 
     // File name (used for debugging)
@@ -44,6 +59,7 @@ private:
 
     // File descriptors and related
     int fd;
+    std::unique_ptr<AsyncFileWriter> writer;
     std::string lock_filename;
 
     uint64_t write_index;
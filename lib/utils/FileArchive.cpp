@@ -0,0 +1,135 @@
+#include "FileArchive.hpp"
+
+#include "chunkUtil.hpp" // for extract_chunk, num_block_chunks
+
+#include "fmt.hpp" // for format, fmt
+
+#include <highfive/H5DataSet.hpp>   // for DataSet
+#include <highfive/H5Exception.hpp> // for DataSetException, HDF5ErrMapper
+#include <highfive/H5Object.hpp>    // for HighFive
+#include <stdexcept>                // for invalid_argument, runtime_error
+#include <utility>                  // for pair
+
+#if !H5_VERSION_GE(1, 10, 3)
+#include <hdf5_hl.h> // for H5DOwrite_chunk
+#endif
+
+#ifdef WITH_BITSHUFFLE
+#include <bitshuffle.h> // for bshuf_compress_lz4, bshuf_compress_lz4_bound, bshuf_default_...
+#endif
+
+using namespace HighFive;
+
+
+bool FileArchive::direct_chunk_write(const std::string& name, const std::vector<size_t>& offset,
+                                     const std::vector<size_t>& count) const {
+#ifdef WITH_BITSHUFFLE
+    auto it = chunk_layouts.find(name);
+    if (it == chunk_layouts.end())
+        return false;
+    const chunkLayout& layout = it->second;
+
+    if (offset.size() != layout.dims.size() || count.size() != layout.dims.size())
+        return false;
+
+    // The block must start on a chunk, and only have partial chunks at the end of the dataset
+    for (size_t d = 0; d < layout.dims.size(); d++) {
+        if (offset[d] % layout.chunk[d] != 0 || offset[d] + count[d] > layout.dims[d])
+            return false;
+        if (count[d] % layout.chunk[d] != 0 && offset[d] + count[d] != layout.dims[d])
+            return false;
+    }
+    return true;
+#else
+    (void)name;
+    (void)offset;
+    (void)count;
+    return false;
+#endif
+}
+
+size_t FileArchive::num_chunks(const std::string& name, const std::vector<size_t>& count) const {
+    return num_block_chunks(count, chunk_layouts.at(name).chunk);
+}
+
+FileArchive::compressedChunk FileArchive::compress_bytes(const std::string& name,
+                                                         const std::vector<size_t>& offset,
+                                                         const std::vector<size_t>& count,
+                                                         const uint8_t* data, size_t elem_size,
+                                                         size_t index) const {
+#ifdef WITH_BITSHUFFLE
+    const chunkLayout& layout = chunk_layouts.at(name);
+    const size_t ndim = layout.chunk.size();
+
+    if (elem_size != layout.elem_size) {
+        throw std::invalid_argument(
+            fmt::format(fmt("Elements of {:d} bytes don't match the {:d} bytes of dataset {:s}."),
+                        elem_size, layout.elem_size, name));
+    }
+
+    std::vector<uint8_t> chunk;
+    std::vector<size_t> start = extract_chunk(data, count, layout.chunk, elem_size, index, chunk);
+    const size_t chunk_elems = chunk.size() / elem_size;
+
+    // Compress into the format of the HDF5 filter: the uncompressed size as a
+    // big endian uint64, and the block size in bytes as a big endian uint32
+    size_t block_size = bshuf_default_block_size(elem_size);
+    const size_t header_size = 12;
+
+    compressedChunk out;
+    out.data.resize(header_size + bshuf_compress_lz4_bound(chunk_elems, elem_size, block_size));
+
+    uint64_t nbytes = chunk.size();
+    for (int i = 0; i < 8; i++)
+        out.data[i] = (nbytes >> (56 - 8 * i)) & 0xff;
+    uint32_t block_bytes = block_size * elem_size;
+    for (int i = 0; i < 4; i++)
+        out.data[8 + i] = (block_bytes >> (24 - 8 * i)) & 0xff;
+
+    int64_t size = bshuf_compress_lz4(chunk.data(), out.data.data() + header_size, chunk_elems,
+                                      elem_size, block_size);
+    if (size < 0) {
+        throw std::runtime_error(fmt::format(
+            fmt("Bitshuffle failed to compress a chunk of {:s} (error {:d})."), name, size));
+    }
+    out.data.resize(header_size + size);
+
+    for (size_t d = 0; d < ndim; d++)
+        out.offset.push_back(offset[d] + start[d]);
+
+    return out;
+#else
+    (void)offset;
+    (void)count;
+    (void)data;
+    (void)elem_size;
+    (void)index;
+    throw std::runtime_error(
+        fmt::format(fmt("Can't compress {:s}, kotekan was built without bitshuffle."), name));
+#endif
+}
+
+void FileArchive::write_chunks(const std::string& name,
+                               const std::vector<compressedChunk>& chunks) {
+    DEBUG2("writing {:d} chunks of {}...", chunks.size(), name);
+    DataSet d = dset(name);
+
+    for (auto& chunk : chunks) {
+        // All the filters were applied, so the filter mask is zero
+#if H5_VERSION_GE(1, 10, 3)
+        herr_t err = H5Dwrite_chunk(d.getId(), H5P_DEFAULT, 0, chunk.offset.data(),
+                                    chunk.data.size(), chunk.data.data());
+#else
+        herr_t err = H5DOwrite_chunk(d.getId(), H5P_DEFAULT, 0, chunk.offset.data(),
+                                     chunk.data.size(), chunk.data.data());
+#endif
+        if (err < 0) {
+            HDF5ErrMapper::ToException<DataSetException>("Failed trying to write a chunk.");
+        }
+    }
+}
+
+void FileArchive::add_chunk_layout(const std::string& name, const std::vector<size_t>& dims,
+                                   const std::vector<hsize_t>& chunk, size_t elem_size) {
+    chunk_layouts[name] = {dims, std::vector<size_t>(chunk.begin(), chunk.end()), elem_size};
+}
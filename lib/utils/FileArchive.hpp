@@ -3,16 +3,88 @@
 
 #include "kotekanLogging.hpp" // for logLevel, kotekanLogging
 
+#include <highfive/H5DataSet.hpp>      // for DataSet
 #include <highfive/H5PropertyList.hpp> // for H5Pcreate, H5Pset_chunk, H5Pset_filter, H5P_DATAS...
+#include <map>                         // for map
+#include <stddef.h>                    // for size_t
+#include <stdint.h>                    // for uint8_t
+#include <string>                      // for string
+#include <vector>                      // for vector
 
 /** @brief A Bitshuffle header file.
  *
  * Header file to store common Bitshuffle constants.
  *
+ * It can also compress the blocks of the bitshuffle compressed datasets
+ * itself, and write the compressed chunks with HDF5 direct chunk writes. This
+ * needs kotekan to be built with @c USE_BITSHUFFLE. The compression doesn't
+ * touch the HDF5 library, so can be done on any thread, while the writes must
+ * be done one at a time.
+ *
  * @author James Willis
  **/
 class FileArchive : public kotekan::kotekanLogging {
 
+public:
+    /// An HDF5 chunk compressed with bitshuffle
+    struct compressedChunk {
+        /// Offset of the chunk in the dataset
+        std::vector<hsize_t> offset;
+        /// The chunk in the format of the bitshuffle HDF5 filter
+        std::vector<uint8_t> data;
+    };
+
+    /**
+     * @brief Check whether a block can be written with direct chunk writes
+     *
+     * This is only possible for bitshuffle compressed datasets, and for blocks
+     * made of whole chunks (the chunks at the end of the dataset can be partial).
+     *
+     * @param name    The dataset.
+     * @param offset  Start of the block in the dataset.
+     * @param count   Shape of the block.
+     *
+     * @returns True if the block can be compressed with @c compress_chunk.
+     **/
+    bool direct_chunk_write(const std::string& name, const std::vector<size_t>& offset,
+                            const std::vector<size_t>& count) const;
+
+    /**
+     * @brief The number of HDF5 chunks in a block
+     *
+     * @param name    The dataset.
+     * @param count   Shape of the block.
+     *
+     * @returns The number of chunks.
+     **/
+    size_t num_chunks(const std::string& name, const std::vector<size_t>& count) const;
+
+    /**
+     * @brief Copy one HDF5 chunk out of a block and compress it
+     *
+     * This doesn't call the HDF5 library, and is safe to call from any thread.
+     *
+     * @param name    The dataset.
+     * @param offset  Start of the block in the dataset.
+     * @param count   Shape of the block.
+     * @param data    The block, dense in the shape @c count.
+     * @param index   The chunk of the block to compress, less than @c num_chunks.
+     *
+     * @returns The compressed chunk.
+     **/
+    template<typename T>
+    compressedChunk compress_chunk(const std::string& name, const std::vector<size_t>& offset,
+                                   const std::vector<size_t>& count, const T* data,
+                                   size_t index) const;
+
+    /**
+     * @brief Write compressed chunks into a dataset
+     *
+     * @param name    The dataset.
+     * @param chunks  The chunks.
+     **/
+    void write_chunks(const std::string& name, const std::vector<compressedChunk>& chunks);
+
 protected:
     // Bitshuffle parameters
     H5Z_filter_t H5Z_BITSHUFFLE = 32008;
@@ -20,6 +92,36 @@ protected:
     unsigned int BSHUF_BLOCK = 0; // let bitshuffle choose
 
     const std::vector<unsigned int> BSHUF_CD = {BSHUF_BLOCK, BSHUF_H5_COMPRESS_LZ4};
+
+    // Record the shape of a bitshuffle compressed dataset
+    void add_chunk_layout(const std::string& name, const std::vector<size_t>& dims,
+                          const std::vector<hsize_t>& chunk, size_t elem_size);
+
+    // Get datasets
+    virtual HighFive::DataSet dset(const std::string& name) = 0;
+
+private:
+    // Shape of a compressed dataset, and of its chunks
+    struct chunkLayout {
+        std::vector<size_t> dims;
+        std::vector<size_t> chunk;
+        size_t elem_size;
+    };
+
+    // Compress a chunk, copied out of a block of elements of `elem_size` bytes
+    compressedChunk compress_bytes(const std::string& name, const std::vector<size_t>& offset,
+                                   const std::vector<size_t>& count, const uint8_t* data,
+                                   size_t elem_size, size_t index) const;
+
+    // The compressed datasets, only written to when they are created
+    std::map<std::string, chunkLayout> chunk_layouts;
 };
 
+template<typename T>
+inline FileArchive::compressedChunk
+FileArchive::compress_chunk(const std::string& name, const std::vector<size_t>& offset,
+                            const std::vector<size_t>& count, const T* data, size_t index) const {
+    return compress_bytes(name, offset, count, (const uint8_t*)data, sizeof(T), index);
+}
+
 #endif
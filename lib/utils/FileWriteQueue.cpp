@@ -0,0 +1,443 @@
+#include "FileWriteQueue.hpp"
+
+#include "Config.hpp"         // for Config
+#include "kotekanLogging.hpp" // for INFO_NON_OO, WARN_NON_OO, ERROR_NON_OO, ERROR
+
+#include "fmt.hpp" // for format
+
+#include <algorithm> // for min
+#include <errno.h>   // for errno, EINTR
+#include <fcntl.h>   // for fcntl, posix_fadvise, sync_file_range, O_DIRECT, F_GETFL
+#include <new>       // for bad_alloc
+#include <pthread.h> // for pthread_setname_np
+#include <stdexcept> // for invalid_argument
+#include <stdlib.h>  // for free, posix_memalign
+#include <string.h>  // for memcpy, memset, strerror
+#include <unistd.h>  // for pwrite, ssize_t, TEMP_FAILURE_RETRY
+
+// Zeros to write the padding from when the writes aren't staged
+static uint8_t zeros[1 << 20];
+
+// Write all of the data, carrying on after short writes
+static bool pwrite_all(int fd, const uint8_t* data, size_t size, off_t offset) {
+    while (size > 0) {
+        ssize_t nbytes = TEMP_FAILURE_RETRY(pwrite(fd, data, size, offset));
+        if (nbytes <= 0)
+            return false;
+        data += nbytes;
+        size -= nbytes;
+        offset += nbytes;
+    }
+    return true;
+}
+
+static size_t round_to_alignment(size_t size) {
+    const size_t a = FileWriteQueue::DIRECT_IO_ALIGNMENT;
+    return (size + a - 1) / a * a;
+}
+
+FileWriteQueue& FileWriteQueue::instance() {
+    static FileWriteQueue _instance;
+    return _instance;
+}
+
+FileWriteQueue& FileWriteQueue::instance(const kotekan::Config& config) {
+    std::string backend_name =
+        config.get_default<std::string>("/file_write_queue", "backend", "sync");
+    Backend backend;
+    if (backend_name == "sync")
+        backend = Backend::sync;
+    else if (backend_name == "threads")
+        backend = Backend::threads;
+    else if (backend_name == "io_uring")
+        backend = Backend::io_uring;
+    else
+        throw std::invalid_argument(
+            fmt::format(fmt("FileWriteQueue: unknown backend {:s}."), backend_name));
+
+    uint32_t num_threads = config.get_default<uint32_t>("/file_write_queue", "num_threads", 2);
+    if (num_threads == 0)
+        throw std::invalid_argument("FileWriteQueue: num_threads has to be at least 1.");
+    uint32_t max_in_flight =
+        config.get_default<uint32_t>("/file_write_queue", "max_in_flight", 64);
+    if (max_in_flight == 0)
+        throw std::invalid_argument("FileWriteQueue: max_in_flight has to be at least 1.");
+
+    FileWriteQueue& queue = instance();
+    queue.stop();
+    queue.start(backend, num_threads, max_in_flight,
+                config.get_default<bool>("/file_write_queue", "direct_io", false));
+    return queue;
+}
+
+FileWriteQueue::~FileWriteQueue() {
+    stop();
+}
+
+void FileWriteQueue::start(Backend new_backend, uint32_t num_threads, uint32_t new_max_in_flight,
+                           bool new_direct_io) {
+    std::lock_guard<std::mutex> lock(state_lock);
+    if (backend != Backend::sync)
+        return;
+
+    direct_io = new_direct_io;
+    max_in_flight = new_max_in_flight;
+    if (new_backend == Backend::sync)
+        return;
+
+    if (new_backend == Backend::io_uring) {
+#ifdef WITH_LIBURING
+        int err = io_uring_queue_init(max_in_flight, &ring, 0);
+        if (err < 0) {
+            WARN_NON_OO("Failed to set up io_uring, using the threads backend: {:s}",
+                        strerror(-err));
+            new_backend = Backend::threads;
+        } else {
+            reaper = std::thread(&FileWriteQueue::reaper_thread, this);
+#ifndef MAC_OSX
+            pthread_setname_np(reaper.native_handle(), "file_write_uring");
+#endif
+        }
+#else
+        WARN_NON_OO("kotekan was built without liburing, using the threads backend");
+        new_backend = Backend::threads;
+#endif
+    }
+
+    INFO_NON_OO("Starting the file write queue with {:s}, {:d} threads and up to {:d} writes in "
+                "flight",
+                (new_backend == Backend::io_uring) ? "io_uring" : "threads", num_threads,
+                max_in_flight);
+
+    stop_threads = false;
+    for (uint32_t i = 0; i < num_threads; ++i) {
+        threads.emplace_back(&FileWriteQueue::writer_thread, this);
+#ifndef MAC_OSX
+        std::string name = fmt::format(fmt("file_write_{:d}"), i);
+        pthread_setname_np(threads[i].native_handle(), name.c_str());
+#endif
+    }
+    backend = new_backend;
+}
+
+void FileWriteQueue::stop() {
+    std::lock_guard<std::mutex> lock(state_lock);
+    if (backend == Backend::sync)
+        return;
+
+    // Once the writes are done any flushes waiting on them are queued too
+    {
+        std::unique_lock<std::mutex> queue_guard(queue_lock);
+        in_flight_cond.wait(queue_guard, [&] { return num_in_flight == 0; });
+    }
+
+#ifdef WITH_LIBURING
+    if (backend == Backend::io_uring) {
+        std::unique_lock<std::mutex> ring_guard(ring_lock);
+        struct io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+        io_uring_prep_nop(sqe);
+        io_uring_sqe_set_data(sqe, nullptr);
+        io_uring_submit(&ring);
+        ring_guard.unlock();
+        reaper.join();
+        io_uring_queue_exit(&ring);
+    }
+#endif
+
+    {
+        std::lock_guard<std::mutex> queue_guard(queue_lock);
+        stop_threads = true;
+    }
+    queue_cond.notify_all();
+    for (auto& t : threads)
+        t.join();
+    threads.clear();
+
+    std::lock_guard<std::mutex> block_guard(block_lock);
+    for (auto& block : free_blocks)
+        free(block.second);
+    free_blocks.clear();
+
+    backend = Backend::sync;
+}
+
+FileWriteQueue::Backend FileWriteQueue::get_backend() {
+    return backend;
+}
+
+bool FileWriteQueue::get_direct_io() {
+    return direct_io;
+}
+
+void FileWriteQueue::submit_write(Op op) {
+    {
+        std::unique_lock<std::mutex> lock(queue_lock);
+        in_flight_cond.wait(lock, [&] { return num_in_flight < max_in_flight; });
+        num_in_flight++;
+
+        if (backend != Backend::io_uring) {
+            ops.push_back(op);
+            lock.unlock();
+            queue_cond.notify_one();
+            return;
+        }
+    }
+
+#ifdef WITH_LIBURING
+    // There's an entry for every write in flight, so this can't run out
+    std::lock_guard<std::mutex> lock(ring_lock);
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+    io_uring_prep_write(sqe, op.file->fd, op.data, op.size, op.offset);
+    io_uring_sqe_set_data(sqe, new Op(op));
+    io_uring_submit(&ring);
+#endif
+}
+
+void FileWriteQueue::submit_flush(Op op) {
+    {
+        std::lock_guard<std::mutex> lock(queue_lock);
+        ops.push_back(op);
+    }
+    queue_cond.notify_one();
+}
+
+void FileWriteQueue::write_done(Op& op, bool ok) {
+    op.file->write_done(op.seq, ok);
+    release_block(op.data, op.size);
+    {
+        std::lock_guard<std::mutex> lock(queue_lock);
+        num_in_flight--;
+    }
+    in_flight_cond.notify_all();
+}
+
+uint8_t* FileWriteQueue::get_block(size_t size) {
+    size = round_to_alignment(size);
+    {
+        std::lock_guard<std::mutex> lock(block_lock);
+        for (auto it = free_blocks.begin(); it != free_blocks.end(); ++it) {
+            if (it->first == size) {
+                uint8_t* block = it->second;
+                free_blocks.erase(it);
+                return block;
+            }
+        }
+    }
+
+    void* block;
+    if (posix_memalign(&block, DIRECT_IO_ALIGNMENT, size) != 0)
+        throw std::bad_alloc();
+    return (uint8_t*)block;
+}
+
+void FileWriteQueue::release_block(uint8_t* block, size_t size) {
+    std::lock_guard<std::mutex> lock(block_lock);
+    if (free_blocks.size() < max_in_flight)
+        free_blocks.emplace_back(round_to_alignment(size), block);
+    else
+        free(block);
+}
+
+void FileWriteQueue::writer_thread() {
+    while (true) {
+        std::unique_lock<std::mutex> lock(queue_lock);
+        queue_cond.wait(lock, [&] { return stop_threads || !ops.empty(); });
+        if (ops.empty())
+            return;
+        Op op = ops.front();
+        ops.pop_front();
+        lock.unlock();
+
+        if (op.is_flush) {
+            op.file->flush_now(op.offset, op.size, op.evict);
+            op.file->flush_done();
+        } else {
+            write_done(op, op.file->write_now(op.offset, op.size, op.data));
+        }
+    }
+}
+
+#ifdef WITH_LIBURING
+void FileWriteQueue::reaper_thread() {
+    while (true) {
+        struct io_uring_cqe* cqe;
+        int err = io_uring_wait_cqe(&ring, &cqe);
+        if (err == -EINTR)
+            continue;
+        if (err < 0) {
+            ERROR_NON_OO("Failed to wait for an io_uring completion: {:s}", strerror(-err));
+            continue;
+        }
+
+        Op* op = (Op*)io_uring_cqe_get_data(cqe);
+        int res = cqe->res;
+        io_uring_cqe_seen(&ring, cqe);
+
+        // Stopped with a nop
+        if (op == nullptr)
+            return;
+
+        bool ok;
+        if (res < 0) {
+            ERROR_NON_OO("Write error attempting to write {:d} bytes at offset {:d} into file "
+                         "{:s}: {:s}",
+                         op->size, op->offset, op->file->name, strerror(-res));
+            ok = false;
+        } else {
+            // Finish off a short write synchronously
+            ok = ((size_t)res == op->size)
+                 || op->file->write_now(op->offset + res, op->size - res, op->data + res);
+        }
+        write_done(*op, ok);
+        delete op;
+    }
+}
+#endif
+
+
+AsyncFileWriter::AsyncFileWriter(int fd, const std::string& name, kotekan::logLevel log_level) :
+    fd(fd), name(name) {
+    set_log_level(log_level);
+
+#ifdef O_DIRECT
+    int flags = fcntl(fd, F_GETFL);
+    direct = (flags != -1) && (flags & O_DIRECT);
+#else
+    direct = false;
+#endif
+}
+
+AsyncFileWriter::~AsyncFileWriter() {
+    wait();
+}
+
+bool AsyncFileWriter::write(off_t offset, size_t size, const std::vector<part_t>& parts) {
+
+    FileWriteQueue& queue = FileWriteQueue::instance();
+
+    // Write straight from the parts if we can
+    if (queue.get_backend() == FileWriteQueue::Backend::sync && !direct) {
+        bool ok = true;
+        off_t pos = offset;
+        for (auto& part : parts) {
+            ok = ok && pwrite_all(fd, (const uint8_t*)part.first, part.second, pos);
+            pos += part.second;
+        }
+        while (ok && pos < offset + (off_t)size) {
+            size_t n = std::min(sizeof(zeros), (size_t)(offset + size - pos));
+            ok = pwrite_all(fd, zeros, n, pos);
+            pos += n;
+        }
+        if (!ok) {
+            ERROR("Write error attempting to write {:d} bytes at offset {:d} into file {:s}: {:s}",
+                  size, offset, name, strerror(errno));
+            num_failed++;
+        }
+        return !failed();
+    }
+
+    // Otherwise copy them into a block, with any padding zeroed
+    uint8_t* block = queue.get_block(size);
+    size_t pos = 0;
+    for (auto& part : parts) {
+        memcpy(block + pos, part.first, part.second);
+        pos += part.second;
+    }
+    memset(block + pos, 0, size - pos);
+
+    if (queue.get_backend() == FileWriteQueue::Backend::sync) {
+        write_now(offset, size, block);
+        queue.release_block(block, size);
+        return !failed();
+    }
+
+    uint64_t seq;
+    {
+        std::lock_guard<std::mutex> lock(this->lock);
+        seq = next_seq++;
+        outstanding.insert(seq);
+    }
+    queue.submit_write({this, false, seq, offset, size, block, false});
+    return !failed();
+}
+
+void AsyncFileWriter::flush(off_t offset, size_t size, bool evict) {
+
+    FileWriteQueue& queue = FileWriteQueue::instance();
+
+    if (queue.get_backend() == FileWriteQueue::Backend::sync) {
+        wait();
+        flush_now(offset, size, evict);
+        return;
+    }
+
+    // Queue the flush straight away if the earlier writes are done, otherwise
+    // once they are
+    std::unique_lock<std::mutex> lock(this->lock);
+    FileWriteQueue::Op op = {this, true, next_seq, offset, size, nullptr, evict};
+    num_flushes++;
+    if (outstanding.empty()) {
+        lock.unlock();
+        queue.submit_flush(op);
+    } else {
+        waiting_flushes.push_back(op);
+    }
+}
+
+void AsyncFileWriter::wait() {
+    std::unique_lock<std::mutex> lock(this->lock);
+    done_cond.wait(lock, [&] { return outstanding.empty() && num_flushes == 0; });
+}
+
+bool AsyncFileWriter::failed() const {
+    return num_failed > 0;
+}
+
+bool AsyncFileWriter::write_now(off_t offset, size_t size, const uint8_t* data) {
+    if (!pwrite_all(fd, data, size, offset)) {
+        ERROR("Write error attempting to write {:d} bytes at offset {:d} into file {:s}: {:s}",
+              size, offset, name, strerror(errno));
+        num_failed++;
+        return false;
+    }
+    return true;
+}
+
+void AsyncFileWriter::flush_now(off_t offset, size_t size, bool evict) {
+#ifdef __linux__
+    if (evict) {
+        sync_file_range(fd, offset, size,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE
+                            | SYNC_FILE_RANGE_WAIT_AFTER);
+        posix_fadvise(fd, offset, size, POSIX_FADV_DONTNEED);
+    } else {
+        sync_file_range(fd, offset, size, SYNC_FILE_RANGE_WRITE);
+    }
+#else
+    (void)offset; // Suppress warning
+    (void)size;
+    (void)evict;
+#endif
+}
+
+void AsyncFileWriter::write_done(uint64_t seq, bool ok) {
+    std::lock_guard<std::mutex> lock(this->lock);
+    if (!ok)
+        num_failed++;
+    outstanding.erase(seq);
+
+    // Queue the flushes that were only waiting on earlier writes
+    FileWriteQueue& queue = FileWriteQueue::instance();
+    while (!waiting_flushes.empty()
+           && (outstanding.empty() || *outstanding.begin() >= waiting_flushes.front().seq)) {
+        queue.submit_flush(waiting_flushes.front());
+        waiting_flushes.pop_front();
+    }
+    done_cond.notify_all();
+}
+
+void AsyncFileWriter::flush_done() {
+    std::lock_guard<std::mutex> lock(this->lock);
+    num_flushes--;
+    done_cond.notify_all();
+}
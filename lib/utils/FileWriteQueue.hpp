@@ -0,0 +1,263 @@
+/*****************************************
+@file
+@brief A shared queue of asynchronous writes to the raw output files.
+- FileWriteQueue
+- AsyncFileWriter
+*****************************************/
+#ifndef FILE_WRITE_QUEUE_HPP
+#define FILE_WRITE_QUEUE_HPP
+
+#include "Config.hpp"         // for Config
+#include "kotekanLogging.hpp" // for kotekanLogging, logLevel, logLevel::INFO
+
+#include <atomic>             // for atomic
+#include <condition_variable> // for condition_variable
+#include <deque>              // for deque
+#include <mutex>              // for mutex
+#include <set>                // for set
+#include <stddef.h>           // for size_t
+#include <stdint.h>           // for uint32_t, uint64_t, uint8_t
+#include <string>             // for string
+#include <sys/types.h>        // for off_t
+#include <thread>             // for thread
+#include <utility>            // for pair
+#include <vector>             // for vector
+
+#ifdef WITH_LIBURING
+#include <liburing.h> // for io_uring
+#endif
+
+class AsyncFileWriter;
+
+/**
+ * @class FileWriteQueue
+ * @brief Does the writes of the raw output files off the writer stage threads
+ *
+ * A blocking write followed by a flush of the page cache stalls the thread of
+ * a writer stage whenever the disk is slow, and its input buffer backs up. With
+ * this queue the writes are copied into staging blocks and done by a backend,
+ * and the writer only blocks once @c max_in_flight writes are queued or in
+ * progress. The flushes of a file (and the eviction from the page cache) are
+ * done once all the writes queued before them are complete.
+ *
+ * The backends are:
+ *  - @c sync: write on the calling thread, as the files always did.
+ *  - @c threads: write on a pool of @c num_threads writer threads.
+ *  - @c io_uring: submit the writes through io_uring. This needs kotekan to be
+ *    built with @c USE_LIBURING, and falls back to @c threads if it wasn't, or
+ *    if the kernel doesn't support it.
+ *
+ * The flushes are run on the writer threads in both asynchronous backends.
+ *
+ * The queue is started with the @c /file_write_queue config block by
+ * @c kotekanMode, and uses the @c sync backend otherwise.
+ *
+ * @conf backend        String, default "sync". One of "sync", "threads" or "io_uring".
+ * @conf num_threads    Int, default 2. The number of writer threads.
+ * @conf max_in_flight  Int, default 64. The maximum number of writes queued or in
+ *                      progress at once.
+ * @conf direct_io      Bool, default false. Open the files with @c O_DIRECT,
+ *                      bypassing the page cache, if their frames are aligned to
+ *                      @c DIRECT_IO_ALIGNMENT.
+ *
+ * This class is a singleton, and can be accessed with @c instance()
+ */
+class FileWriteQueue {
+public:
+    /// How the writes are done
+    enum class Backend { sync, threads, io_uring };
+
+    /// The alignment of the staging blocks, and of the frames for @c O_DIRECT
+    static const size_t DIRECT_IO_ALIGNMENT = 4096;
+
+    /**
+     * @brief Set the config and start the global FileWriteQueue
+     *
+     * Restarts the queue if it was already running.
+     *
+     * @param config The config.
+     * @returns A reference to the global FileWriteQueue instance.
+     */
+    static FileWriteQueue& instance(const kotekan::Config& config);
+
+    /**
+     * @brief Get the global FileWriteQueue.
+     *
+     * @returns A reference to the global FileWriteQueue instance.
+     **/
+    static FileWriteQueue& instance();
+
+    ~FileWriteQueue();
+
+    /**
+     * @brief Start the backend
+     *
+     * @param backend        How to do the writes.
+     * @param num_threads    The number of writer threads.
+     * @param max_in_flight  The maximum number of writes queued or in progress.
+     * @param direct_io      Whether the files should be opened with @c O_DIRECT.
+     */
+    void start(Backend backend, uint32_t num_threads, uint32_t max_in_flight, bool direct_io);
+
+    /**
+     * @brief Finish the queued writes and stop the backend
+     *
+     * The queue goes back to the @c sync backend until it is started again. No
+     * files can be written to while it is stopping.
+     */
+    void stop();
+
+    /// The backend in use
+    Backend get_backend();
+
+    /// Whether the files should be opened with @c O_DIRECT, if their frames are aligned
+    bool get_direct_io();
+
+private:
+    friend class AsyncFileWriter;
+
+    FileWriteQueue() = default;
+
+    // A write or a flush of one file
+    struct Op {
+        AsyncFileWriter* file;
+        bool is_flush;
+        uint64_t seq;
+        off_t offset;
+        size_t size;
+        uint8_t* data;
+        bool evict;
+    };
+
+    // Queue a write, blocking while there are too many in flight
+    void submit_write(Op op);
+
+    // Queue a flush, which must be ready to run
+    void submit_flush(Op op);
+
+    // Called by the backend once a write is finished
+    void write_done(Op& op, bool ok);
+
+    // Get and release staging blocks
+    uint8_t* get_block(size_t size);
+    void release_block(uint8_t* block, size_t size);
+
+    void writer_thread();
+
+    // Protects starting and stopping
+    std::mutex state_lock;
+    std::atomic<Backend> backend = Backend::sync;
+    std::atomic<bool> direct_io = false;
+    uint32_t max_in_flight = 1;
+
+    // The writes and flushes waiting for a writer thread
+    std::mutex queue_lock;
+    std::condition_variable queue_cond;
+    std::condition_variable in_flight_cond;
+    std::deque<Op> ops;
+    uint32_t num_in_flight = 0;
+    bool stop_threads = false;
+    std::vector<std::thread> threads;
+
+    // Free staging blocks, by size
+    std::mutex block_lock;
+    std::vector<std::pair<size_t, uint8_t*>> free_blocks;
+
+#ifdef WITH_LIBURING
+    void reaper_thread();
+
+    struct io_uring ring;
+    std::mutex ring_lock;
+    std::thread reaper;
+#endif
+};
+
+/**
+ * @class AsyncFileWriter
+ * @brief Writes to one file through the @c FileWriteQueue
+ *
+ * The data of each write is copied before it returns, so the frame it came from
+ * can be released straight away. Errors are logged when the write fails, and
+ * reported by @c failed() afterwards.
+ *
+ * Writes to overlapping ranges of the file may be done in any order, call
+ * @c wait() in between them.
+ */
+class AsyncFileWriter : public kotekan::kotekanLogging {
+public:
+    /// A piece of data to write, and its size in bytes
+    using part_t = std::pair<const void*, size_t>;
+
+    /**
+     * @brief Create a writer for a file
+     *
+     * @param fd         The open file. It isn't closed by the writer.
+     * @param name       The file name, for the logging.
+     * @param log_level  The log level.
+     */
+    AsyncFileWriter(int fd, const std::string& name,
+                    kotekan::logLevel log_level = kotekan::logLevel::INFO);
+
+    /// Waits for all the writes and flushes of the file
+    ~AsyncFileWriter();
+
+    /**
+     * @brief Write the parts one after another into the file
+     *
+     * @param offset  The offset to write at.
+     * @param size    The number of bytes to write, any space left after the parts
+     *                is zero filled. This must be a multiple of
+     *                @c FileWriteQueue::DIRECT_IO_ALIGNMENT for @c O_DIRECT files.
+     * @param parts   The data to write.
+     *
+     * @returns False if this or an earlier write failed.
+     */
+    bool write(off_t offset, size_t size, const std::vector<part_t>& parts);
+
+    /**
+     * @brief Flush a range of the file to disk once the writes queued so far are done
+     *
+     * @param offset  The start of the range.
+     * @param size    The length of the range.
+     * @param evict   Wait for the flush, and then evict the range from the page cache.
+     */
+    void flush(off_t offset, size_t size, bool evict);
+
+    /// Wait for all the queued writes and flushes of the file
+    void wait();
+
+    /// Whether any write has failed
+    bool failed() const;
+
+private:
+    friend class FileWriteQueue;
+
+    // Do a write or a flush, returns false if the write failed
+    bool write_now(off_t offset, size_t size, const uint8_t* data);
+    void flush_now(off_t offset, size_t size, bool evict);
+
+    // Called by the queue when a write or flush is finished
+    void write_done(uint64_t seq, bool ok);
+    void flush_done();
+
+    int fd;
+    const std::string name;
+
+    // Whether the file was opened with O_DIRECT, so can't be written from the frames
+    bool direct;
+
+    std::mutex lock;
+    std::condition_variable done_cond;
+
+    // The sequence number of the next write, and the writes not done yet
+    uint64_t next_seq = 0;
+    std::set<uint64_t> outstanding;
+
+    // The flushes waiting on earlier writes, and the number queued or running
+    std::deque<FileWriteQueue::Op> waiting_flushes;
+    uint32_t num_flushes = 0;
+
+    std::atomic<uint64_t> num_failed = 0;
+};
+
+#endif
@@ -112,7 +112,7 @@ private:
     void create_datasets();
 
     // Get datasets
-    HighFive::DataSet dset(const std::string& name);
+    HighFive::DataSet dset(const std::string& name) override;
     size_t length(const std::string& axis_name);
 
     // Description of weights stored in hfb_weight dataset
@@ -218,6 +218,9 @@ struct EigConvergenceStats {
 
     /// RMS of residuals
     double rms = 0.0;
+
+    /// Did the iteration start from given eigenpairs?
+    bool warm_start = false;
 };
 
 /**
@@ -237,6 +240,10 @@ struct EigConvergenceStats {
  *                   zero, use all eigenpairs.
  * @param  p         Size of the Krylov subspace in the augmented Ritz.
  * @param  q         Number of subspace updates per iteration.
+ * @param  initial   Eigenpairs to start from, e.g. those of a similar matrix found
+ *                   earlier. Their vectors seed the subspace and their rank-k
+ *                   approximation fills in the masked entries. If null, or not of
+ *                   the right shape, start from a random subspace.
  *
  * @return           The estimated eigenpairs.
  **/
@@ -245,7 +252,7 @@ std::pair<eig_t<MT>, EigConvergenceStats>
 eigen_masked_subspace(const DynamicHermitian<MT>& A,
                       const DynamicHermitian<float>& W, // Should this be symmetric
                       size_t k, float tol_eval, float tol_evec, size_t maxiter, size_t k_conv = 0,
-                      size_t p = 2, size_t q = 3) {
+                      size_t p = 2, size_t q = 3, const eig_t<MT>* initial = nullptr) {
     blaze::DynamicVector<real_t<MT>> evals, evalsp;
     blaze::DynamicMatrix<MT, blaze::columnMajor> V, Vp;
 
@@ -256,21 +263,36 @@ eigen_masked_subspace(const DynamicHermitian<MT>& A,
     // Set k_conv appropriately
     k_conv = k_conv == 0 ? k : k_conv;
 
-    // Initialise (randomly the vector array)
-    V.resize(n, k);
-    for (unsigned int i = 0; i < n; i++) {
-        for (unsigned int j = 0; j < k; j++) {
-            V(i, j) = blaze::rand<MT>();
+    EigConvergenceStats stats;
+
+    stats.warm_start = (initial != nullptr && initial->first.size() == k
+                        && initial->second.rows() == n && initial->second.columns() == k);
+
+    if (stats.warm_start) {
+        // Start from the given eigenpairs, and use them to fill in the masked entries.
+        // These came out of augmented_ritz, so are already orthonormal and have the
+        // same phase convention as the vectors we compare them to below.
+        V = initial->second;
+        auto Ar = expand_rankN(*initial);
+        Am = A % W + Ar - Ar % W;
+
+        evalsp = initial->first;
+    } else {
+        // Initialise (randomly the vector array)
+        V.resize(n, k);
+        for (unsigned int i = 0; i < n; i++) {
+            for (unsigned int j = 0; j < k; j++) {
+                V(i, j) = blaze::rand<MT>();
+            }
         }
+        V = orth(V);
+
+        evalsp.resize(k);
+        evalsp = 0.0;
     }
-    V = orth(V);
 
     // Initialise loop variables for holding the previous state
     Vp = V;
-    evalsp.resize(k);
-    evalsp = 0.0;
-
-    EigConvergenceStats stats;
 
     for (stats.iterations = 0; !stats.converged && stats.iterations < maxiter; stats.iterations++) {
 
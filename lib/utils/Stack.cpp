@@ -1,17 +1,22 @@
 #include "Stack.hpp"
 
-#include "visUtil.hpp" // for rstack_ctype, prod_ctype, input_ctype
+#include "simdUtil.hpp" // for CONJ_INDEX_FLAG, conj_sign, gather_pairs
+#include "visUtil.hpp"  // for rstack_ctype, prod_ctype, input_ctype
 
 #include "fmt.hpp" // for format, fmt
 
 #include <algorithm>  // for copy, sort, transform, max
+#include <complex>    // for conj
 #include <cstdint>    // for uint32_t, int8_t, int16_t
 #include <functional> // for _Bind_helper<>::type, bind, _1, placeholders
+#ifdef __AVX2__
+#include <immintrin.h> // for _mm_i32gather_ps, _mm256_add_ps, _mm256_mul_ps
+#endif
 #include <iterator>   // for back_insert_iterator, begin, end, back_inserter
 #include <math.h>     // for abs
 #include <memory>     // for allocator_traits<>::value_type
-#include <numeric>    // for iota
-#include <stdexcept>  // for invalid_argument
+#include <numeric>    // for iota, partial_sum
+#include <stdexcept>  // for invalid_argument, out_of_range
 #include <stdlib.h>   // for abs
 #include <string>     // for operator<<
 #include <tuple>      // for tuple, make_tuple, operator!=, operator<
@@ -124,3 +129,124 @@ stack_chime_in_cyl(const std::vector<input_ctype>& inputs, const std::vector<pro
 
     return {++cur_stack_ind, stack_map};
 }
+
+
+StackPlan::StackPlan(uint32_t num_stack, const std::vector<rstack_ctype>& stack_map,
+                     const std::vector<prod_ctype>& prods) :
+    stack_start(num_stack + 1, 0) {
+
+    if (stack_map.size() != prods.size()) {
+        throw std::invalid_argument("Stack map and products have different lengths.");
+    }
+    if (prods.size() > ~CONJ_INDEX_FLAG) {
+        throw std::invalid_argument("Too many products to plan a stack.");
+    }
+
+    // Count the products in each stack, and turn that into the start of each stack
+    for (auto& s : stack_map) {
+        if (s.stack >= num_stack)
+            throw std::out_of_range("Stack map asks for stacks out of range.");
+        stack_start[s.stack + 1]++;
+    }
+    std::partial_sum(stack_start.begin(), stack_start.end(), stack_start.begin());
+
+    // Put the products in place, keeping their order within each stack
+    prod_index.resize(prods.size());
+    input_a.resize(prods.size());
+    input_b.resize(prods.size());
+    std::vector<uint32_t> next(stack_start.begin(), stack_start.end() - 1);
+    for (uint32_t prod_ind = 0; prod_ind < prods.size(); prod_ind++) {
+        uint32_t k = next[stack_map[prod_ind].stack]++;
+        prod_index[k] = prod_ind | (stack_map[prod_ind].conjugate ? CONJ_INDEX_FLAG : 0);
+        input_a[k] = prods[prod_ind].input_a;
+        input_b[k] = prods[prod_ind].input_b;
+    }
+}
+
+void StackPlan::stack(const cfloat* vis, const float* weight, const float* flags, uint32_t start,
+                      uint32_t end, cfloat* out_vis, float* out_v2, float* out_var,
+                      float* out_norm) const {
+
+#ifdef __AVX2__
+    const __m128i index_mask = _mm_set1_epi32(~CONJ_INDEX_FLAG);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0);
+#endif
+
+    for (uint32_t stack_ind = start; stack_ind < end; stack_ind++) {
+        uint32_t k = stack_start[stack_ind];
+        uint32_t k_end = stack_start[stack_ind + 1];
+
+        cfloat sum_vis = 0.0;
+        float sum_v2 = 0.0;
+        float sum_var = 0.0;
+        float sum_norm = 0.0;
+
+#ifdef __AVX2__
+        // Four products at a time. The complex sums are kept as two interleaved
+        // (real, imaginary) pairs per 128 bit lane.
+        __m256 acc_vis = _mm256_setzero_ps();
+        __m256 acc_v2 = _mm256_setzero_ps();
+        __m128 acc_var = _mm_setzero_ps();
+        __m128 acc_norm = _mm_setzero_ps();
+
+        for (; k + 4 <= k_end; k += 4) {
+            __m128i idx = _mm_loadu_si128((const __m128i*)&prod_index[k]);
+            __m128i pi = _mm_and_si128(idx, index_mask);
+
+            // Skip products with zero weight or a flagged input
+            __m128 w = _mm_i32gather_ps(weight, pi, 4);
+            __m128 fa = _mm_i32gather_ps(flags, _mm_loadu_si128((const __m128i*)&input_a[k]), 4);
+            __m128 fb = _mm_i32gather_ps(flags, _mm_loadu_si128((const __m128i*)&input_b[k]), 4);
+            __m128 valid = _mm_and_ps(_mm_cmp_ps(w, zero, _CMP_NEQ_UQ),
+                                      _mm_and_ps(_mm_cmp_ps(fa, zero, _CMP_NEQ_UQ),
+                                                 _mm_cmp_ps(fb, zero, _CMP_NEQ_UQ)));
+            __m256 valid_pair =
+                _mm256_castsi256_ps(_mm256_cvtepi32_epi64(_mm_castps_si128(valid)));
+
+            // Gather the visibilities and conjugate by flipping the sign of the imaginary part
+            __m256 v = _mm256_castsi256_ps(gather_pairs(vis, idx));
+            __m256 sign = _mm256_castsi256_ps(conj_sign(idx));
+            v = _mm256_and_ps(_mm256_xor_ps(v, sign), valid_pair);
+
+            acc_vis = _mm256_add_ps(acc_vis, v);
+            acc_v2 = _mm256_add_ps(acc_v2, _mm256_mul_ps(v, v));
+            acc_var = _mm_add_ps(acc_var, _mm_and_ps(_mm_div_ps(one, w), valid));
+            acc_norm = _mm_add_ps(acc_norm, _mm_and_ps(one, valid));
+        }
+
+        alignas(32) float t_vis[8], t_v2[8], t_var[4], t_norm[4];
+        _mm256_store_ps(t_vis, acc_vis);
+        _mm256_store_ps(t_v2, acc_v2);
+        _mm_store_ps(t_var, acc_var);
+        _mm_store_ps(t_norm, acc_norm);
+        for (int i = 0; i < 4; i++) {
+            sum_vis += cfloat(t_vis[2 * i], t_vis[2 * i + 1]);
+            sum_v2 += t_v2[2 * i] + t_v2[2 * i + 1];
+            sum_var += t_var[i];
+            sum_norm += t_norm[i];
+        }
+#endif
+
+        for (; k < k_end; k++) {
+            uint32_t pi = prod_index[k] & ~CONJ_INDEX_FLAG;
+            float w = weight[pi];
+
+            // If the weight is zero, completely skip this product
+            if (w == 0 || flags[input_a[k]] == 0 || flags[input_b[k]] == 0)
+                continue;
+
+            cfloat v = (prod_index[k] & CONJ_INDEX_FLAG) ? std::conj(vis[pi]) : vis[pi];
+
+            sum_vis += v;
+            sum_v2 += fast_norm(v);
+            sum_var += 1.0 / w;
+            sum_norm += 1.0;
+        }
+
+        out_vis[stack_ind] = sum_vis;
+        out_v2[stack_ind] = sum_v2;
+        out_var[stack_ind] = sum_var;
+        out_norm[stack_ind] = sum_norm;
+    }
+}
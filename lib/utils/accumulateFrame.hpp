@@ -0,0 +1,125 @@
+#ifndef ACCUMULATE_FRAME_HPP
+#define ACCUMULATE_FRAME_HPP
+
+#include "simdUtil.hpp" // for SIMD_BEGIN_KERNELS, SIMD_END_KERNELS
+
+#include <cstddef> // for size_t
+#include <cstdint> // for int32_t
+#include <vector>  // for vector
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h> // for __m256i, __m512i, _mm256_add_epi32, _mm512_add_epi32, ...
+#endif
+
+
+/**
+ *  @brief Accumulate the products [start, end) of one GPU frame, one at a time.
+ *
+ *  The frame is added into the visibility sums of every dataset in `vis1`, then on
+ *  even frames it is saved into `vis_even`, and on odd frames the squared difference
+ *  from the saved even frame is added into `vis2`.
+ *
+ *  @param  input     The GPU frame, as interleaved imaginary and real parts.
+ *  @param  vis1      The visibility sums to add the frame into.
+ *  @param  vis_even  The saved even frame.
+ *  @param  vis2      The sums of the squared differences between pairs of frames.
+ *  @param  even      Whether this is an even frame.
+ *  @param  start     The first product.
+ *  @param  end       One past the last product.
+ */
+inline void accumulate_frame_scalar(const int32_t* input, const std::vector<int32_t*>& vis1,
+                                    int32_t* vis_even, float* vis2, bool even, size_t start,
+                                    size_t end) {
+    for (size_t i = start; i < end; i++) {
+        int32_t in_r = input[2 * i + 1];
+        int32_t in_i = input[2 * i];
+
+        for (int32_t* acc : vis1) {
+            acc[2 * i] += in_i;
+            acc[2 * i + 1] += in_r;
+        }
+
+        if (even) {
+            vis_even[2 * i] = in_i;
+            vis_even[2 * i + 1] = in_r;
+        } else {
+            // NOTE: avoid using the slow std::complex routines in here
+            float di = in_i - vis_even[2 * i];
+            float dr = in_r - vis_even[2 * i + 1];
+            vis2[i] += (dr * dr + di * di);
+        }
+    }
+}
+
+
+SIMD_BEGIN_KERNELS
+
+/**
+ *  @brief Accumulate the products [start, end) of one GPU frame in a single pass over
+ *         it, as `accumulate_frame_scalar` does.
+ *
+ *  Uses AVX-512 or AVX2 when they are available. The integer sums are bit for bit the
+ *  same, the squared differences may differ in the last bit if the compiler fuses the
+ *  multiply and add differently in the two paths.
+ */
+inline void accumulate_frame(const int32_t* input, const std::vector<int32_t*>& vis1,
+                             int32_t* vis_even, float* vis2, bool even, size_t start,
+                             size_t end) {
+    size_t i = start;
+
+#if defined(__AVX512F__)
+    const __m512i even_idx =
+        _mm512_setr_epi32(0, 2, 4, 6, 8, 10, 12, 14, 0, 2, 4, 6, 8, 10, 12, 14);
+
+    // Eight products at a time
+    for (; i + 8 <= end; i += 8) {
+        __m512i in = _mm512_loadu_si512(input + 2 * i);
+
+        for (int32_t* acc : vis1) {
+            __m512i sum = _mm512_add_epi32(_mm512_loadu_si512(acc + 2 * i), in);
+            _mm512_storeu_si512(acc + 2 * i, sum);
+        }
+
+        if (even) {
+            _mm512_storeu_si512(vis_even + 2 * i, in);
+        } else {
+            __m512 d =
+                _mm512_cvtepi32_ps(_mm512_sub_epi32(in, _mm512_loadu_si512(vis_even + 2 * i)));
+            d = _mm512_mul_ps(d, d);
+            // Add the real and imaginary parts, then keep one copy of each sum
+            d = _mm512_add_ps(d, _mm512_permute_ps(d, 0xB1));
+            __m256 power = _mm512_castps512_ps256(_mm512_permutexvar_ps(even_idx, d));
+            _mm256_storeu_ps(vis2 + i, _mm256_add_ps(_mm256_loadu_ps(vis2 + i), power));
+        }
+    }
+#elif defined(__AVX2__)
+    const __m256i even_idx = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+
+    // Four products at a time
+    for (; i + 4 <= end; i += 4) {
+        __m256i in = _mm256_loadu_si256((const __m256i*)(input + 2 * i));
+
+        for (int32_t* acc : vis1) {
+            __m256i sum = _mm256_add_epi32(_mm256_loadu_si256((__m256i*)(acc + 2 * i)), in);
+            _mm256_storeu_si256((__m256i*)(acc + 2 * i), sum);
+        }
+
+        if (even) {
+            _mm256_storeu_si256((__m256i*)(vis_even + 2 * i), in);
+        } else {
+            __m256 d = _mm256_cvtepi32_ps(
+                _mm256_sub_epi32(in, _mm256_loadu_si256((__m256i*)(vis_even + 2 * i))));
+            d = _mm256_mul_ps(d, d);
+            // Add the real and imaginary parts, then keep one copy of each sum
+            d = _mm256_add_ps(d, _mm256_permute_ps(d, 0xB1));
+            __m128 power = _mm256_castps256_ps128(_mm256_permutevar8x32_ps(d, even_idx));
+            _mm_storeu_ps(vis2 + i, _mm_add_ps(_mm_loadu_ps(vis2 + i), power));
+        }
+    }
+#endif
+
+    accumulate_frame_scalar(input, vis1, vis_even, vis2, even, i, end);
+}
+
+SIMD_END_KERNELS
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef APPLY_GAINS_ROW_HPP
+#define APPLY_GAINS_ROW_HPP
+
+#include "visUtil.hpp" // for cfloat
+
+#include <cstddef> // for size_t
+#if defined(__AVX__)
+#include <immintrin.h> // for _mm256_addsub_ps, _mm256_loadu_ps, _mm256_mul_ps, ...
+#endif
+
+
+/**
+ *  @brief Apply the gains to n products of one row of the triangle, one at a time.
+ *
+ *  The products share the first input, and their second inputs are consecutive.
+ *  The weights are zeroed wherever the weight factor is, even if they were
+ *  infinite.
+ *
+ *  @param  gi             The gain of the first input.
+ *  @param  wi             The weight factor of the first input.
+ *  @param  gain_conj      The conjugated gains of the second inputs.
+ *  @param  weight_factor  The weight factors of the second inputs.
+ *  @param  n              The number of products.
+ *  @param  in_vis         The visibilities to apply the gains to.
+ *  @param  out_vis        The calibrated visibilities, can be @p in_vis.
+ *  @param  in_weight      The weights to apply the weight factors to.
+ *  @param  out_weight     The new weights, can be @p in_weight.
+ */
+inline void apply_gains_row_scalar(cfloat gi, float wi, const cfloat* gain_conj,
+                                   const float* weight_factor, size_t n, const cfloat* in_vis,
+                                   cfloat* out_vis, const float* in_weight, float* out_weight) {
+    for (size_t k = 0; k < n; k++) {
+        out_vis[k] = in_vis[k] * (gi * gain_conj[k]);
+
+        // Update the weights take care not to generate NaN's if both the gain
+        // was zero and the weight was infinite (which can happen if a channel
+        // was turned off)
+        float wp = wi * weight_factor[k];
+        out_weight[k] = (wp == 0 ? 0.0 : in_weight[k] * wp);
+    }
+}
+
+
+/**
+ *  @brief Apply the gains to n products of one row of the triangle, as
+ *         `apply_gains_row_scalar` does.
+ *
+ *  Uses AVX for four products at a time when it is available. The results can
+ *  differ from `apply_gains_row_scalar` in the last bits, as the complex products
+ *  are rounded differently.
+ */
+inline void apply_gains_row(cfloat gi, float wi, const cfloat* gain_conj,
+                            const float* weight_factor, size_t n, const cfloat* in_vis,
+                            cfloat* out_vis, const float* in_weight, float* out_weight) {
+    size_t k = 0;
+
+#ifdef __AVX__
+    const __m256 gi_re = _mm256_set1_ps(gi.real());
+    const __m256 gi_im = _mm256_set1_ps(gi.imag());
+    const __m128 wi_vec = _mm_set1_ps(wi);
+    const __m128 zero = _mm_setzero_ps();
+
+    // Four products at a time, with the complex values as interleaved floats
+    for (; k + 4 <= n; k += 4) {
+        // The gain factors gi * conj(gj)
+        __m256 gj = _mm256_loadu_ps(reinterpret_cast<const float*>(gain_conj + k));
+        __m256 gij = _mm256_addsub_ps(_mm256_mul_ps(gj, gi_re),
+                                      _mm256_mul_ps(_mm256_permute_ps(gj, 0xb1), gi_im));
+
+        // Gains are to be multiplied to vis
+        __m256 vis = _mm256_loadu_ps(reinterpret_cast<const float*>(in_vis + k));
+        vis = _mm256_addsub_ps(_mm256_mul_ps(vis, _mm256_moveldup_ps(gij)),
+                               _mm256_mul_ps(_mm256_permute_ps(vis, 0xb1),
+                                             _mm256_movehdup_ps(gij)));
+        _mm256_storeu_ps(reinterpret_cast<float*>(out_vis + k), vis);
+
+        // Update the weights, zeroing them wherever the weight factor is zero
+        __m128 wp = _mm_mul_ps(wi_vec, _mm_loadu_ps(weight_factor + k));
+        __m128 weight = _mm_mul_ps(_mm_loadu_ps(in_weight + k), wp);
+        _mm_storeu_ps(out_weight + k, _mm_andnot_ps(_mm_cmpeq_ps(wp, zero), weight));
+    }
+#endif
+
+    apply_gains_row_scalar(gi, wi, gain_conj + k, weight_factor + k, n - k, in_vis + k,
+                           out_vis + k, in_weight + k, out_weight + k);
+}
+
+#endif
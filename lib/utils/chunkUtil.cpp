@@ -0,0 +1,57 @@
+#include "chunkUtil.hpp"
+
+#include <algorithm> // for min
+#include <cstring>   // for memcpy
+
+
+size_t num_block_chunks(const std::vector<size_t>& count, const std::vector<size_t>& chunk) {
+    size_t n = 1;
+    for (size_t d = 0; d < chunk.size(); d++) {
+        n *= (count[d] + chunk[d] - 1) / chunk[d];
+    }
+    return n;
+}
+
+std::vector<size_t> extract_chunk(const uint8_t* block, const std::vector<size_t>& count,
+                                  const std::vector<size_t>& chunk, size_t elem_size, size_t index,
+                                  std::vector<uint8_t>& out) {
+    const size_t ndim = chunk.size();
+
+    // Find the start of the chunk in the block, the last axis varies fastest
+    std::vector<size_t> start(ndim), extent(ndim);
+    for (size_t d = ndim; d-- > 0;) {
+        size_t nc = (count[d] + chunk[d] - 1) / chunk[d];
+        start[d] = (index % nc) * chunk[d];
+        extent[d] = std::min(chunk[d], count[d] - start[d]);
+        index /= nc;
+    }
+
+    // Copy the rows of the chunk out of the block, zero padding the partial chunks
+    size_t chunk_elems = 1;
+    for (auto c : chunk)
+        chunk_elems *= c;
+    out.assign(chunk_elems * elem_size, 0);
+
+    const size_t row_bytes = extent[ndim - 1] * elem_size;
+    std::vector<size_t> pos(ndim, 0);
+    while (true) {
+        size_t block_ind = 0, chunk_ind = 0;
+        for (size_t d = 0; d < ndim; d++) {
+            block_ind = block_ind * count[d] + start[d] + pos[d];
+            chunk_ind = chunk_ind * chunk[d] + pos[d];
+        }
+        std::memcpy(out.data() + chunk_ind * elem_size, block + block_ind * elem_size, row_bytes);
+
+        // Move to the next row
+        int d = (int)ndim - 2;
+        for (; d >= 0; d--) {
+            if (++pos[d] < extent[d])
+                break;
+            pos[d] = 0;
+        }
+        if (d < 0)
+            break;
+    }
+
+    return start;
+}
@@ -0,0 +1,39 @@
+#ifndef CHUNK_UTIL_HPP
+#define CHUNK_UTIL_HPP
+
+#include <stddef.h> // for size_t
+#include <stdint.h> // for uint8_t
+#include <vector>   // for vector
+
+
+/**
+ * @brief The number of chunks covering a block of an N-dimensional array.
+ *
+ * @param count  The shape of the block.
+ * @param chunk  The shape of the chunks.
+ *
+ * @returns The number of chunks, counting the partial ones at the edges.
+ **/
+size_t num_block_chunks(const std::vector<size_t>& count, const std::vector<size_t>& chunk);
+
+/**
+ * @brief Copy one chunk out of a block of an N-dimensional array.
+ *
+ * The chunks are numbered in C order, with the last axis varying fastest, like
+ * the block itself. The chunks at the far edges of the block can be partial,
+ * and are zero padded up to the full chunk shape.
+ *
+ * @param block      The block.
+ * @param count      The shape of the block.
+ * @param chunk      The shape of the chunks.
+ * @param elem_size  The size of the elements in bytes.
+ * @param index      The chunk to copy, less than @c num_block_chunks.
+ * @param out        Filled with the chunk, in C order of the full chunk shape.
+ *
+ * @returns The offset of the chunk within the block.
+ **/
+std::vector<size_t> extract_chunk(const uint8_t* block, const std::vector<size_t>& count,
+                                  const std::vector<size_t>& chunk, size_t elem_size, size_t index,
+                                  std::vector<uint8_t>& out);
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef SIMD_UTIL_HPP
+#define SIMD_UTIL_HPP
+
+#include <stdint.h> // for uint32_t, INT64_MIN
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h> // for __m128i, __m256i, __m512i, _mm256_i32gather_epi64, ...
+#endif
+
+
+// GCC 12 warns about the undefined inputs used inside the AVX-512 intrinsics (bug 105593), so
+// the kernels which use them go between these two
+#define SIMD_BEGIN_KERNELS                                                                         \
+    _Pragma("GCC diagnostic push") _Pragma("GCC diagnostic ignored \"-Wmaybe-uninitialized\"")
+#define SIMD_END_KERNELS _Pragma("GCC diagnostic pop")
+
+/// The top bit of a gather index, which flags that the product it points at needs conjugating
+static constexpr uint32_t CONJ_INDEX_FLAG = 0x80000000;
+
+#if defined(__AVX2__)
+
+/**
+ * @brief Gather four 64 bit pairs (e.g. complex values) by index.
+ *
+ * @param  base  The pairs to gather from.
+ * @param  idx   The indices of the pairs, which can have @c CONJ_INDEX_FLAG set.
+ *
+ * @returns The pairs at @c base[idx & ~CONJ_INDEX_FLAG].
+ **/
+inline __m256i gather_pairs(const void* base, __m128i idx) {
+    const __m128i index_mask = _mm_set1_epi32(~CONJ_INDEX_FLAG);
+    return _mm256_i32gather_epi64((const long long*)base, _mm_and_si128(idx, index_mask), 8);
+}
+
+/**
+ * @brief The sign bits which conjugate the pairs gathered by @c gather_pairs.
+ *
+ * XORing this with the gathered pairs flips the sign of the upper float of every
+ * pair whose index has @c CONJ_INDEX_FLAG set.
+ *
+ * @param  idx  The indices the pairs were gathered with.
+ *
+ * @returns The sign bit of the upper 32 bits of each flagged pair.
+ **/
+inline __m256i conj_sign(__m128i idx) {
+    const __m256i imag_sign = _mm256_set1_epi64x(INT64_MIN);
+    return _mm256_and_si256(_mm256_slli_epi64(_mm256_cvtepu32_epi64(idx), 32), imag_sign);
+}
+
+#endif
+
+#if defined(__AVX512F__)
+
+/// Gather eight 64 bit pairs by index, see the AVX2 version above
+inline __m512i gather_pairs(const void* base, __m256i idx) {
+    const __m256i index_mask = _mm256_set1_epi32(~CONJ_INDEX_FLAG);
+    return _mm512_i32gather_epi64(_mm256_and_si256(idx, index_mask), base, 8);
+}
+
+/// The sign bits which conjugate eight pairs, see the AVX2 version above
+inline __m512i conj_sign(__m256i idx) {
+    const __m512i imag_sign = _mm512_set1_epi64(INT64_MIN);
+    return _mm512_and_si512(_mm512_slli_epi64(_mm512_cvtepu32_epi64(idx), 32), imag_sign);
+}
+
+#endif
+
+#endif
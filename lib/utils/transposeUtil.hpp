@@ -0,0 +1,141 @@
+#ifndef TRANSPOSE_UTIL_HPP
+#define TRANSPOSE_UTIL_HPP
+
+#include "WorkPool.hpp" // for WorkPool
+
+#include <algorithm> // for copy, min
+#include <stddef.h>  // for size_t
+#include <stdint.h>  // for uint32_t
+#include <vector>    // for vector
+
+
+template<typename T>
+inline void strided_copy(T* in, T* out, size_t offset, size_t stride, size_t n_val) {
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+    for (size_t i = 0; i < n_val; i++) {
+        out[offset + i * stride] = in[i];
+    }
+}
+
+/**
+ * @brief Transposes frames into a time fastest chunk a tile at a time
+ *
+ * Copying each frame straight into the chunk (with @c strided_copy) touches a
+ * different cache line and often a different page for every value. Instead the
+ * frames of each frequency are staged until there are @c tile_t of them, and
+ * then transposed into the chunk in square tiles, so every row of a tile
+ * written fills a cache line.
+ *
+ * The chunk holds @c num_val values for each frequency and time, laid out as
+ * [freq][value][time], and the tiles of a frequency start at the times which are
+ * multiples of @c tile_t.
+ */
+template<typename T>
+class tiledTranspose {
+public:
+    /// The number of times in a tile, so a row of a tile is a cache line
+    static constexpr size_t tile_t = sizeof(T) >= 64 ? 1 : 64 / sizeof(T);
+
+    /**
+     * @brief Allocate the staging tiles
+     *
+     * @param num_freq     The number of frequencies in a chunk.
+     * @param num_val      The number of values in each frame.
+     * @param max_helpers  The number of WorkPool workers to ask for help with
+     *                     each transpose, zero to transpose on the calling thread.
+     **/
+    void resize(size_t num_freq, size_t num_val, uint32_t max_helpers = 0) {
+        this->num_val = num_val;
+        this->max_helpers = max_helpers;
+        tiles.assign(num_freq * tile_t * num_val, T());
+    }
+
+    /**
+     * @brief Where to put the values of a frame
+     *
+     * Once they are filled in the row must be passed to @c commit.
+     *
+     * @param freq_index  Frequency index within the chunk.
+     * @param time_index  Time index within the chunk.
+     *
+     * @returns The row for the frame, of @c num_val values.
+     **/
+    T* row(uint32_t freq_index, uint32_t time_index) {
+        return tiles.data() + (freq_index * tile_t + time_index % tile_t) * num_val;
+    }
+
+    /**
+     * @brief Transpose the staged frames into the chunk once their tile is complete
+     *
+     * @param out         The chunk.
+     * @param freq_index  Frequency index within the chunk.
+     * @param time_index  Time index within the chunk.
+     * @param write_t     Size of the time dimension of the chunk.
+     **/
+    void commit(T* out, uint32_t freq_index, uint32_t time_index, size_t write_t) {
+        size_t nt = time_index % tile_t + 1;
+        if (nt < tile_t && time_index + 1 < write_t)
+            return;
+
+        const T* tile = tiles.data() + freq_index * tile_t * num_val;
+        T* dst = out + freq_index * num_val * write_t + (time_index + 1 - nt);
+
+        if (nt < tile_t) {
+            // Partial tile at the end of the chunk
+            for (size_t i = 0; i < num_val; i++) {
+                for (size_t t = 0; t < nt; t++)
+                    dst[i * write_t + t] = tile[t * num_val + i];
+            }
+            return;
+        }
+
+        // Split the full tiles into one contiguous range for each thread. The loop
+        // sizes are constant, so the compiler can transpose the tiles in registers.
+        const size_t num_tiles = num_val / tile_t;
+        const size_t num_ranges = std::min<size_t>(num_tiles, max_helpers + 1);
+        auto transpose_range = [&](size_t r) {
+            size_t end = (r + 1) * num_tiles / num_ranges * tile_t;
+            for (size_t i0 = r * num_tiles / num_ranges * tile_t; i0 < end; i0 += tile_t) {
+                for (size_t i = i0; i < i0 + tile_t; i++) {
+                    for (size_t t = 0; t < tile_t; t++)
+                        dst[i * write_t + t] = tile[t * num_val + i];
+                }
+            }
+        };
+        if (num_ranges > 1) {
+            kotekan::WorkPool::instance().parallel_for(num_ranges, transpose_range, max_helpers);
+        } else if (num_ranges == 1) {
+            transpose_range(0);
+        }
+
+        for (size_t i = num_tiles * tile_t; i < num_val; i++) {
+            for (size_t t = 0; t < tile_t; t++)
+                dst[i * write_t + t] = tile[t * num_val + i];
+        }
+    }
+
+    /**
+     * @brief Copy a frame into the chunk
+     *
+     * @param in          The values of the frame.
+     * @param out         The chunk.
+     * @param freq_index  Frequency index within the chunk.
+     * @param time_index  Time index within the chunk.
+     * @param write_t     Size of the time dimension of the chunk.
+     **/
+    void copy(const T* in, T* out, uint32_t freq_index, uint32_t time_index, size_t write_t) {
+        std::copy(in, in + num_val, row(freq_index, time_index));
+        commit(out, freq_index, time_index, write_t);
+    }
+
+private:
+    size_t num_val = 0;
+    uint32_t max_helpers = 0;
+
+    // The staged frames, [freq][time % tile_t][value]
+    std::vector<T> tiles;
+};
+
+#endif
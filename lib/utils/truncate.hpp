@@ -1,4 +1,13 @@
-#include <cstdint>
+#include "simdUtil.hpp" // for SIMD_BEGIN_KERNELS, SIMD_END_KERNELS
+
+#include <cmath>   // for abs
+#include <complex> // for complex
+#include <cstddef> // for size_t
+#include <cstdint> // for int32_t, uint32_t
+#include <cstring> // for memcpy
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h> // for __m256, __m512, _mm256_add_epi32, _mm512_add_epi32, ...
+#endif
 
 // 2**31 + 2**30 will be used to check for overflow
 const uint32_t HIGH_BITS = 3221225472;
@@ -64,12 +73,12 @@ inline int32_t count_zeros(int32_t x) {
  * @returns The result of 2^e
  */
 inline float fast_pow(int8_t e) {
-    float* out_f;
+    float out_f;
     // Construct float bitwise
     uint32_t out_i = ((uint32_t)(127 + e) << 23);
-    // Cast into float
-    out_f = (float*)&out_i;
-    return *out_f;
+    // Copy into float
+    std::memcpy(&out_f, &out_i, sizeof(out_f));
+    return out_f;
 }
 
 
@@ -117,3 +126,231 @@ inline float bit_truncate_float(float val, float err) {
 
     return tr_val_ptr[0];
 }
+
+
+#ifdef __AVX2__
+/**
+ *  @brief Truncate eight floats at once, giving bit for bit the same results as
+ *         `bit_truncate_float`.
+ */
+inline __m256 bit_truncate_float_avx2(__m256 val, __m256 err) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi32(1);
+
+    __m256i bits = _mm256_castps_si256(val);
+    // extract the exponent, sign and mantissa with the implicit 24th bit
+    __m256i val_pow = _mm256_and_si256(_mm256_srai_epi32(bits, 23), _mm256_set1_epi32(255));
+    __m256i val_s = _mm256_srai_epi32(bits, 31);
+    __m256i val_man = _mm256_add_epi32(_mm256_and_si256(bits, _mm256_set1_epi32(8388607)),
+                                       _mm256_set1_epi32(8388608));
+
+    // scale the error by 2**(150 - pow), wrapping the exponent to an int8_t like
+    // the call to `fast_pow` does
+    __m256i e = _mm256_sub_epi32(_mm256_set1_epi32(150), val_pow);
+    e = _mm256_srai_epi32(_mm256_slli_epi32(e, 24), 24);
+    __m256 scale =
+        _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(e, _mm256_set1_epi32(127)), 23));
+    __m256i int_err = _mm256_cvttps_epi32(_mm256_mul_ps(err, scale));
+    __m256i overflow =
+        _mm256_cmpeq_epi32(_mm256_and_si256(int_err, _mm256_set1_epi32(HIGH_BITS)), zero);
+    int_err = _mm256_blendv_epi8(_mm256_set1_epi32(1073741823), int_err, overflow);
+
+    // truncate the mantissa, as in `bit_truncate`
+    __m256i gran = int_err;
+    gran = _mm256_or_si256(gran, _mm256_srli_epi32(gran, 1));
+    gran = _mm256_or_si256(gran, _mm256_srli_epi32(gran, 2));
+    gran = _mm256_or_si256(gran, _mm256_srli_epi32(gran, 4));
+    gran = _mm256_or_si256(gran, _mm256_srli_epi32(gran, 8));
+    gran = _mm256_or_si256(gran, _mm256_srli_epi32(gran, 16));
+    gran = _mm256_add_epi32(gran, one);
+    __m256i bitmask = _mm256_sub_epi32(gran, one);
+    __m256i tie =
+        _mm256_cmpeq_epi32(_mm256_slli_epi32(_mm256_and_si256(val_man, bitmask), 1), gran);
+    __m256i tr_man =
+        _mm256_or_si256(_mm256_sub_epi32(val_man, _mm256_srli_epi32(gran, 1)), bitmask);
+    tr_man = _mm256_add_epi32(tr_man, one);
+    tr_man = _mm256_add_epi32(tr_man, _mm256_cmpeq_epi32(int_err, zero));
+    tr_man = _mm256_sub_epi32(tr_man, _mm256_and_si256(tr_man, _mm256_and_si256(tie, gran)));
+
+    // count the leading zeros from the exponent of the mantissa as a float, which is
+    // exact as it never has more than 24 significant bits
+    __m256i man_pow = _mm256_srli_epi32(_mm256_castps_si256(_mm256_cvtepi32_ps(tr_man)), 23);
+    __m256i z_count =
+        _mm256_min_epi32(_mm256_sub_epi32(_mm256_set1_epi32(158), man_pow), _mm256_set1_epi32(32));
+
+    // adjust the power and mantissa for the loss of the implicit bit
+    __m256i shift = _mm256_sub_epi32(z_count, _mm256_set1_epi32(8));
+    val_pow = _mm256_sub_epi32(val_pow, shift);
+    tr_man = _mm256_and_si256(_mm256_sllv_epi32(tr_man, shift), _mm256_set1_epi32(8388607));
+    // round to zero case
+    val_pow = _mm256_andnot_si256(_mm256_cmpeq_epi32(z_count, _mm256_set1_epi32(32)), val_pow);
+    // restore sign and exponent
+    __m256i tr_val = _mm256_or_si256(
+        tr_man, _mm256_slli_epi32(_mm256_or_si256(val_pow, _mm256_slli_epi32(val_s, 8)), 23));
+
+    return _mm256_castsi256_ps(tr_val);
+}
+#endif
+
+
+SIMD_BEGIN_KERNELS
+
+#ifdef __AVX512F__
+/**
+ *  @brief Truncate sixteen floats at once, giving bit for bit the same results as
+ *         `bit_truncate_float`.
+ */
+inline __m512 bit_truncate_float_avx512(__m512 val, __m512 err) {
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i one = _mm512_set1_epi32(1);
+
+    __m512i bits = _mm512_castps_si512(val);
+    // extract the exponent, sign and mantissa with the implicit 24th bit
+    __m512i val_pow = _mm512_and_si512(_mm512_srai_epi32(bits, 23), _mm512_set1_epi32(255));
+    __m512i val_s = _mm512_srai_epi32(bits, 31);
+    __m512i val_man = _mm512_add_epi32(_mm512_and_si512(bits, _mm512_set1_epi32(8388607)),
+                                       _mm512_set1_epi32(8388608));
+
+    // scale the error by 2**(150 - pow), wrapping the exponent to an int8_t like
+    // the call to `fast_pow` does
+    __m512i e = _mm512_sub_epi32(_mm512_set1_epi32(150), val_pow);
+    e = _mm512_srai_epi32(_mm512_slli_epi32(e, 24), 24);
+    __m512 scale =
+        _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_add_epi32(e, _mm512_set1_epi32(127)), 23));
+    __m512i int_err = _mm512_cvttps_epi32(_mm512_mul_ps(err, scale));
+    __mmask16 overflow = _mm512_test_epi32_mask(int_err, _mm512_set1_epi32(HIGH_BITS));
+    int_err = _mm512_mask_mov_epi32(int_err, overflow, _mm512_set1_epi32(1073741823));
+
+    // truncate the mantissa, as in `bit_truncate`
+    __m512i gran = int_err;
+    gran = _mm512_or_si512(gran, _mm512_srli_epi32(gran, 1));
+    gran = _mm512_or_si512(gran, _mm512_srli_epi32(gran, 2));
+    gran = _mm512_or_si512(gran, _mm512_srli_epi32(gran, 4));
+    gran = _mm512_or_si512(gran, _mm512_srli_epi32(gran, 8));
+    gran = _mm512_or_si512(gran, _mm512_srli_epi32(gran, 16));
+    gran = _mm512_add_epi32(gran, one);
+    __m512i bitmask = _mm512_sub_epi32(gran, one);
+    __mmask16 tie =
+        _mm512_cmpeq_epi32_mask(_mm512_slli_epi32(_mm512_and_si512(val_man, bitmask), 1), gran);
+    __m512i tr_man =
+        _mm512_or_si512(_mm512_sub_epi32(val_man, _mm512_srli_epi32(gran, 1)), bitmask);
+    tr_man = _mm512_add_epi32(tr_man, one);
+    tr_man = _mm512_mask_sub_epi32(tr_man, _mm512_cmpeq_epi32_mask(int_err, zero), tr_man, one);
+    tr_man = _mm512_sub_epi32(tr_man, _mm512_and_si512(tr_man, _mm512_maskz_mov_epi32(tie, gran)));
+
+    // count the leading zeros from the exponent of the mantissa as a float, which is
+    // exact as it never has more than 24 significant bits
+    __m512i man_pow = _mm512_srli_epi32(_mm512_castps_si512(_mm512_cvtepi32_ps(tr_man)), 23);
+    __m512i z_count =
+        _mm512_min_epi32(_mm512_sub_epi32(_mm512_set1_epi32(158), man_pow), _mm512_set1_epi32(32));
+
+    // adjust the power and mantissa for the loss of the implicit bit
+    __m512i shift = _mm512_sub_epi32(z_count, _mm512_set1_epi32(8));
+    val_pow = _mm512_sub_epi32(val_pow, shift);
+    tr_man = _mm512_and_si512(_mm512_sllv_epi32(tr_man, shift), _mm512_set1_epi32(8388607));
+    // round to zero case
+    __mmask16 round_zero = _mm512_cmpeq_epi32_mask(z_count, _mm512_set1_epi32(32));
+    val_pow = _mm512_mask_mov_epi32(val_pow, round_zero, zero);
+    // restore sign and exponent
+    __m512i tr_val = _mm512_or_si512(
+        tr_man, _mm512_slli_epi32(_mm512_or_si512(val_pow, _mm512_slli_epi32(val_s, 8)), 23));
+
+    return _mm512_castsi512_ps(tr_val);
+}
+#endif
+
+
+/**
+ *  @brief Truncate the precision of an array of floats in place, each to its own
+ *         error, as `bit_truncate_float` would.
+ *
+ *  Uses AVX-512 or AVX2 when they are available.
+ *
+ *  @param  val  The values to truncate.
+ *  @param  err  The maximum error of each value.
+ *  @param  n    The number of values.
+ */
+inline void bit_truncate_float_array(float* val, const float* err, size_t n) {
+    size_t i = 0;
+#if defined(__AVX512F__)
+    for (; i + 16 <= n; i += 16) {
+        __m512 tr = bit_truncate_float_avx512(_mm512_loadu_ps(val + i), _mm512_loadu_ps(err + i));
+        _mm512_storeu_ps(val + i, tr);
+    }
+#elif defined(__AVX2__)
+    for (; i + 8 <= n; i += 8) {
+        __m256 tr = bit_truncate_float_avx2(_mm256_loadu_ps(val + i), _mm256_loadu_ps(err + i));
+        _mm256_storeu_ps(val + i, tr);
+    }
+#endif
+    for (; i < n; i++)
+        val[i] = bit_truncate_float(val[i], err[i]);
+}
+
+
+/**
+ *  @brief Truncate the precision of an array of complex values in place, with the
+ *         real and imaginary parts of each sharing one error.
+ *
+ *  Uses AVX-512 or AVX2 when they are available.
+ *
+ *  @param  val  The values to truncate.
+ *  @param  err  The maximum error of the real and imaginary parts of each value.
+ *  @param  n    The number of complex values.
+ */
+inline void bit_truncate_cfloat_array(std::complex<float>* val, const float* err, size_t n) {
+    float* fval = reinterpret_cast<float*>(val);
+    size_t i = 0;
+#if defined(__AVX512F__)
+    // Duplicate each error for the pair of floats of a value
+    const __m512i dup = _mm512_set_epi32(7, 7, 6, 6, 5, 5, 4, 4, 3, 3, 2, 2, 1, 1, 0, 0);
+    for (; i + 8 <= n; i += 8) {
+        __m512 e = _mm512_permutexvar_ps(dup, _mm512_castps256_ps512(_mm256_loadu_ps(err + i)));
+        _mm512_storeu_ps(fval + 2 * i, bit_truncate_float_avx512(_mm512_loadu_ps(fval + 2 * i), e));
+    }
+#elif defined(__AVX2__)
+    // Duplicate each error for the pair of floats of a value
+    const __m256i dup = _mm256_set_epi32(3, 3, 2, 2, 1, 1, 0, 0);
+    for (; i + 4 <= n; i += 4) {
+        __m256 e = _mm256_permutevar8x32_ps(_mm256_castps128_ps256(_mm_loadu_ps(err + i)), dup);
+        _mm256_storeu_ps(fval + 2 * i, bit_truncate_float_avx2(_mm256_loadu_ps(fval + 2 * i), e));
+    }
+#endif
+    for (; i < n; i++) {
+        fval[2 * i] = bit_truncate_float(fval[2 * i], err[i]);
+        fval[2 * i + 1] = bit_truncate_float(fval[2 * i + 1], err[i]);
+    }
+}
+
+
+/**
+ *  @brief Truncate an array of floats in place to a fixed fractional precision,
+ *         giving each an error of `prec` times its magnitude.
+ *
+ *  @param  val   The values to truncate.
+ *  @param  prec  The fractional precision.
+ *  @param  n     The number of values.
+ */
+inline void bit_truncate_float_array_fixed(float* val, float prec, size_t n) {
+    size_t i = 0;
+#if defined(__AVX512F__)
+    const __m512 prec_vec = _mm512_set1_ps(prec);
+    for (; i + 16 <= n; i += 16) {
+        __m512 v = _mm512_loadu_ps(val + i);
+        __m512 e = _mm512_abs_ps(_mm512_mul_ps(prec_vec, v));
+        _mm512_storeu_ps(val + i, bit_truncate_float_avx512(v, e));
+    }
+#elif defined(__AVX2__)
+    const __m256 prec_vec = _mm256_set1_ps(prec);
+    const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(2147483647));
+    for (; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_loadu_ps(val + i);
+        __m256 e = _mm256_and_ps(_mm256_mul_ps(prec_vec, v), abs_mask);
+        _mm256_storeu_ps(val + i, bit_truncate_float_avx2(v, e));
+    }
+#endif
+    for (; i < n; i++)
+        val[i] = bit_truncate_float(val[i], std::abs(prec * val[i]));
+}
+
+SIMD_END_KERNELS
@@ -296,6 +296,9 @@ void visFileArchive::create_dataset(const std::string& name, const std::vector<s
 
         DataSet dset = file->createDataSet(name, space, type, plist);
         dset.createAttribute<std::string>("axis", DataSpace::From(axes)).write(axes);
+
+        // Remember the chunking, so the chunks can be compressed by us
+        add_chunk_layout(name, cur_dims, real_chunk, type.getSize());
     } else {
         DataSet dset = file->createDataSet(name, space, type, chunk_dims);
         dset.createAttribute<std::string>("axis", DataSpace::From(axes)).write(axes);
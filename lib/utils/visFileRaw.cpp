@@ -1,6 +1,7 @@
 
 #include "visFileRaw.hpp"
 
+#include "FileWriteQueue.hpp" // for AsyncFileWriter, FileWriteQueue
 #include "Hash.hpp"           // for Hash
 #include "datasetManager.hpp" // for datasetManager, dset_id_t
 #include "datasetState.hpp"   // for stackState, eigenvalueState, freqState, gatingState, input...
@@ -13,15 +14,16 @@
 #include <cxxabi.h>     // for __forced_unwind
 #include <errno.h>      // for errno
 #include <exception>    // for exception
-#include <fcntl.h>      // for fallocate, sync_file_range, open, posix_fadvise, FALLOC_FL...
+#include <fcntl.h>      // for fallocate, open, FALLOC_FL_KEEP_SIZE, O_DIRECT
 #include <fstream>      // for ofstream, basic_ostream::write, ios
 #include <future>       // for async, future
 #include <stdexcept>    // for out_of_range, runtime_error
 #include <string.h>     // for strerror
 #include <sys/stat.h>   // for S_IRGRP, S_IROTH, S_IRUSR, S_IWGRP, S_IWUSR
 #include <system_error> // for system_error
-#include <unistd.h>     // for close, pwrite, TEMP_FAILURE_RETRY
+#include <unistd.h>     // for close
 #include <utility>      // for pair
+#include <vector>       // for vector
 
 
 // Register the raw file writer
@@ -106,8 +108,15 @@ visFileRaw::visFileRaw(const std::string& name, const kotekan::logLevel log_leve
     file_metadata["structure"]["data_size"] = data_size;
     file_metadata["structure"]["frame_size"] = frame_size;
     file_metadata["structure"]["nfreq"] = nfreq;
+    file_metadata["structure"]["index_entry_size"] = sizeof(rawIndexEntry);
 
 
+    // The frames are page aligned, so can always be written directly
+#ifdef O_DIRECT
+    if (FileWriteQueue::instance().get_direct_io())
+        oflags |= O_DIRECT;
+#endif
+
     // Create lock file and then open the other files
     lock_filename = create_lockfile(_name);
     metadata_file = std::ofstream(_name + ".meta", std::ios::binary);
@@ -117,6 +126,21 @@ visFileRaw::visFileRaw(const std::string& name, const kotekan::logLevel log_leve
         throw std::runtime_error(
             fmt::format(fmt("Failed to open file {:s}.data: {:s}."), _name, strerror(errno)));
     }
+    writer = std::make_unique<AsyncFileWriter>(fd, _name + ".data", log_level);
+
+    // The index entries are much smaller than a page, so never use O_DIRECT for them
+#ifdef O_DIRECT
+    int index_oflags = oflags & ~O_DIRECT;
+#else
+    int index_oflags = oflags;
+#endif
+    if ((index_fd = open((_name + ".index").c_str(), index_oflags,
+                         S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH))
+        == -1) {
+        throw std::runtime_error(
+            fmt::format(fmt("Failed to open file {:s}.index: {:s}."), _name, strerror(errno)));
+    }
+    index_writer = std::make_unique<AsyncFileWriter>(index_fd, _name + ".index", log_level);
 
     // Preallocate data file (without increasing the length)
 #ifdef __linux__
@@ -143,7 +167,10 @@ visFileRaw::~visFileRaw() {
     metadata_file.close();
 
     // TODO: final sync of data file.
+    writer.reset();
     close(fd);
+    index_writer.reset();
+    close(index_fd);
 
     std::remove(lock_filename.c_str());
 }
@@ -153,24 +180,13 @@ size_t visFileRaw::num_time() {
 }
 
 void visFileRaw::flush_raw_async(int ind) {
-#ifdef __linux__
     size_t n = nfreq * frame_size;
-    sync_file_range(fd, ind * n, n, SYNC_FILE_RANGE_WRITE);
-#else
-    (void)ind;      // Suppress warning
-#endif
+    writer->flush(ind * n, n, false);
 }
 
 void visFileRaw::flush_raw_sync(int ind) {
-#ifdef __linux__
     size_t n = nfreq * frame_size;
-    sync_file_range(fd, ind * n, n,
-                    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE
-                        | SYNC_FILE_RANGE_WAIT_AFTER);
-    posix_fadvise(fd, ind * n, n, POSIX_FADV_DONTNEED);
-#else
-    (void)ind;      // Suppress warning
-#endif
+    writer->flush(ind * n, n, true);
 }
 
 uint32_t visFileRaw::extend_time(time_ctype new_time) {
@@ -207,17 +223,7 @@ void visFileRaw::deactivate_time(uint32_t time_ind) {
 
 
 bool visFileRaw::write_raw(off_t offset, size_t nb, const void* data) {
-
-    // Write in a retry macro loop incase the write was interrupted by a signal
-    int nbytes = TEMP_FAILURE_RETRY(pwrite(fd, data, nb, offset));
-
-    if (nbytes < 0) {
-        ERROR("Write error attempting to write {:d} bytes at offset {:d} into file {:s}: {:s}", nb,
-              offset, _name, strerror(errno));
-        return false;
-    }
-
-    return true;
+    return writer->write(offset, nb, {{data, nb}});
 }
 
 void visFileRaw::write_sample(uint32_t time_ind, uint32_t freq_ind, const FrameView& frame_view) {
@@ -236,7 +242,12 @@ void visFileRaw::write_sample(uint32_t time_ind, uint32_t freq_ind, const FrameV
     // Write out data to the right place
     off_t offset = (time_ind * nfreq + freq_ind) * frame_size;
 
-    write_raw(offset, 1, &ONE);
-    write_raw(offset + 1, metadata_size, frame.metadata());
-    write_raw(offset + 1 + metadata_size, data_size, frame.data());
+    // Write the whole frame at once, so it can be queued
+    writer->write(offset, frame_size,
+                  {{&ONE, 1}, {frame.metadata(), metadata_size}, {frame.data(), data_size}});
+
+    // Record the frame in the index
+    rawIndexEntry entry = {1, frame.freq_id, frame.dataset_id};
+    index_writer->write((time_ind * nfreq + freq_ind) * sizeof(entry), sizeof(entry),
+                        {{&entry, sizeof(entry)}});
 }
@@ -6,6 +6,7 @@
 #ifndef VIS_FILE_RAW_HPP
 #define VIS_FILE_RAW_HPP
 
+#include "FileWriteQueue.hpp" // for AsyncFileWriter
 #include "FrameView.hpp"      // for FrameView
 #include "dataset.hpp"        // for dset_id_t
 #include "kotekanLogging.hpp" // for logLevel
@@ -18,12 +19,20 @@
 #include <fcntl.h>     // for O_CREAT, O_EXCL, O_WRONLY
 #include <fstream>     // for ofstream
 #include <map>         // for map
+#include <memory>      // for unique_ptr
 #include <stddef.h>    // for size_t
 #include <string>      // for string
 #include <sys/types.h> // for off_t
 #include <vector>      // for vector
 
 
+/// An entry of the `.index` file of a raw file, zero for the frames not written
+struct rawIndexEntry {
+    uint32_t valid;
+    uint32_t freq_id;
+    dset_id_t dataset_id;
+};
+
 /** @brief A CHIME correlator file in raw format.
  *
  * The class creates and manages writes to a CHIME style correlator output
@@ -44,6 +53,12 @@
  *  - VisMetadata struct dump
  *  - VisFrameView dump
  *
+ * The `.index` file has a `rawIndexEntry` for every frame in the `.data` file,
+ * in the same order, giving whether the frame was written, and its frequency
+ * and dataset IDs. Together with the times in the `.meta` file this lets a
+ * reader find the frames of a time range or of some frequencies, and skip the
+ * empty frames, without reading through the `.data` file.
+ *
  * @author Richard Shaw
  **/
 class visFileRaw : public visFile {
@@ -106,9 +121,14 @@ protected:
     /**
      * @brief  Helper routine for writing data into the file
      *
+     * The write is queued with the @c FileWriteQueue, so may not be done when
+     * this returns.
+     *
      * @param offset Offset of the data to write.
      * @param nb     The size of the data in bytes.
      * @param data   The data to write out.
+     *
+     * @returns False if this or an earlier write failed.
      **/
     bool write_raw(off_t offset, size_t nb, const void* data);
 
@@ -134,6 +154,9 @@ protected:
 
     // File descriptors and related
     int fd;
+    std::unique_ptr<AsyncFileWriter> writer;
+    int index_fd;
+    std::unique_ptr<AsyncFileWriter> index_writer;
     std::ofstream metadata_file;
     std::string lock_filename;
 
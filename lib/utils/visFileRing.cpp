@@ -1,16 +1,16 @@
 #include "visFileRing.hpp"
 
-#include "visFile.hpp" // for REGISTER_VIS_FILE, _factory_aliasvisFile
-#include "visUtil.hpp" // for time_ctype
+#include "FileWriteQueue.hpp" // for AsyncFileWriter
+#include "visFile.hpp"        // for REGISTER_VIS_FILE, _factory_aliasvisFile
+#include "visUtil.hpp"        // for time_ctype
 
 #include "json.hpp" // for basic_json<>::value_type, json
 
-#include <errno.h>     // for errno
 #include <fcntl.h>     // for O_CREAT, O_WRONLY
+#include <memory>      // for unique_ptr
 #include <ostream>     // for ofstream, basic_ostream::flush, basic_ostream::seekp, basi...
-#include <string.h>    // for size_t, strerror
+#include <stddef.h>    // for size_t
 #include <sys/types.h> // for uint
-#include <unistd.h>    // for pwrite, TEMP_FAILURE_RETRY
 #include <vector>      // for vector
 
 // Register the HDF5 file writers
@@ -37,18 +37,17 @@ uint32_t visFileRing::extend_time(time_ctype new_time) {
 
         // Insert new time at current position in file
         times[cur_pos] = new_time;
-        // Erase data in this row
+        // Erase data in this row, and wait so the new frames are written after it
         size_t nb = nfreq * frame_size;
-        std::vector<char> zeros(frame_size, 0);
-        for (size_t i = 0; i < nfreq; i++) {
-            int res = TEMP_FAILURE_RETRY(
-                pwrite(fd, zeros.data(), frame_size, cur_pos * nb + i * frame_size));
-
-            if (res < 0) {
-                ERROR("Write error attempting to write frame at time {:d}, freq {:d}: {:s}.",
-                      cur_pos, i, strerror(errno));
-            }
+        if (!writer->write(cur_pos * nb, nb, {})) {
+            ERROR("Write error attempting to erase time {:d}.", cur_pos);
         }
+        size_t nbi = nfreq * sizeof(rawIndexEntry);
+        if (!index_writer->write(cur_pos * nbi, nbi, {})) {
+            ERROR("Write error attempting to erase the index of time {:d}.", cur_pos);
+        }
+        writer->wait();
+        index_writer->wait();
 
         // TODO: Are these appropriate in this context?
         // Start to flush out older dataset regions
@@ -1,9 +1,13 @@
 #include "visUtil.hpp"
 
-#include "Config.hpp" // for Config
+#include "Config.hpp"   // for Config
+#include "simdUtil.hpp" // for CONJ_INDEX_FLAG, SIMD_BEGIN_KERNELS, SIMD_END_KERNELS, conj_sign, ...
 
 #include <cstring>   // for memset
 #include <exception> // for exception
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h> // for _mm256_i32gather_ps, _mm512_i32gather_ps, _mm256_cvtepi32_ps, ...
+#endif
 #include <iterator>  // for back_insert_iterator, back_inserter
 #include <limits>
 #include <regex>     // for sregex_token_iterator, match_results<>::_Base_type, _NFA, regex
@@ -101,16 +105,21 @@ std::string json_type_name(nlohmann::json& value) {
 
 // Copy the visibility triangle out of the buffer of data, allowing for a
 // possible reordering of the inputs
-// TODO: port this to using map_vis_triangle. Need a unit test first.
 void copy_vis_triangle(const int32_t* inputdata, const std::vector<uint32_t>& inputmap,
                        size_t block, size_t N, gsl::span<cfloat> output) {
-
-    auto copyfunc = [&](int32_t pi, int32_t bi, bool conj) {
-        int i_sign = conj ? -1 : 1;
-        output[pi] = {(float)inputdata[2 * bi + 1], i_sign * (float)inputdata[2 * bi]};
-    };
-
-    map_vis_triangle(inputmap, block, N, 0, copyfunc);
+    // Keep the map of the last call on this thread, so that calling this for
+    // every frame only builds it again when the inputs change
+    thread_local std::vector<uint32_t> last_inputmap;
+    thread_local size_t last_block = 0, last_N = 0;
+    thread_local VisTriangleMap vis_map;
+
+    if (inputmap != last_inputmap || block != last_block || N != last_N) {
+        vis_map = VisTriangleMap(inputmap, block, N);
+        last_inputmap = inputmap;
+        last_block = block;
+        last_N = N;
+    }
+    vis_map.copy_vis(inputdata, output);
 }
 
 // Apply a function over the visibility triangle
@@ -148,6 +157,112 @@ void map_vis_triangle(const std::vector<uint32_t>& inputmap, size_t block, size_
 }
 
 
+VisTriangleMap::VisTriangleMap(const std::vector<uint32_t>& inputmap, size_t block, size_t N) :
+    gpu_freq_size(gpu_N2_size(N, block)) {
+
+    if (gpu_freq_size > ~CONJ_INDEX_FLAG) {
+        throw std::invalid_argument("Too many products in the GPU buffer to map.");
+    }
+
+    index.reserve(inputmap.size() * (inputmap.size() + 1) / 2);
+    map_vis_triangle(inputmap, block, N, 0, [&](int32_t pi, int32_t bi, bool conj) {
+        (void)pi;
+        index.push_back(bi | (conj ? CONJ_INDEX_FLAG : 0));
+    });
+}
+
+SIMD_BEGIN_KERNELS
+
+void VisTriangleMap::copy_vis(const int32_t* inputdata, gsl::span<cfloat> output, uint32_t freq,
+                              float scale) const {
+
+    if (output.size() < index.size()) {
+        throw std::invalid_argument("Output is smaller than the visibility triangle.");
+    }
+
+    const int32_t* in = inputdata + 2 * freq * gpu_freq_size;
+    size_t n = index.size();
+    size_t pi = 0;
+
+#if defined(__AVX512F__)
+    const __m512 vscale = _mm512_set1_ps(scale);
+
+    // Eight products at a time, as with AVX2 below
+    for (; pi + 8 <= n; pi += 8) {
+        __m256i idx = _mm256_loadu_si256((const __m256i*)&index[pi]);
+        __m512i packed = gather_pairs(in, idx);
+
+        __m512 vis = _mm512_cvtepi32_ps(_mm512_shuffle_epi32(packed, (_MM_PERM_ENUM)0xB1));
+
+        // There is no floating point xor in AVX-512F, so flip the sign bits as integers
+        vis = _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(vis), conj_sign(idx)));
+
+        _mm512_storeu_ps((float*)&output[pi], _mm512_mul_ps(vis, vscale));
+    }
+#elif defined(__AVX2__)
+    const __m256 vscale = _mm256_set1_ps(scale);
+
+    // Four products at a time, each one a 64 bit (imaginary, real) pair
+    for (; pi + 4 <= n; pi += 4) {
+        __m128i idx = _mm_loadu_si128((const __m128i*)&index[pi]);
+        __m256i packed = gather_pairs(in, idx);
+
+        // Swap into (real, imaginary) order and convert
+        __m256 vis = _mm256_cvtepi32_ps(_mm256_shuffle_epi32(packed, 0xB1));
+
+        // Move the conjugate flag onto the sign bit of the imaginary part
+        vis = _mm256_xor_ps(vis, _mm256_castsi256_ps(conj_sign(idx)));
+
+        _mm256_storeu_ps((float*)&output[pi], _mm256_mul_ps(vis, vscale));
+    }
+#endif
+
+    for (; pi < n; pi++) {
+        uint32_t bi = index[pi] & ~CONJ_INDEX_FLAG;
+        float i_sign = (index[pi] & CONJ_INDEX_FLAG) ? -1 : 1;
+        output[pi] = scale * cfloat{(float)in[2 * bi + 1], i_sign * (float)in[2 * bi]};
+    }
+}
+
+void VisTriangleMap::copy_inverse(const float* inputdata, gsl::span<float> output, uint32_t freq,
+                                  float numerator) const {
+
+    if (output.size() < index.size()) {
+        throw std::invalid_argument("Output is smaller than the visibility triangle.");
+    }
+
+    const float* in = inputdata + freq * gpu_freq_size;
+    size_t n = index.size();
+    size_t pi = 0;
+
+#if defined(__AVX512F__)
+    const __m512i index_mask = _mm512_set1_epi32(~CONJ_INDEX_FLAG);
+    const __m512 vnum = _mm512_set1_ps(numerator);
+
+    for (; pi + 16 <= n; pi += 16) {
+        __m512i idx = _mm512_loadu_si512(&index[pi]);
+        __m512 t = _mm512_i32gather_ps(_mm512_and_si512(idx, index_mask), in, 4);
+        _mm512_storeu_ps(&output[pi], _mm512_div_ps(vnum, t));
+    }
+#elif defined(__AVX2__)
+    const __m256i index_mask = _mm256_set1_epi32(~CONJ_INDEX_FLAG);
+    const __m256 vnum = _mm256_set1_ps(numerator);
+
+    for (; pi + 8 <= n; pi += 8) {
+        __m256i idx = _mm256_loadu_si256((const __m256i*)&index[pi]);
+        __m256 t = _mm256_i32gather_ps(in, _mm256_and_si256(idx, index_mask), 4);
+        _mm256_storeu_ps(&output[pi], _mm256_div_ps(vnum, t));
+    }
+#endif
+
+    for (; pi < n; pi++) {
+        output[pi] = numerator / in[index[pi] & ~CONJ_INDEX_FLAG];
+    }
+}
+
+SIMD_END_KERNELS
+
+
 std::tuple<uint32_t, uint32_t, std::string> parse_reorder_single(json j) {
     if (!j.is_array() || j.size() != 3) {
         throw std::runtime_error("Could not parse json item for input reordering: " + j.dump());
@@ -380,6 +380,11 @@ inline constexpr uint32_t gpu_N2_size(uint32_t N, uint32_t block) {
 
 /**
  * @brief Copy the visibility triangle into a contiguous array.
+ *
+ * The `VisTriangleMap` of the last call on each thread is kept, and only built
+ * again when the inputs, block or N change. Stages which copy a triangle for
+ * every frame should still keep their own `VisTriangleMap`.
+ *
  * @param inputdata Input data to copy out.
  * @param inputmap  Vector of feed indices to extract.
  * @param block     Block size.
@@ -416,6 +421,67 @@ void map_vis_triangle(const std::vector<uint32_t>& inputmap, size_t block, size_
                       std::function<void(int32_t, int32_t, bool)> f);
 
 
+/**
+ * @class VisTriangleMap
+ * @brief A precomputed map from the GPU packed data to the visibility triangle.
+ *
+ * Does the same mapping as `map_vis_triangle`, but the index of every product
+ * in the GPU buffer is worked out once when the map is created, so stages which
+ * remap every frame only do a gather. The flag for the products that need
+ * conjugating is kept in the top bit of the index.
+ *
+ * If the CPU supports AVX2 the copies use vector gathers.
+ **/
+class VisTriangleMap {
+public:
+    /// Create an empty map
+    VisTriangleMap() = default;
+
+    /**
+     * @brief Precompute the map.
+     * @param inputmap  Vector of feed indices to extract.
+     * @param block     Block size.
+     * @param N         Number of inputs in input data.
+     **/
+    VisTriangleMap(const std::vector<uint32_t>& inputmap, size_t block, size_t N);
+
+    /// The number of products in the visibility triangle
+    size_t num_prod() const {
+        return index.size();
+    }
+
+    /**
+     * @brief Copy the visibilities into the triangle.
+     * @param inputdata GPU packed visibilities (pairs of imaginary and real parts).
+     * @param output    The triangle to write into.
+     * @param freq      Frequency index within a multi-frequency GPU buffer.
+     * @param scale     Factor to multiply the visibilities by.
+     **/
+    void copy_vis(const int32_t* inputdata, gsl::span<cfloat> output, uint32_t freq = 0,
+                  float scale = 1.0) const;
+
+    /**
+     * @brief Copy the inverse of per product values (e.g. variances) into the triangle.
+     *
+     * Writes `numerator / inputdata[i]` for each product.
+     *
+     * @param inputdata GPU packed values, one per product.
+     * @param output    The triangle to write into.
+     * @param freq      Frequency index within a multi-frequency GPU buffer.
+     * @param numerator The numerator of the inverse.
+     **/
+    void copy_inverse(const float* inputdata, gsl::span<float> output, uint32_t freq = 0,
+                      float numerator = 1.0) const;
+
+private:
+    // Index of each product in the GPU buffer, with the conjugate flag in the top bit
+    std::vector<uint32_t> index;
+
+    // Number of products per frequency in the GPU buffer
+    size_t gpu_freq_size = 0;
+};
+
+
 /**
  * @brief Parse the reordering configuration section
  * @param config    Configuration handle.
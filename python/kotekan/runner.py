@@ -516,13 +516,15 @@ class DumpVisBuffer(OutputBuffer):
     ----------
     output_dir : string
         Temporary directory to output to. The dumped files are not removed.
+    in_buf : string
+        Optionally specify the name of an input buffer instead of creating one.
     """
 
     _buf_ind = 0
 
     name = None
 
-    def __init__(self, output_dir):
+    def __init__(self, output_dir, in_buf=None):
 
         self.name = "dumpvis_buf%i" % self._buf_ind
         stage_name = "dump%i" % self._buf_ind
@@ -530,17 +532,22 @@ class DumpVisBuffer(OutputBuffer):
 
         self.output_dir = output_dir
 
-        self.buffer_block = {
-            self.name: {
-                "kotekan_buffer": "vis",
-                "metadata_pool": "vis_pool",
-                "num_frames": "buffer_depth",
+        if in_buf is None:
+            self.buffer_block = {
+                self.name: {
+                    "kotekan_buffer": "vis",
+                    "metadata_pool": "vis_pool",
+                    "num_frames": "buffer_depth",
+                }
             }
-        }
+            buf_name = self.name
+        else:
+            buf_name = in_buf
+            self.buffer_block = {}
 
         stage_config = {
             "kotekan_stage": "rawFileWrite",
-            "in_buf": self.name,
+            "in_buf": buf_name,
             "file_name": self.name,
             "file_ext": "dump",
             "base_dir": output_dir,
@@ -815,10 +822,21 @@ class ReadRawBeamformBuffer(InputBuffer):
 
 
 class ReadRawBuffer(InputBuffer):
+    """Read a raw visibility file with `VisRawReader`.
+
+    Parameters
+    ----------
+    infile : string
+        Path to the raw file, without the .data or .meta extension.
+    chunk_size : list
+        The (freq, prod, time) chunk size to read in.
+    extra_config : dict
+        Any extra config for the stage (e.g. the times and frequencies to read).
+    """
 
     _buf_ind = 0
 
-    def __init__(self, infile, chunk_size):
+    def __init__(self, infile, chunk_size, extra_config=None):
 
         self.name = "read_raw_buf{:d}".format(self._buf_ind)
         stage_name = "read_raw{:d}".format(self._buf_ind)
@@ -839,6 +857,8 @@ class ReadRawBuffer(InputBuffer):
             "chunk_size": chunk_size,
             "readahead_blocks": 4,
         }
+        if extra_config is not None:
+            stage_config.update(extra_config)
 
         self.stage_block = {stage_name: stage_config}
 
@@ -0,0 +1,74 @@
+#define BOOST_TEST_MODULE "test_accumulate"
+
+#include "accumulateFrame.hpp" // for accumulate_frame, accumulate_frame_scalar
+#include "test_simd_utils.hpp" // for check_simd_output, check_simd_sizes, SIMD_TEST_EVEN_SIZES
+
+#include <boost/test/included/unit_test.hpp> // for BOOST_PP_IIF_1, BOOST_PP_IIF_0, BOOST_PP_BO...
+#include <cstddef>                           // for size_t
+#include <cstdint>                           // for int32_t
+#include <random>                            // for mt19937, uniform_int_distribution, uniform...
+#include <vector>                            // for vector
+
+
+// Accumulate an even and an odd frame of `num_prod` products, starting at product `start`,
+// with the SIMD and the scalar kernels and check they agree
+static void check_accumulate(size_t num_prod, size_t start, std::mt19937& gen) {
+    std::uniform_int_distribution<int32_t> vis_dist(-(1 << 20), 1 << 20);
+    std::uniform_real_distribution<float> vis2_dist(0, 1e3);
+
+    std::vector<int32_t> frames[2];
+    for (auto& frame : frames) {
+        frame.resize(2 * num_prod);
+        for (auto& v : frame)
+            v = vis_dist(gen);
+    }
+
+    // Start the sums off with non-integer squared differences and two datasets
+    std::vector<int32_t> acc_simd[2], acc_scalar[2];
+    for (int d = 0; d < 2; d++) {
+        acc_simd[d].resize(2 * num_prod);
+        for (auto& v : acc_simd[d])
+            v = vis_dist(gen);
+        acc_scalar[d] = acc_simd[d];
+    }
+    std::vector<float> vis2_simd(num_prod);
+    for (auto& v : vis2_simd)
+        v = vis2_dist(gen);
+    std::vector<float> vis2_scalar = vis2_simd;
+
+    std::vector<int32_t> even_simd(2 * num_prod), even_scalar(2 * num_prod);
+    std::vector<int32_t*> vis1_simd = {acc_simd[0].data(), acc_simd[1].data()};
+    std::vector<int32_t*> vis1_scalar = {acc_scalar[0].data(), acc_scalar[1].data()};
+
+    for (int f = 0; f < 2; f++) {
+        bool even = (f == 0);
+        accumulate_frame(frames[f].data(), vis1_simd, even_simd.data(), vis2_simd.data(), even,
+                         start, num_prod);
+        accumulate_frame_scalar(frames[f].data(), vis1_scalar, even_scalar.data(),
+                                vis2_scalar.data(), even, start, num_prod);
+    }
+
+    for (int d = 0; d < 2; d++)
+        check_simd_output(acc_simd[d], acc_scalar[d]);
+    check_simd_output(even_simd, even_scalar);
+    check_simd_output(vis2_simd, vis2_scalar, 1e-6);
+}
+
+
+BOOST_AUTO_TEST_CASE(_accumulate_frame_odd) {
+    check_simd_sizes(SIMD_TEST_ODD_SIZES,
+                     [](size_t n, std::mt19937& gen) { check_accumulate(n, 0, gen); });
+}
+
+
+BOOST_AUTO_TEST_CASE(_accumulate_frame_even) {
+    check_simd_sizes(SIMD_TEST_EVEN_SIZES,
+                     [](size_t n, std::mt19937& gen) { check_accumulate(n, 0, gen); });
+}
+
+
+BOOST_AUTO_TEST_CASE(_accumulate_frame_offset) {
+    // Tiles of a frame start part way through the products
+    check_simd_sizes({9, 33, 1025},
+                     [](size_t n, std::mt19937& gen) { check_accumulate(n, 5, gen); });
+}
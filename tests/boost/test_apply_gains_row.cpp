@@ -0,0 +1,74 @@
+#define BOOST_TEST_MODULE "test_apply_gains_row"
+
+#include "applyGainsRow.hpp"   // for apply_gains_row, apply_gains_row_scalar
+#include "test_simd_utils.hpp" // for check_simd_output, check_simd_sizes, SIMD_TEST_EVEN_SIZES
+#include "visUtil.hpp"         // for cfloat
+
+#include <boost/test/included/unit_test.hpp> // for BOOST_PP_IIF_1, BOOST_PP_IIF_0, BOOST_PP_BO...
+#include <cmath>                             // for abs, isnan
+#include <complex>                           // for complex, conj
+#include <cstddef>                           // for size_t
+#include <limits>                            // for numeric_limits
+#include <random>                            // for mt19937, uniform_real_distribution
+#include <vector>                            // for vector
+
+
+// Apply non-integer gains to a row of `n` products with the SIMD and the scalar kernels, once
+// out of place and once in place, and check they agree
+static void check_apply_gains(size_t n, std::mt19937& gen) {
+    std::uniform_real_distribution<float> dist(-10, 10);
+    auto rand_cfloat = [&]() { return cfloat(dist(gen), dist(gen)); };
+
+    std::vector<cfloat> gain_conj(n), in_vis(n);
+    std::vector<float> weight_factor(n), in_weight(n);
+    for (size_t k = 0; k < n; k++) {
+        gain_conj[k] = std::conj(rand_cfloat());
+        in_vis[k] = rand_cfloat();
+        weight_factor[k] = std::abs(dist(gen));
+        in_weight[k] = std::abs(dist(gen));
+    }
+
+    // Zero some of the weight factors, one of them with an infinite weight, as for an input
+    // which was turned off
+    for (size_t k = 1; k < n; k += 3)
+        weight_factor[k] = 0;
+    if (n > 1)
+        in_weight[1] = std::numeric_limits<float>::infinity();
+
+    const cfloat gi = rand_cfloat();
+    const float wi = std::abs(dist(gen));
+
+    std::vector<cfloat> vis_simd(n), vis_scalar(n);
+    std::vector<float> weight_simd(n), weight_scalar(n);
+    apply_gains_row(gi, wi, gain_conj.data(), weight_factor.data(), n, in_vis.data(),
+                    vis_simd.data(), in_weight.data(), weight_simd.data());
+    apply_gains_row_scalar(gi, wi, gain_conj.data(), weight_factor.data(), n, in_vis.data(),
+                           vis_scalar.data(), in_weight.data(), weight_scalar.data());
+
+    // In place, as the stage does when it doesn't copy the frame
+    std::vector<cfloat> vis_inplace = in_vis;
+    std::vector<float> weight_inplace = in_weight;
+    apply_gains_row(gi, wi, gain_conj.data(), weight_factor.data(), n, vis_inplace.data(),
+                    vis_inplace.data(), weight_inplace.data(), weight_inplace.data());
+
+    check_simd_output(vis_simd, vis_scalar, 1e-5);
+    check_simd_output(weight_simd, weight_scalar, 1e-6);
+    check_simd_output(vis_inplace, vis_simd);
+    check_simd_output(weight_inplace, weight_simd);
+
+    for (size_t k = 0; k < n; k++) {
+        BOOST_CHECK(!std::isnan(weight_simd[k]));
+        if (weight_factor[k] == 0)
+            BOOST_CHECK_EQUAL(weight_simd[k], 0);
+    }
+}
+
+
+BOOST_AUTO_TEST_CASE(_apply_gains_row_odd) {
+    check_simd_sizes(SIMD_TEST_ODD_SIZES, check_apply_gains);
+}
+
+
+BOOST_AUTO_TEST_CASE(_apply_gains_row_even) {
+    check_simd_sizes(SIMD_TEST_EVEN_SIZES, check_apply_gains);
+}
@@ -0,0 +1,465 @@
+#define BOOST_TEST_MODULE "test_buffer"
+
+#include "BufferHandle.hpp"  // for BufferConsumer, BufferProducer, BatchedBufferConsumer
+#include "Config.hpp"        // for Config
+#include "buffer.h"          // for Buffer, create_buffer, delete_buffer, mark_frame_empty, mar...
+#include "bufferFactory.hpp" // for bufferFactory
+#include "metadata.h"        // for create_metadata_pool, delete_metadata_pool, request_metadata...
+
+#include "json.hpp" // for json
+
+#include <boost/test/included/unit_test.hpp> // for BOOST_PP_IIF_1, BOOST_CHECK, BOOST_PP_BOOL_2
+#include <chrono>                            // for milliseconds
+#include <map>                               // for map
+#include <stdexcept>                         // for runtime_error
+#include <stdint.h>                          // for uint32_t, uint8_t, uintptr_t
+#include <stdlib.h>                          // for free
+#include <string>                            // for string, to_string
+#include <thread>                            // for thread, sleep_for
+#include <time.h>                            // for clock_gettime, timespec, CLOCK_REALTIME
+#include <vector>                            // for vector
+
+namespace {
+
+const int num_frames = 4;
+const int num_test_frames = 2000;
+const size_t frame_size = 1024;
+
+struct BufferFixture {
+    BufferFixture() {
+        pool = create_metadata_pool(2 * num_frames, 64, "test_pool", "none", false);
+    }
+    ~BufferFixture() {
+        delete_metadata_pool(pool);
+        free(pool);
+    }
+
+    struct Buffer* make_buffer(bool lock_free) {
+        return create_buffer(num_frames, frame_size, pool, "test_buf", "standard", 0, 0, false,
+                             false, true, lock_free);
+    }
+
+    void destroy_buffer(struct Buffer* buf) {
+        delete_buffer(buf);
+        free(buf);
+    }
+
+    // Push `num_test_frames` frames through the buffer with one producer and
+    // `num_consumers` consumers, each consumer checks it sees every frame in order.
+    void run_pipeline(struct Buffer* buf, int num_consumers) {
+        register_producer(buf, "producer");
+        std::vector<std::string> names;
+        for (int c = 0; c < num_consumers; ++c) {
+            names.push_back("consumer" + std::to_string(c));
+            register_consumer(buf, names.back().c_str());
+        }
+
+        std::vector<std::thread> consumers;
+        for (int c = 0; c < num_consumers; ++c) {
+            consumers.emplace_back([&, c]() {
+                for (int i = 0; i < num_test_frames; ++i) {
+                    int frame_id = i % num_frames;
+                    uint8_t* frame = wait_for_full_frame(buf, names[c].c_str(), frame_id);
+                    BOOST_REQUIRE(frame != nullptr);
+                    BOOST_CHECK_EQUAL(*(uint32_t*)frame, (uint32_t)i);
+                    mark_frame_empty(buf, names[c].c_str(), frame_id);
+                }
+            });
+        }
+
+        for (int i = 0; i < num_test_frames; ++i) {
+            int frame_id = i % num_frames;
+            uint8_t* frame = wait_for_empty_frame(buf, "producer", frame_id);
+            BOOST_REQUIRE(frame != nullptr);
+            *(uint32_t*)frame = i;
+            allocate_new_metadata_object(buf, frame_id);
+            mark_frame_full(buf, "producer", frame_id);
+        }
+
+        for (auto& t : consumers)
+            t.join();
+
+        BOOST_CHECK_EQUAL(get_num_full_frames(buf), 0);
+    }
+
+    struct metadataPool* pool;
+};
+
+} // namespace
+
+BOOST_FIXTURE_TEST_CASE(_locking_pipeline, BufferFixture) {
+    struct Buffer* buf = make_buffer(false);
+    run_pipeline(buf, 3);
+    destroy_buffer(buf);
+}
+
+BOOST_FIXTURE_TEST_CASE(_lock_free_pipeline, BufferFixture) {
+    struct Buffer* buf = make_buffer(true);
+    BOOST_CHECK(buf->lock_free);
+    run_pipeline(buf, 5);
+    destroy_buffer(buf);
+}
+
+BOOST_FIXTURE_TEST_CASE(_lock_free_no_consumers, BufferFixture) {
+    struct Buffer* buf = make_buffer(true);
+    register_producer(buf, "producer");
+    // With no consumers registered frames are dropped, so this never blocks
+    for (int i = 0; i < 3 * num_frames; ++i) {
+        BOOST_CHECK(wait_for_empty_frame(buf, "producer", i % num_frames) != nullptr);
+        mark_frame_full(buf, "producer", i % num_frames);
+    }
+    BOOST_CHECK_EQUAL(get_num_full_frames(buf), 0);
+    destroy_buffer(buf);
+}
+
+BOOST_FIXTURE_TEST_CASE(_lock_free_unregister, BufferFixture) {
+    struct Buffer* buf = make_buffer(true);
+    register_producer(buf, "producer");
+    register_consumer(buf, "fast");
+    register_consumer(buf, "stalled");
+
+    wait_for_empty_frame(buf, "producer", 0);
+    mark_frame_full(buf, "producer", 0);
+    wait_for_full_frame(buf, "fast", 0);
+    mark_frame_empty(buf, "fast", 0);
+    BOOST_CHECK_EQUAL(is_frame_empty(buf, 0), 0);
+
+    // Removing the stalled consumer releases the frame
+    unregister_consumer(buf, "stalled");
+    BOOST_CHECK_EQUAL(is_frame_empty(buf, 0), 1);
+    destroy_buffer(buf);
+}
+
+BOOST_FIXTURE_TEST_CASE(_lock_free_shutdown, BufferFixture) {
+    struct Buffer* buf = make_buffer(true);
+    register_producer(buf, "producer");
+    register_consumer(buf, "consumer");
+
+    std::thread waiter([&]() { BOOST_CHECK(wait_for_full_frame(buf, "consumer", 0) == nullptr); });
+    send_shutdown_signal(buf);
+    waiter.join();
+
+    BOOST_CHECK(wait_for_empty_frame(buf, "producer", 1) == nullptr);
+    destroy_buffer(buf);
+}
+
+BOOST_FIXTURE_TEST_CASE(_register_returns_slot, BufferFixture) {
+    struct Buffer* buf = make_buffer(false);
+    BOOST_CHECK_EQUAL(register_consumer(buf, "consumer0"), 0);
+    BOOST_CHECK_EQUAL(register_consumer(buf, "consumer1"), 1);
+    BOOST_CHECK_EQUAL(register_producer(buf, "producer"), 0);
+    unregister_consumer(buf, "consumer0");
+    BOOST_CHECK_EQUAL(register_consumer(buf, "consumer2"), 0);
+    destroy_buffer(buf);
+}
+
+BOOST_FIXTURE_TEST_CASE(_handles, BufferFixture) {
+    for (bool lock_free : {false, true}) {
+        struct Buffer* buf = make_buffer(lock_free);
+        kotekan::BufferProducer producer(buf, "producer");
+        std::vector<kotekan::BufferConsumer> consumers;
+        for (int c = 0; c < 2; ++c)
+            consumers.emplace_back(buf, "consumer" + std::to_string(c));
+        BOOST_CHECK_EQUAL(consumers[1].get_slot(), 1);
+
+        std::thread consumer_thread([&]() {
+            for (int i = 0; i < num_test_frames; ++i) {
+                for (auto& consumer : consumers) {
+                    uint8_t* frame = consumer.wait_for_full_frame(i % num_frames);
+                    BOOST_REQUIRE(frame != nullptr);
+                    BOOST_CHECK_EQUAL(*(uint32_t*)frame, (uint32_t)i);
+                    consumer.mark_frame_empty(i % num_frames);
+                }
+            }
+        });
+
+        for (int i = 0; i < num_test_frames; ++i) {
+            uint8_t* frame = producer.wait_for_empty_frame(i % num_frames);
+            BOOST_REQUIRE(frame != nullptr);
+            *(uint32_t*)frame = i;
+            producer.mark_frame_full(i % num_frames);
+        }
+        consumer_thread.join();
+
+        BOOST_CHECK_EQUAL(get_num_full_frames(buf), 0);
+        destroy_buffer(buf);
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(_batched, BufferFixture) {
+    for (bool lock_free : {false, true}) {
+        struct Buffer* buf = make_buffer(lock_free);
+        register_producer(buf, "producer");
+        register_consumer(buf, "consumer");
+
+        // Nothing is full yet so fill three frames and check we get them all in one go
+        for (int i = 0; i < 3; ++i) {
+            *(uint32_t*)wait_for_empty_frame(buf, "producer", i) = i;
+            mark_frame_full(buf, "producer", i);
+        }
+        BOOST_CHECK_EQUAL(wait_for_full_frames(buf, "consumer", 0, num_frames), 3);
+        BOOST_CHECK_EQUAL(wait_for_full_frames(buf, "consumer", 1, 1), 1);
+        mark_frames_empty(buf, "consumer", 0, 3);
+        BOOST_CHECK_EQUAL(get_num_full_frames(buf), 0);
+
+        // Wrap around the end of the buffer
+        for (int i = 3; i < 6; ++i) {
+            *(uint32_t*)wait_for_empty_frame(buf, "producer", i % num_frames) = i;
+            mark_frame_full(buf, "producer", i % num_frames);
+        }
+        BOOST_CHECK_EQUAL(wait_for_full_frames(buf, "consumer", 3, num_frames), 3);
+        mark_frames_empty(buf, "consumer", 3, 3);
+        BOOST_CHECK_EQUAL(get_num_full_frames(buf), 0);
+
+        send_shutdown_signal(buf);
+        BOOST_CHECK_EQUAL(wait_for_full_frames(buf, "consumer", 2, 2), 0);
+        destroy_buffer(buf);
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(_batched_consumer, BufferFixture) {
+    for (bool lock_free : {false, true}) {
+        struct Buffer* buf = make_buffer(lock_free);
+        kotekan::BufferProducer producer(buf, "producer");
+        kotekan::BatchedBufferConsumer consumer(kotekan::BufferConsumer(buf, "consumer"), 2);
+
+        std::thread consumer_thread([&]() {
+            for (int i = 0; i < num_test_frames; ++i) {
+                uint8_t* frame = consumer.wait_for_full_frame();
+                BOOST_REQUIRE(frame != nullptr);
+                BOOST_CHECK_EQUAL(consumer.get_frame_id(), i % num_frames);
+                BOOST_CHECK_EQUAL(*(uint32_t*)frame, (uint32_t)i);
+                consumer.mark_frame_empty();
+            }
+        });
+
+        for (int i = 0; i < num_test_frames; ++i) {
+            uint8_t* frame = producer.wait_for_empty_frame(i % num_frames);
+            BOOST_REQUIRE(frame != nullptr);
+            *(uint32_t*)frame = i;
+            producer.mark_frame_full(i % num_frames);
+        }
+        consumer_thread.join();
+
+        BOOST_CHECK_EQUAL(get_num_full_frames(buf), 0);
+        destroy_buffer(buf);
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(_share_frame, BufferFixture) {
+    for (bool lock_free : {false, true}) {
+        struct Buffer* src = make_buffer(lock_free);
+        struct Buffer* dest = make_buffer(false);
+        register_producer(src, "producer");
+        int copy_id = register_consumer(src, "copy");
+        register_consumer(src, "other");
+        register_producer(dest, "copy");
+        register_consumer(dest, "down");
+        uint8_t* dest_frame = dest->frames[0];
+
+        *(uint32_t*)wait_for_empty_frame(src, "producer", 0) = 1234;
+        mark_frame_full(src, "producer", 0);
+
+        BOOST_REQUIRE(wait_for_full_frame(src, "copy", 0) != nullptr);
+        BOOST_REQUIRE(wait_for_empty_frame(dest, "copy", 0) != nullptr);
+        share_frame(src, copy_id, 0, dest, 0);
+        mark_frame_full(dest, "copy", 0);
+        mark_frame_empty(src, "copy", 0);
+        BOOST_CHECK(dest->frames[0] == src->frames[0]);
+        BOOST_CHECK_EQUAL(is_frame_shared(src, 0), 1);
+        BOOST_CHECK_EQUAL(is_frame_shared(dest, 0), 1);
+
+        // All the src consumers are done, but the frame is still lent out
+        wait_for_full_frame(src, "other", 0);
+        mark_frame_empty(src, "other", 0);
+        BOOST_CHECK_EQUAL(is_frame_empty(src, 0), 0);
+
+        uint8_t* frame = wait_for_full_frame(dest, "down", 0);
+        BOOST_REQUIRE(frame != nullptr);
+        BOOST_CHECK_EQUAL(*(uint32_t*)frame, 1234u);
+        mark_frame_empty(dest, "down", 0);
+
+        // Releasing the last share hands the frame back
+        BOOST_CHECK_EQUAL(is_frame_empty(src, 0), 1);
+        BOOST_CHECK_EQUAL(is_frame_shared(src, 0), 0);
+        BOOST_CHECK_EQUAL(is_frame_shared(dest, 0), 0);
+        BOOST_CHECK(dest->frames[0] == dest_frame);
+
+        destroy_buffer(dest);
+        destroy_buffer(src);
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(_frame_numa_node, BufferFixture) {
+    struct Buffer* buf = make_buffer(false);
+    for (int i = 0; i < num_frames; ++i)
+        BOOST_CHECK_EQUAL(get_frame_numa_node(buf, i), 0);
+
+    // Only the layout is checked, the frames were allocated without interleaving
+    buf->numa_interleave_mask = 0b1010;
+    BOOST_CHECK_EQUAL(get_frame_numa_node(buf, 0), 1);
+    BOOST_CHECK_EQUAL(get_frame_numa_node(buf, 1), 3);
+    BOOST_CHECK_EQUAL(get_frame_numa_node(buf, 2), 1);
+    BOOST_CHECK_EQUAL(get_frame_numa_node(buf, 3), 3);
+    buf->numa_interleave_mask = 0;
+
+    register_producer(buf, "producer");
+    for (int i = 0; i < num_frames; ++i) {
+        wait_for_empty_frame(buf, "producer", i);
+        mark_frame_full(buf, "producer", i);
+    }
+    BOOST_CHECK_EQUAL(get_num_frames_filled(buf), (uint64_t)num_frames);
+
+    destroy_buffer(buf);
+}
+
+BOOST_FIXTURE_TEST_CASE(_stage_timing, BufferFixture) {
+    for (bool lock_free : {false, true}) {
+        struct Buffer* buf = make_buffer(lock_free);
+        int producer_id = register_producer(buf, "producer");
+        int consumer_id = register_consumer(buf, "consumer");
+
+        wait_for_empty_frame(buf, "producer", 0);
+        mark_frame_full(buf, "producer", 0);
+        wait_for_full_frame(buf, "consumer", 0);
+        mark_frame_empty(buf, "consumer", 0);
+
+        const StageInfo& producer = buf->producers[producer_id];
+        const StageInfo& consumer = buf->consumers[consumer_id];
+        BOOST_CHECK_EQUAL(producer.num_waits, 1u);
+        BOOST_CHECK_EQUAL(producer.num_released, 1u);
+        BOOST_CHECK_EQUAL(consumer.num_waits, 1u);
+        BOOST_CHECK_EQUAL(consumer.num_released, 1u);
+        BOOST_CHECK(consumer.residency_time_ns > 0);
+
+        uint64_t total = 0;
+        for (int i = 0; i < BUFFER_LATENCY_BINS; ++i)
+            total += consumer.residency_hist[i];
+        BOOST_CHECK_EQUAL(total, 1u);
+
+        destroy_buffer(buf);
+    }
+    BOOST_CHECK_CLOSE(get_latency_bin_upper_bound(10), 1024e-6, 1e-9);
+}
+
+BOOST_FIXTURE_TEST_CASE(_metadata_pool, BufferFixture) {
+    // Every container is cache line aligned, and requested at most once at a time
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&]() {
+            for (int i = 0; i < num_test_frames; ++i) {
+                struct metadataContainer* a = request_metadata_object(pool);
+                struct metadataContainer* b = request_metadata_object(pool);
+                BOOST_REQUIRE(a != b);
+                BOOST_CHECK_EQUAL((uintptr_t)a->metadata % METADATA_CACHE_LINE, 0u);
+                BOOST_CHECK_EQUAL(*(uint32_t*)a->metadata, 0u);
+                *(uint32_t*)a->metadata = 1;
+
+                increment_metadata_ref_count(a);
+                decrement_metadata_ref_count(a);
+                BOOST_CHECK_EQUAL(a->ref_count, 1u);
+
+                decrement_metadata_ref_count(a);
+                decrement_metadata_ref_count(b);
+            }
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+
+    // All of them are back in the pool
+    std::vector<struct metadataContainer*> containers;
+    for (unsigned int i = 0; i < pool->pool_size; ++i)
+        containers.push_back(request_metadata_object(pool));
+    for (auto* container : containers) {
+        BOOST_CHECK_EQUAL(container->ref_count, 1u);
+        decrement_metadata_ref_count(container);
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(_wait_for_any, BufferFixture) {
+    for (bool lock_free : {false, true}) {
+        struct Buffer* bufs[2] = {make_buffer(lock_free), make_buffer(lock_free)};
+        int consumer_ids[2];
+        int frame_ids[2] = {0, 0};
+        struct bufferWaitSet set;
+        init_buffer_wait_set(&set);
+        for (int i = 0; i < 2; ++i) {
+            register_producer(bufs[i], "producer");
+            consumer_ids[i] = register_consumer(bufs[i], "consumer");
+            attach_buffer_wait_set(bufs[i], consumer_ids[i], &set);
+        }
+
+        // Nothing arrives
+        int ready = -1;
+        struct timespec timeout;
+        clock_gettime(CLOCK_REALTIME, &timeout);
+        timeout.tv_nsec += 1000000;
+        if (timeout.tv_nsec >= 1000000000) {
+            timeout.tv_sec += 1;
+            timeout.tv_nsec -= 1000000000;
+        }
+        BOOST_CHECK_EQUAL(
+            wait_for_any_full_frame(&set, bufs, consumer_ids, frame_ids, 2, &timeout, &ready), 1);
+
+        // A frame arrives on the second buffer while we sleep
+        std::thread producer([&]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            wait_for_empty_frame(bufs[1], "producer", 0);
+            mark_frame_full(bufs[1], "producer", 0);
+        });
+        BOOST_CHECK_EQUAL(
+            wait_for_any_full_frame(&set, bufs, consumer_ids, frame_ids, 2, NULL, &ready), 0);
+        BOOST_CHECK_EQUAL(ready, 1);
+        producer.join();
+        mark_frame_empty(bufs[1], "consumer", 0);
+        frame_ids[1] = 1;
+
+        // When both have frames they take turns, starting after the last one returned
+        for (int i = 0; i < 2; ++i) {
+            wait_for_empty_frame(bufs[i], "producer", frame_ids[i]);
+            mark_frame_full(bufs[i], "producer", frame_ids[i]);
+        }
+        BOOST_CHECK_EQUAL(
+            wait_for_any_full_frame(&set, bufs, consumer_ids, frame_ids, 2, NULL, &ready), 0);
+        BOOST_CHECK_EQUAL(ready, 0);
+
+        // Shutting down either buffer wakes us
+        std::thread stopper([&]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            send_shutdown_signal(bufs[0]);
+        });
+        frame_ids[0] = 1;
+        frame_ids[1] = 2;
+        BOOST_CHECK_EQUAL(
+            wait_for_any_full_frame(&set, bufs, consumer_ids, frame_ids, 2, NULL, &ready), -1);
+        stopper.join();
+
+        for (int i = 0; i < 2; ++i) {
+            attach_buffer_wait_set(bufs[i], consumer_ids[i], NULL);
+            destroy_buffer(bufs[i]);
+        }
+        destroy_buffer_wait_set(&set);
+    }
+}
+
+/*
+ * A NUMA node which doesn't exist, or doesn't fit in the interleave mask, is a config error.
+ */
+BOOST_AUTO_TEST_CASE(_bad_numa_node) {
+    std::map<std::string, struct metadataPool*> pools;
+    for (int numa_node : {-1, 64}) {
+        kotekan::Config config;
+        config.update_config({{"buf",
+                               {{"kotekan_buffer", "standard"},
+                                {"num_frames", 2},
+                                {"frame_size", 64},
+                                {"numa_node", numa_node}}}});
+
+        kotekan::bufferFactory factory(config, pools);
+        auto is_numa_error = [](const std::runtime_error& e) {
+            return std::string(e.what()).find("NUMA node") != std::string::npos;
+        };
+        BOOST_CHECK_EXCEPTION(factory.build_buffers(), std::runtime_error, is_numa_error);
+    }
+}
@@ -1,16 +1,19 @@
 #define BOOST_TEST_MODULE "test_chime_stacking"
 
-#include "Stack.hpp"        // for stack_chime_in_cyl, chimeFeed, CYL_A, CYL_D
+#include "Stack.hpp"        // for stack_chime_in_cyl, chimeFeed, CYL_A, CYL_D, StackPlan
 #include "datasetState.hpp" // for invert_stack
 #include "visUtil.hpp"      // for input_ctype, prod_ctype, rstack_ctype, stac...
 
 #include <algorithm>                         // for copy, max, transform
 #include <boost/test/included/unit_test.hpp> // for BOOST_PP_IIF_1, BOOST_PP_IIF_0, BOOST_PP_BO...
+#include <cmath>                             // for abs
+#include <complex>                           // for conj, norm
 #include <cstdint>                           // for uint32_t, uint16_t
+#include <cstdlib>                           // for rand, srand
 #include <memory>                            // for allocator_traits<>::value_type
 #include <numeric>                           // for iota
 #include <ostream>                           // for operator<<, ostream, basic_ostream, basic_o...
-#include <stdexcept>                         // for invalid_argument
+#include <stdexcept>                         // for invalid_argument, out_of_range
 #include <string>                            // for string
 #include <utility>                           // for pair
 #include <vector>                            // for vector, vector<>::iterator
@@ -134,3 +137,126 @@ BOOST_AUTO_TEST_CASE(chimeStacking) {
     BOOST_CHECK_EQUAL_COLLECTIONS(stack_ind1.begin(), stack_ind1.end(), stack_ind2.begin(),
                                   stack_ind2.end());
 }
+
+
+// Every third input of a full CHIME correlation, and all their products
+static std::pair<std::vector<input_ctype>, std::vector<prod_ctype>> chime_subset() {
+    std::vector<input_ctype> inputs;
+    for (uint16_t i = 0; i < 2048; i += 3) {
+        inputs.emplace_back(i, "");
+    }
+    std::vector<prod_ctype> prods;
+    for (uint16_t i = 0; i < inputs.size(); i++) {
+        for (uint16_t j = i; j < inputs.size(); j++) {
+            prods.push_back({i, j});
+        }
+    }
+    return {inputs, prods};
+}
+
+
+BOOST_AUTO_TEST_CASE(stackPlan) {
+    // Stack a full CHIME correlation, with some products flagged by zero weight
+    // and some inputs flagged, and compare to scattering each product into its stack
+    auto [inputs, prods] = chime_subset();
+    auto [num_stack, stack_map] = stack_chime_in_cyl(inputs, prods);
+
+    srand(42);
+    std::vector<cfloat> vis(prods.size());
+    std::vector<float> weight(prods.size());
+    for (size_t i = 0; i < prods.size(); i++) {
+        vis[i] = {(float)(rand() % 2001 - 1000), (float)(rand() % 2001 - 1000)};
+        weight[i] = (rand() % 10 == 0) ? 0.0 : 1.0 + rand() % 4;
+    }
+    std::vector<float> flags(inputs.size(), 1.0);
+    flags[3] = 0.0;
+    flags[100] = 0.0;
+
+    std::vector<cfloat> exp_vis(num_stack, 0.0);
+    std::vector<double> exp_v2(num_stack, 0.0), exp_var(num_stack, 0.0);
+    std::vector<float> exp_norm(num_stack, 0.0);
+    for (size_t i = 0; i < prods.size(); i++) {
+        if (weight[i] == 0 || flags[prods[i].input_a] == 0 || flags[prods[i].input_b] == 0)
+            continue;
+        auto& s = stack_map[i];
+        cfloat v = s.conjugate ? std::conj(vis[i]) : vis[i];
+        exp_vis[s.stack] += v;
+        exp_v2[s.stack] += std::norm(v);
+        exp_var[s.stack] += 1.0 / weight[i];
+        exp_norm[s.stack] += 1.0;
+    }
+
+    StackPlan plan(num_stack, stack_map, prods);
+    BOOST_CHECK_EQUAL(plan.num_stack(), num_stack);
+
+    // Do it in two uneven pieces to check the ranges
+    std::vector<cfloat> out_vis(num_stack);
+    std::vector<float> out_v2(num_stack), out_var(num_stack), out_norm(num_stack);
+    uint32_t split = num_stack / 3;
+    plan.stack(vis.data(), weight.data(), flags.data(), 0, split, out_vis.data(), out_v2.data(),
+               out_var.data(), out_norm.data());
+    plan.stack(vis.data(), weight.data(), flags.data(), split, num_stack, out_vis.data(),
+               out_v2.data(), out_var.data(), out_norm.data());
+
+    for (uint32_t i = 0; i < num_stack; i++) {
+        // The sums of integers are exact
+        BOOST_CHECK_EQUAL(out_norm[i], exp_norm[i]);
+        BOOST_CHECK_EQUAL(out_vis[i], exp_vis[i]);
+        BOOST_CHECK_CLOSE(out_v2[i], exp_v2[i], 1e-4);
+        BOOST_CHECK_CLOSE(out_var[i], exp_var[i], 1e-4);
+    }
+
+    BOOST_CHECK_THROW(StackPlan(num_stack - 1, stack_map, prods), std::out_of_range);
+}
+
+
+BOOST_AUTO_TEST_CASE(stackPlanNonInteger) {
+    // Compare to the scatter baselineCompression used before StackPlan, in single
+    // precision, with non-integer data. The SIMD path sums the products of a stack in
+    // a different order, so they agree to rounding, which is bounded by the sum of the
+    // magnitudes of the products in each stack.
+    auto [inputs, prods] = chime_subset();
+    auto [num_stack, stack_map] = stack_chime_in_cyl(inputs, prods);
+
+    srand(7);
+    std::vector<cfloat> vis(prods.size());
+    std::vector<float> weight(prods.size());
+    for (size_t i = 0; i < prods.size(); i++) {
+        vis[i] = {1000.0f * rand() / RAND_MAX - 500.0f, 1000.0f * rand() / RAND_MAX - 500.0f};
+        weight[i] = (rand() % 10 == 0) ? 0.0 : 0.1 + 10.0f * rand() / RAND_MAX;
+    }
+    std::vector<float> flags(inputs.size(), 1.0);
+    flags[5] = 0.0;
+
+    std::vector<cfloat> exp_vis(num_stack, 0.0);
+    std::vector<float> exp_v2(num_stack, 0.0), exp_var(num_stack, 0.0), exp_norm(num_stack, 0.0);
+    std::vector<float> abs_sum(num_stack, 0.0);
+    for (uint32_t prod_ind = 0; prod_ind < prods.size(); prod_ind++) {
+        cfloat v = vis[prod_ind];
+        float w = weight[prod_ind];
+        auto& p = prods[prod_ind];
+        auto& s = stack_map[prod_ind];
+        if (w == 0 || flags[p.input_a] == 0 || flags[p.input_b] == 0)
+            continue;
+        v = s.conjugate ? std::conj(v) : v;
+        exp_vis[s.stack] += v;
+        exp_v2[s.stack] += fast_norm(v);
+        exp_var[s.stack] += (1.0 / w);
+        exp_norm[s.stack] += 1.0;
+        abs_sum[s.stack] += std::abs(v.real()) + std::abs(v.imag());
+    }
+
+    StackPlan plan(num_stack, stack_map, prods);
+    std::vector<cfloat> out_vis(num_stack);
+    std::vector<float> out_v2(num_stack), out_var(num_stack), out_norm(num_stack);
+    plan.stack(vis.data(), weight.data(), flags.data(), 0, num_stack, out_vis.data(),
+               out_v2.data(), out_var.data(), out_norm.data());
+
+    const float tol = 1e-5;
+    for (uint32_t i = 0; i < num_stack; i++) {
+        BOOST_CHECK_EQUAL(out_norm[i], exp_norm[i]);
+        BOOST_CHECK_SMALL(std::abs(out_vis[i] - exp_vis[i]), tol * abs_sum[i] + 1e-30f);
+        BOOST_CHECK_CLOSE(out_v2[i], exp_v2[i], tol * 100);
+        BOOST_CHECK_CLOSE(out_var[i], exp_var[i], tol * 100);
+    }
+}
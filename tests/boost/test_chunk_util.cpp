@@ -0,0 +1,77 @@
+#define BOOST_TEST_MODULE "test_chunk_util"
+
+#include "chunkUtil.hpp" // for extract_chunk, num_block_chunks
+
+#include <boost/test/included/unit_test.hpp> // for BOOST_PP_IIF_1, BOOST_PP_IIF_0, BOOST_PP_BO...
+#include <cstddef>                           // for size_t
+#include <cstdint>                           // for uint8_t, uint32_t
+#include <cstring>                           // for memcpy
+#include <vector>                            // for vector
+
+
+// Cut a block into chunks, pass them through an identity "compressor" and put them back
+// together at their offsets, checking the padding of the partial chunks is zero
+static void check_tiling(const std::vector<size_t>& count, const std::vector<size_t>& chunk) {
+    const size_t ndim = count.size();
+    const size_t elem_size = sizeof(uint32_t);
+
+    size_t num_elems = 1, chunk_elems = 1, num_chunks = 1;
+    for (size_t d = 0; d < ndim; d++) {
+        num_elems *= count[d];
+        chunk_elems *= chunk[d];
+        num_chunks *= (count[d] + chunk[d] - 1) / chunk[d];
+    }
+    BOOST_CHECK_EQUAL(num_block_chunks(count, chunk), num_chunks);
+
+    std::vector<uint32_t> block(num_elems);
+    for (size_t i = 0; i < num_elems; i++)
+        block[i] = i + 1;
+
+    std::vector<uint32_t> rebuilt(num_elems, 0);
+    std::vector<uint8_t> out;
+    for (size_t c = 0; c < num_chunks; c++) {
+        std::vector<size_t> start =
+            extract_chunk((const uint8_t*)block.data(), count, chunk, elem_size, c, out);
+        BOOST_REQUIRE_EQUAL(out.size(), chunk_elems * elem_size);
+        BOOST_REQUIRE_EQUAL(start.size(), ndim);
+
+        std::vector<uint32_t> values(chunk_elems);
+        std::memcpy(values.data(), out.data(), out.size());
+
+        // Scatter each element of the chunk back into the block, or check it's padding
+        for (size_t i = 0; i < chunk_elems; i++) {
+            size_t rem = i, block_ind = 0, stride = 1;
+            bool inside = true;
+            for (size_t d = ndim; d-- > 0;) {
+                size_t pos = start[d] + rem % chunk[d];
+                rem /= chunk[d];
+                inside = inside && pos < count[d];
+                block_ind += pos * stride;
+                stride *= count[d];
+            }
+            if (inside) {
+                BOOST_CHECK_EQUAL(rebuilt[block_ind], 0);
+                rebuilt[block_ind] = values[i];
+            } else {
+                BOOST_CHECK_EQUAL(values[i], 0);
+            }
+        }
+    }
+
+    BOOST_CHECK_EQUAL_COLLECTIONS(rebuilt.begin(), rebuilt.end(), block.begin(), block.end());
+}
+
+
+BOOST_AUTO_TEST_CASE(_whole_chunks) {
+    check_tiling({4, 6, 8}, {2, 3, 4});
+    check_tiling({16}, {4});
+}
+
+
+BOOST_AUTO_TEST_CASE(_partial_chunks) {
+    // Partial chunks along every axis, and chunks larger than the block
+    check_tiling({5, 7, 9}, {2, 3, 4});
+    check_tiling({3, 10}, {4, 4});
+    check_tiling({1, 5, 3}, {2, 2, 8});
+    check_tiling({13}, {4});
+}
@@ -0,0 +1,101 @@
+#define BOOST_TEST_MODULE "test_file_write_queue"
+
+#include "FileWriteQueue.hpp" // for AsyncFileWriter, FileWriteQueue, FileWriteQueue::Backend
+
+#include <boost/test/included/unit_test.hpp> // for BOOST_PP_IIF_1, BOOST_CHECK, BOOST_PP_BOOL_2
+#include <fcntl.h>                           // for open, O_CREAT, O_RDWR
+#include <stdint.h>                          // for uint8_t, uint32_t
+#include <stdlib.h>                          // for mkstemp
+#include <string>                            // for string
+#include <sys/types.h>                       // for ssize_t
+#include <unistd.h>                          // for close, pread, unlink
+#include <vector>                            // for vector
+
+using Backend = FileWriteQueue::Backend;
+
+// Write frames of 3 parts and padding into a temporary file, and check what
+// ends up in it
+static void check_frames(Backend backend) {
+    FileWriteQueue& queue = FileWriteQueue::instance();
+    queue.start(backend, 3, 4, false);
+
+    char name[] = "/tmp/test_file_write_queueXXXXXX";
+    int fd = mkstemp(name);
+    BOOST_REQUIRE(fd != -1);
+
+    const size_t frame_size = 8192;
+    const uint32_t num_frames = 64;
+    const uint8_t ONE = 1;
+    std::vector<uint8_t> a(100), b(5000);
+    {
+        AsyncFileWriter writer(fd, name);
+        for (uint32_t i = 0; i < num_frames; i++) {
+            for (size_t j = 0; j < a.size(); j++)
+                a[j] = i + j;
+            for (size_t j = 0; j < b.size(); j++)
+                b[j] = 3 * i + j;
+            // The frames are copied, so the data can change straight away
+            BOOST_CHECK(writer.write(i * frame_size, frame_size,
+                                     {{&ONE, 1}, {a.data(), a.size()}, {b.data(), b.size()}}));
+            if (i % 8 == 7)
+                writer.flush((i - 7) * frame_size, 8 * frame_size, i % 16 == 15);
+        }
+        writer.wait();
+        BOOST_CHECK(!writer.failed());
+    }
+    queue.stop();
+    BOOST_CHECK(queue.get_backend() == Backend::sync);
+
+    std::vector<uint8_t> frame(frame_size);
+    for (uint32_t i = 0; i < num_frames; i++) {
+        BOOST_REQUIRE_EQUAL(pread(fd, frame.data(), frame_size, i * frame_size),
+                            (ssize_t)frame_size);
+        size_t bad = (frame[0] != 1);
+        for (size_t j = 0; j < a.size(); j++)
+            bad += (frame[1 + j] != (uint8_t)(i + j));
+        for (size_t j = 0; j < b.size(); j++)
+            bad += (frame[1 + a.size() + j] != (uint8_t)(3 * i + j));
+        for (size_t j = 1 + a.size() + b.size(); j < frame_size; j++)
+            bad += (frame[j] != 0);
+        BOOST_CHECK_EQUAL(bad, 0u);
+    }
+
+    close(fd);
+    unlink(name);
+}
+
+BOOST_AUTO_TEST_CASE(sync_backend) {
+    check_frames(Backend::sync);
+}
+
+BOOST_AUTO_TEST_CASE(threads_backend) {
+    check_frames(Backend::threads);
+}
+
+/*
+ * Without liburing the io_uring backend falls back to the threads.
+ */
+BOOST_AUTO_TEST_CASE(io_uring_backend) {
+    check_frames(Backend::io_uring);
+}
+
+/*
+ * A write to a file that can't be written fails, and so do the ones after it.
+ */
+BOOST_AUTO_TEST_CASE(write_error) {
+    FileWriteQueue& queue = FileWriteQueue::instance();
+    queue.start(Backend::threads, 2, 4, false);
+
+    int fd = open("/dev/null", O_RDONLY);
+    BOOST_REQUIRE(fd != -1);
+    {
+        AsyncFileWriter writer(fd, "/dev/null", kotekan::logLevel::OFF);
+        const uint8_t ONE = 1;
+        writer.write(0, 1, {{&ONE, 1}});
+        writer.wait();
+        BOOST_CHECK(writer.failed());
+        BOOST_CHECK(!writer.write(1, 1, {{&ONE, 1}}));
+    }
+    queue.stop();
+    close(fd);
+}
@@ -0,0 +1,50 @@
+#ifndef TEST_SIMD_UTILS_HPP
+#define TEST_SIMD_UTILS_HPP
+
+#include <boost/test/included/unit_test.hpp> // for BOOST_CHECK_EQUAL_COLLECTIONS, BOOST_TEST_C...
+#include <cmath>                             // for abs
+#include <complex>                           // for complex, abs
+#include <cstddef>                           // for size_t
+#include <random>                            // for mt19937
+#include <vector>                            // for vector
+
+// The lengths to compare SIMD kernels with their scalar versions at. The odd ones leave a
+// scalar tail after the vectors of every width, the even ones are made of whole vectors.
+const std::vector<size_t> SIMD_TEST_ODD_SIZES = {1, 3, 5, 7, 9, 13, 17, 31, 255, 1023};
+const std::vector<size_t> SIMD_TEST_EVEN_SIZES = {2, 4, 8, 16, 256, 1024};
+
+// Run `check(n, gen)` for each length `n`, with a random generator seeded with the length so
+// that a failure can be repeated
+template<typename F>
+void check_simd_sizes(const std::vector<size_t>& sizes, F check) {
+    for (size_t n : sizes) {
+        BOOST_TEST_CONTEXT("n = " << n) {
+            std::mt19937 gen(n);
+            check(n, gen);
+        }
+    }
+}
+
+// Check the output of a SIMD kernel is the same as the output of the scalar one
+template<typename T>
+void check_simd_output(const std::vector<T>& simd, const std::vector<T>& scalar) {
+    BOOST_CHECK_EQUAL_COLLECTIONS(simd.begin(), simd.end(), scalar.begin(), scalar.end());
+}
+
+// Check the output of a SIMD kernel is within `tol` of the scalar one, relative to the scalar
+// output, as the kernels can round differently
+inline void check_simd_output(const std::vector<float>& simd, const std::vector<float>& scalar,
+                              float tol) {
+    BOOST_REQUIRE_EQUAL(simd.size(), scalar.size());
+    for (size_t i = 0; i < simd.size(); i++)
+        BOOST_CHECK_SMALL(std::abs(simd[i] - scalar[i]), tol * std::abs(scalar[i]));
+}
+
+inline void check_simd_output(const std::vector<std::complex<float>>& simd,
+                              const std::vector<std::complex<float>>& scalar, float tol) {
+    BOOST_REQUIRE_EQUAL(simd.size(), scalar.size());
+    for (size_t i = 0; i < simd.size(); i++)
+        BOOST_CHECK_SMALL(std::abs(simd[i] - scalar[i]), tol * std::abs(scalar[i]));
+}
+
+#endif
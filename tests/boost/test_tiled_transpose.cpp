@@ -0,0 +1,87 @@
+#define BOOST_TEST_MODULE "test_tiled_transpose"
+
+#include "WorkPool.hpp"      // for WorkPool
+#include "transposeUtil.hpp" // for tiledTranspose, strided_copy
+#include "visUtil.hpp"       // for cfloat
+
+#include <algorithm>                         // for copy
+#include <boost/test/included/unit_test.hpp> // for BOOST_PP_IIF_1, BOOST_PP_IIF_0, BOOST_PP_BO...
+#include <complex>                           // for complex
+#include <cstddef>                           // for size_t
+#include <cstdint>                           // for uint32_t, uint8_t
+#include <vector>                            // for vector
+
+using kotekan::WorkPool;
+
+
+// A value which is different for every frequency, time and value
+template<typename T>
+static T test_value(size_t f, size_t t, size_t i) {
+    return T(f * 1000000 + t * 1000 + i);
+}
+
+template<>
+cfloat test_value<cfloat>(size_t f, size_t t, size_t i) {
+    return cfloat(f * 1000 + t, -(float)i);
+}
+
+// Fill a chunk of `num_freq` frequencies and `write_t` times with tiledTranspose and with
+// strided_copy, and check they match. The frequencies of each time come in reverse order,
+// and every other one goes through row() and commit() instead of copy().
+template<typename T>
+static void check_transpose(size_t num_freq, size_t num_val, size_t write_t,
+                            uint32_t max_helpers) {
+    tiledTranspose<T> tiles;
+    tiles.resize(num_freq, num_val, max_helpers);
+
+    std::vector<T> out_tiled(num_freq * num_val * write_t);
+    std::vector<T> out_strided(num_freq * num_val * write_t);
+    std::vector<T> frame(num_val);
+
+    for (uint32_t t = 0; t < write_t; t++) {
+        for (uint32_t f = num_freq; f-- > 0;) {
+            for (size_t i = 0; i < num_val; i++)
+                frame[i] = test_value<T>(f, t, i);
+
+            if (f % 2) {
+                tiles.copy(frame.data(), out_tiled.data(), f, t, write_t);
+            } else {
+                std::copy(frame.begin(), frame.end(), tiles.row(f, t));
+                tiles.commit(out_tiled.data(), f, t, write_t);
+            }
+            strided_copy(frame.data(), out_strided.data(), f * num_val * write_t + t, write_t,
+                         num_val);
+        }
+    }
+
+    BOOST_CHECK(out_tiled == out_strided);
+}
+
+template<typename T>
+static void check_sizes(uint32_t max_helpers) {
+    const size_t tile_t = tiledTranspose<T>::tile_t;
+
+    // Odd numbers of values, fewer than a tile and not a multiple of it
+    for (size_t num_val : {1, 7, 13, 37, 131}) {
+        // Whole tiles, a partial tile at the end, and a chunk smaller than a tile
+        for (size_t write_t : {2 * tile_t, 2 * tile_t + 3, tile_t + 1, tile_t - 3})
+            check_transpose<T>(3, num_val, write_t, max_helpers);
+    }
+    check_transpose<T>(1, 4 * tile_t, 3 * tile_t - 1, max_helpers);
+}
+
+
+BOOST_AUTO_TEST_CASE(_tiled_transpose) {
+    check_sizes<float>(0);
+    check_sizes<cfloat>(0);
+    check_sizes<uint8_t>(0);
+}
+
+
+BOOST_AUTO_TEST_CASE(_tiled_transpose_pool) {
+    // The tiles of the bigger rows are split across the workers
+    WorkPool::instance().start(3, {});
+    check_sizes<float>(2);
+    check_sizes<cfloat>(2);
+    WorkPool::instance().stop();
+}
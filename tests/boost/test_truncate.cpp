@@ -1,10 +1,15 @@
 #define BOOST_TEST_MODULE "test_truncate"
 
-#include "truncate.hpp" // for fast_pow, bit_truncate_float, count_zeros
+#include "truncate.hpp" // for bit_truncate_float, bit_truncate_float_array, fast_pow, count...
 
 #include <boost/test/included/unit_test.hpp> // for BOOST_PP_IIF_1, BOOST_PP_IIF_0, BOOST_PP_BO...
+#include <cmath>                             // for abs, ldexp
+#include <complex>                           // for complex
+#include <cstring>                           // for memcmp
 #include <limits>                            // for numeric_limits
+#include <random>                            // for mt19937, uniform_int_distribution, uniform...
 #include <stdint.h>                          // for INT8_MAX, INT32_MAX, INT32_MIN, INT8_MIN
+#include <vector>                            // for vector
 
 
 BOOST_AUTO_TEST_CASE(_fast_pow) {
@@ -56,3 +61,109 @@ BOOST_AUTO_TEST_CASE(_bit_truncate_float) {
     BOOST_CHECK_EQUAL(bit_truncate_float(std::numeric_limits<float>::min(), 0.01),
                       std::numeric_limits<float>::min());
 }
+
+// Values and errors covering the sign, zero, denormal, huge, inf and NaN cases, the
+// overflow of the error and the exponent wrap in `fast_pow`
+static void make_test_values(std::vector<float>& val, std::vector<float>& err) {
+    std::mt19937 gen(1234);
+    std::uniform_real_distribution<float> mantissa(-2.0, 2.0);
+    std::uniform_int_distribution<int> exponent(-140, 127);
+    std::uniform_real_distribution<float> frac_err(0.0, 0.5);
+
+    const float special[] = {0.0,
+                             -0.0,
+                             1.0,
+                             -1.0,
+                             std::numeric_limits<float>::min(),
+                             std::numeric_limits<float>::denorm_min(),
+                             std::numeric_limits<float>::max(),
+                             -std::numeric_limits<float>::max(),
+                             std::numeric_limits<float>::infinity(),
+                             -std::numeric_limits<float>::infinity(),
+                             std::numeric_limits<float>::quiet_NaN()};
+    for (float v : special) {
+        for (float e : special) {
+            val.push_back(v);
+            err.push_back(e);
+        }
+    }
+
+    for (int i = 0; i < 100000; i++) {
+        float v = std::ldexp(mantissa(gen), exponent(gen));
+        val.push_back(v);
+        // Mostly errors relative to the value, with some zero and absolute ones
+        if (i % 10 == 0)
+            err.push_back(0.0);
+        else if (i % 10 == 1)
+            err.push_back(std::ldexp(frac_err(gen), exponent(gen)));
+        else
+            err.push_back(std::abs(v) * frac_err(gen));
+    }
+}
+
+static bool same_bits(float a, float b) {
+    return std::memcmp(&a, &b, sizeof(float)) == 0;
+}
+
+BOOST_AUTO_TEST_CASE(_bit_truncate_float_array) {
+    std::vector<float> val, err;
+    make_test_values(val, err);
+
+    std::vector<float> tr = val;
+    bit_truncate_float_array(tr.data(), err.data(), tr.size());
+
+    size_t num_diff = 0;
+    for (size_t i = 0; i < val.size(); i++)
+        num_diff += !same_bits(tr[i], bit_truncate_float(val[i], err[i]));
+    BOOST_CHECK_EQUAL(num_diff, 0);
+
+#ifdef __AVX2__
+    // The AVX2 version, which the array functions don't use when AVX-512 is available
+    num_diff = 0;
+    for (size_t i = 0; i + 8 <= val.size(); i += 8) {
+        float tr8[8];
+        _mm256_storeu_ps(tr8, bit_truncate_float_avx2(_mm256_loadu_ps(&val[i]),
+                                                      _mm256_loadu_ps(&err[i])));
+        for (size_t j = 0; j < 8; j++)
+            num_diff += !same_bits(tr8[j], bit_truncate_float(val[i + j], err[i + j]));
+    }
+    BOOST_CHECK_EQUAL(num_diff, 0);
+#endif
+}
+
+BOOST_AUTO_TEST_CASE(_bit_truncate_cfloat_array) {
+    std::vector<float> val, err;
+    make_test_values(val, err);
+
+    // Pair up the values, using the error of the real part for both, and leave an
+    // odd number to go through the scalar tail
+    size_t n = val.size() / 2 - 1;
+    std::vector<std::complex<float>> tr(n);
+    std::vector<float> cerr(n);
+    for (size_t i = 0; i < n; i++) {
+        tr[i] = {val[2 * i], val[2 * i + 1]};
+        cerr[i] = err[2 * i];
+    }
+    bit_truncate_cfloat_array(tr.data(), cerr.data(), n);
+
+    size_t num_diff = 0;
+    for (size_t i = 0; i < n; i++) {
+        num_diff += !same_bits(tr[i].real(), bit_truncate_float(val[2 * i], cerr[i]));
+        num_diff += !same_bits(tr[i].imag(), bit_truncate_float(val[2 * i + 1], cerr[i]));
+    }
+    BOOST_CHECK_EQUAL(num_diff, 0);
+}
+
+BOOST_AUTO_TEST_CASE(_bit_truncate_float_array_fixed) {
+    std::vector<float> val, err;
+    make_test_values(val, err);
+
+    const float prec = 0.001;
+    std::vector<float> tr = val;
+    bit_truncate_float_array_fixed(tr.data(), prec, tr.size());
+
+    size_t num_diff = 0;
+    for (size_t i = 0; i < val.size(); i++)
+        num_diff += !same_bits(tr[i], bit_truncate_float(val[i], std::abs(prec * val[i])));
+    BOOST_CHECK_EQUAL(num_diff, 0);
+}
@@ -0,0 +1,93 @@
+#define BOOST_TEST_MODULE "test_vis_triangle"
+
+#include "visUtil.hpp" // for VisTriangleMap, map_vis_triangle, gpu_N2_size, cfloat
+
+#include <boost/test/included/unit_test.hpp> // for BOOST_PP_IIF_1, BOOST_CHECK_EQUAL, BOOST_PP_...
+#include <complex>                           // for conj
+#include <stdexcept>                         // for invalid_argument
+#include <stdint.h>                          // for int32_t, uint32_t
+#include <stdlib.h>                          // for rand, srand
+#include <vector>                            // for vector
+
+// An odd number of inputs in a scrambled order, so some products are conjugated and
+// the vector kernels have a remainder to deal with.
+const std::vector<uint32_t> inputmap = {13, 2, 7, 0, 15, 6};
+const size_t block = 4;
+const size_t N = 16;
+const size_t num_freq = 3;
+const size_t num_prod = inputmap.size() * (inputmap.size() + 1) / 2;
+
+BOOST_AUTO_TEST_CASE(_copy_vis) {
+    srand(42);
+    std::vector<int32_t> gpu(2 * num_freq * gpu_N2_size(N, block));
+    for (auto& v : gpu)
+        v = rand() % 20001 - 10000;
+
+    VisTriangleMap vis_map(inputmap, block, N);
+    BOOST_CHECK_EQUAL(vis_map.num_prod(), num_prod);
+
+    for (uint32_t freq = 0; freq < num_freq; freq++) {
+        float scale = 0.25 * (freq + 1);
+
+        std::vector<cfloat> expected(num_prod);
+        map_vis_triangle(inputmap, block, N, freq, [&](int32_t pi, int32_t bi, bool conj) {
+            cfloat t = {(float)gpu[2 * bi + 1], (float)gpu[2 * bi]};
+            expected[pi] = scale * (conj ? std::conj(t) : t);
+        });
+
+        std::vector<cfloat> output(num_prod);
+        vis_map.copy_vis(gpu.data(), output, freq, scale);
+        for (size_t i = 0; i < num_prod; i++) {
+            BOOST_CHECK_EQUAL(output[i].real(), expected[i].real());
+            BOOST_CHECK_EQUAL(output[i].imag(), expected[i].imag());
+        }
+    }
+
+    // The single frequency copy should match
+    std::vector<cfloat> expected(num_prod), output(num_prod);
+    map_vis_triangle(inputmap, block, N, 0, [&](int32_t pi, int32_t bi, bool conj) {
+        expected[pi] = {(float)gpu[2 * bi + 1], (conj ? -1 : 1) * (float)gpu[2 * bi]};
+    });
+    copy_vis_triangle(gpu.data(), inputmap, block, N, output);
+    BOOST_CHECK(output == expected);
+
+    // A second call with other inputs must not use the map of the first
+    const std::vector<uint32_t> inputmap2 = {1, 4, 3};
+    std::vector<cfloat> expected2(3 * 4 / 2), output2(3 * 4 / 2);
+    map_vis_triangle(inputmap2, block, N, 0, [&](int32_t pi, int32_t bi, bool conj) {
+        expected2[pi] = {(float)gpu[2 * bi + 1], (conj ? -1 : 1) * (float)gpu[2 * bi]};
+    });
+    copy_vis_triangle(gpu.data(), inputmap2, block, N, output2);
+    BOOST_CHECK(output2 == expected2);
+
+    copy_vis_triangle(gpu.data(), inputmap, block, N, output);
+    BOOST_CHECK(output == expected);
+}
+
+BOOST_AUTO_TEST_CASE(_copy_inverse) {
+    srand(42);
+    std::vector<float> gpu(num_freq * gpu_N2_size(N, block));
+    for (auto& v : gpu)
+        v = 1 + rand() % 1000;
+
+    VisTriangleMap vis_map(inputmap, block, N);
+
+    for (uint32_t freq = 0; freq < num_freq; freq++) {
+        std::vector<float> expected(num_prod);
+        map_vis_triangle(inputmap, block, N, freq,
+                         [&](int32_t pi, int32_t bi, bool) { expected[pi] = 3.0 / gpu[bi]; });
+
+        std::vector<float> output(num_prod);
+        vis_map.copy_inverse(gpu.data(), output, freq, 3.0);
+        BOOST_CHECK(output == expected);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(_bad_map) {
+    BOOST_CHECK_THROW(VisTriangleMap({0, 16}, block, N), std::invalid_argument);
+
+    VisTriangleMap vis_map(inputmap, block, N);
+    std::vector<int32_t> gpu(2 * gpu_N2_size(N, block));
+    std::vector<cfloat> output(num_prod - 1);
+    BOOST_CHECK_THROW(vis_map.copy_vis(gpu.data(), output), std::invalid_argument);
+}
@@ -0,0 +1,251 @@
+#define BOOST_TEST_MODULE "test_work_pool"
+
+#include "BufferHandle.hpp"     // for BufferConsumer, BufferProducer
+#include "ParallelFrameMap.hpp" // for ParallelFrameMap
+#include "WorkPool.hpp"         // for WorkPool, OrderedTasks
+#include "buffer.h"             // for create_buffer, delete_buffer, send_shutdown_signal
+#include "metadata.h"           // for create_metadata_pool, delete_metadata_pool
+
+#include <atomic>                            // for atomic
+#include <boost/test/included/unit_test.hpp> // for BOOST_PP_IIF_1, BOOST_CHECK, BOOST_PP_BOOL_2
+#include <chrono>                            // for microseconds, milliseconds
+#include <mutex>                             // for mutex, lock_guard
+#include <optional>                          // for optional, nullopt
+#include <stdint.h>                          // for uint32_t, uint64_t
+#include <stdlib.h>                          // for free
+#include <string>                            // for string
+#include <thread>                            // for sleep_for
+#include <vector>                            // for vector
+
+using kotekan::BufferConsumer;
+using kotekan::BufferProducer;
+using kotekan::OrderedTasks;
+using kotekan::ParallelFrameMap;
+using kotekan::WorkPool;
+
+/*
+ * Every submitted task runs, including the ones still queued when the pool is stopped.
+ */
+BOOST_AUTO_TEST_CASE(submit) {
+    WorkPool& pool = WorkPool::instance();
+    pool.start(4, {});
+    BOOST_CHECK_EQUAL(pool.get_num_threads(), 4u);
+
+    std::atomic<int> count(0);
+    for (int i = 0; i < 1000; ++i)
+        pool.submit([&] { count++; });
+
+    pool.stop();
+    BOOST_CHECK_EQUAL(count, 1000);
+    BOOST_CHECK_EQUAL(pool.get_num_threads(), 0u);
+}
+
+/*
+ * The work of the tasks runs out of order (later tasks sleep less), but the
+ * finish callbacks must still come out in submission order.
+ */
+BOOST_AUTO_TEST_CASE(ordered) {
+    WorkPool::instance().start(4, {});
+
+    const int num_tasks = 200;
+    std::vector<int> order;
+    {
+        OrderedTasks tasks;
+        for (int i = 0; i < num_tasks; ++i) {
+            tasks.submit(
+                [i] { std::this_thread::sleep_for(std::chrono::microseconds((i % 8) * 100)); },
+                [i, &order] { order.push_back(i); });
+            tasks.wait(16);
+        }
+    }
+
+    BOOST_REQUIRE_EQUAL(order.size(), (size_t)num_tasks);
+    for (int i = 0; i < num_tasks; ++i)
+        BOOST_CHECK_EQUAL(order[i], i);
+
+    WorkPool::instance().stop();
+}
+
+/*
+ * The pool starts itself with the defaults on the first submit.
+ */
+BOOST_AUTO_TEST_CASE(lazy_start) {
+    std::atomic<bool> ran(false);
+    {
+        OrderedTasks tasks;
+        tasks.submit([] {}, [&] { ran = true; });
+    }
+    BOOST_CHECK(ran);
+    BOOST_CHECK(WorkPool::instance().get_num_threads() > 0);
+    WorkPool::instance().stop();
+}
+
+/*
+ * Stopping the pool while a task is still submitting more work waits for that work
+ * too, instead of deadlocking the workers against the stop.
+ */
+BOOST_AUTO_TEST_CASE(stop_while_submitting) {
+    WorkPool& pool = WorkPool::instance();
+    pool.start(2, {});
+
+    std::atomic<bool> started(false);
+    std::atomic<int> count(0);
+    pool.submit([&] {
+        started = true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+        // Both directly, and through the helpers of an ordered sequence and a loop
+        for (int i = 0; i < 100; ++i)
+            pool.submit([&] { count++; });
+        {
+            OrderedTasks tasks;
+            for (int i = 0; i < 10; ++i)
+                tasks.submit([&] { count++; }, nullptr);
+        }
+        pool.parallel_for(100, [&](size_t) { count++; }, 2);
+    });
+
+    while (!started)
+        std::this_thread::yield();
+    pool.stop();
+
+    BOOST_CHECK_EQUAL(count, 210);
+    BOOST_CHECK_EQUAL(pool.get_num_threads(), 0u);
+}
+
+/*
+ * Concurrent first submits start the pool once, and all their tasks run.
+ */
+BOOST_AUTO_TEST_CASE(concurrent_lazy_start) {
+    WorkPool& pool = WorkPool::instance();
+
+    std::atomic<int> count(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; ++t) {
+        threads.emplace_back([&] {
+            for (int i = 0; i < 100; ++i)
+                pool.submit([&] { count++; });
+        });
+    }
+    for (auto& thread : threads)
+        thread.join();
+
+    uint32_t num_threads = std::thread::hardware_concurrency();
+    BOOST_CHECK_EQUAL(pool.get_num_threads(), num_threads > 0 ? num_threads : 1);
+
+    pool.stop();
+    BOOST_CHECK_EQUAL(count, 800);
+}
+
+/*
+ * parallel_for runs every index once, including when it's called from tasks on the
+ * pool which use up all the workers.
+ */
+BOOST_AUTO_TEST_CASE(parallel_for) {
+    WorkPool& pool = WorkPool::instance();
+    pool.start(2, {});
+
+    std::vector<std::atomic<int>> count(1000);
+    pool.parallel_for(count.size(), [&](size_t i) { count[i]++; }, 4);
+    for (auto& c : count)
+        BOOST_CHECK_EQUAL(c, 1);
+
+    std::atomic<int> total(0);
+    auto count_total = [&](size_t) { total++; };
+    {
+        OrderedTasks tasks;
+        for (int i = 0; i < 8; ++i)
+            tasks.submit([&] { pool.parallel_for(100, count_total, 4); }, nullptr);
+    }
+    BOOST_CHECK_EQUAL(total, 800);
+
+    pool.stop();
+}
+
+/*
+ * Frames go through a ParallelFrameMap in order, with every third one dropped by
+ * prepare and the processing time varying from frame to frame.
+ */
+static void check_frame_map(const std::string& name, const int num_frames, const uint32_t window) {
+    WorkPool::instance().start(4, {});
+
+    const uint32_t num_test_frames = 300;
+    struct metadataPool* pool =
+        create_metadata_pool(2 * num_frames, 64, "test_pool", "none", false);
+    struct Buffer* in_buf = create_buffer(num_frames, sizeof(uint32_t), pool, "in_buf",
+                                          "standard", 0, 0, false, false, true, false);
+    struct Buffer* out_buf = create_buffer(num_frames, sizeof(uint32_t), pool, "out_buf",
+                                           "standard", 0, 0, false, false, true, false);
+
+    BufferProducer source(in_buf, "source");
+    BufferConsumer sink(out_buf, "sink");
+    ParallelFrameMap<uint32_t> frame_map(BufferConsumer(in_buf, "map"),
+                                         BufferProducer(out_buf, "map"), name, window);
+
+    std::thread producer([&] {
+        for (uint32_t i = 0; i < num_test_frames; ++i) {
+            uint8_t* frame = source.wait_for_empty_frame(i % num_frames);
+            BOOST_REQUIRE(frame != nullptr);
+            *(uint32_t*)frame = i;
+            source.mark_frame_full(i % num_frames);
+        }
+    });
+
+    // Count how often each frame is processed
+    std::vector<std::atomic<int>> processed(num_test_frames);
+
+    std::atomic_bool stop_thread(false);
+    std::thread map_thread([&] {
+        frame_map.run(
+            stop_thread,
+            [&](int in_frame_id) -> std::optional<uint32_t> {
+                uint32_t value = *(uint32_t*)in_buf->frames[in_frame_id];
+                if (value % 3 == 2)
+                    return std::nullopt;
+                return value;
+            },
+            [&](uint32_t& value, int, int out_frame_id) {
+                processed[value]++;
+                std::this_thread::sleep_for(std::chrono::microseconds((value % 5) * 100));
+                *(uint32_t*)out_buf->frames[out_frame_id] = value;
+            });
+    });
+
+    for (uint32_t i = 0, out_id = 0; i < num_test_frames; ++i) {
+        if (i % 3 == 2)
+            continue;
+        uint8_t* frame = sink.wait_for_full_frame(out_id);
+        BOOST_REQUIRE(frame != nullptr);
+        BOOST_CHECK_EQUAL(*(uint32_t*)frame, i);
+        sink.mark_frame_empty(out_id);
+        out_id = (out_id + 1) % num_frames;
+    }
+
+    stop_thread = true;
+    send_shutdown_signal(in_buf);
+    producer.join();
+    map_thread.join();
+
+    for (uint32_t i = 0; i < num_test_frames; ++i)
+        BOOST_CHECK_EQUAL(processed[i], i % 3 == 2 ? 0 : 1);
+
+    delete_buffer(in_buf);
+    free(in_buf);
+    delete_buffer(out_buf);
+    free(out_buf);
+    delete_metadata_pool(pool);
+    free(pool);
+    WorkPool::instance().stop();
+}
+
+BOOST_AUTO_TEST_CASE(parallel_frame_map) {
+    check_frame_map("test_map", 8, 4);
+}
+
+/*
+ * A window larger than the buffers (e.g. num_threads set above the buffer depth)
+ * is capped, so frames still in flight are never picked up again.
+ */
+BOOST_AUTO_TEST_CASE(parallel_frame_map_large_window) {
+    check_frame_map("test_map_large_window", 3, 16);
+}
@@ -27,8 +27,8 @@ params = {
 }
 
 
-@pytest.fixture(scope="module")
-def vis_data(tmpdir_factory):
+@pytest.fixture(scope="module", params=[1, 3])
+def vis_data(tmpdir_factory, request):
 
     tmpdir_l = tmpdir_factory.mktemp("freqsplit_lower")
     tmpdir_h = tmpdir_factory.mktemp("freqsplit_higher")
@@ -44,8 +44,13 @@ def vis_data(tmpdir_factory):
 
     dump_buffer_h = runner.DumpVisBuffer(str(tmpdir_h))
 
+    # Also read the input in batches
     test = runner.KotekanStageTester(
-        "freqSplit", {}, fakevis_buffer, [dump_buffer_l, dump_buffer_h], params
+        "freqSplit",
+        {"batch_size": request.param},
+        fakevis_buffer,
+        [dump_buffer_l, dump_buffer_h],
+        params,
     )
 
     test.run()
@@ -0,0 +1,176 @@
+# === Start Python 2/3 compatibility
+from __future__ import absolute_import, division, print_function, unicode_literals
+from future.builtins import *  # noqa  pylint: disable=W0401, W0614
+from future.builtins.disabled import *  # noqa  pylint: disable=W0401, W0614
+
+# === End Python 2/3 compatibility
+
+import glob
+import os
+import shutil
+
+import numpy as np
+import pytest
+
+from kotekan import runner, visbuffer, visutil
+
+start_time = 1_500_000_000
+
+writer_params = {
+    "num_elements": 4,
+    "num_ev": 2,
+    "cadence": 1.0,
+    "total_frames": 12,
+    "freq": [3, 50, 554, 777],
+    "dataset_manager": {"use_dataset_broker": False},
+}
+
+# Read the times [3, 9) and two of the frequencies, in a different order to the file
+read_params = {
+    "start_time": start_time + 2.5,
+    "end_time": start_time + 8.5,
+    "freq_ids": [777, 3],
+}
+read_times = start_time + np.arange(3, 9) * writer_params["cadence"]
+read_freqs = [3, 777]
+
+
+@pytest.fixture(scope="module")
+def raw_file(tmpdir_factory):
+    """Write a raw file with a flags update part way through, giving two datasets."""
+
+    tmpdir = str(tmpdir_factory.mktemp("raw"))
+
+    fakevis_buffer = runner.FakeVisBuffer(
+        freq_ids=writer_params["freq"],
+        num_frames=writer_params["total_frames"],
+        cadence=writer_params["cadence"],
+        start_time=start_time,
+        state_changes=[{"timestamp": start_time + 5.5, "type": "flags"}],
+        mode="change_state",
+    )
+
+    params = writer_params.copy()
+    params["root_path"] = tmpdir
+
+    test = runner.KotekanStageTester(
+        "VisWriter",
+        {"node_mode": False, "file_type": "raw"},
+        fakevis_buffer,
+        None,
+        params,
+    )
+
+    test.run()
+
+    files = sorted(glob.glob(tmpdir + "/20??????T??????Z_*_corr/*.meta"))
+    assert len(files) == 1
+    infile = os.path.splitext(files[0])[0]
+    assert os.path.exists(infile + ".index")
+
+    return infile
+
+
+def read_raw(tmpdir_factory, infile, extra_config):
+    """Read `infile` with VisRawReader and load the frames it streams out."""
+
+    tmpdir = str(tmpdir_factory.mktemp("read"))
+
+    # Shut down a second after the last frame, once the dump has caught up
+    config = dict(read_params, update_dataset_id=False, sleep_time=1.0)
+    config.update(extra_config)
+    raw_buf = runner.ReadRawBuffer(infile, [2, 4, 3], extra_config=config)
+    dump_buffer = runner.DumpVisBuffer(tmpdir, in_buf=raw_buf.name)
+
+    stages = dict(raw_buf.stage_block)
+    stages.update(dump_buffer.stage_block)
+
+    runner.KotekanRunner(raw_buf.buffer_block, stages, writer_params).run()
+
+    return dump_buffer.load()
+
+
+def copy_without_index(tmpdir_factory, infile):
+    """Copy the .data and .meta of a raw file, leaving the .index behind."""
+
+    tmpdir = str(tmpdir_factory.mktemp("noindex"))
+    outfile = os.path.join(tmpdir, os.path.basename(infile))
+    for ext in [".data", ".meta"]:
+        shutil.copy(infile + ext, outfile + ext)
+
+    return outfile
+
+
+def ds_id(dataset_id):
+    """A dataset ID as a hashable tuple."""
+    return tuple(int(x) for x in np.array(dataset_id, dtype=np.uint64).ravel())
+
+
+def file_frames(infile):
+    """The dataset ID of each (time, freq ID) frame in the file."""
+
+    vr = visbuffer.VisRaw.from_file(infile)
+
+    frames = {}
+    for ti, ctime in enumerate(vr.time["ctime"]):
+        for fi in range(vr.num_freq):
+            freq_id = int(vr.metadata["freq_id"][ti, fi])
+            frames[(ctime, freq_id)] = ds_id(vr.metadata["dataset_id"][ti, fi])
+
+    return frames
+
+
+@pytest.mark.parametrize(
+    "index, prefetch_threads", [(True, 0), (False, 0), (True, 2), (False, 2)]
+)
+def test_read_selection(tmpdir_factory, raw_file, index, prefetch_threads):
+    """Read a window of times and a subset of the frequencies."""
+
+    infile = raw_file if index else copy_without_index(tmpdir_factory, raw_file)
+    frames = read_raw(tmpdir_factory, infile, {"prefetch_threads": prefetch_threads})
+    expected = file_frames(raw_file)
+
+    assert len(frames) == len(read_times) * len(read_freqs)
+
+    seen = set()
+    for frame in frames:
+        ctime = visutil.ts_to_double(frame.metadata.ctime)
+        freq_id = frame.metadata.freq_id
+        assert ctime in read_times
+        assert freq_id in read_freqs
+        seen.add((ctime, freq_id))
+
+        # The frames keep the dataset IDs they had in the file
+        assert ds_id(frame.metadata.dataset_id) == expected[(ctime, freq_id)]
+
+    # Every frame of the selection was read once
+    assert len(seen) == len(frames)
+
+    # The selection spans the flags update
+    assert len(set(expected[key] for key in seen)) == 2
+
+
+def test_local_dataset_ids(tmpdir_factory, raw_file):
+    """The datasets registered on top of the file's are the same with or without the
+    index, and there is one for each dataset in the file."""
+
+    config = {"update_dataset_id": True, "use_local_dataset_man": True}
+    with_index = read_raw(tmpdir_factory, raw_file, config)
+    without_index = read_raw(
+        tmpdir_factory, copy_without_index(tmpdir_factory, raw_file), config
+    )
+    expected = file_frames(raw_file)
+
+    assert len(with_index) == len(without_index) == len(read_times) * len(read_freqs)
+
+    ds_map = {}
+    for frame_a, frame_b in zip(with_index, without_index):
+        key = (visutil.ts_to_double(frame_a.metadata.ctime), frame_a.metadata.freq_id)
+        ds_a = ds_id(frame_a.metadata.dataset_id)
+        ds_b = ds_id(frame_b.metadata.dataset_id)
+
+        assert ds_a == ds_b
+        assert ds_a != expected[key]
+        assert ds_map.setdefault(expected[key], ds_a) == ds_a
+
+    assert len(set(ds_map.values())) == 2
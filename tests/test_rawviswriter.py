@@ -22,8 +22,8 @@ writer_params = {
 }
 
 
-@pytest.fixture(scope="module")
-def written_data(tmpdir_factory):
+@pytest.fixture(scope="module", params=[False, True], ids=["main", "acq_threads"])
+def written_data(tmpdir_factory, request):
 
     tmpdir = str(tmpdir_factory.mktemp("writer"))
 
@@ -38,7 +38,7 @@ def written_data(tmpdir_factory):
 
     test = runner.KotekanStageTester(
         "VisWriter",
-        {"node_mode": False, "file_type": "raw"},
+        {"node_mode": False, "file_type": "raw", "acq_threads": request.param},
         fakevis_buffer,
         None,
         params,
@@ -53,8 +53,8 @@ def written_data(tmpdir_factory):
     yield [visbuffer.VisRaw.from_file(fname) for fname in files]
 
 
-@pytest.fixture(scope="module")
-def critical_state_data(tmpdir_factory):
+@pytest.fixture(scope="module", params=[False, True], ids=["main", "acq_threads"])
+def critical_state_data(tmpdir_factory, request):
 
     tmpdir = str(tmpdir_factory.mktemp("writer"))
     start_time = 1_500_000_000
@@ -77,7 +77,7 @@ def critical_state_data(tmpdir_factory):
 
     test = runner.KotekanStageTester(
         "VisWriter",
-        {"node_mode": False, "file_type": "raw"},
+        {"node_mode": False, "file_type": "raw", "acq_threads": request.param},
         fakevis_buffer,
         None,
         params,
@@ -0,0 +1,215 @@
+# === Start Python 2/3 compatibility
+from __future__ import absolute_import, division, print_function, unicode_literals
+from future.builtins import *  # noqa  pylint: disable=W0401, W0614
+from future.builtins.disabled import *  # noqa  pylint: disable=W0401, W0614
+
+# === End Python 2/3 compatibility
+
+import pytest
+import time
+
+import h5py
+import numpy as np
+
+from kotekan import runner
+
+start_time = time.time() - 100
+gains_update_id = "gains{}".format(start_time)
+
+global_params = {
+    "dataset_manager": {"use_dataset_broker": False},
+    # Non-integer visibilities, so the truncation changes them
+    "fakevis_mode": "phase_ij",
+    "cadence": 0.1,
+    "total_frames": 10,
+    "num_ev": 0,
+    # Enough products for VisChain to split each frame into several tiles
+    "num_elements": 128,
+    "out_file": "/tmp/out.csv",
+    "dynamic_attributes": {
+        "flagging": {
+            "kotekan_update_endpoint": "json",
+            "bad_inputs": [1, 4],
+            "start_time": start_time,
+            "update_id": "initial_test_flags",
+        }
+    },
+    "gains": {
+        "kotekan_update_endpoint": "json",
+        "start_time": start_time,
+        "update_id": gains_update_id,
+        "transition_interval": 10.0,
+        "new_state": True,
+    },
+    "updatable_config": "/dynamic_attributes/flagging",
+}
+
+chain_params = {
+    "operations": ["flags"],
+    "num_frame_threads": 2,
+    "flags": {"type": "ReceiveFlags"},
+}
+
+truncate_params = {
+    "err_sq_lim": 0.003,
+    "weight_fixed_precision": 0.001,
+    "data_fixed_precision": 0.0001,
+}
+
+
+def run_stages(tmpdir_factory, stages):
+    """Run the FakeVis frames through each of `stages` in turn and load the output.
+
+    Parameters
+    ----------
+    stages : list of (str, dict)
+        The type and config of each stage, in the order the frames pass through them.
+    """
+
+    tmpdir = tmpdir_factory.mktemp(stages[0][0])
+
+    fakevis_buffer = runner.FakeVisBuffer(
+        num_frames=global_params["total_frames"],
+        mode=global_params["fakevis_mode"],
+        cadence=global_params["cadence"],
+        wait=True,
+        sleep_before=2.0,
+    )
+
+    out_dump_buffer = runner.DumpVisBuffer(str(tmpdir))
+
+    buffer_block = {}
+    stage_block = {}
+    for buf in [fakevis_buffer, out_dump_buffer]:
+        buffer_block.update(buf.buffer_block)
+        stage_block.update(buf.stage_block)
+
+    in_buf = fakevis_buffer.name
+    for ind, (stage_type, params) in enumerate(stages):
+        if ind == len(stages) - 1:
+            out_buf = out_dump_buffer.name
+        else:
+            out_buf = "stage_buf%i" % ind
+            buffer_block[out_buf] = {
+                "kotekan_buffer": "vis",
+                "metadata_pool": "vis_pool",
+                "num_frames": "buffer_depth",
+            }
+
+        config = dict(params, kotekan_stage=stage_type, in_buf=in_buf, out_buf=out_buf)
+        stage_block["%s_test%i" % (stage_type, ind)] = config
+        in_buf = out_buf
+
+    runner.KotekanRunner(buffer_block, stage_block, global_params).run()
+
+    return out_dump_buffer.load()
+
+
+def run_stage(tmpdir_factory, stage_type, params):
+    return run_stages(tmpdir_factory, [(stage_type, params)])
+
+
+def assert_frames_equal(chain_dump, stage_dump):
+    """The chain and the stages should give the same frames and datasets."""
+
+    assert len(chain_dump) == global_params["total_frames"]
+    assert len(chain_dump) == len(stage_dump)
+
+    for chain_frame, stage_frame in zip(chain_dump, stage_dump):
+        assert chain_frame.metadata.fpga_seq == stage_frame.metadata.fpga_seq
+        assert np.all(chain_frame.flags == stage_frame.flags)
+        assert np.all(chain_frame.gain == stage_frame.gain)
+        assert np.all(chain_frame.vis == stage_frame.vis)
+        assert np.all(chain_frame.weight == stage_frame.weight)
+        assert list(chain_frame.metadata.dataset_id) == list(
+            stage_frame.metadata.dataset_id
+        )
+
+
+@pytest.fixture(scope="module")
+def gains_dir(tmpdir_factory):
+    """Write a gain file for the initial gain update, with a few inputs weighted out."""
+
+    gains_dir = tmpdir_factory.mktemp("gains")
+    num_elements = global_params["num_elements"]
+
+    gain = (1.0 + 0.5j * (np.arange(num_elements)[None, :] + 1) / num_elements).astype(
+        np.complex64
+    )
+    weight = np.ones((1, num_elements), dtype=bool)
+    weight[:, 3] = False
+
+    with h5py.File(str(gains_dir.join(gains_update_id + ".h5")), "w") as f:
+        f.create_dataset("gain", data=gain)
+        f.create_dataset("weight", data=weight)
+        f.create_dataset("index_map/freq", data=np.array([800.0], dtype="f"))
+        f.create_dataset("index_map/input", data=np.arange(num_elements, dtype="i"))
+
+    return str(gains_dir)
+
+
+def test_chain_matches_stage(tmpdir_factory):
+    """The chain should give the same frames and datasets as the stage it replaces."""
+
+    chain_dump = run_stage(tmpdir_factory, "VisChain", chain_params)
+    stage_dump = run_stage(tmpdir_factory, "ReceiveFlags", {})
+
+    expected_flags = np.ones(global_params["num_elements"])
+    expected_flags[[1, 4]] = 0
+    for chain_frame in chain_dump:
+        assert np.all(chain_frame.flags == expected_flags)
+
+    assert_frames_equal(chain_dump, stage_dump)
+
+
+def test_chain_flags_truncate(tmpdir_factory):
+    """Flagging then truncating in one chain should match the two stages in a row."""
+
+    params = {
+        "operations": ["flags", "truncate"],
+        "num_frame_threads": 2,
+        "flags": {"type": "ReceiveFlags"},
+        "truncate": dict(truncate_params, type="VisTruncate"),
+    }
+    chain_dump = run_stage(tmpdir_factory, "VisChain", params)
+    stage_dump = run_stages(
+        tmpdir_factory, [("ReceiveFlags", {}), ("VisTruncate", truncate_params)]
+    )
+
+    assert_frames_equal(chain_dump, stage_dump)
+
+
+@pytest.mark.skipif(not runner.has_hdf5(), reason="HDF5 support not available.")
+def test_chain_gains_flags_truncate(tmpdir_factory, gains_dir):
+    """Applying gains, flagging and truncating in one chain should match the three
+    stages in a row."""
+
+    gains_params = {
+        "read_from_file": True,
+        "gains_dir": gains_dir,
+        "updatable_config": "/gains",
+    }
+
+    params = {
+        "operations": ["gains", "flags", "truncate"],
+        "num_frame_threads": 2,
+        "gains": dict(gains_params, type="applyGains"),
+        "flags": {"type": "ReceiveFlags"},
+        "truncate": dict(truncate_params, type="VisTruncate"),
+    }
+    chain_dump = run_stage(tmpdir_factory, "VisChain", params)
+    stage_dump = run_stages(
+        tmpdir_factory,
+        [
+            ("applyGains", gains_params),
+            ("ReceiveFlags", {}),
+            ("VisTruncate", truncate_params),
+        ],
+    )
+
+    # The gains have been applied, and input 3 weighted out
+    for frame in chain_dump:
+        assert np.all(frame.gain[[0, 1, 2, 4]] != 1.0)
+        assert frame.gain[3] == 1.0
+
+    assert_frames_equal(chain_dump, stage_dump)